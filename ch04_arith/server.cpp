@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include "../eval_server/server.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+interpreter::Budget MakeBudget(const server::Limits& limits) {
+    interpreter::Budget budget;
+
+    if (limits.max_steps_ > 0) {
+        budget.max_steps_ = limits.max_steps_;
+    }
+
+    if (limits.max_term_nodes_ > 0) {
+        budget.max_term_nodes_ = limits.max_term_nodes_;
+    }
+
+    if (limits.timeout_ms_ > 0) {
+        budget.max_time_ = std::chrono::milliseconds(limits.timeout_ms_);
+    }
+
+    return budget;
+}
+
+/**
+ * Evaluates the program of a request in slices and prints its result the way
+ * interpreter.cpp does.
+ */
+class EvaluationJob : public server::Job {
+   public:
+    explicit EvaluationJob(const server::Request& request)
+        : program_(parser::Parser{std::istringstream{request.program_}}
+                       .ParseProgram()) {
+        interpreter_.SetBudget(MakeBudget(request.limits_));
+    }
+
+    std::optional<server::Outcome> Resume(long long fuel) override {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+
+        try {
+            // Started by the first slice rather than the constructor, so that
+            // a program over the term size budget is reported as such.
+            if (!evaluation_) {
+                evaluation_.emplace(interpreter_, program_);
+            }
+
+            if (!evaluation_->Resume(fuel)) {
+                return std::nullopt;
+            }
+        } catch (const interpreter::BudgetExceeded& error) {
+            return server::Outcome{server::Status::BUDGET_EXCEEDED,
+                                   error.what()};
+        }
+
+        std::ostringstream ss;
+        ss << evaluation_->Result();
+        return server::Outcome{server::Status::OK, ss.str()};
+    }
+
+   private:
+    parser::Term program_;
+    interpreter::Interpreter interpreter_;
+    std::optional<interpreter::Interpreter::Evaluation> evaluation_;
+};
+
+std::unique_ptr<server::Job> Start(const server::Request& request) {
+    return std::make_unique<EvaluationJob>(request);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto policy = server::Scheduler::Policy::LEAST_ATTAINED;
+    long long quantum = 10000;
+    std::string cache_dir;
+    std::string trace_path;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc - 1; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag != "--threads" && flag != "--policy" && flag != "--quantum" &&
+            flag != "--cache" && flag != "--trace") {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+
+        if (++arg_idx >= argc - 1) {
+            std::cerr << "Error: expected a value after " << flag << ".\n";
+            return 1;
+        }
+
+        std::string value = argv[arg_idx];
+
+        try {
+            if (flag == "--threads") {
+                num_threads = std::stoi(value);
+            } else if (flag == "--quantum") {
+                quantum = std::stoll(value);
+            } else if (flag == "--cache") {
+                cache_dir = value;
+            } else if (flag == "--trace") {
+                trace_path = value;
+            } else if (value == "fair") {
+                policy = server::Scheduler::Policy::FAIR;
+            } else if (value == "least-attained") {
+                policy = server::Scheduler::Policy::LEAST_ATTAINED;
+            } else {
+                std::cerr << "Error: unknown policy " << value << ".\n";
+                return 1;
+            }
+        } catch (std::exception&) {
+            std::cerr << "Error: invalid value " << value << " for " << flag
+                      << ".\n";
+            return 1;
+        }
+    }
+
+    if (arg_idx >= argc) {
+        std::cerr << "Error: expected a socket path as a command line "
+                     "argument.\n";
+        return 1;
+    }
+
+    // Outlive the server, whose threads use them.
+    std::optional<result_cache::ResultCache> cache;
+    tracing::Tracer tracer;
+    server::Server server{"ch04_arith", num_threads, policy, quantum,
+                          Start};
+
+    try {
+        if (!cache_dir.empty()) {
+            cache.emplace(cache_dir);
+            server.SetCache(*cache, interpreter::kEngineVersion);
+        }
+
+        if (!trace_path.empty()) {
+            server.SetTracer(tracer, trace_path);
+        }
+
+        server.Run(argv[arg_idx]);
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
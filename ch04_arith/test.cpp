@@ -379,8 +379,63 @@ std::vector<TestData> kData{
     TestData{"succ succ true", "<ERROR>"},
 };
 
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 10000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::string expected_program_string_;
+    std::string expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "succ^" + n_str + " 0", Repeat("succ ", n) + "0",
+        Repeat("succ (", n) + "0" + Repeat(")", n), n_str});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "iszero pred succ^" + n_str + " 0",
+        "iszero pred " + Repeat("succ ", n) + "0",
+        "iszero (pred (" + Repeat("succ (", n) + "0" + Repeat(")", n + 2),
+        "false"});
+
+    // if terms are several times larger per nesting level, so they are nested
+    // less deeply to keep the test fast.
+    const int m = n / 10;
+    std::string m_str = std::to_string(m);
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + m_str + " 0 (else 0)^" + m_str,
+        Repeat("if true then ", m) + "0" + Repeat(" else 0", m),
+        Repeat("if (true) then (", m) + "0" + Repeat(") else (0)", m), "0"});
+}
+
 void Run() {
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests = kData.size() + kDeepTermData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -426,9 +481,39 @@ void Run() {
         }
     }
 
+    // Test that every stage handles terms nested deeper than the call stack
+    // could hold.
+    for (const auto& test : kDeepTermData) {
+        Term program =
+            parser::Parser{std::istringstream{test.input_program_}}
+                .ParseProgram();
+        Term program_copy = program;
+        std::ostringstream program_string;
+        program_string << program;
+        std::string actual_eval_res =
+            Interpreter().Interpret(std::move(program_copy));
+
+        if (program_string.str() != test.expected_program_string_ ||
+            actual_eval_res != test.expected_eval_result_) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            std::cout << color::kGreen
+                      << "  Expected evaluation result: " << color::kReset
+                      << test.expected_eval_result_ << "\n";
+
+            std::cout << color::kRed
+                      << "  Actual evaluation result: " << color::kReset
+                      << actual_eval_res << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../complexity_fuzzer/fuzzer.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+using complexity_fuzzer::Repeat;
+
+/**
+ * Returns the seconds parsing and evaluating source take.
+ */
+std::vector<double> Measure(const std::string& source) {
+    parser::Term program;
+    interpreter::Interpreter interpreter;
+    double parse_time = complexity_fuzzer::Seconds([&] {
+        program =
+            parser::Parser{std::istringstream{source}}.ParseProgram();
+    });
+    double eval_time = complexity_fuzzer::Seconds(
+        [&] { interpreter.Interpret(program); });
+
+    return {parse_time, eval_time};
+}
+
+const std::vector<complexity_fuzzer::Family> kFamilies = {
+    {"lambda nesting", [](int n) { return Repeat("l x. ", n) + "x"; }},
+    {"application spine",
+     [](int n) { return "(l x. x)" + Repeat(" (l x. x)", n); }},
+    {"nested redexes",
+     [](int n) {
+         return Repeat("(l x. x) (", n) + "l y. y" + Repeat(")", n);
+     }},
+    {"church numeral",
+     [](int n) {
+         return "(l f. l x. " + Repeat("f (", n) + "x" + Repeat(")", n) +
+                ") (l y. y) (l z. z)";
+     }},
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    complexity_fuzzer::Options options;
+
+    if (!complexity_fuzzer::ParseOptions(argc, argv, options, std::cerr)) {
+        return 1;
+    }
+
+    complexity_fuzzer::Fuzzer fuzzer{"ch07_untyped", {"parse", "eval"}, Measure,
+                                     options};
+    return fuzzer.Run(kFamilies, std::cout) > 0 ? 1 : 0;
+}
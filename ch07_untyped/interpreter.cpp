@@ -1,23 +1,235 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <optional>
 
+#include "../result_cache/result_cache.hpp"
 #include "interpreter.hpp"
 
+std::string ReadFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+
+    if (!in) {
+        throw std::runtime_error("Can't read " + path + ".");
+    }
+
+    return {std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()};
+}
+
+/**
+ * Replaces the file at path by checkpoint. The checkpoint is written to a
+ * temporary file first, so a crash while writing leaves the previous one
+ * intact.
+ */
+void SaveCheckpoint(const std::string& checkpoint, const std::string& path) {
+    std::string tmp_path = path + ".tmp";
+
+    {
+        std::ofstream out{tmp_path, std::ios::binary};
+        out << checkpoint;
+
+        if (!out.flush()) {
+            throw std::runtime_error("Can't write " + tmp_path + ".");
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Can't replace " + path + ".");
+    }
+}
+
+/**
+ * Evaluates program, which took steps reduction steps already if it was
+ * resumed from a checkpoint. Unless checkpoint_path is empty, saves a
+ * checkpoint there every checkpoint_interval steps.
+ */
+template <typename Interpreter>
+void Evaluate(Interpreter& interpreter, parser::Term& program, long long steps,
+              const std::string& checkpoint_path,
+              long long checkpoint_interval) {
+    allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+    typename Interpreter::Evaluation evaluation{interpreter, program, steps};
+    long long fuel = checkpoint_path.empty()
+                         ? std::numeric_limits<long long>::max()
+                         : checkpoint_interval;
+
+    while (!evaluation.Resume(fuel)) {
+        SaveCheckpoint(evaluation.Snapshot(), checkpoint_path);
+    }
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr
-            << "Error: expected input program as a command line argument.\n";
+    bool profile = false;
+    bool resume = false;
+    std::string trace_path;
+    std::string cache_dir;
+    std::string checkpoint_path;
+    long long checkpoint_interval = 10000000;
+    interpreter::Budget budget;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc - 1; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag == "--profile") {
+            profile = true;
+        } else if (flag == "--resume") {
+            resume = true;
+        } else if (flag == "--trace" || flag == "--cache" ||
+                   flag == "--max-steps" || flag == "--max-nodes" ||
+                   flag == "--timeout-ms" ||
+                   flag == "--checkpoint" || flag == "--checkpoint-every") {
+            if (++arg_idx >= argc - 1) {
+                std::cerr << "Error: expected a value after " << flag << ".\n";
+                return 1;
+            }
+
+            std::string value = argv[arg_idx];
+
+            try {
+                if (flag == "--trace") {
+                    trace_path = value;
+                } else if (flag == "--cache") {
+                    cache_dir = value;
+                } else if (flag == "--checkpoint") {
+                    checkpoint_path = value;
+                } else if (flag == "--checkpoint-every") {
+                    checkpoint_interval = std::stoll(value);
+                } else if (flag == "--max-steps") {
+                    budget.max_steps_ = std::stoll(value);
+                } else if (flag == "--max-nodes") {
+                    budget.max_term_nodes_ = std::stoull(value);
+                } else {
+                    budget.max_time_ =
+                        std::chrono::milliseconds(std::stoll(value));
+                }
+            } catch (std::exception&) {
+                std::cerr << "Error: invalid value " << value << " for " << flag
+                          << ".\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+    }
+
+    if (arg_idx >= argc) {
+        std::cerr << "Error: expected input program (or checkpoint file with "
+                     "--resume) as a command line argument.\n";
         return 1;
     }
 
-    parser::Parser parser{std::istringstream{argv[1]}};
-    auto program = parser.ParseProgram();
+    tracing::Tracer tracer;
+    auto& trace = tracer.GetBuffer();
+
+    // A program run before with the same options is answered from the
+    // cache. Profiling is about doing the work and a checkpoint isn't a
+    // program, so both bypass the cache.
+    std::optional<result_cache::ResultCache> cache;
+    std::optional<result_cache::OutputRecorder> recorder;
+    std::string cache_key;
+
+    if (!cache_dir.empty() && !profile && !resume) {
+        try {
+            cache.emplace(cache_dir);
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+            return 1;
+        }
+
+        cache_key = result_cache::MakeKey(
+            "ch07_untyped/" + std::to_string(interpreter::kEngineVersion),
+            "max-steps=" + std::to_string(budget.max_steps_) +
+                " max-nodes=" + std::to_string(budget.max_term_nodes_),
+            argv[arg_idx]);
+        auto output = trace.Record("cache lookup", 0,
+                                   [&] { return cache->Find(cache_key); });
+
+        if (output) {
+            std::cout << *output;
+
+            if (!trace_path.empty()) {
+                std::ofstream trace_file{trace_path};
+                tracer.Write(trace_file);
+            }
+
+            return 0;
+        }
+
+        // Record what is printed from here on to store it in the cache.
+        recorder.emplace(std::cout);
+    }
+
+    interpreter::Checkpoint start;
 
+    try {
+        if (resume) {
+            start = trace.Record("load checkpoint", 0, [&] {
+                return interpreter::ReadCheckpoint(ReadFile(argv[arg_idx]));
+            });
+        } else {
+            parser::Parser parser{std::istringstream{argv[arg_idx]}};
+            start.term_ = trace.Record("parse", 0,
+                                       [&] { return parser.ParseProgram(); });
+        }
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    auto& program = start.term_;
     std::cout << "   " << program << "\n";
 
-    interpreter::Interpreter interpreter;
-    interpreter.Interpret(program);
+    int status = 0;
+
+    try {
+        if (profile) {
+            interpreter::ProfilingInterpreter interpreter;
+            interpreter.SetBudget(budget);
+            trace.Record("eval", 0, [&] {
+                Evaluate(interpreter, program, start.steps_, checkpoint_path,
+                         checkpoint_interval);
+            });
+            std::cout << "=> " << program << "\n";
+            interpreter.GetProfiler().Print(std::cerr);
+        } else {
+            interpreter::Interpreter interpreter;
+            interpreter.SetBudget(budget);
+            trace.Record("eval", 0, [&] {
+                Evaluate(interpreter, program, start.steps_, checkpoint_path,
+                         checkpoint_interval);
+            });
+            std::cout << "=> " << program << "\n";
+        }
+    } catch (const interpreter::BudgetExceeded& error) {
+        std::cout << "=> " << error.what() << "\n";
+        status = 1;
+    } catch (const std::runtime_error& error) {
+        std::cerr << "Error: " << error.what() << "\n";
+        status = 1;
+    }
+
+    if (recorder && status == 0) {
+        try {
+            cache->Insert(cache_key, recorder->GetOutput());
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+        }
+    }
 
-    std::cout << "=> " << program << "\n";
+    if (allocation::kEnabled) {
+        allocation::Tracker::Print(std::cerr);
+    }
+
+    if (!trace_path.empty()) {
+        std::ofstream trace_file{trace_path};
+        tracer.Write(trace_file);
+    }
 
-    return 0;
+    return status;
 }
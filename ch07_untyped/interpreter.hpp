@@ -1,10 +1,24 @@
-#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <map>
 #include <memory>
+#include <ostream>
 #include <sstream>
 #include <stack>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
 namespace lexer {
 class Token {
    public:
@@ -56,6 +70,7 @@ class Lexer {
     // NOTE The idea described above was implemented in "Simply Typed Lambda
     // Calculus" (ch10_simplebool).
     Token NextToken() {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         if (is_cached_token_valid) {
             is_cached_token_valid = false;
             return cached_token;
@@ -178,8 +193,13 @@ std::ostream& operator<<(std::ostream& out, Token token) {
 
 namespace parser {
 
-class Term {
+class ImageReader;
+class ImageWriter;
+
+class Term : private budget::Counted<Term> {
     friend std::ostream& operator<<(std::ostream&, const Term&);
+    friend class ImageReader;
+    friend class ImageWriter;
 
    public:
     static Term Lambda(std::string arg_name) {
@@ -196,6 +216,7 @@ class Term {
         result.de_bruijn_idx_ = de_bruijn_idx;
         result.is_variable_ = true;
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -206,6 +227,7 @@ class Term {
         result.application_lhs_ = std::move(lhs);
         result.application_rhs_ = std::move(rhs);
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -217,7 +239,22 @@ class Term {
     Term(Term&&) = default;
     Term& operator=(Term&&) = default;
 
-    ~Term() = default;
+    /**
+     * Destroys the sub-terms iteratively. The implicit destructor would recurse
+     * once per nesting level and overflow the stack for deep terms.
+     */
+    ~Term() {
+        std::vector<std::unique_ptr<Term>> pending;
+        DetachSubTerms(pending);
+
+        while (!pending.empty()) {
+            std::unique_ptr<Term> term = std::move(pending.back());
+            pending.pop_back();
+            // term is destroyed at the end of the iteration, after its
+            // sub-terms were detached.
+            term->DetachSubTerms(pending);
+        }
+    }
 
     bool IsLambda() const { return is_lambda_; }
 
@@ -249,37 +286,49 @@ class Term {
                 "Term::Combine() received an invalid Term.");
         }
 
-        if (IsLambda()) {
-            if (lambda_body_) {
+        // Combining a term into a lambda whose body is not completely parsed
+        // yet means combining it into the lambda's body. Walk down such
+        // lambdas in a loop since they may be nested arbitrarily deep.
+        std::vector<Term*> path{this};
+
+        while (path.back()->IsLambda() && path.back()->lambda_body_ &&
+               !path.back()->is_complete_lambda_) {
+            path.push_back(path.back()->lambda_body_.get());
+        }
+
+        Term& target = *path.back();
+
+        if (target.IsLambda()) {
+            if (target.lambda_body_) {
                 // If the lambda body was completely parsed, then combining this
                 // term and the argument term means applying this lambda to the
                 // argument.
-                if (is_complete_lambda_) {
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    is_lambda_ = false;
-                    lambda_body_ = nullptr;
-                    lambda_arg_name_ = "";
-                    is_complete_lambda_ = false;
-                } else {
-                    lambda_body_->Combine(std::move(term));
-                }
-            } else {
-                lambda_body_ = std::make_unique<Term>(std::move(term));
-            }
-        } else if (IsVariable()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
+                target =
+                    Application(std::make_unique<Term>(std::move(target)),
                                 std::make_unique<Term>(std::move(term)));
 
-            is_variable_ = false;
-            variable_name_ = "";
-        } else if (IsApplication()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
+                target.is_lambda_ = false;
+                target.lambda_body_ = nullptr;
+                target.lambda_arg_name_ = "";
+                target.is_complete_lambda_ = false;
+            } else {
+                target.lambda_body_ = std::make_unique<Term>(std::move(term));
+            }
+        } else if (target.IsVariable()) {
+            target = Application(std::make_unique<Term>(std::move(target)),
+                                 std::make_unique<Term>(std::move(term)));
+
+            target.is_variable_ = false;
+            target.variable_name_ = "";
+        } else if (target.IsApplication()) {
+            target = Application(std::make_unique<Term>(std::move(target)),
+                                 std::make_unique<Term>(std::move(term)));
         } else {
-            *this = std::move(term);
+            target = std::move(term);
+        }
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            (*it)->UpdateFreeVariableBound();
         }
 
         return *this;
@@ -290,24 +339,39 @@ class Term {
      * distance amount. For an example use, see Term::Substitute(int, Term&).
      */
     void Shift(int distance) {
-        std::function<void(int, Term&)> walk = [&distance, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
-            if (term.IsVariable()) {
-                if (term.de_bruijn_idx_ >= binding_context_size) {
-                    term.de_bruijn_idx_ += distance;
-                }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
-            } else {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
+            if (term.IsInvalid()) {
                 throw std::invalid_argument("Trying to shift an invalid term.");
             }
-        };
 
-        walk(0, *this);
+            // Skip sub-terms whose variables are all bound inside this Term.
+            if (term.free_variable_bound_ <= entry.binding_context_size) {
+                continue;
+            }
+
+            if (term.IsVariable()) {
+                term.de_bruijn_idx_ += distance;
+                term.UpdateFreeVariableBound();
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
+            }
+        }
     }
 
     /**
@@ -320,28 +384,44 @@ class Term {
                 "Trying to substitute using invalid terms.");
         }
 
-        std::function<void(int, Term&)> walk = [&variable, &sub, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
+            // Adjust variable according to the current binding depth before
+            // comparing it with term's free variables.
+            int term_variable = variable + entry.binding_context_size;
+
+            // Skip sub-terms in which variable doesn't occur.
+            if (term.free_variable_bound_ <= term_variable) {
+                continue;
+            }
+
             if (term.IsVariable()) {
-                // Adjust variable according to the current binding
-                // depth before comparing term's index.
-                if (term.de_bruijn_idx_ == variable + binding_context_size) {
+                if (term.de_bruijn_idx_ == term_variable) {
                     // Shift sub up by binding_context_size distance since sub
                     // is now substituted in binding_context_size deep context.
                     auto clone = sub.Clone();
-                    clone.Shift(binding_context_size);
+                    clone.Shift(entry.binding_context_size);
                     std::swap(term, clone);
                 }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
             }
-        };
-
-        walk(0, *this);
+        }
     }
 
     Term& LambdaBody() const {
@@ -368,65 +448,198 @@ class Term {
         return *application_rhs_;
     }
 
-    bool operator==(const Term& other) const {
-        if (IsLambda() && other.IsLambda()) {
-            return LambdaBody() == other.LambdaBody();
+    /**
+     * Returns the number of nodes of this Term and its depth (the number of
+     * nodes on its longest path from the root).
+     */
+    std::pair<std::size_t, std::size_t> SizeAndDepth() const {
+        std::size_t size = 0;
+        std::size_t depth = 0;
+        std::vector<std::pair<const Term*, std::size_t>> stack{{this, 1}};
+
+        while (!stack.empty()) {
+            auto [term, term_depth] = stack.back();
+            stack.pop_back();
+            ++size;
+            depth = std::max(depth, term_depth);
+            term->ForEachSubterm([&](const Term& sub_term, int) {
+                stack.push_back({&sub_term, term_depth + 1});
+            });
         }
 
-        if (IsVariable() && other.IsVariable()) {
-            return de_bruijn_idx_ == other.de_bruijn_idx_;
-        }
+        return {size, depth};
+    }
 
-        if (IsApplication() && other.IsApplication()) {
-            return (ApplicationLHS() == other.ApplicationLHS()) &&
-                   (ApplicationRHS() == other.ApplicationRHS());
+    bool operator==(const Term& other) const {
+        std::vector<std::pair<const Term*, const Term*>> stack{{this, &other}};
+
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
+
+            if (lhs->IsLambda() && rhs->IsLambda()) {
+                stack.push_back({&lhs->LambdaBody(), &rhs->LambdaBody()});
+            } else if (lhs->IsVariable() && rhs->IsVariable()) {
+                if (lhs->de_bruijn_idx_ != rhs->de_bruijn_idx_) {
+                    return false;
+                }
+            } else if (lhs->IsApplication() && rhs->IsApplication()) {
+                stack.push_back(
+                    {&lhs->ApplicationRHS(), &rhs->ApplicationRHS()});
+                stack.push_back(
+                    {&lhs->ApplicationLHS(), &rhs->ApplicationLHS()});
+            } else {
+                return false;
+            }
         }
 
-        return false;
+        return true;
     }
 
     bool operator!=(const Term& other) const { return !(*this == other); }
 
     std::string ASTString(int indentation = 0) const {
         std::ostringstream out;
-        std::string prefix = std::string(indentation, ' ');
+        // Work items, last one first: either a term to print at some
+        // indentation or, if term is nullptr, a line break.
+        std::vector<std::pair<const Term*, int>> stack{{this, indentation}};
 
-        if (IsLambda()) {
-            out << prefix << "λ " << lambda_arg_name_ << "\n";
-            out << lambda_body_->ASTString(indentation + 2);
-        } else if (IsVariable()) {
-            out << prefix << variable_name_ << "[" << de_bruijn_idx_ << "]";
-        } else if (IsApplication()) {
-            out << prefix << "<-\n";
-            out << application_lhs_->ASTString(indentation + 2) << "\n";
-            out << application_rhs_->ASTString(indentation + 2);
+        while (!stack.empty()) {
+            auto [term, term_indentation] = stack.back();
+            stack.pop_back();
+
+            if (!term) {
+                out << "\n";
+                continue;
+            }
+
+            std::string prefix = std::string(term_indentation, ' ');
+
+            if (term->IsLambda()) {
+                out << prefix << "λ " << term->lambda_arg_name_ << "\n";
+                stack.push_back({term->lambda_body_.get(), term_indentation + 2});
+            } else if (term->IsVariable()) {
+                out << prefix << term->variable_name_ << "["
+                    << term->de_bruijn_idx_ << "]";
+            } else if (term->IsApplication()) {
+                out << prefix << "<-\n";
+                stack.push_back(
+                    {term->application_rhs_.get(), term_indentation + 2});
+                stack.push_back({nullptr, 0});
+                stack.push_back(
+                    {term->application_lhs_.get(), term_indentation + 2});
+            }
         }
 
         return out.str();
     }
 
+    /**
+     * Copies this Term iteratively so that arbitrarily deep terms can be
+     * cloned.
+     */
     Term Clone() const {
-        if (IsInvalid()) {
-            throw std::logic_error("Trying to clone an invalid term.");
+        Term clone;
+        // Pairs of an original term and its (so far empty) clone.
+        std::vector<std::pair<const Term*, Term*>> stack{{this, &clone}};
+
+        while (!stack.empty()) {
+            auto [original, copy] = stack.back();
+            stack.pop_back();
+
+            if (original->IsInvalid()) {
+                throw std::logic_error("Trying to clone an invalid term.");
+            }
+
+            copy->is_lambda_ = original->is_lambda_;
+            copy->lambda_arg_name_ = original->lambda_arg_name_;
+            copy->is_complete_lambda_ = original->is_complete_lambda_;
+            copy->is_variable_ = original->is_variable_;
+            copy->variable_name_ = original->variable_name_;
+            copy->de_bruijn_idx_ = original->de_bruijn_idx_;
+            copy->is_application_ = original->is_application_;
+            copy->free_variable_bound_ = original->free_variable_bound_;
+
+            auto clone_sub_term = [&stack](const std::unique_ptr<Term>& from,
+                                           std::unique_ptr<Term>& to) {
+                if (from) {
+                    to = std::make_unique<Term>();
+                    stack.push_back({from.get(), to.get()});
+                }
+            };
+
+            clone_sub_term(original->lambda_body_, copy->lambda_body_);
+            clone_sub_term(original->application_lhs_, copy->application_lhs_);
+            clone_sub_term(original->application_rhs_, copy->application_rhs_);
         }
 
+        return clone;
+    }
+
+   private:
+    /**
+     * An entry of the explicit stacks used by Shift() and Substitute().
+     */
+    struct WalkEntry {
+        Term* term;
+        // The number of binders between term and the Term being walked.
+        int binding_context_size;
+        // Whether term's sub-terms were walked already (i.e. term is visited
+        // for the second time to update its free_variable_bound_).
+        bool sub_terms_walked;
+    };
+
+    /**
+     * Calls visit(sub_term, num_binders) for each direct sub-term of this Term
+     * (that was parsed so far), where num_binders is the number of variables
+     * this Term binds around sub_term.
+     */
+    template <typename Visitor>
+    void ForEachSubterm(Visitor visit) const {
+        auto visit_if_parsed = [&visit](const std::unique_ptr<Term>& sub_term,
+                                        int num_binders) {
+            if (sub_term) {
+                visit(*sub_term, num_binders);
+            }
+        };
+
         if (IsLambda()) {
-            return std::move(
-                Lambda(lambda_arg_name_).Combine(lambda_body_->Clone()));
-        } else if (IsVariable()) {
-            return Variable(variable_name_, de_bruijn_idx_);
+            visit_if_parsed(lambda_body_, 1);
         } else if (IsApplication()) {
-            return Application(
-                std::make_unique<Term>(application_lhs_->Clone()),
-                std::make_unique<Term>(application_rhs_->Clone()));
+            visit_if_parsed(application_lhs_, 0);
+            visit_if_parsed(application_rhs_, 0);
         }
+    }
 
-        std::ostringstream error_ss;
-        error_ss << "Couldn't clone term: " << *this;
-        throw std::logic_error(error_ss.str());
+    /**
+     * Moves the direct sub-terms of this Term to sub_terms.
+     */
+    void DetachSubTerms(std::vector<std::unique_ptr<Term>>& sub_terms) {
+        for (auto* sub_term :
+             {&lambda_body_, &application_lhs_, &application_rhs_}) {
+            if (*sub_term) {
+                sub_terms.push_back(std::move(*sub_term));
+            }
+        }
+    }
+
+    /**
+     * Recalculates free_variable_bound_ from the ones of the sub-terms.
+     */
+    void UpdateFreeVariableBound() {
+        if (IsVariable()) {
+            free_variable_bound_ = std::max(de_bruijn_idx_ + 1, 0);
+            return;
+        }
+
+        int bound = 0;
+        ForEachSubterm([&bound](Term& sub_term, int num_binders) {
+            bound = std::max(bound,
+                             sub_term.free_variable_bound_ - num_binders);
+        });
+        free_variable_bound_ = bound;
     }
 
-   private:
     bool is_lambda_ = false;
     std::string lambda_arg_name_ = "";
     std::unique_ptr<Term> lambda_body_{};
@@ -440,21 +653,44 @@ class Term {
     bool is_application_ = false;
     std::unique_ptr<Term> application_lhs_{};
     std::unique_ptr<Term> application_rhs_{};
+
+    // 1 + the largest de Bruijn index of the free variables of this Term (0 if
+    // the Term is closed). Sub-terms that are evaluated in place don't update
+    // it, which is fine since evaluation never introduces free variables. So
+    // it is always an upper bound that lets Shift() and Substitute() skip
+    // closed sub-terms.
+    int free_variable_bound_ = 0;
 };
 
 std::ostream& operator<<(std::ostream& out, const Term& term) {
-    if (term.IsInvalid()) {
-        out << "<INVALID>";
-    } else if (term.IsVariable()) {
-        out << "[" << term.variable_name_ << "=" << term.de_bruijn_idx_ << "]";
-    } else if (term.IsLambda()) {
-        out << "{λ " << term.lambda_arg_name_ << ". " << *term.lambda_body_
-            << "}";
-    } else if (term.IsApplication()) {
-        out << "(" << *term.application_lhs_ << " <- " << *term.application_rhs_
-            << ")";
-    } else {
-        out << "<ERROR>";
+    // Work items, last one first: either a term to print or, if term is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Term*, const char*>> stack{{&term, nullptr}};
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+        } else if (current->IsInvalid()) {
+            out << "<INVALID>";
+        } else if (current->IsVariable()) {
+            out << "[" << current->variable_name_ << "="
+                << current->de_bruijn_idx_ << "]";
+        } else if (current->IsLambda()) {
+            out << "{λ " << current->lambda_arg_name_ << ". ";
+            stack.push_back({nullptr, "}"});
+            stack.push_back({current->lambda_body_.get(), nullptr});
+        } else if (current->IsApplication()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->application_rhs_.get(), nullptr});
+            stack.push_back({nullptr, " <- "});
+            stack.push_back({current->application_lhs_.get(), nullptr});
+        } else {
+            out << "<ERROR>";
+        }
     }
 
     return out;
@@ -467,6 +703,7 @@ class Parser {
     Parser(std::istringstream&& in) : lexer_(std::move(in)) {}
 
     Term ParseProgram() {
+        allocation::PhaseScope scope{allocation::Phase::PARSING};
         Token next_token;
         std::vector<Term> term_stack;
         term_stack.emplace_back(Term());
@@ -607,53 +844,612 @@ class Parser {
    private:
     lexer::Lexer lexer_;
 };
+
+/**
+ * Identifies (and versions) the binary term images written by ImageWriter.
+ */
+const std::string kImageMagic = "TAPL07";
+const std::uint8_t kImageVersion = 1;
+// Set in the tag byte of lambdas that the parser marked as complete.
+const std::uint8_t kImageCompleteFlag = 0x80;
+
+enum class ImageTermTag : std::uint8_t { LAMBDA, VARIABLE, APPLICATION };
+
+/**
+ * Writes a term into a compact binary "term image" that ImageReader loads
+ * without lexing and parsing. An image consists of:
+ *  - kImageMagic followed by kImageVersion,
+ *  - a table of all names in the term,
+ *  - the term's nodes in pre-order.
+ *
+ * Integers are LEB128-encoded and names are referred to by their table
+ * indices. Terms are walked iteratively, so deep terms don't overflow the
+ * stack.
+ */
+class ImageWriter {
+   public:
+    std::string Write(const Term& term) {
+        strings_.clear();
+        string_indices_.clear();
+
+        std::string nodes;
+        std::vector<const Term*> stack{&term};
+
+        while (!stack.empty()) {
+            const Term* current = stack.back();
+            stack.pop_back();
+
+            if (current->IsInvalid()) {
+                throw std::invalid_argument(
+                    "Trying to write an incompletely parsed term.");
+            }
+
+            if (current->IsLambda()) {
+                auto tag = static_cast<std::uint8_t>(ImageTermTag::LAMBDA);
+                nodes.push_back(current->is_complete_lambda_
+                                    ? tag | kImageCompleteFlag
+                                    : tag);
+                WriteUInt(StringIdx(current->lambda_arg_name_), nodes);
+                stack.push_back(current->lambda_body_.get());
+            } else if (current->IsVariable()) {
+                nodes.push_back(
+                    static_cast<std::uint8_t>(ImageTermTag::VARIABLE));
+                WriteUInt(StringIdx(current->variable_name_), nodes);
+                WriteUInt(ZigZag(current->de_bruijn_idx_), nodes);
+            } else {
+                nodes.push_back(
+                    static_cast<std::uint8_t>(ImageTermTag::APPLICATION));
+                stack.push_back(current->application_rhs_.get());
+                stack.push_back(current->application_lhs_.get());
+            }
+        }
+
+        std::string image = kImageMagic;
+        image.push_back(kImageVersion);
+        WriteUInt(strings_.size(), image);
+
+        for (const auto& str : strings_) {
+            WriteUInt(str.size(), image);
+            image += str;
+        }
+
+        image += nodes;
+
+        return image;
+    }
+
+   private:
+    std::size_t StringIdx(const std::string& str) {
+        auto it = string_indices_.find(str);
+
+        if (it != std::end(string_indices_)) {
+            return it->second;
+        }
+
+        strings_.push_back(str);
+
+        return string_indices_[str] = strings_.size() - 1;
+    }
+
+    static void WriteUInt(std::uint64_t value, std::string& out) {
+        do {
+            char byte = value & 0x7f;
+            value >>= 7;
+            out.push_back(value ? byte | 0x80 : byte);
+        } while (value);
+    }
+
+    /**
+     * Maps signed to unsigned integers such that numbers with small absolute
+     * values stay small (0, -1, 1, -2, ... are mapped to 0, 1, 2, 3, ...).
+     */
+    static std::uint64_t ZigZag(std::int64_t value) {
+        std::uint64_t shifted = static_cast<std::uint64_t>(value) << 1;
+
+        return value < 0 ? ~shifted : shifted;
+    }
+
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, std::size_t> string_indices_;
+};
+
+/**
+ * Loads a term from an image written by ImageWriter.
+ */
+class ImageReader {
+   public:
+    /**
+     * \p data has to stay valid until ReadTerm() returns.
+     */
+    ImageReader(const char* data, std::size_t size)
+        : pos_(data), end_(data + size) {}
+
+    Term ReadTerm() {
+        if (Remaining() < kImageMagic.size() ||
+            std::string(pos_, kImageMagic.size()) != kImageMagic) {
+            throw std::invalid_argument("Not a term image.");
+        }
+
+        pos_ += kImageMagic.size();
+
+        if (ReadByte() != kImageVersion) {
+            throw std::invalid_argument("Unsupported term image version.");
+        }
+
+        std::size_t num_strings = ReadUInt();
+
+        for (std::size_t i = 0; i < num_strings; ++i) {
+            std::size_t size = ReadUInt();
+
+            if (Remaining() < size) {
+                throw std::invalid_argument("Truncated term image.");
+            }
+
+            strings_.emplace_back(pos_, size);
+            pos_ += size;
+        }
+
+        // Decode the nodes first and then link them in reverse pre-order:
+        // that way the sub-terms of a node are the last ones completed when
+        // the node is reached.
+        std::vector<Term> nodes;
+
+        while (pos_ != end_) {
+            nodes.push_back(ReadNode());
+        }
+
+        std::vector<std::unique_ptr<Term>> completed;
+
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            auto node = std::make_unique<Term>(std::move(*it));
+
+            if (node->IsLambda()) {
+                node->lambda_body_ = PopCompleted(completed);
+            } else if (node->IsApplication()) {
+                node->application_lhs_ = PopCompleted(completed);
+                node->application_rhs_ = PopCompleted(completed);
+            }
+
+            node->UpdateFreeVariableBound();
+            completed.push_back(std::move(node));
+        }
+
+        if (completed.size() != 1) {
+            throw std::invalid_argument("Invalid term image.");
+        }
+
+        return std::move(*completed.back());
+    }
+
+   private:
+    Term ReadNode() {
+        std::uint8_t tag = ReadByte();
+        Term node;
+
+        switch (static_cast<ImageTermTag>(tag & ~kImageCompleteFlag)) {
+            case ImageTermTag::LAMBDA:
+                node.is_lambda_ = true;
+                node.is_complete_lambda_ = tag & kImageCompleteFlag;
+                node.lambda_arg_name_ = ReadString();
+                break;
+            case ImageTermTag::VARIABLE: {
+                node.is_variable_ = true;
+                node.variable_name_ = ReadString();
+                std::uint64_t idx = ReadUInt();
+                node.de_bruijn_idx_ = (idx >> 1) ^ -(idx & 1);
+                break;
+            }
+            case ImageTermTag::APPLICATION:
+                node.is_application_ = true;
+                break;
+            default:
+                throw std::invalid_argument("Invalid term in term image.");
+        }
+
+        return node;
+    }
+
+    static std::unique_ptr<Term> PopCompleted(
+        std::vector<std::unique_ptr<Term>>& completed) {
+        if (completed.empty()) {
+            throw std::invalid_argument("Truncated term image.");
+        }
+
+        auto term = std::move(completed.back());
+        completed.pop_back();
+
+        return term;
+    }
+
+    const std::string& ReadString() {
+        std::uint64_t idx = ReadUInt();
+
+        if (idx >= strings_.size()) {
+            throw std::invalid_argument("Invalid string in term image.");
+        }
+
+        return strings_[idx];
+    }
+
+    std::uint64_t ReadUInt() {
+        std::uint64_t value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            std::uint8_t byte = ReadByte();
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+
+        throw std::invalid_argument("Invalid integer in term image.");
+    }
+
+    std::size_t Remaining() const { return end_ - pos_; }
+
+    std::uint8_t ReadByte() {
+        if (pos_ == end_) {
+            throw std::invalid_argument("Truncated term image.");
+        }
+
+        return *pos_++;
+    }
+
+    const char* pos_;
+    const char* end_;
+
+    std::vector<std::string> strings_;
+};
 }  // namespace parser
 
 namespace interpreter {
-class Interpreter {
+/**
+ * Identifies how this interpreter evaluates programs and prints their results
+ * in caches of results (see result_cache/). Bump it whenever either changes.
+ */
+constexpr int kEngineVersion = 1;
+
+using budget::Budget;
+using budget::BudgetExceeded;
+using budget::BudgetMeter;
+
+/**
+ * Identifies (and versions) the checkpoints written by WriteCheckpoint().
+ */
+const std::string kCheckpointMagic = "TAPL07CK";
+
+/**
+ * An evaluation in progress: the term as far as it is reduced and the number
+ * of steps that took.
+ */
+struct Checkpoint {
+    parser::Term term_;
+    long long steps_ = 0;
+};
+
+/**
+ * Encodes a checkpoint as kCheckpointMagic, the number of steps (8 bytes,
+ * little endian) and the image of the term. So the cost of a checkpoint is
+ * proportional to the size of the term, however long the evaluation ran.
+ */
+std::string WriteCheckpoint(const parser::Term& term, long long steps) {
+    std::string checkpoint = kCheckpointMagic;
+
+    for (int i = 0; i < 8; ++i) {
+        checkpoint.push_back(static_cast<std::uint64_t>(steps) >> (8 * i));
+    }
+
+    return checkpoint + parser::ImageWriter().Write(term);
+}
+
+/**
+ * Decodes a checkpoint written by WriteCheckpoint(). Throws
+ * std::invalid_argument if data isn't one.
+ */
+Checkpoint ReadCheckpoint(const std::string& data) {
+    std::size_t header_size = kCheckpointMagic.size() + 8;
+
+    if (data.size() < header_size ||
+        data.compare(0, kCheckpointMagic.size(), kCheckpointMagic) != 0) {
+        throw std::invalid_argument("Not a checkpoint.");
+    }
+
+    std::uint64_t steps = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        steps |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(
+                     data[kCheckpointMagic.size() + i]))
+                 << (8 * i);
+    }
+
+    parser::ImageReader reader{data.data() + header_size,
+                               data.size() - header_size};
+
+    return {reader.ReadTerm(), static_cast<long long>(steps)};
+}
+
+/**
+ * Profiling policy of BasicInterpreter that records nothing. Its hooks are
+ * empty inline functions, so an unprofiled interpreter doesn't pay for them.
+ */
+struct NullProfiler {
+    void CountRule(const char*) {}
+
+    template <typename Operation>
+    void Time(const char*, Operation operation) {
+        operation();
+    }
+
+    void RecordTerm(const parser::Term&, std::size_t) {}
+
+    void RecordResult(const parser::Term&) {}
+};
+
+/**
+ * Profiling policy of BasicInterpreter that counts how often each reduction
+ * rule fires, measures the time spent in Shift() and Substitute() (which
+ * includes cloning the substituted terms) and tracks the largest term that
+ * evaluation produces.
+ */
+class Profiler {
+   public:
+    // How many steps apart the depth of the evaluated term is measured.
+    static constexpr long long kDepthSampleInterval = 1024;
+
+    void CountRule(const char* rule) { ++rule_counts_[rule]; }
+
+    template <typename Operation>
+    void Time(const char* name, Operation operation) {
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        operation_times_[name] += std::chrono::steady_clock::now() - start;
+    }
+
+    /**
+     * Records the term after a reduction step, given its size as counted by
+     * the budget meter. Measuring its depth takes a walk over the whole term,
+     * so that is only sampled every kDepthSampleInterval steps and on the
+     * result.
+     */
+    void RecordTerm(const parser::Term& term, std::size_t size) {
+        max_term_size_ = std::max(max_term_size_, size);
+
+        if (num_terms_++ % kDepthSampleInterval == 0) {
+            RecordResult(term);
+        }
+    }
+
+    void RecordResult(const parser::Term& term) {
+        max_term_depth_ = std::max(max_term_depth_, term.SizeAndDepth().second);
+    }
+
+    /**
+     * Prints the collected data and the peak memory usage of the process as a
+     * table.
+     */
+    void Print(std::ostream& out) const {
+        const int kNameWidth = 24;
+        out << std::left << std::setw(kNameWidth) << "Rule" << "Count\n";
+
+        for (const auto& [rule, count] : rule_counts_) {
+            out << std::setw(kNameWidth) << rule << count << "\n";
+        }
+
+        out << "\n" << std::setw(kNameWidth) << "Operation" << "Time (ms)\n";
+
+        for (const auto& [name, time] : operation_times_) {
+            out << std::setw(kNameWidth) << name
+                << std::chrono::duration<double, std::milli>(time).count()
+                << "\n";
+        }
+
+        out << "\n"
+            << std::setw(kNameWidth) << "Max term size" << max_term_size_
+            << " nodes\n"
+            << std::setw(kNameWidth) << "Max sampled depth" << max_term_depth_
+            << "\n"
+            << std::setw(kNameWidth) << "Peak memory" << PeakMemoryKiB()
+            << " KiB\n";
+    }
+
+   private:
+    static long PeakMemoryKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        // macOS reports ru_maxrss in bytes rather than KiB.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    std::map<std::string, long long> rule_counts_;
+    std::map<std::string, std::chrono::steady_clock::duration>
+        operation_times_;
+    std::size_t max_term_size_ = 0;
+    std::size_t max_term_depth_ = 0;
+    long long num_terms_ = 0;
+};
+
+/**
+ * Evaluates programs, reporting every reduction step to a ProfilingPolicy
+ * (NullProfiler or Profiler).
+ */
+template <typename ProfilingPolicy>
+class BasicInterpreter {
     using Term = parser::Term;
 
    public:
-    void Interpret(Term& program) { Eval(program); }
+    const ProfilingPolicy& GetProfiler() const { return profiler_; }
 
-    void Eval(Term& term) {
-        try {
-            Eval1(term);
-            Eval(term);
-        } catch (std::invalid_argument&) {
+    /**
+     * Limits every following evaluation to budget. Interpret() throws
+     * BudgetExceeded when an evaluation goes over it.
+     */
+    void SetBudget(const Budget& budget) { budget_ = budget; }
+
+    /**
+     * An evaluation of a term in place that can be suspended between any two
+     * reduction steps, so that a scheduler can interleave many evaluations on
+     * a few threads. The term must not be used otherwise until Resume()
+     * returned true.
+     *
+     * The evaluation context of the current redex is kept as an explicit
+     * stack of the sub-terms on the path from the term to the redex (i.e. a
+     * zipper over the term), which is all the state there is to suspend.
+     * After a reduction, the search for the next redex resumes at the reduced
+     * sub-term and only moves up as far as necessary instead of starting over
+     * at the term, so each step takes amortized constant search
+     * time regardless of how deep its evaluation context is.
+     */
+    class Evaluation {
+       public:
+        /**
+         * Prepares to evaluate term, which took steps reduction steps already
+         * if it was resumed from a checkpoint.
+         */
+        Evaluation(BasicInterpreter& interpreter, Term& term,
+                   long long steps = 0)
+            : interpreter_(interpreter),
+              term_(term),
+              context_{&term},
+              meter_(interpreter.budget_, steps) {
+            meter_.Start(term_);
+            interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
         }
+
+        /**
+         * Performs at most fuel (> 0) reduction steps and returns true once no
+         * evaluation rule applies anymore. Throws BudgetExceeded when the
+         * evaluation goes over the interpreter's budget.
+         */
+        bool Resume(long long fuel) {
+            meter_.Resume();
+
+            try {
+                while (!context_.empty()) {
+                    Term& focus = *context_.back();
+
+                    if (interpreter_.IsValue(focus)) {
+                        // Continue evaluating the enclosing term.
+                        context_.pop_back();
+                        continue;
+                    }
+
+                    Term* sub_term = interpreter_.Eval1(focus);
+
+                    if (sub_term) {
+                        if (interpreter_.IsValue(*sub_term)) {
+                            // The enclosing term is stuck.
+                            throw std::invalid_argument("No applicable rule.");
+                        }
+
+                        context_.push_back(sub_term);
+                    } else {
+                        meter_.Step();
+                        interpreter_.profiler_.RecordTerm(
+                            term_, meter_.GetTermNodes());
+
+                        if (--fuel <= 0) {
+                            return false;
+                        }
+                    }
+                }
+            } catch (std::invalid_argument&) {
+                context_.clear();
+            }
+
+            interpreter_.profiler_.RecordResult(term_);
+            meter_.Check();
+            return true;
+        }
+
+        /**
+         * The number of reduction steps performed so far.
+         */
+        long long GetSteps() const { return meter_.GetSteps(); }
+
+        /**
+         * Returns a checkpoint of the evaluation from which a new Evaluation
+         * continues with the same result. The evaluation context isn't part
+         * of it: evaluation is deterministic, so the search for the next
+         * redex from the term finds the same one.
+         */
+        std::string Snapshot() const {
+            return WriteCheckpoint(term_, GetSteps());
+        }
+
+       private:
+        BasicInterpreter& interpreter_;
+        Term& term_;
+        std::vector<Term*> context_;
+        BudgetMeter<Term> meter_;
+    };
+
+    void Interpret(Term& program) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        Evaluation evaluation{*this, program};
+        evaluation.Resume(std::numeric_limits<long long>::max());
     }
 
-    void Eval1(Term& term) {
-        auto term_subst_top = [](Term& s, Term& t) {
+    /**
+     * Performs a single evaluation step on term in place and returns nullptr
+     * if term is a redex. Otherwise, returns the sub-term that the congruence
+     * rules select to be evaluated next. Throws std::invalid_argument if no
+     * evaluation rule applies.
+     */
+    Term* Eval1(Term& term) {
+        auto term_subst_top = [this](Term& s, Term& t) {
             // Adjust the free variables in s by increasing their static
             // distances by 1. That's because s will now be embedded one level
             // deeper in t (i.e. t's bound variable will be replaced by s).
-            s.Shift(1);
-            t.Substitute(0, s);
+            profiler_.Time("Shift", [&s] { s.Shift(1); });
+            profiler_.Time("Substitute", [&] { t.Substitute(0, s); });
             // Because of the substitution, one level of abstraction was peeled
             // off. Account for that by decreasing the static distances of the
             // free variables in t by 1.
-            t.Shift(-1);
+            profiler_.Time("Shift", [&t] { t.Shift(-1); });
             // NOTE: For more details see: tapl,§6.3.
         };
 
         if (term.IsApplication() && term.ApplicationLHS().IsLambda() &&
             IsValue(term.ApplicationRHS())) {
+            profiler_.CountRule("E-AppAbs");
             term_subst_top(term.ApplicationRHS(),
                            term.ApplicationLHS().LambdaBody());
-            std::swap(term, term.ApplicationLHS().LambdaBody());
+            ReplaceBySubTerm(term, term.ApplicationLHS().LambdaBody());
+            return nullptr;
         } else if (term.IsApplication() && IsValue(term.ApplicationLHS())) {
-            Eval1(term.ApplicationRHS());
+            return &term.ApplicationRHS();
         } else if (term.IsApplication()) {
-            Eval1(term.ApplicationLHS());
-        } else {
-            throw std::invalid_argument("No applicable rule.");
+            return &term.ApplicationLHS();
         }
+
+        throw std::invalid_argument("No applicable rule.");
+    }
+
+    /**
+     * Replaces term by its (direct or indirect) sub-term without copying the
+     * sub-term.
+     */
+    void ReplaceBySubTerm(Term& term, Term& sub_term) {
+        // sub_term is owned by term, so it has to be moved out before term is
+        // overwritten. (Swapping the two instead would make sub_term own the
+        // rest of term, which then is never freed.)
+        Term tmp = std::move(sub_term);
+        term = std::move(tmp);
     }
 
     bool IsValue(const Term& term) {
         return term.IsLambda() || term.IsVariable();
     }
+
+    ProfilingPolicy profiler_;
+    Budget budget_;
 };
+
+using Interpreter = BasicInterpreter<NullProfiler>;
+using ProfilingInterpreter = BasicInterpreter<Profiler>;
 }  // namespace interpreter
@@ -1011,9 +1011,111 @@ void InitData() {
                  Term::Application(VariableUP("y", 24), VariableUP("y", 24))});
 }
 
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 1000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::string expected_eval_result_string_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData;
+
+struct BudgetTestData {
+    std::string input_program_;
+    Budget budget_;
+    // The limit that evaluation should exceed, or nullopt if it should
+    // finish within budget_.
+    std::optional<BudgetExceeded::Limit> expected_limit_;
+};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+std::vector<BudgetTestData> kBudgetData = {
+    {"(l x. x) (l y. y)", Budget{1}, std::nullopt},
+    {"(l x. x x) (l x. x x)", Budget{1000}, BudgetExceeded::Limit::STEPS},
+    // Grows by one node per step.
+    {"(l x. x x x) (l x. x x x)",
+     Budget{std::numeric_limits<long long>::max(), 1000},
+     BudgetExceeded::Limit::TERM_NODES},
+    // Doubles in size with every step and finishes after 22 steps, at over
+    // 10^7 nodes.
+    {Repeat("(l x. l y. y x x) (", 22) + "l z. z" + Repeat(")", 22),
+     Budget{std::numeric_limits<long long>::max(), 1000},
+     BudgetExceeded::Limit::TERM_NODES},
+    {"(l x. x x) (l x. x x)",
+     Budget{std::numeric_limits<long long>::max(),
+            std::numeric_limits<std::size_t>::max(),
+            std::chrono::milliseconds(10)},
+     BudgetExceeded::Limit::TIME},
+};
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+    std::string lambdas = Repeat("l x. ", n) + "l y. y";
+    std::string lambdas_string =
+        Repeat("{λ x. ", n) + "{λ y. [y=0]}" + Repeat("}", n);
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l x.)^" + n_str + " l y. y", lambdas, lambdas_string});
+
+    kDeepTermData.emplace_back(
+        DeepTermTestData{"(l z. z) ((l x.)^" + n_str + " l y. y)",
+                         "(l z. z) (" + lambdas + ")", lambdas_string});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "x^" + n_str + " x", Repeat("x ", n) + "x",
+        Repeat("(", n) + "[x=23]" + Repeat(" <- [x=23])", n)});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(x ()^" + n_str + " x ())^" + n_str,
+        Repeat("x (", n) + "x" + Repeat(")", n),
+        Repeat("([x=23] <- ", n) + "[x=23]" + Repeat(")", n)});
+}
+
+/**
+ * Evaluates program one step at a time, continuing each step from a
+ * checkpoint of the previous one.
+ */
+Term EvaluateFromCheckpoints(Term program) {
+    Interpreter interpreter;
+    long long steps = 0;
+
+    while (true) {
+        Interpreter::Evaluation evaluation{interpreter, program, steps};
+
+        if (evaluation.Resume(1)) {
+            return program;
+        }
+
+        Checkpoint checkpoint = ReadCheckpoint(evaluation.Snapshot());
+        program = std::move(checkpoint.term_);
+        steps = checkpoint.steps_;
+    }
+}
+
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests =
+        kData.size() + kDeepTermData.size() + kBudgetData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -1021,12 +1123,17 @@ void Run() {
     for (const auto& test : kData) {
         Interpreter interpreter{};
         parser::Term actual_eval_res;
+        // The result of an evaluation resumed from checkpoints.
+        parser::Term resumed_eval_res;
 
         try {
             parser::Parser parser{std::istringstream{test.input_program_}};
             auto program = parser.ParseProgram();
+            Term resumed_program = program.Clone();
             interpreter.Interpret(program);
             actual_eval_res = std::move(program);
+            resumed_eval_res =
+                EvaluateFromCheckpoints(std::move(resumed_program));
         } catch (std::exception& ex) {
             std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
 
@@ -1043,7 +1150,8 @@ void Run() {
             continue;
         }
 
-        if (actual_eval_res != test.expected_eval_result_) {
+        if (actual_eval_res != test.expected_eval_result_ ||
+            resumed_eval_res != test.expected_eval_result_) {
             std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
 
             std::cout << "  Input program: " << test.input_program_ << "\n";
@@ -1056,13 +1164,66 @@ void Run() {
                       << "  Actual evaluation result:   " << color::kReset
                       << actual_eval_res << "\n";
 
+            std::cout << color::kRed
+                      << "  Resumed evaluation result:  " << color::kReset
+                      << resumed_eval_res << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    // Test that every stage handles terms nested deeper than the call stack
+    // could hold.
+    for (const auto& test : kDeepTermData) {
+        Term program =
+            Parser{std::istringstream{test.input_program_}}.ParseProgram();
+        Interpreter().Interpret(program);
+        Term eval_res_clone = program.Clone();
+        std::string image = ImageWriter().Write(program);
+        Term loaded_eval_res =
+            ImageReader{image.data(), image.size()}.ReadTerm();
+        std::ostringstream actual_eval_res_string;
+        actual_eval_res_string << program;
+
+        if (eval_res_clone != program || loaded_eval_res != program ||
+            actual_eval_res_string.str() != test.expected_eval_result_string_) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    // Test that divergent programs stop when they exceed their budget.
+    for (const auto& test : kBudgetData) {
+        Term program =
+            Parser{std::istringstream{test.input_program_}}.ParseProgram();
+        Interpreter interpreter;
+        interpreter.SetBudget(test.budget_);
+        std::optional<BudgetExceeded::Limit> actual_limit;
+
+        try {
+            interpreter.Interpret(program);
+        } catch (BudgetExceeded& ex) {
+            actual_limit = ex.GetLimit();
+        }
+
+        if (actual_limit != test.expected_limit_) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.input_program_ << "\n";
+
+            std::cout << color::kRed << "  Exceeded a different budget limit."
+                      << color::kReset << "\n";
+
             ++num_failed;
         }
     }
 
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "interpreter.hpp"
+
+namespace {
+
+struct Benchmark {
+    std::string name_;
+    std::string program_;
+    // The number of evaluation steps it takes to reduce program_ to a value.
+    int num_steps_;
+};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+std::vector<Benchmark> MakeBenchmarks(int depth) {
+    std::string n = std::to_string(depth);
+
+    return {
+        Benchmark{"pred^" + n + " succ^" + n + " 0",
+                  Repeat("pred ", depth) + Repeat("succ ", depth) + "0",
+                  depth},
+        Benchmark{"iszero pred^" + n + " succ^" + n + " 0",
+                  "iszero " + Repeat("pred ", depth) + Repeat("succ ", depth) +
+                      "0",
+                  depth + 1},
+        Benchmark{"if^" + n + " true",
+                  Repeat("if true then ", depth) + "0" +
+                      Repeat(" else 0", depth),
+                  depth},
+    };
+}
+
+/**
+ * A group of hardware counters read with perf_event_open(2) around each phase
+ * of a benchmark. Counters that the kernel or the CPU can't provide (all of
+ * them outside Linux, or when perf_event_paranoid forbids it) are left out
+ * and reported as unavailable rather than failing the benchmark.
+ */
+class PerfCounters {
+   public:
+    enum Counter {
+        kCycles,
+        kInstructions,
+        kL1DMisses,
+        kLLCMisses,
+        kBranchMisses,
+        kNumCounters
+    };
+    using Values = std::array<double, kNumCounters>;
+
+    /**
+     * Accumulates the counts of the calling thread while a Scope is alive
+     * into totals. Does nothing if counters is null.
+     */
+    class Scope {
+       public:
+        Scope(PerfCounters* counters, Values& totals)
+            : counters_(counters), totals_(totals) {
+            if (counters_ != nullptr) {
+                counters_->Start();
+            }
+        }
+
+        ~Scope() {
+            if (counters_ != nullptr) {
+                counters_->StopAndAdd(totals_);
+            }
+        }
+
+       private:
+        PerfCounters* counters_;
+        Values& totals_;
+    };
+
+    PerfCounters() {
+#ifdef __linux__
+        const std::array<std::pair<std::uint32_t, std::uint64_t>, kNumCounters>
+            kEvents = {{
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HW_CACHE,
+                 PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            }};
+
+        for (int counter = 0; counter < kNumCounters; ++counter) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = kEvents[counter].first;
+            attr.config = kEvents[counter].second;
+            attr.disabled = leader_ < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+
+            if (fd < 0) {
+                error_ = std::strerror(errno);
+                continue;
+            }
+
+            if (leader_ < 0) {
+                leader_ = fd;
+            }
+
+            fds_.push_back(fd);
+            opened_.push_back(static_cast<Counter>(counter));
+        }
+#else
+        error_ = "perf_event_open is only available on Linux";
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds_) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool IsAvailable(Counter counter) const {
+        return std::find(opened_.begin(), opened_.end(), counter) !=
+               opened_.end();
+    }
+
+    bool IsAnyAvailable() const { return !opened_.empty(); }
+
+    /**
+     * The reason the last counter that couldn't be opened failed.
+     */
+    const std::string& GetError() const { return error_; }
+
+   private:
+    void Start() {
+#ifdef __linux__
+        if (leader_ >= 0) {
+            ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    void StopAndAdd(Values& totals) {
+#ifdef __linux__
+        if (leader_ < 0) {
+            return;
+        }
+
+        ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // Layout of a PERF_FORMAT_GROUP read: the number of counters, the
+        // times the group was enabled and running, then one value per
+        // counter in the order they were opened.
+        std::array<std::uint64_t, 3 + kNumCounters> data{};
+
+        if (read(leader_, data.data(), sizeof(data)) <= 0) {
+            return;
+        }
+
+        // If the group shared the PMU with other events, scale its counts up
+        // to the whole time it was enabled.
+        double scale = data[2] > 0 ? static_cast<double>(data[1]) / data[2] : 0;
+
+        for (std::size_t i = 0; i < opened_.size() && i < data[0]; ++i) {
+            totals[opened_[i]] += data[3 + i] * scale;
+        }
+#else
+        (void)totals;
+#endif
+    }
+
+    int leader_ = -1;
+    std::vector<int> fds_;
+    std::vector<Counter> opened_;
+    std::string error_;
+};
+
+/**
+ * The counts a benchmark accumulated in one phase of the pipeline.
+ */
+struct PhaseCounts {
+    const char* name_;
+    PerfCounters::Values values_{};
+};
+
+struct Result {
+    double steps_per_second_;
+    // The total number of nodes of all programs evaluated.
+    long long num_nodes_ = 0;
+    std::vector<PhaseCounts> phases_;
+};
+
+/**
+ * Runs phase() and adds the hardware counts it causes to totals if counters
+ * isn't null.
+ */
+template <typename Phase>
+decltype(auto) Measure(PerfCounters* counters, PerfCounters::Values& totals,
+                       Phase phase) {
+    PerfCounters::Scope scope{counters, totals};
+    return phase();
+}
+
+/**
+ * Evaluates benchmark's program repeatedly for at least min_duration and
+ * returns the number of evaluation steps per second along with, if counters
+ * isn't null, the hardware counts of parsing, type checking (except for the
+ * fused engine, which type checks while it evaluates) and evaluation.
+ */
+template <typename Engine>
+Result Run(const Benchmark& benchmark,
+           std::chrono::duration<double> min_duration,
+           PerfCounters* counters) {
+    std::chrono::duration<double> total_duration{0};
+    long long total_num_steps = 0;
+    Engine interpreter;
+    constexpr bool kFused =
+        std::is_same_v<Engine, interpreter::FusedInterpreter>;
+    Result res{0, 0, {{"parse"}, {"type check"}, {"eval"}}};
+
+    if (kFused) {
+        res.phases_.erase(res.phases_.begin() + 1);
+    }
+
+    while (total_duration < min_duration) {
+        parser::Parser parser{std::istringstream{benchmark.program_}};
+        auto program = Measure(counters, res.phases_.front().values_,
+                               [&] { return parser.ParseProgram(); });
+        res.num_nodes_ += program.SizeAndDepth().first;
+
+        if constexpr (!kFused) {
+            Measure(counters, res.phases_[1].values_,
+                    [&] { return type_checker::TypeChecker().TypeOf(program); });
+        }
+
+        Measure(counters, res.phases_.back().values_, [&] {
+            auto start = std::chrono::steady_clock::now();
+            interpreter.Interpret(std::move(program));
+            total_duration += std::chrono::steady_clock::now() - start;
+        });
+        total_num_steps += benchmark.num_steps_;
+    }
+
+    res.steps_per_second_ = total_num_steps / total_duration.count();
+    return res;
+}
+
+/**
+ * Prints the IPC and the cache and branch misses per program node of each
+ * phase in res, or "n/a" for what counters couldn't measure.
+ */
+void PrintCounts(const Result& res, const PerfCounters& counters) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+
+    for (const auto& phase : res.phases_) {
+        const auto& values = phase.values_;
+        out << "    " << std::left << std::setw(12) << phase.name_ << "IPC ";
+
+        if (counters.IsAvailable(PerfCounters::kCycles) &&
+            counters.IsAvailable(PerfCounters::kInstructions) &&
+            values[PerfCounters::kCycles] > 0) {
+            out << values[PerfCounters::kInstructions] /
+                       values[PerfCounters::kCycles];
+        } else {
+            out << "n/a";
+        }
+
+        for (auto [counter, name] :
+             {std::pair{PerfCounters::kL1DMisses, "L1D"},
+              std::pair{PerfCounters::kLLCMisses, "LLC"},
+              std::pair{PerfCounters::kBranchMisses, "branch"}}) {
+            out << ", " << name << " misses/node ";
+
+            if (counters.IsAvailable(counter)) {
+                out << values[counter] / res.num_nodes_;
+            } else {
+                out << "n/a";
+            }
+        }
+
+        out << "\n";
+    }
+
+    std::cout << out.str();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<int> depths;
+    bool fused = false;
+    bool perf = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string{argv[i]} == "--fused") {
+            fused = true;
+        } else if (std::string{argv[i]} == "--perf") {
+            perf = true;
+        } else {
+            depths.push_back(std::stoi(argv[i]));
+        }
+    }
+
+    if (depths.empty()) {
+        depths = {1000, 10000};
+    }
+
+    std::optional<PerfCounters> counters;
+
+    if (perf) {
+        counters.emplace();
+
+        if (!counters->IsAnyAvailable()) {
+            std::cerr << "Hardware counters are unavailable ("
+                      << counters->GetError() << "), reporting time only.\n";
+            counters.reset();
+        }
+    }
+
+    PerfCounters* counters_ptr = counters ? &*counters : nullptr;
+
+    for (int depth : depths) {
+        for (const auto& benchmark : MakeBenchmarks(depth)) {
+            auto min_duration = std::chrono::milliseconds(500);
+            auto res =
+                fused ? Run<interpreter::FusedInterpreter>(
+                            benchmark, min_duration, counters_ptr)
+                      : Run<interpreter::Interpreter>(benchmark, min_duration,
+                                                      counters_ptr);
+            std::cout << benchmark.name_ << ": " << res.steps_per_second_
+                      << " steps/s\n";
+
+            if (counters) {
+                PrintCounts(res, *counters);
+            }
+        }
+    }
+
+    return 0;
+}
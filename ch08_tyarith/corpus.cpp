@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "../corpus_runner/pipeline.hpp"
+#include "../corpus_runner/runner.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+parser::Term Parse(std::string_view source) {
+    return parser::Parser{std::istringstream{std::string{source}}}
+        .ParseProgram();
+}
+
+/**
+ * Runs the program the way interpreter.cpp does.
+ */
+corpus_runner::Result Evaluate(parser::Term program,
+                               const interpreter::Budget& budget) {
+    // The interpreter evaluates ill-typed programs as well, so they are
+    // told apart before.
+    if (type_checker::TypeChecker().TypeOf(program) ==
+        type_checker::Type::IllTyped) {
+        return {corpus_runner::Status::ERROR, "Ill-typed program."};
+    }
+
+    interpreter::Interpreter interpreter;
+    interpreter.SetBudget(budget);
+
+    try {
+        auto res = interpreter.Interpret(std::move(program));
+        std::ostringstream ss;
+        ss << res.first << ": " << res.second;
+        return {corpus_runner::Status::OK, ss.str()};
+    } catch (const interpreter::BudgetExceeded& error) {
+        return {corpus_runner::Status::BUDGET_EXCEEDED, error.what()};
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int num_workers = std::max(1u, std::thread::hardware_concurrency());
+    bool stream = false;
+    int num_parse_threads = 1;
+    int num_eval_threads = num_workers;
+    interpreter::Budget budget;
+    std::string trace_path;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc && std::string{argv[arg_idx]}.rfind("--", 0) == 0;
+         ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag == "--stream") {
+            stream = true;
+            continue;
+        }
+
+        if (flag != "--workers" && flag != "--parse-threads" &&
+            flag != "--eval-threads" && flag != "--max-steps" &&
+            flag != "--max-nodes" && flag != "--timeout-ms" &&
+            flag != "--trace") {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+
+        if (++arg_idx >= argc) {
+            std::cerr << "Error: expected a value after " << flag << ".\n";
+            return 1;
+        }
+
+        std::string value = argv[arg_idx];
+
+        try {
+            if (flag == "--trace") {
+                trace_path = value;
+            } else if (flag == "--workers") {
+                num_workers = std::stoi(value);
+            } else if (flag == "--parse-threads") {
+                num_parse_threads = std::stoi(value);
+            } else if (flag == "--eval-threads") {
+                num_eval_threads = std::stoi(value);
+            } else if (flag == "--max-steps") {
+                budget.max_steps_ = std::stoll(value);
+            } else if (flag == "--max-nodes") {
+                budget.max_term_nodes_ = std::stoull(value);
+            } else {
+                budget.max_time_ = std::chrono::milliseconds(std::stoll(value));
+            }
+        } catch (std::exception&) {
+            std::cerr << "Error: invalid value " << value << " for " << flag
+                      << ".\n";
+            return 1;
+        }
+    }
+
+    auto evaluate = [&](parser::Term program) {
+        return Evaluate(std::move(program), budget);
+    };
+
+    tracing::Tracer tracer;
+
+    auto write_trace = [&] {
+        if (!trace_path.empty()) {
+            std::ofstream trace_file{trace_path};
+            tracer.Write(trace_file);
+        }
+    };
+
+    // Programs arriving on stdin can't be split up front, so they go
+    // through a pipeline of threads instead.
+    if (stream) {
+        corpus_runner::Pipeline pipeline{num_parse_threads, num_eval_threads,
+                                         256, Parse, evaluate};
+
+        if (!trace_path.empty()) {
+            pipeline.SetTracer(tracer);
+        }
+
+        pipeline.Run(std::cin, std::cout).Print(std::cerr);
+        write_trace();
+        return 0;
+    }
+
+    if (arg_idx >= argc) {
+        std::cerr << "Error: expected a corpus file as a command line "
+                     "argument.\n";
+        return 1;
+    }
+
+    corpus_runner::Runner runner{num_workers, [&](std::string_view source) {
+                                     return evaluate(Parse(source));
+                                 }};
+
+    if (!trace_path.empty()) {
+        runner.SetTracer(tracer);
+    }
+
+    try {
+        corpus_runner::MappedFile corpus{argv[arg_idx]};
+        runner.Run(corpus.GetContents(), std::cout).Print(std::cerr);
+        write_trace();
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../complexity_fuzzer/fuzzer.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+using complexity_fuzzer::Repeat;
+
+/**
+ * Returns the seconds parsing, type checking and evaluating source take.
+ */
+std::vector<double> Measure(const std::string& source) {
+    parser::Term program;
+    interpreter::Interpreter interpreter;
+    double parse_time = complexity_fuzzer::Seconds([&] {
+        program =
+            parser::Parser{std::istringstream{source}}.ParseProgram();
+    });
+    double type_check_time = complexity_fuzzer::Seconds(
+        [&] { type_checker::TypeChecker().TypeOf(program); });
+    double eval_time = complexity_fuzzer::Seconds(
+        [&] { interpreter.Interpret(std::move(program)); });
+
+    return {parse_time, type_check_time, eval_time};
+}
+
+const std::vector<complexity_fuzzer::Family> kFamilies = {
+    {"numeral", [](int n) { return Repeat("succ ", n) + "0"; }},
+    {"pred of numeral",
+     [](int n) { return Repeat("pred ", n) + Repeat("succ ", n) + "0"; }},
+    {"nested if condition",
+     [](int n) {
+         return Repeat("if ", n) + "true" +
+                Repeat(" then false else true", n);
+     }},
+    {"iszero of numeral",
+     [](int n) { return "iszero " + Repeat("succ ", n) + "0"; }},
+    {"nested if branch",
+     [](int n) {
+         return Repeat("if true then ", n) + "0" + Repeat(" else 0", n);
+     }},
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    complexity_fuzzer::Options options;
+
+    if (!complexity_fuzzer::ParseOptions(argc, argv, options, std::cerr)) {
+        return 1;
+    }
+
+    complexity_fuzzer::Fuzzer fuzzer{"ch08_tyarith",
+                                     {"parse", "type check", "eval"},
+                                     Measure,
+                                     options};
+    return fuzzer.Run(kFamilies, std::cout) > 0 ? 1 : 0;
+}
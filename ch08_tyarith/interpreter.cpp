@@ -1,22 +1,171 @@
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <optional>
 
+#include "../result_cache/result_cache.hpp"
 #include "interpreter.hpp"
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    bool fused = false;
+    bool profile = false;
+    std::string trace_path;
+    std::string cache_dir;
+    interpreter::Budget budget;
+    bool budgeted = false;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc - 1; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag == "--fused") {
+            fused = true;
+        } else if (flag == "--profile") {
+            profile = true;
+        } else if (flag == "--trace" || flag == "--cache" ||
+                   flag == "--max-steps" || flag == "--max-nodes" ||
+                   flag == "--timeout-ms") {
+            if (++arg_idx >= argc - 1) {
+                std::cerr << "Error: expected a value after " << flag << ".\n";
+                return 1;
+            }
+
+            std::string value = argv[arg_idx];
+            try {
+                budgeted = budgeted || flag != "--trace";
+
+                if (flag == "--trace") {
+                    trace_path = value;
+                } else if (flag == "--cache") {
+                    cache_dir = value;
+                } else if (flag == "--max-steps") {
+                    budget.max_steps_ = std::stoll(value);
+                } else if (flag == "--max-nodes") {
+                    budget.max_term_nodes_ = std::stoull(value);
+                } else {
+                    budget.max_time_ =
+                        std::chrono::milliseconds(std::stoll(value));
+                }
+            } catch (std::exception&) {
+                std::cerr << "Error: invalid value " << value << " for " << flag
+                          << ".\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+    }
+
+    if (arg_idx >= argc) {
         std::cerr
             << "Error: expected input program as a command line argument.\n";
         return 1;
     }
 
-    parser::Parser parser{std::istringstream{argv[1]}};
+    tracing::Tracer tracer;
+    auto& trace = tracer.GetBuffer();
+
+    // A program run before with the same options is answered from the
+    // cache. Profiling is about doing the work, so it bypasses the cache.
+    std::optional<result_cache::ResultCache> cache;
+    std::optional<result_cache::OutputRecorder> recorder;
+    std::string cache_key;
+
+    if (!cache_dir.empty() && !profile) {
+        try {
+            cache.emplace(cache_dir);
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+            return 1;
+        }
+
+        cache_key = result_cache::MakeKey(
+            "ch08_tyarith/" + std::to_string(interpreter::kEngineVersion),
+            std::string(fused ? "fused " : "") + "max-steps=" +
+                std::to_string(budget.max_steps_) + " max-nodes=" +
+                std::to_string(budget.max_term_nodes_),
+            argv[arg_idx]);
+        auto output = trace.Record("cache lookup", 0,
+                                   [&] { return cache->Find(cache_key); });
+
+        if (output) {
+            std::cout << *output;
+
+            if (!trace_path.empty()) {
+                std::ofstream trace_file{trace_path};
+                tracer.Write(trace_file);
+            }
+
+            return 0;
+        }
+
+        // Record what is printed from here on to store it in the cache.
+        recorder.emplace(std::cout);
+    }
+
+    parser::Parser parser{std::istringstream{argv[arg_idx]}};
     type_checker::TypeChecker checker;
-    auto program = parser.ParseProgram();
-    std::cout << "   " << program << ": " << checker.TypeOf(program) << "\n";
+    auto program =
+        trace.Record("parse", 0, [&] { return parser.ParseProgram(); });
+    auto type =
+        trace.Record("type check", 0, [&] { return checker.TypeOf(program); });
+    std::cout << "   " << program << ": " << type << "\n";
 
-    interpreter::Interpreter interpreter;
-    auto res = interpreter.Interpret(program);
-    std::cout << "=> " << res.first << ": " << res.second << "\n";
+    if (fused && profile) {
+        std::cerr << "Error: the fused interpreter can't be profiled.\n";
+        return 1;
+    }
+
+    if (fused && budgeted) {
+        // The fused interpreter visits every node once and always terminates.
+        std::cerr << "Error: the fused interpreter doesn't take a budget.\n";
+        return 1;
+    }
+
+    int status = 0;
+
+    try {
+        if (profile) {
+            interpreter::ProfilingInterpreter interpreter;
+            interpreter.SetBudget(budget);
+            auto res = trace.Record(
+                "eval", 0, [&] { return interpreter.Interpret(program); });
+            std::cout << "=> " << res.first << ": " << res.second << "\n";
+            interpreter.GetProfiler().Print(std::cerr);
+        } else if (fused) {
+            auto res = trace.Record("eval", 0, [&] {
+                return interpreter::FusedInterpreter().Interpret(program);
+            });
+            std::cout << "=> " << res.first << ": " << res.second << "\n";
+        } else {
+            interpreter::Interpreter interpreter;
+            interpreter.SetBudget(budget);
+            auto res = trace.Record(
+                "eval", 0, [&] { return interpreter.Interpret(program); });
+            std::cout << "=> " << res.first << ": " << res.second << "\n";
+        }
+    } catch (const interpreter::BudgetExceeded& error) {
+        std::cout << "=> " << error.what() << "\n";
+        status = 1;
+    }
+
+    if (recorder && status == 0) {
+        try {
+            cache->Insert(cache_key, recorder->GetOutput());
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+        }
+    }
+
+    if (allocation::kEnabled) {
+        allocation::Tracker::Print(std::cerr);
+    }
+
+    if (!trace_path.empty()) {
+        std::ofstream trace_file{trace_path};
+        tracer.Write(trace_file);
+    }
 
-    return 0;
+    return status;
 }
@@ -1,10 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
 namespace lexer {
 struct Token {
     enum class Category {
@@ -40,6 +52,7 @@ class Lexer {
     Lexer(std::istringstream&& in) : in_(std::move(in)) {}
 
     Token NextToken() {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         Token token;
 
         if (in_ >> token.text) {
@@ -130,94 +143,174 @@ std::string Token::DebugString() const {
 
 namespace parser {
 
-class Term {
+class Term : private budget::Counted<Term> {
     using Cat = lexer::Token::Category;
     friend std::ostream& operator<<(std::ostream& out,
                                     const Term& token_category);
 
    public:
     Term(Cat first_token_category, std::vector<Term> sub_terms = {})
-        : first_token_category_(first_token_category), sub_terms_(sub_terms) {}
+        : first_token_category_(first_token_category),
+          sub_terms_(std::move(sub_terms)) {}
 
     Term() = default;
-    Term(const Term&) = default;
+
+    /**
+     * Copies other iteratively so that arbitrarily deep terms can be copied.
+     */
+    Term(const Term& other)
+        : Counted(other), first_token_category_(other.Category()) {
+        // Pairs of a copied term and the original term whose sub-terms still
+        // have to be copied into it.
+        std::vector<std::pair<Term*, const Term*>> stack{{this, &other}};
+
+        while (!stack.empty()) {
+            auto [copy, original] = stack.back();
+            stack.pop_back();
+            // Reserve first so that pointers into copy->sub_terms_ stay valid.
+            copy->sub_terms_.reserve(original->sub_terms_.size());
+
+            for (const Term& sub_term : original->sub_terms_) {
+                copy->sub_terms_.emplace_back(sub_term.Category());
+                stack.push_back({&copy->sub_terms_.back(), &sub_term});
+            }
+        }
+    }
+
     Term(Term&&) = default;
-    Term& operator=(const Term&) = default;
+
+    Term& operator=(const Term& other) {
+        Term copy = other;
+        return *this = std::move(copy);
+    }
+
     Term& operator=(Term&&) = default;
 
+    /**
+     * Destroys the sub-terms iteratively. The implicit destructor would recurse
+     * once per nesting level and overflow the stack for deep terms.
+     */
+    ~Term() {
+        std::vector<Term> pending = std::move(sub_terms_);
+
+        while (!pending.empty()) {
+            // Detach the sub-terms before destroying a term so that its
+            // destructor has nothing left to recurse into.
+            std::vector<Term> sub_terms = std::move(pending.back().sub_terms_);
+            pending.pop_back();
+
+            for (Term& sub_term : sub_terms) {
+                pending.push_back(std::move(sub_term));
+            }
+        }
+    }
+
     Cat Category() const { return first_token_category_; }
+    int NumSubTerms() const { return sub_terms_.size(); }
     Term& SubTerm(int i) { return sub_terms_[i]; }
+    const Term& SubTerm(int i) const { return sub_terms_[i]; }
+
+    /**
+     * Returns the number of nodes of this Term and its depth (the number of
+     * nodes on its longest path from the root).
+     */
+    std::pair<std::size_t, std::size_t> SizeAndDepth() const {
+        std::size_t size = 0;
+        std::size_t depth = 0;
+        std::vector<std::pair<const Term*, std::size_t>> stack{{this, 1}};
+
+        while (!stack.empty()) {
+            auto [term, term_depth] = stack.back();
+            stack.pop_back();
+            ++size;
+            depth = std::max(depth, term_depth);
+            for (const Term& sub_term : term->sub_terms_) {
+                stack.push_back({&sub_term, term_depth + 1});
+            }
+        }
+
+        return {size, depth};
+    }
 
     std::string ASTString(int indentation = 0) const {
         std::ostringstream out;
-        std::string prefix = std::string(indentation, ' ');
-
-        switch (Category()) {
-            case Cat::CONSTANT_ZERO:
-            case Cat::CONSTANT_TRUE:
-            case Cat::CONSTANT_FALSE:
-                out << prefix << Category();
-                break;
-
-            case Cat::KEYWORD_IF:
-                out << prefix << Category() << "\n";
-                out << sub_terms_[0].ASTString(indentation + 2) << "\n";
-                out << prefix << Cat::KEYWORD_ELSE << "\n";
-                out << sub_terms_[1].ASTString(indentation + 2) << "\n";
-                out << prefix << Cat::KEYWORD_THEN << "\n";
-                out << sub_terms_[2].ASTString(indentation + 2);
-                break;
-
-            case Cat::KEYWORD_SUCC:
-            case Cat::KEYWORD_PRED:
-            case Cat::KEYWORD_ISZERO:
-                out << prefix << Category() << "\n";
-                out << sub_terms_[0].ASTString(indentation + 2);
-                break;
+        // Work items, last one first: either a sub-term to print at some
+        // indentation or, if term is nullptr, a piece of text to print as is.
+        struct Item {
+            const Term* term;
+            int indentation;
+            std::string text;
+        };
+        std::vector<Item> stack{{this, indentation, ""}};
+
+        while (!stack.empty()) {
+            Item item = std::move(stack.back());
+            stack.pop_back();
+
+            if (!item.term) {
+                out << item.text;
+                continue;
+            }
 
-            default:
-                break;
+            const Term& term = *item.term;
+            std::string prefix = std::string(item.indentation, ' ');
+            int sub_indentation = item.indentation + 2;
+
+            switch (term.Category()) {
+                case Cat::CONSTANT_ZERO:
+                case Cat::CONSTANT_TRUE:
+                case Cat::CONSTANT_FALSE:
+                    out << prefix << term.Category();
+                    break;
+
+                case Cat::KEYWORD_IF: {
+                    std::ostringstream else_line;
+                    std::ostringstream then_line;
+                    else_line << "\n" << prefix << Cat::KEYWORD_ELSE << "\n";
+                    then_line << "\n" << prefix << Cat::KEYWORD_THEN << "\n";
+
+                    out << prefix << term.Category() << "\n";
+                    stack.push_back({&term.sub_terms_[2], sub_indentation, ""});
+                    stack.push_back({nullptr, 0, then_line.str()});
+                    stack.push_back({&term.sub_terms_[1], sub_indentation, ""});
+                    stack.push_back({nullptr, 0, else_line.str()});
+                    stack.push_back({&term.sub_terms_[0], sub_indentation, ""});
+                    break;
+                }
+
+                case Cat::KEYWORD_SUCC:
+                case Cat::KEYWORD_PRED:
+                case Cat::KEYWORD_ISZERO:
+                    out << prefix << term.Category() << "\n";
+                    stack.push_back({&term.sub_terms_[0], sub_indentation, ""});
+                    break;
+
+                default:
+                    break;
+            }
         }
 
         return out.str();
     }
 
     bool operator==(const Term& other) const {
-        if (Category() != other.Category()) {
-            return false;
-        }
+        std::vector<std::pair<const Term*, const Term*>> stack{{this, &other}};
 
-        bool res = true;
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
 
-        switch (Category()) {
-            case Cat::CONSTANT_ZERO:
-            case Cat::CONSTANT_TRUE:
-            case Cat::CONSTANT_FALSE:
-                break;
-
-            case Cat::KEYWORD_IF:
-                for (int i = 0; i < 3; ++i) {
-                    res = res && (sub_terms_[i] == other.sub_terms_[i]);
-
-                    if (!res) {
-                        break;
-                    }
-                }
-
-                break;
-
-            case Cat::KEYWORD_SUCC:
-            case Cat::KEYWORD_PRED:
-            case Cat::KEYWORD_ISZERO:
-                res = res && (sub_terms_[0] == other.sub_terms_[0]);
-
-                break;
+            if (lhs->Category() != rhs->Category() ||
+                lhs->sub_terms_.size() != rhs->sub_terms_.size()) {
+                return false;
+            }
 
-            default:
-                break;
+            for (size_t i = 0; i < lhs->sub_terms_.size(); ++i) {
+                stack.push_back({&lhs->sub_terms_[i], &rhs->sub_terms_[i]});
+            }
         }
 
-        return res;
+        return true;
     }
 
     bool operator!=(const Term& other) const { return !(*this == other); }
@@ -230,16 +323,37 @@ class Term {
 
 std::ostream& operator<<(std::ostream& out, const Term& term) {
     using Category = lexer::Token::Category;
-    out << term.first_token_category_;
+    // Work items, last one first: either a term to print or, if term is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Term*, const char*>> stack{{&term, nullptr}};
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
 
-    if (term.first_token_category_ == Category::KEYWORD_IF) {
-        out << " (" << term.sub_terms_[0] << ") " << Category::KEYWORD_THEN
-            << " (" << term.sub_terms_[1] << ") " << Category::KEYWORD_ELSE
-            << " (" << term.sub_terms_[2] << ")";
-    } else if (term.first_token_category_ == Category::KEYWORD_SUCC ||
-               term.first_token_category_ == Category::KEYWORD_PRED ||
-               term.first_token_category_ == Category::KEYWORD_ISZERO) {
-        out << " (" << term.sub_terms_[0] << ")";
+        if (!current) {
+            out << text;
+            continue;
+        }
+
+        out << current->first_token_category_;
+
+        if (current->first_token_category_ == Category::KEYWORD_IF) {
+            out << " (";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({&current->sub_terms_[2], nullptr});
+            stack.push_back({nullptr, ") else ("});
+            stack.push_back({&current->sub_terms_[1], nullptr});
+            stack.push_back({nullptr, ") then ("});
+            stack.push_back({&current->sub_terms_[0], nullptr});
+        } else if (current->first_token_category_ == Category::KEYWORD_SUCC ||
+                   current->first_token_category_ == Category::KEYWORD_PRED ||
+                   current->first_token_category_ ==
+                       Category::KEYWORD_ISZERO) {
+            out << " (";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({&current->sub_terms_[0], nullptr});
+        }
     }
 
     return out;
@@ -250,6 +364,7 @@ class Parser {
     Parser(std::istringstream&& in) : lexer_(std::move(in)) {}
 
     Term ParseProgram() {
+        allocation::PhaseScope scope{allocation::Phase::PARSING};
         auto program = NextTerm();
 
         if (lexer_.NextToken().category != lexer::Token::Category::MARKER_END) {
@@ -261,72 +376,90 @@ class Parser {
     }
 
    private:
+    /**
+     * Parses the next term using an explicit stack of the terms whose
+     * sub-terms are still being parsed, so that the nesting depth of the parsed
+     * term is not limited by the call stack.
+     */
     Term NextTerm() {
         using Category = lexer::Token::Category;
-        auto token = lexer_.NextToken();
-
-        std::vector<Term> sub_terms;
+        // Incomplete terms (innermost last) along with their parsed sub-terms.
+        std::vector<std::pair<Category, std::vector<Term>>> open_terms;
+
+        while (true) {
+            auto token = lexer_.NextToken();
+
+            switch (token.category) {
+                    // Possible terms:
+                case Category::CONSTANT_TRUE:
+                case Category::CONSTANT_FALSE:
+                    break;
+
+                case Category::CONSTANT_ZERO:
+                    break;
+
+                case Category::KEYWORD_IF:
+                case Category::KEYWORD_SUCC:
+                case Category::KEYWORD_PRED:
+                case Category::KEYWORD_ISZERO:
+                    // Parse the sub-terms first.
+                    open_terms.push_back({token.category, {}});
+                    continue;
+
+                    // End of input (parse error):
+                case Category::MARKER_END:
+                    throw std::invalid_argument("Error: reached end of input.");
+
+                    // Lexing errors:
+                case Category::MARKER_ERROR:
+                    throw std::invalid_argument(
+                        "Error: invalid token: " + token.text + ".");
 
-        switch (token.category) {
-                // Possible terms:
-            case Category::CONSTANT_TRUE:
-            case Category::CONSTANT_FALSE:
-                break;
+                    // Parsing errors:
+                case Category::KEYWORD_THEN:
+                case Category::KEYWORD_ELSE:
+                    throw std::invalid_argument("Error: invalid term start " +
+                                                token.text + ".");
+            }
 
-            case Category::CONSTANT_ZERO:
-                break;
+            Term term(token.category);
 
-            case Category::KEYWORD_IF: {
-                // Add condition sub-term.
-                sub_terms.emplace_back(NextTerm());
+            // Add the complete term to the innermost incomplete term. If that
+            // was its last sub-term, it is complete as well.
+            while (!open_terms.empty()) {
+                auto& [category, sub_terms] = open_terms.back();
+                sub_terms.emplace_back(std::move(term));
 
-                if (lexer_.NextToken().category != Category::KEYWORD_THEN) {
-                    // Parsing error:
-                    throw std::invalid_argument(
-                        "Error: invalid if-then-else term.");
+                if (sub_terms.size() < NumSubTerms(category)) {
+                    break;
                 }
 
-                // Add then branch sub-term.
-                sub_terms.emplace_back(NextTerm());
+                term = Term(category, std::move(sub_terms));
+                open_terms.pop_back();
+            }
+
+            if (open_terms.empty()) {
+                return term;
+            }
+
+            if (open_terms.back().first == Category::KEYWORD_IF) {
+                // The condition is followed by then and the then branch is
+                // followed by else.
+                auto expected_category = open_terms.back().second.size() == 1
+                                             ? Category::KEYWORD_THEN
+                                             : Category::KEYWORD_ELSE;
 
-                if (lexer_.NextToken().category != Category::KEYWORD_ELSE) {
+                if (lexer_.NextToken().category != expected_category) {
                     // Parsing error:
                     throw std::invalid_argument(
                         "Error: invalid if-then-else term.");
                 }
-
-                // Add then else sub-term.
-                sub_terms.emplace_back(NextTerm());
-            } break;
-
-            case Category::KEYWORD_SUCC: {
-                auto sub_term = NextTerm();
-                sub_terms.emplace_back(sub_term);
-            } break;
-
-            case Category::KEYWORD_PRED:
-            case Category::KEYWORD_ISZERO: {
-                auto sub_term = NextTerm();
-                sub_terms.emplace_back(sub_term);
-            } break;
-
-                // End of input (parse error):
-            case Category::MARKER_END:
-                throw std::invalid_argument("Error: reached end of input.");
-
-                // Lexing errors:
-            case Category::MARKER_ERROR:
-                throw std::invalid_argument(
-                    "Error: invalid token: " + token.text + ".");
-
-                // Parsing errors:
-            case Category::KEYWORD_THEN:
-            case Category::KEYWORD_ELSE:
-                throw std::invalid_argument("Error: invalid term start " +
-                                            token.text + ".");
+            }
         }
+    }
 
-        return Term(token.category, sub_terms);
+    static size_t NumSubTerms(lexer::Token::Category category) {
+        return category == lexer::Token::Category::KEYWORD_IF ? 3 : 1;
     }
 
    private:
@@ -359,7 +492,48 @@ using parser::Term;
 
 class TypeChecker {
    public:
-    Type TypeOf(Term term) {
+    /**
+     * Computes the type of term bottom-up using an explicit stack so that
+     * arbitrarily deep terms can be type checked.
+     */
+    Type TypeOf(const Term& term) {
+        allocation::PhaseScope scope{allocation::Phase::TYPE_CHECKING};
+        // The types of the visited sub-terms whose parents were not visited
+        // yet.
+        std::vector<Type> types;
+        // Each entry stores a term along with whether its sub-terms have
+        // already been pushed.
+        std::vector<std::pair<const Term*, bool>> stack{{&term, false}};
+
+        while (!stack.empty()) {
+            auto [current, expanded] = stack.back();
+
+            if (!expanded) {
+                stack.back().second = true;
+
+                for (int i = current->NumSubTerms() - 1; i >= 0; --i) {
+                    stack.push_back({&current->SubTerm(i), false});
+                }
+
+                continue;
+            }
+
+            stack.pop_back();
+            Type res = TypeOf(*current,
+                              types.data() + types.size() -
+                                  current->NumSubTerms());
+            types.resize(types.size() - current->NumSubTerms());
+            types.push_back(res);
+        }
+
+        return types.back();
+    }
+
+   private:
+    /**
+     * Computes the type of term given the types of its sub-terms.
+     */
+    Type TypeOf(const Term& term, const Type* sub_term_types) {
         Type res = Type::IllTyped;
 
         if (term.Category() == Token::Category::CONSTANT_TRUE ||
@@ -368,13 +542,13 @@ class TypeChecker {
         } else if (term.Category() == Token::Category::CONSTANT_ZERO) {
             res = Type::Nat;
         } else if (term.Category() == Token::Category::KEYWORD_IF) {
-            auto cond_type = TypeOf(term.SubTerm(0));
+            auto cond_type = sub_term_types[0];
 
             if (cond_type != Type::Bool) {
                 res = Type::IllTyped;
             } else {
-                auto then_type = TypeOf(term.SubTerm(1));
-                auto else_type = TypeOf(term.SubTerm(2));
+                auto then_type = sub_term_types[1];
+                auto else_type = sub_term_types[2];
 
                 if (then_type != else_type) {
                     res = Type::IllTyped;
@@ -384,7 +558,7 @@ class TypeChecker {
             }
         } else if (term.Category() == Token::Category::KEYWORD_SUCC ||
                    term.Category() == Token::Category::KEYWORD_PRED) {
-            auto subterm_type = TypeOf(term.SubTerm(0));
+            auto subterm_type = sub_term_types[0];
 
             if (subterm_type != Type::Nat) {
                 res = Type::IllTyped;
@@ -392,7 +566,7 @@ class TypeChecker {
                 res = Type::Nat;
             }
         } else if (term.Category() == Token::Category::KEYWORD_ISZERO) {
-            auto subterm_type = TypeOf(term.SubTerm(0));
+            auto subterm_type = sub_term_types[0];
 
             if (subterm_type != Type::Nat) {
                 res = Type::IllTyped;
@@ -410,143 +584,522 @@ namespace interpreter {
 using lexer::Token;
 using parser::Term;
 
-class Interpreter {
+/**
+ * Identifies how this interpreter evaluates programs and prints their results
+ * in caches of results (see result_cache/). Bump it whenever either changes.
+ */
+constexpr int kEngineVersion = 1;
+
+using budget::Budget;
+using budget::BudgetExceeded;
+using budget::BudgetMeter;
+
+/**
+ * Profiling policy of BasicInterpreter that records nothing. Its hooks are
+ * empty inline functions, so an unprofiled interpreter doesn't pay for them.
+ */
+struct NullProfiler {
+    void CountRule(const char*) {}
+
+    void RecordTerm(const parser::Term&, std::size_t) {}
+
+    void RecordResult(const parser::Term&) {}
+};
+
+/**
+ * Profiling policy of BasicInterpreter that counts how often each reduction
+ * rule fires and tracks the largest term that evaluation produces.
+ */
+class Profiler {
    public:
+    // How many steps apart the depth of the evaluated term is measured.
+    static constexpr long long kDepthSampleInterval = 1024;
+
+    void CountRule(const char* rule) { ++rule_counts_[rule]; }
+
+    /**
+     * Records the term after a reduction step, given its size as counted by
+     * the budget meter. Measuring its depth takes a walk over the whole term,
+     * so that is only sampled every kDepthSampleInterval steps and on the
+     * result.
+     */
+    void RecordTerm(const parser::Term& term, std::size_t size) {
+        max_term_size_ = std::max(max_term_size_, size);
+
+        if (num_terms_++ % kDepthSampleInterval == 0) {
+            RecordResult(term);
+        }
+    }
+
+    void RecordResult(const parser::Term& term) {
+        max_term_depth_ = std::max(max_term_depth_, term.SizeAndDepth().second);
+    }
+
+    /**
+     * Prints the collected data and the peak memory usage of the process as a
+     * table.
+     */
+    void Print(std::ostream& out) const {
+        const int kNameWidth = 24;
+        out << std::left << std::setw(kNameWidth) << "Rule" << "Count\n";
+
+        for (const auto& [rule, count] : rule_counts_) {
+            out << std::setw(kNameWidth) << rule << count << "\n";
+        }
+
+        out << "\n"
+            << std::setw(kNameWidth) << "Max term size" << max_term_size_
+            << " nodes\n"
+            << std::setw(kNameWidth) << "Max sampled depth" << max_term_depth_
+            << "\n"
+            << std::setw(kNameWidth) << "Peak memory" << PeakMemoryKiB()
+            << " KiB\n";
+    }
+
+   private:
+    static long PeakMemoryKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        // macOS reports ru_maxrss in bytes rather than KiB.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    std::map<std::string, long long> rule_counts_;
+    std::size_t max_term_size_ = 0;
+    std::size_t max_term_depth_ = 0;
+    long long num_terms_ = 0;
+};
+
+/**
+ * Evaluates programs, reporting every reduction step to a ProfilingPolicy
+ * (NullProfiler or Profiler).
+ */
+template <typename ProfilingPolicy>
+class BasicInterpreter {
+   public:
+    const ProfilingPolicy& GetProfiler() const { return profiler_; }
+
+    /**
+     * Limits every following evaluation to budget. Interpret() throws
+     * BudgetExceeded when an evaluation goes over it.
+     */
+    void SetBudget(const Budget& budget) { budget_ = budget; }
+
+    /**
+     * An evaluation of a term in place that can be suspended between any two
+     * reduction steps, so that a scheduler can interleave many evaluations on
+     * a few threads. The term must not be used otherwise until Resume()
+     * returned true.
+     */
+    class Evaluation {
+       public:
+        Evaluation(BasicInterpreter& interpreter, Term& term)
+            : interpreter_(interpreter),
+              term_(term),
+              meter_(interpreter.budget_) {
+            meter_.Start(term_);
+            interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
+        }
+
+        /**
+         * Performs at most fuel (> 0) reduction steps and returns true once no
+         * evaluation rule applies anymore. Throws BudgetExceeded when the
+         * evaluation goes over the interpreter's budget.
+         */
+        bool Resume(long long fuel) {
+            meter_.Resume();
+
+            try {
+                while (true) {
+                    interpreter_.Eval1(term_);
+                    meter_.Step();
+                    interpreter_.profiler_.RecordTerm(term_,
+                                                      meter_.GetTermNodes());
+
+                    if (--fuel <= 0) {
+                        return false;
+                    }
+                }
+            } catch (std::invalid_argument&) {
+            }
+
+            interpreter_.profiler_.RecordResult(term_);
+            meter_.Check();
+            return true;
+        }
+
+        /**
+         * Returns what Interpret() returns for the term once Resume() returned
+         * true.
+         */
+        std::pair<std::string, type_checker::Type> Result() const {
+            type_checker::Type res_type =
+                type_checker::TypeChecker().TypeOf(term_);
+
+            if (!interpreter_.IsValue(term_)) {
+                return {interpreter_.AsString(
+                            Term(Token::Category::MARKER_ERROR, {})),
+                        res_type};
+            }
+
+            return {interpreter_.AsString(term_), res_type};
+        }
+
+        /**
+         * The number of reduction steps performed so far.
+         */
+        long long GetSteps() const { return meter_.GetSteps(); }
+
+       private:
+        BasicInterpreter& interpreter_;
+        Term& term_;
+        BudgetMeter<Term> meter_;
+    };
+
+    /**
+     * Evaluates program in place. Pass an rvalue to avoid copying program.
+     */
     std::pair<std::string, type_checker::Type> Interpret(Term program) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
         // This is a Curry-style interperter. It trys to evaluate terms even
         // those that are ill-typed (ref: tapl,§9.6).
-        Term res = Eval(program);
-        type_checker::Type res_type = type_checker::TypeChecker().TypeOf(res);
-
-        return {
-            AsString(IsValue(res) ? res
-                                  : Term(Token::Category::MARKER_ERROR, {})),
-            res_type};
+        Evaluation evaluation{*this, program};
+        evaluation.Resume(std::numeric_limits<long long>::max());
+        return evaluation.Result();
     }
 
    private:
-    std::string AsString(Term value) {
-        std::ostringstream ss;
-        ss << value;
-        auto term_str = ss.str();
-
+    std::string AsString(const Term& value) {
         if (IsNumericValue(value)) {
-            std::size_t start_pos = 0;
-            int num = 0;
+            long long num = 0;
 
-            while ((start_pos = term_str.find("succ", start_pos)) !=
-                   std::string::npos) {
+            for (const Term* nv = &value;
+                 nv->Category() == Token::Category::KEYWORD_SUCC;
+                 nv = &nv->SubTerm(0)) {
                 ++num;
-                ++start_pos;
             }
 
             return std::to_string(num);
         }
 
-        return term_str;
+        std::ostringstream ss;
+        ss << value;
+        return ss.str();
     }
 
-    Term Eval(Term term) {
-        try {
-            Term res = Eval1(term);
-            return Eval(res);
-        } catch (std::invalid_argument&) {
-            return term;
-        }
-    }
+    /**
+     * Performs a single evaluation step on term in place. Throws
+     * std::invalid_argument if no evaluation rule applies.
+     *
+     * Congruence rules (e.g. E-Succ) only select the sub-term to step, so the
+     * redex is searched for in a loop rather than by recursion, which would
+     * overflow the stack for deeply nested terms.
+     */
+    void Eval1(Term& term) {
+        for (Term* current = &term; current;) {
+            switch (current->Category()) {
+                case Token::Category::KEYWORD_IF: {
+                    current = Eval1If(*current);
+                    break;
+                }
 
-    Term Eval1(Term term) {
-        switch (term.Category()) {
-            case Token::Category::KEYWORD_IF: {
-                return Eval1If(term);
-            }
+                case Token::Category::KEYWORD_SUCC: {
+                    current = &current->SubTerm(0);
+                    break;
+                }
 
-            case Token::Category::KEYWORD_SUCC: {
-                term.SubTerm(0) = Eval1(term.SubTerm(0));
-                return term;
-            }
+                case Token::Category::KEYWORD_PRED: {
+                    current = Eval1Pred(*current);
+                    break;
+                }
 
-            case Token::Category::KEYWORD_PRED: {
-                return Eval1Pred(term);
-            }
+                case Token::Category::KEYWORD_ISZERO: {
+                    current = Eval1IsZero(*current);
+                    break;
+                }
 
-            case Token::Category::KEYWORD_ISZERO: {
-                return Eval1IsZero(term);
+                default:
+                    throw std::invalid_argument("No applicable rule.");
             }
-
-            default:
-                throw std::invalid_argument("No applicable rule.");
         }
     }
 
-    Term Eval1If(Term term) {
+    /**
+     * The Eval1*() functions below either reduce term in place and return
+     * nullptr or return the sub-term of term that has to be stepped instead.
+     */
+    Term* Eval1If(Term& term) {
         switch (term.SubTerm(0).Category()) {
             case Token::Category::CONSTANT_TRUE: {
-                return term.SubTerm(1);
+                profiler_.CountRule("E-IfTrue");
+                ReplaceBySubTerm(term, term.SubTerm(1));
+                return nullptr;
             }
 
             case Token::Category::CONSTANT_FALSE: {
-                return term.SubTerm(2);
+                profiler_.CountRule("E-IfFalse");
+                ReplaceBySubTerm(term, term.SubTerm(2));
+                return nullptr;
             }
 
             default:
-                term.SubTerm(0) = Eval1(term.SubTerm(0));
-                return term;
+                return &term.SubTerm(0);
         }
     }
 
-    Term Eval1Pred(Term term) {
+    Term* Eval1Pred(Term& term) {
         switch (term.SubTerm(0).Category()) {
             case Token::Category::CONSTANT_ZERO: {
-                return Term(Token::Category::CONSTANT_ZERO);
+                profiler_.CountRule("E-PredZero");
+                term = Term(Token::Category::CONSTANT_ZERO);
+                return nullptr;
             }
 
             case Token::Category::KEYWORD_SUCC: {
                 if (IsNumericValue(term.SubTerm(0))) {
-                    return term.SubTerm(0).SubTerm(0);
-                } else {
-                    term.SubTerm(0) = Eval1(term.SubTerm(0));
-                    return term;
+                    profiler_.CountRule("E-PredSucc");
+                    ReplaceBySubTerm(term, term.SubTerm(0).SubTerm(0));
+                    return nullptr;
                 }
+
+                return &term.SubTerm(0);
             }
 
             default:
-                term.SubTerm(0) = Eval1(term.SubTerm(0));
-                return term;
+                return &term.SubTerm(0);
         }
     }
 
-    Term Eval1IsZero(Term term) {
+    Term* Eval1IsZero(Term& term) {
         switch (term.SubTerm(0).Category()) {
             case Token::Category::CONSTANT_ZERO: {
-                return Term(Token::Category::CONSTANT_TRUE);
+                profiler_.CountRule("E-IsZeroZero");
+                term = Term(Token::Category::CONSTANT_TRUE);
+                return nullptr;
             }
 
             case Token::Category::KEYWORD_SUCC: {
                 if (IsNumericValue(term.SubTerm(0))) {
-                    return Term(Token::Category::CONSTANT_FALSE);
-                } else {
-                    term.SubTerm(0) = Eval1(term.SubTerm(0));
-                    return term;
+                    profiler_.CountRule("E-IsZeroSucc");
+                    term = Term(Token::Category::CONSTANT_FALSE);
+                    return nullptr;
                 }
+
+                return &term.SubTerm(0);
             }
 
             default:
-                term.SubTerm(0) = Eval1(term.SubTerm(0));
-                return term;
+                return &term.SubTerm(0);
         }
     }
 
-    bool IsNumericValue(Term term) {
-        return term.Category() == Token::Category::CONSTANT_ZERO ||
-               (term.Category() == Token::Category::KEYWORD_SUCC &&
-                IsNumericValue(term.SubTerm(0)));
+    /**
+     * Replaces term by its (direct or indirect) sub-term without copying the
+     * sub-term.
+     */
+    void ReplaceBySubTerm(Term& term, Term& sub_term) {
+        // sub_term is owned by term, so it has to be moved out before term is
+        // overwritten.
+        Term tmp = std::move(sub_term);
+        term = std::move(tmp);
+    }
+
+    bool IsNumericValue(const Term& term) {
+        const Term* nv = &term;
+
+        while (nv->Category() == Token::Category::KEYWORD_SUCC) {
+            nv = &nv->SubTerm(0);
+        }
+
+        return nv->Category() == Token::Category::CONSTANT_ZERO;
     }
 
-    bool IsValue(Term term) {
+    bool IsValue(const Term& term) {
         return term.Category() == Token::Category::CONSTANT_TRUE ||
                term.Category() == Token::Category::CONSTANT_FALSE ||
                IsNumericValue(term);
     }
+
+    ProfilingPolicy profiler_;
+    Budget budget_;
+};
+
+using Interpreter = BasicInterpreter<NullProfiler>;
+using ProfilingInterpreter = BasicInterpreter<Profiler>;
+
+/**
+ * An alternative to Interpreter that type checks and evaluates a program in a
+ * single post-order traversal.
+ *
+ * Since ch08 terms are closed and evaluation always terminates, the normal form
+ * of a term is fully determined by the normal forms of its sub-terms (i.e. a
+ * big-step semantics). Therefore, each node is visited exactly once and only
+ * constant work is done per node. Results are identical to
+ * Interpreter::Interpret.
+ */
+class FusedInterpreter {
+   public:
+    std::pair<std::string, type_checker::Type> Interpret(const Term& program) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        // Summaries of the sub-terms visited so far whose parents have not been
+        // visited yet.
+        std::vector<Summary> summaries;
+        // Each entry stores a term along with whether its sub-terms have
+        // already been pushed.
+        std::vector<std::pair<const Term*, bool>> stack{{&program, false}};
+
+        while (!stack.empty()) {
+            auto& [term, expanded] = stack.back();
+
+            if (!expanded) {
+                expanded = true;
+                const Term* current = term;
+
+                for (int i = current->NumSubTerms() - 1; i >= 0; --i) {
+                    stack.push_back({&current->SubTerm(i), false});
+                }
+
+                continue;
+            }
+
+            Summary summary = Summarize(*term, summaries);
+            summaries.resize(summaries.size() - term->NumSubTerms());
+            summaries.push_back(summary);
+            stack.pop_back();
+        }
+
+        program_type_ = summaries.back().type;
+
+        return AsResult(summaries.back());
+    }
+
+    /**
+     * Returns the type of the last interpreted program as computed by
+     * type_checker::TypeChecker::TypeOf (i.e. before evaluation).
+     */
+    type_checker::Type ProgramType() const { return program_type_; }
+
+   private:
+    enum class NormalForm { True, False, Numeric, Stuck };
+
+    struct Summary {
+        // The type of the term (not of its normal form).
+        type_checker::Type type;
+        NormalForm normal_form;
+        // The value of the normal form if it is NormalForm::Numeric.
+        long long num;
+    };
+
+    /**
+     * Computes the summary of term given that the summaries of its sub-terms
+     * are the last entries of summaries.
+     */
+    Summary Summarize(const Term& term, const std::vector<Summary>& summaries) {
+        using type_checker::Type;
+        const Summary* sub =
+            summaries.data() + summaries.size() - term.NumSubTerms();
+
+        switch (term.Category()) {
+            case Token::Category::CONSTANT_TRUE:
+                return {Type::Bool, NormalForm::True, 0};
+
+            case Token::Category::CONSTANT_FALSE:
+                return {Type::Bool, NormalForm::False, 0};
+
+            case Token::Category::CONSTANT_ZERO:
+                return {Type::Nat, NormalForm::Numeric, 0};
+
+            case Token::Category::KEYWORD_IF: {
+                Type type = sub[0].type == Type::Bool &&
+                                    sub[1].type == sub[2].type
+                                ? sub[1].type
+                                : Type::IllTyped;
+
+                if (sub[0].normal_form == NormalForm::True) {
+                    return {type, sub[1].normal_form, sub[1].num};
+                }
+
+                if (sub[0].normal_form == NormalForm::False) {
+                    return {type, sub[2].normal_form, sub[2].num};
+                }
+
+                return {type, NormalForm::Stuck, 0};
+            }
+
+            case Token::Category::KEYWORD_SUCC: {
+                Type type = sub[0].type == Type::Nat ? Type::Nat
+                                                     : Type::IllTyped;
+
+                if (sub[0].normal_form == NormalForm::Numeric) {
+                    return {type, NormalForm::Numeric, sub[0].num + 1};
+                }
+
+                return {type, NormalForm::Stuck, 0};
+            }
+
+            case Token::Category::KEYWORD_PRED: {
+                Type type = sub[0].type == Type::Nat ? Type::Nat
+                                                     : Type::IllTyped;
+
+                if (sub[0].normal_form == NormalForm::Numeric) {
+                    return {type, NormalForm::Numeric,
+                            sub[0].num == 0 ? 0 : sub[0].num - 1};
+                }
+
+                return {type, NormalForm::Stuck, 0};
+            }
+
+            case Token::Category::KEYWORD_ISZERO: {
+                Type type = sub[0].type == Type::Nat ? Type::Bool
+                                                     : Type::IllTyped;
+
+                if (sub[0].normal_form == NormalForm::Numeric) {
+                    return {type,
+                            sub[0].num == 0 ? NormalForm::True
+                                            : NormalForm::False,
+                            0};
+                }
+
+                return {type, NormalForm::Stuck, 0};
+            }
+
+            default:
+                return {Type::IllTyped, NormalForm::Stuck, 0};
+        }
+    }
+
+    /**
+     * Converts the summary of a program to the result Interpreter::Interpret
+     * returns. The latter reports the type of the program's normal form, which
+     * is always the type of the value it denotes. By the progress theorem, a
+     * stuck normal form is always ill-typed.
+     */
+    std::pair<std::string, type_checker::Type> AsResult(
+        const Summary& summary) {
+        std::ostringstream ss;
+
+        switch (summary.normal_form) {
+            case NormalForm::True:
+                ss << Term(Token::Category::CONSTANT_TRUE);
+                return {ss.str(), type_checker::Type::Bool};
+
+            case NormalForm::False:
+                ss << Term(Token::Category::CONSTANT_FALSE);
+                return {ss.str(), type_checker::Type::Bool};
+
+            case NormalForm::Numeric:
+                return {std::to_string(summary.num), type_checker::Type::Nat};
+
+            default:
+                ss << Term(Token::Category::MARKER_ERROR);
+                return {ss.str(), type_checker::Type::IllTyped};
+        }
+    }
+
+    type_checker::Type program_type_ = type_checker::Type::IllTyped;
 };
 }  // namespace interpreter
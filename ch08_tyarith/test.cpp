@@ -381,10 +381,74 @@ std::vector<TestData> kData{
     TestData{"pred succ pred succ 0", {"0", Type::Nat}},
     TestData{"succ if true then true else false", {"<ERROR>", Type::IllTyped}},
     TestData{"succ succ true", {"<ERROR>", Type::IllTyped}},
+    TestData{"iszero if false then 0 else succ 0", {"false", Type::Bool}},
+    TestData{"if iszero pred succ 0 then pred 0 else false", {"0", Type::Nat}},
+    TestData{"if 0 then true else false", {"<ERROR>", Type::IllTyped}},
+    TestData{"iszero true", {"<ERROR>", Type::IllTyped}},
 };
 
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 10000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::string expected_program_string_;
+    Type expected_program_type_;
+    std::pair<std::string, Type> expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "succ^" + n_str + " 0", Repeat("succ ", n) + "0",
+        Repeat("succ (", n) + "0" + Repeat(")", n), Type::Nat,
+        {n_str, Type::Nat}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "iszero pred succ^" + n_str + " true",
+        "iszero pred " + Repeat("succ ", n) + "true",
+        "iszero (pred (" + Repeat("succ (", n) + "true" + Repeat(")", n + 2),
+        Type::IllTyped,
+        {"<ERROR>", Type::IllTyped}});
+
+    // if terms are several times larger per nesting level, so they are nested
+    // less deeply to keep the test fast.
+    const int m = n / 10;
+    std::string m_str = std::to_string(m);
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + m_str + " 0 (else 0)^" + m_str,
+        Repeat("if true then ", m) + "0" + Repeat(" else 0", m),
+        Repeat("if (true) then (", m) + "0" + Repeat(") else (0)", m),
+        Type::Nat,
+        {"0", Type::Nat}});
+}
+
 void Run() {
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests = kData.size() + kDeepTermData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -420,6 +484,68 @@ void Run() {
 
             std::cout << "  Input program: " << test.input_program_ << "\n";
 
+            std::cout << color::kGreen
+                      << "  Expected evaluation result: " << color::kReset
+                      << test.expected_eval_result_.first << ": "
+                      << test.expected_eval_result_.second << "\n";
+
+            std::cout << color::kRed
+                      << "  Actual evaluation result: " << color::kReset
+                      << actual_eval_res.first << ": " << actual_eval_res.second
+                      << "\n";
+
+            ++num_failed;
+            continue;
+        }
+
+        auto program = parser::Parser{std::istringstream{test.input_program_}}
+                           .ParseProgram();
+        FusedInterpreter fused_interpreter{};
+        auto fused_eval_res = fused_interpreter.Interpret(program);
+
+        if (fused_eval_res != actual_eval_res ||
+            fused_interpreter.ProgramType() != TypeChecker().TypeOf(program)) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.input_program_ << "\n";
+
+            std::cout << color::kGreen
+                      << "  Expected fused evaluation result: "
+                      << color::kReset << actual_eval_res.first << ": "
+                      << actual_eval_res.second << " (program type "
+                      << TypeChecker().TypeOf(program) << ")\n";
+
+            std::cout << color::kRed
+                      << "  Actual fused evaluation result: " << color::kReset
+                      << fused_eval_res.first << ": " << fused_eval_res.second
+                      << " (program type " << fused_interpreter.ProgramType()
+                      << ")\n";
+
+            ++num_failed;
+        }
+    }
+
+    // Test that every stage handles terms nested deeper than the call stack
+    // could hold.
+    for (const auto& test : kDeepTermData) {
+        Term program =
+            parser::Parser{std::istringstream{test.input_program_}}
+                .ParseProgram();
+        Term program_copy = program;
+        std::ostringstream program_string;
+        program_string << program;
+        Type program_type = TypeChecker().TypeOf(program);
+        auto fused_eval_res = FusedInterpreter().Interpret(program);
+        auto actual_eval_res = Interpreter().Interpret(std::move(program_copy));
+
+        if (program_string.str() != test.expected_program_string_ ||
+            program_type != test.expected_program_type_ ||
+            actual_eval_res != test.expected_eval_result_ ||
+            fused_eval_res != test.expected_eval_result_) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
             std::cout << color::kGreen
                       << "  Expected evaluation result: " << color::kReset
                       << test.expected_eval_result_.first << ": "
@@ -435,8 +561,8 @@ void Run() {
     }
 
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../complexity_fuzzer/fuzzer.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+using complexity_fuzzer::Repeat;
+
+/**
+ * Returns the seconds parsing, type checking and evaluating source take.
+ */
+std::vector<double> Measure(const std::string& source) {
+    parser::Term program;
+    interpreter::Interpreter interpreter;
+    double parse_time = complexity_fuzzer::Seconds([&] {
+        program =
+            parser::Parser{std::istringstream{source}}.ParseProgram();
+    });
+    double type_check_time = complexity_fuzzer::Seconds(
+        [&] { type_checker::TypeChecker().TypeOf(program); });
+    double eval_time = complexity_fuzzer::Seconds(
+        [&] { interpreter.Interpret(program); });
+
+    return {parse_time, type_check_time, eval_time};
+}
+
+const std::vector<complexity_fuzzer::Family> kFamilies = {
+    {"lambda nesting", [](int n) { return Repeat("l x:Bool. ", n) + "x"; }},
+    {"arrow type width",
+     [](int n) { return "l f:" + Repeat("Bool->", n) + "Bool. f"; }},
+    {"application spine",
+     [](int n) {
+         return "(" + Repeat("l x:Bool. ", n) + "x)" + Repeat(" true", n);
+     }},
+    {"nested redexes",
+     [](int n) {
+         return Repeat("(l x:Bool. x) (", n) + "true" + Repeat(")", n);
+     }},
+    {"nested if branch",
+     [](int n) {
+         return Repeat("if true then ", n) + "false" + Repeat(" else false", n);
+     }},
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    complexity_fuzzer::Options options;
+
+    if (!complexity_fuzzer::ParseOptions(argc, argv, options, std::cerr)) {
+        return 1;
+    }
+
+    complexity_fuzzer::Fuzzer fuzzer{"ch10_simplebool",
+                                     {"parse", "type check", "eval"},
+                                     Measure,
+                                     options};
+    return fuzzer.Run(kFamilies, std::cout) > 0 ? 1 : 0;
+}
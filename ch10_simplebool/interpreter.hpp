@@ -1,14 +1,24 @@
 #pragma once
 
-#include <deque>
-#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
 namespace lexer {
 struct Token {
     enum class Category {
@@ -61,6 +71,7 @@ const std::string kKeywordBool = "Bool";
 class Lexer {
    public:
     Lexer(std::istringstream&& in) {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         std::istringstream iss(SurroundTokensBySpaces(std::move(in)));
         token_strings_ =
             std::vector<std::string>(std::istream_iterator<std::string>{iss},
@@ -68,6 +79,7 @@ class Lexer {
     }
 
     Token NextToken() {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         Token token;
 
         if (current_token_ == token_strings_.size()) {
@@ -256,32 +268,68 @@ class Type {
     Type(Type&&) = default;
     Type& operator=(Type&&) = default;
 
-    ~Type() = default;
-
-    Type Clone() const {
-        if (IsIllTyped()) {
-            return Type::IllTyped();
+    /**
+     * Destroys the sub-types iteratively. The types of deeply nested lambdas
+     * are deeply nested too and the implicit destructor would recurse once per
+     * nesting level.
+     */
+    ~Type() {
+        std::vector<std::unique_ptr<Type>> pending;
+        DetachSubTypes(pending);
+
+        while (!pending.empty()) {
+            std::unique_ptr<Type> type = std::move(pending.back());
+            pending.pop_back();
+            // type is destroyed at the end of the iteration, after its
+            // sub-types were detached.
+            type->DetachSubTypes(pending);
         }
+    }
 
-        if (IsSimpleBool()) {
-            return Type::SimpleBool();
+    Type Clone() const {
+        Type clone;
+        // Pairs of an original type and its (so far empty) clone.
+        std::vector<std::pair<const Type*, Type*>> stack{{this, &clone}};
+
+        while (!stack.empty()) {
+            auto [original, copy] = stack.back();
+            stack.pop_back();
+
+            copy->ill_typed_ = original->ill_typed_;
+            copy->simple_bool_ = original->simple_bool_;
+
+            if (original->IsFunction()) {
+                copy->lhs_ = std::make_unique<Type>();
+                copy->rhs_ = std::make_unique<Type>();
+                stack.push_back({original->lhs_.get(), copy->lhs_.get()});
+                stack.push_back({original->rhs_.get(), copy->rhs_.get()});
+            }
         }
 
-        return Type::FunctionType(std::make_unique<Type>(lhs_->Clone()),
-                                  std::make_unique<Type>(rhs_->Clone()));
+        return clone;
     }
 
     bool operator==(const Type& other) const {
-        if (ill_typed_) {
-            return other.ill_typed_;
-        }
+        std::vector<std::pair<const Type*, const Type*>> stack{{this, &other}};
+
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
 
-        if (simple_bool_) {
-            return other.simple_bool_;
+            if (lhs->ill_typed_ || lhs->simple_bool_) {
+                if (lhs->ill_typed_ != rhs->ill_typed_ ||
+                    lhs->simple_bool_ != rhs->simple_bool_) {
+                    return false;
+                }
+            } else if (lhs->lhs_ && lhs->rhs_ && rhs->lhs_ && rhs->rhs_) {
+                stack.push_back({lhs->rhs_.get(), rhs->rhs_.get()});
+                stack.push_back({lhs->lhs_.get(), rhs->lhs_.get()});
+            } else {
+                return false;
+            }
         }
 
-        return lhs_ && rhs_ && other.lhs_ && other.rhs_ &&
-               (*lhs_ == *other.lhs_) && (*rhs_ == *other.rhs_);
+        return true;
     }
 
     bool operator!=(const Type& other) const { return !(*this == other); }
@@ -309,6 +357,17 @@ class Type {
     }
 
    private:
+    /**
+     * Moves the direct sub-types of this Type to sub_types.
+     */
+    void DetachSubTypes(std::vector<std::unique_ptr<Type>>& sub_types) {
+        for (auto* sub_type : {&lhs_, &rhs_}) {
+            if (*sub_type) {
+                sub_types.push_back(std::move(*sub_type));
+            }
+        }
+    }
+
     bool ill_typed_ = false;
 
     bool simple_bool_ = false;
@@ -318,20 +377,35 @@ class Type {
 };
 
 std::ostream& operator<<(std::ostream& out, const Type& type) {
-    if (type.IsSimpleBool()) {
-        out << lexer::kKeywordBool;
-    } else if (type.IsFunction()) {
-        out << "(" << *type.lhs_ << " "
-            << lexer::Token(lexer::Token::Category::ARROW) << " " << *type.rhs_
-            << ")";
-    } else {
-        out << "Ⱦ";
+    // Work items, last one first: either a type to print or, if type is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Type*, std::string>> stack{{&type, ""}};
+    std::ostringstream arrow;
+    arrow << " " << lexer::Token(lexer::Token::Category::ARROW) << " ";
+
+    while (!stack.empty()) {
+        auto [current, text] = std::move(stack.back());
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+        } else if (current->IsSimpleBool()) {
+            out << lexer::kKeywordBool;
+        } else if (current->IsFunction()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->rhs_.get(), ""});
+            stack.push_back({nullptr, arrow.str()});
+            stack.push_back({current->lhs_.get(), ""});
+        } else {
+            out << "Ⱦ";
+        }
     }
 
     return out;
 }
 
-class Term {
+class Term : private budget::Counted<Term> {
     friend std::ostream& operator<<(std::ostream&, const Term&);
 
    public:
@@ -350,6 +424,7 @@ class Term {
         result.de_bruijn_idx_ = de_bruijn_idx;
         result.is_variable_ = true;
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -360,6 +435,7 @@ class Term {
         result.application_lhs_ = std::move(lhs);
         result.application_rhs_ = std::move(rhs);
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -392,7 +468,22 @@ class Term {
     Term(Term&&) = default;
     Term& operator=(Term&&) = default;
 
-    ~Term() = default;
+    /**
+     * Destroys the sub-terms iteratively. The implicit destructor would recurse
+     * once per nesting level and overflow the stack for deep terms.
+     */
+    ~Term() {
+        std::vector<std::unique_ptr<Term>> pending;
+        DetachSubTerms(pending);
+
+        while (!pending.empty()) {
+            std::unique_ptr<Term> term = std::move(pending.back());
+            pending.pop_back();
+            // term is destroyed at the end of the iteration, after its
+            // sub-terms were detached.
+            term->DetachSubTerms(pending);
+        }
+    }
 
     bool IsLambda() const { return is_lambda_; }
 
@@ -441,76 +532,73 @@ class Term {
                 "Term::Combine() received an invalid Term.");
         }
 
-        if (IsLambda()) {
-            if (lambda_body_) {
+        // A term combined into a Term whose sub-term is still being parsed is
+        // combined into that sub-term instead. Walk down such sub-terms in a
+        // loop since they may be nested arbitrarily deep.
+        std::vector<Term*> path{this};
+
+        while (Term* sub_term = path.back()->IncompleteSubTerm()) {
+            path.push_back(sub_term);
+        }
+
+        Term& target = *path.back();
+
+        if (target.IsLambda()) {
+            if (target.lambda_body_) {
                 // If the lambda body was completely parsed, then combining this
                 // term and the argument term means applying this lambda to the
                 // argument.
-                if (is_complete_lambda_) {
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    is_lambda_ = false;
-                    lambda_body_ = nullptr;
-                    lambda_arg_name_ = "";
-                    is_complete_lambda_ = false;
-                } else {
-                    lambda_body_->Combine(std::move(term));
-                }
+                target =
+                    Application(std::make_unique<Term>(std::move(target)),
+                                std::make_unique<Term>(std::move(term)));
+
+                target.is_lambda_ = false;
+                target.lambda_body_ = nullptr;
+                target.lambda_arg_name_ = "";
+                target.is_complete_lambda_ = false;
             } else {
-                lambda_body_ = std::make_unique<Term>(std::move(term));
+                target.lambda_body_ = std::make_unique<Term>(std::move(term));
             }
-        } else if (IsVariable()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
+        } else if (target.IsVariable()) {
+            target = Application(std::make_unique<Term>(std::move(target)),
+                                 std::make_unique<Term>(std::move(term)));
+
+            target.is_variable_ = false;
+            target.variable_name_ = "";
+        } else if (target.IsApplication()) {
+            target = Application(std::make_unique<Term>(std::move(target)),
+                                 std::make_unique<Term>(std::move(term)));
+        } else if (target.IsIf()) {
+            if (!target.is_complete_if_condition_) {
+                target.if_condition_ = std::make_unique<Term>(std::move(term));
+            } else if (!target.is_complete_if_then_) {
+                target.if_then_ = std::make_unique<Term>(std::move(term));
+            } else if (target.if_else_) {
+                // If the if term was completely parsed, then combining this
+                // term and the argument term means applying the if term to the
+                // argument.
+                target =
+                    Application(std::make_unique<Term>(std::move(target)),
                                 std::make_unique<Term>(std::move(term)));
 
-            is_variable_ = false;
-            variable_name_ = "";
-        } else if (IsApplication()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
-        } else if (IsIf()) {
-            if (!is_complete_if_condition_) {
-                if (if_condition_) {
-                    if_condition_->Combine(std::move(term));
-                } else {
-                    if_condition_ = std::make_unique<Term>(std::move(term));
-                }
-            } else if (!is_complete_if_then_) {
-                if (if_then_) {
-                    if_then_->Combine(std::move(term));
-                } else {
-                    if_then_ = std::make_unique<Term>(std::move(term));
-                }
+                target.is_if_ = false;
+                target.if_condition_ = nullptr;
+                target.if_then_ = nullptr;
+                target.if_else_ = nullptr;
+                target.is_complete_if_condition_ = false;
+                target.is_complete_if_then_ = false;
+                target.is_complete_if_else_ = false;
             } else {
-                if (if_else_) {
-                    // If the lambda body was completely parsed, then combining
-                    // this term and the argument term means applying this
-                    // lambda to the argument.
-                    if (is_complete_if_else_) {
-                        *this = Application(
-                            std::make_unique<Term>(std::move(*this)),
-                            std::make_unique<Term>(std::move(term)));
-
-                        is_if_ = false;
-                        if_condition_ = nullptr;
-                        if_then_ = nullptr;
-                        if_else_ = nullptr;
-                        is_complete_if_condition_ = false;
-                        is_complete_if_then_ = false;
-                        is_complete_if_else_ = false;
-                    } else {
-                        if_else_->Combine(std::move(term));
-                    }
-                } else {
-                    if_else_ = std::make_unique<Term>(std::move(term));
-                }
+                target.if_else_ = std::make_unique<Term>(std::move(term));
             }
-        } else if (IsTrue() || IsFalse()) {
+        } else if (target.IsTrue() || target.IsFalse()) {
             throw std::invalid_argument("Trying to combine with a constant.");
         } else {
-            *this = std::move(term);
+            target = std::move(term);
+        }
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            (*it)->UpdateFreeVariableBound();
         }
 
         return *this;
@@ -521,26 +609,39 @@ class Term {
      * distance amount. For an example use, see Term::Substitute(int, Term&).
      */
     void Shift(int distance) {
-        std::function<void(int, Term&)> walk = [&distance, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
             if (term.IsInvalid()) {
                 throw std::invalid_argument("Trying to shift an invalid term.");
             }
 
-            if (term.IsVariable()) {
-                if (term.de_bruijn_idx_ >= binding_context_size) {
-                    term.de_bruijn_idx_ += distance;
-                }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
+            // Skip sub-terms whose variables are all bound inside this Term.
+            if (term.free_variable_bound_ <= entry.binding_context_size) {
+                continue;
             }
-        };
 
-        walk(0, *this);
+            if (term.IsVariable()) {
+                term.de_bruijn_idx_ += distance;
+                term.UpdateFreeVariableBound();
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
+            }
+        }
     }
 
     /**
@@ -553,32 +654,44 @@ class Term {
                 "Trying to substitute using invalid terms.");
         }
 
-        std::function<void(int, Term&)> walk = [&variable, &sub, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
+            // Adjust variable according to the current binding depth before
+            // comparing it with term's free variables.
+            int term_variable = variable + entry.binding_context_size;
+
+            // Skip sub-terms in which variable doesn't occur.
+            if (term.free_variable_bound_ <= term_variable) {
+                continue;
+            }
+
             if (term.IsVariable()) {
-                // Adjust variable according to the current binding
-                // depth before comparing term's index.
-                if (term.de_bruijn_idx_ == variable + binding_context_size) {
+                if (term.de_bruijn_idx_ == term_variable) {
                     // Shift sub up by binding_context_size distance since sub
                     // is now substituted in binding_context_size deep context.
                     auto clone = sub.Clone();
-                    clone.Shift(binding_context_size);
+                    clone.Shift(entry.binding_context_size);
                     std::swap(term, clone);
                 }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
-            } else if (term.IsIf()) {
-                walk(binding_context_size, *term.if_condition_);
-                walk(binding_context_size, *term.if_then_);
-                walk(binding_context_size, *term.if_else_);
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
             }
-        };
-
-        walk(0, *this);
+        }
     }
 
     Term& LambdaBody() const {
@@ -661,99 +774,275 @@ class Term {
         return *if_else_;
     }
 
-    bool operator==(const Term& other) const {
-        if (IsLambda() && other.IsLambda()) {
-            return LambdaArgType() == other.LambdaArgType() &&
-                   LambdaBody() == other.LambdaBody();
+    /**
+     * Returns the number of nodes of this Term and its depth (the number of
+     * nodes on its longest path from the root).
+     */
+    std::pair<std::size_t, std::size_t> SizeAndDepth() const {
+        std::size_t size = 0;
+        std::size_t depth = 0;
+        std::vector<std::pair<const Term*, std::size_t>> stack{{this, 1}};
+
+        while (!stack.empty()) {
+            auto [term, term_depth] = stack.back();
+            stack.pop_back();
+            ++size;
+            depth = std::max(depth, term_depth);
+            term->ForEachSubterm([&](const Term& sub_term, int) {
+                stack.push_back({&sub_term, term_depth + 1});
+            });
         }
 
-        if (IsVariable() && other.IsVariable()) {
-            return de_bruijn_idx_ == other.de_bruijn_idx_;
-        }
+        return {size, depth};
+    }
 
-        if (IsApplication() && other.IsApplication()) {
-            return (ApplicationLHS() == other.ApplicationLHS()) &&
-                   (ApplicationRHS() == other.ApplicationRHS());
-        }
+    bool operator==(const Term& other) const {
+        std::vector<std::pair<const Term*, const Term*>> stack{{this, &other}};
 
-        if (IsIf() && other.IsIf()) {
-            return (IfCondition() == other.IfCondition()) &&
-                   (IfThen() == other.IfThen()) && (IfElse() == other.IfElse());
-        }
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
 
-        if (IsTrue() && other.IsTrue()) {
-            return true;
-        }
+            if (lhs->IsLambda() && rhs->IsLambda()) {
+                if (lhs->LambdaArgType() != rhs->LambdaArgType()) {
+                    return false;
+                }
 
-        if (IsFalse() && other.IsFalse()) {
-            return true;
+                stack.push_back({&lhs->LambdaBody(), &rhs->LambdaBody()});
+            } else if (lhs->IsVariable() && rhs->IsVariable()) {
+                if (lhs->de_bruijn_idx_ != rhs->de_bruijn_idx_) {
+                    return false;
+                }
+            } else if (lhs->IsApplication() && rhs->IsApplication()) {
+                stack.push_back(
+                    {&lhs->ApplicationRHS(), &rhs->ApplicationRHS()});
+                stack.push_back(
+                    {&lhs->ApplicationLHS(), &rhs->ApplicationLHS()});
+            } else if (lhs->IsIf() && rhs->IsIf()) {
+                stack.push_back({&lhs->IfElse(), &rhs->IfElse()});
+                stack.push_back({&lhs->IfThen(), &rhs->IfThen()});
+                stack.push_back({&lhs->IfCondition(), &rhs->IfCondition()});
+            } else if (!(lhs->IsTrue() && rhs->IsTrue()) &&
+                       !(lhs->IsFalse() && rhs->IsFalse())) {
+                return false;
+            }
         }
 
-        return false;
+        return true;
     }
 
     bool operator!=(const Term& other) const { return !(*this == other); }
 
     std::string ASTString(int indentation = 0) const {
         std::ostringstream out;
-        std::string prefix = std::string(indentation, '-');
+        // Work items, last one first: either a term to print at some
+        // indentation or, if term is nullptr, a piece of text to print as is.
+        struct Item {
+            const Term* term;
+            int indentation;
+            std::string text;
+        };
+        std::vector<Item> stack{{this, indentation, ""}};
 
-        if (IsLambda()) {
-            out << prefix << "λ " << lambda_arg_name_ << ":"
-                << *lambda_arg_type_ << "\n";
-            out << lambda_body_->ASTString(indentation + 2);
-        } else if (IsVariable()) {
-            out << prefix << variable_name_ << "[" << de_bruijn_idx_ << "]";
-        } else if (IsApplication()) {
-            out << prefix << "<-\n";
-            out << application_lhs_->ASTString(indentation + 2) << "\n";
-            out << application_rhs_->ASTString(indentation + 2);
-        } else if (IsIf()) {
-            out << prefix << "if\n";
-            out << if_condition_->ASTString(indentation + 2) << "\n";
-            out << prefix << "then\n";
-            out << if_then_->ASTString(indentation + 2) << "\n";
-            out << prefix << "else\n";
-            out << if_else_->ASTString(indentation + 2);
-        } else if (IsTrue()) {
-            out << prefix << "true";
-        } else if (IsFalse()) {
-            out << prefix << "false";
+        while (!stack.empty()) {
+            Item item = std::move(stack.back());
+            stack.pop_back();
+
+            if (!item.term) {
+                out << item.text;
+                continue;
+            }
+
+            const Term& term = *item.term;
+            std::string prefix = std::string(item.indentation, '-');
+            int sub_indentation = item.indentation + 2;
+
+            if (term.IsLambda()) {
+                out << prefix << "λ " << term.lambda_arg_name_ << ":"
+                    << *term.lambda_arg_type_ << "\n";
+                stack.push_back({term.lambda_body_.get(), sub_indentation, ""});
+            } else if (term.IsVariable()) {
+                out << prefix << term.variable_name_ << "["
+                    << term.de_bruijn_idx_ << "]";
+            } else if (term.IsApplication()) {
+                out << prefix << "<-\n";
+                stack.push_back(
+                    {term.application_rhs_.get(), sub_indentation, ""});
+                stack.push_back({nullptr, 0, "\n"});
+                stack.push_back(
+                    {term.application_lhs_.get(), sub_indentation, ""});
+            } else if (term.IsIf()) {
+                out << prefix << "if\n";
+                stack.push_back({term.if_else_.get(), sub_indentation, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "else\n"});
+                stack.push_back({term.if_then_.get(), sub_indentation, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "then\n"});
+                stack.push_back(
+                    {term.if_condition_.get(), sub_indentation, ""});
+            } else if (term.IsTrue()) {
+                out << prefix << "true";
+            } else if (term.IsFalse()) {
+                out << prefix << "false";
+            }
         }
 
         return out.str();
     }
 
+    /**
+     * Copies this Term iteratively so that arbitrarily deep terms can be
+     * cloned.
+     */
     Term Clone() const {
-        if (IsInvalid()) {
-            throw std::logic_error("Trying to clone an invalid term.");
+        Term clone;
+        // Pairs of an original term and its (so far empty) clone.
+        std::vector<std::pair<const Term*, Term*>> stack{{this, &clone}};
+
+        while (!stack.empty()) {
+            auto [original, copy] = stack.back();
+            stack.pop_back();
+
+            if (original->IsInvalid()) {
+                throw std::logic_error("Trying to clone an invalid term.");
+            }
+
+            copy->is_lambda_ = original->is_lambda_;
+            copy->lambda_arg_name_ = original->lambda_arg_name_;
+            copy->is_complete_lambda_ = original->is_complete_lambda_;
+            copy->is_variable_ = original->is_variable_;
+            copy->variable_name_ = original->variable_name_;
+            copy->de_bruijn_idx_ = original->de_bruijn_idx_;
+            copy->is_application_ = original->is_application_;
+            copy->is_if_ = original->is_if_;
+            copy->is_complete_if_condition_ =
+                original->is_complete_if_condition_;
+            copy->is_complete_if_then_ = original->is_complete_if_then_;
+            copy->is_complete_if_else_ = original->is_complete_if_else_;
+            copy->is_true_ = original->is_true_;
+            copy->is_false_ = original->is_false_;
+            copy->free_variable_bound_ = original->free_variable_bound_;
+
+            if (original->lambda_arg_type_) {
+                copy->lambda_arg_type_ =
+                    std::make_unique<Type>(original->lambda_arg_type_->Clone());
+            }
+
+            auto clone_sub_term = [&stack](const std::unique_ptr<Term>& from,
+                                           std::unique_ptr<Term>& to) {
+                if (from) {
+                    to = std::make_unique<Term>();
+                    stack.push_back({from.get(), to.get()});
+                }
+            };
+
+            clone_sub_term(original->lambda_body_, copy->lambda_body_);
+            clone_sub_term(original->application_lhs_, copy->application_lhs_);
+            clone_sub_term(original->application_rhs_, copy->application_rhs_);
+            clone_sub_term(original->if_condition_, copy->if_condition_);
+            clone_sub_term(original->if_then_, copy->if_then_);
+            clone_sub_term(original->if_else_, copy->if_else_);
         }
 
+        return clone;
+    }
+
+    bool is_complete_lambda_ = false;
+
+   private:
+    /**
+     * An entry of the explicit stacks used by Shift() and Substitute().
+     */
+    struct WalkEntry {
+        Term* term;
+        // The number of binders between term and the Term being walked.
+        int binding_context_size;
+        // Whether term's sub-terms were walked already (i.e. term is visited
+        // for the second time to update its free_variable_bound_).
+        bool sub_terms_walked;
+    };
+
+    /**
+     * Calls visit(sub_term, num_binders) for each direct sub-term of this Term
+     * (that was parsed so far), where num_binders is the number of variables
+     * this Term binds around sub_term.
+     */
+    template <typename Visitor>
+    void ForEachSubterm(Visitor visit) const {
+        auto visit_if_parsed = [&visit](const std::unique_ptr<Term>& sub_term,
+                                        int num_binders) {
+            if (sub_term) {
+                visit(*sub_term, num_binders);
+            }
+        };
+
         if (IsLambda()) {
-            return std::move(
-                Lambda(lambda_arg_name_,
-                       std::make_unique<Type>(lambda_arg_type_->Clone()))
-                    .Combine(lambda_body_->Clone()));
-        } else if (IsVariable()) {
-            return Variable(variable_name_, de_bruijn_idx_);
+            visit_if_parsed(lambda_body_, 1);
         } else if (IsApplication()) {
-            return Application(
-                std::make_unique<Term>(application_lhs_->Clone()),
-                std::make_unique<Term>(application_rhs_->Clone()));
-        } else if (IsTrue()) {
-            return Term::True();
-        } else if (IsFalse()) {
-            return Term::False();
+            visit_if_parsed(application_lhs_, 0);
+            visit_if_parsed(application_rhs_, 0);
+        } else if (IsIf()) {
+            visit_if_parsed(if_condition_, 0);
+            visit_if_parsed(if_then_, 0);
+            visit_if_parsed(if_else_, 0);
+        }
+    }
+
+    /**
+     * Returns the sub-term that is still being parsed and into which terms
+     * combined into this Term go, or nullptr if there is none.
+     */
+    Term* IncompleteSubTerm() const {
+        if (IsLambda() && !is_complete_lambda_) {
+            return lambda_body_.get();
         }
 
-        std::ostringstream error_ss;
-        error_ss << "Couldn't clone term: " << *this;
-        throw std::logic_error(error_ss.str());
+        if (IsIf()) {
+            if (!is_complete_if_condition_) {
+                return if_condition_.get();
+            }
+
+            if (!is_complete_if_then_) {
+                return if_then_.get();
+            }
+
+            if (!is_complete_if_else_) {
+                return if_else_.get();
+            }
+        }
+
+        return nullptr;
     }
 
-    bool is_complete_lambda_ = false;
+    /**
+     * Moves the direct sub-terms of this Term to sub_terms.
+     */
+    void DetachSubTerms(std::vector<std::unique_ptr<Term>>& sub_terms) {
+        for (auto* sub_term :
+             {&lambda_body_, &application_lhs_, &application_rhs_,
+              &if_condition_, &if_then_, &if_else_}) {
+            if (*sub_term) {
+                sub_terms.push_back(std::move(*sub_term));
+            }
+        }
+    }
+
+    /**
+     * Recalculates free_variable_bound_ from the ones of the sub-terms.
+     */
+    void UpdateFreeVariableBound() {
+        if (IsVariable()) {
+            free_variable_bound_ = std::max(de_bruijn_idx_ + 1, 0);
+            return;
+        }
+
+        int bound = 0;
+        ForEachSubterm([&bound](Term& sub_term, int num_binders) {
+            bound = std::max(bound,
+                             sub_term.free_variable_bound_ - num_binders);
+        });
+        free_variable_bound_ = bound;
+    }
 
-   private:
     bool is_lambda_ = false;
     std::string lambda_arg_name_ = "";
     std::unique_ptr<Type> lambda_arg_type_{};
@@ -779,28 +1068,56 @@ class Term {
     bool is_true_ = false;
 
     bool is_false_ = false;
+
+    // 1 + the largest de Bruijn index of the free variables of this Term (0 if
+    // the Term is closed). Sub-terms that are evaluated in place don't update
+    // it, which is fine since evaluation never introduces free variables. So
+    // it is always an upper bound that lets Shift() and Substitute() skip
+    // closed sub-terms.
+    int free_variable_bound_ = 0;
 };
 
 std::ostream& operator<<(std::ostream& out, const Term& term) {
-    if (term.IsInvalid()) {
-        out << "<INVALID>";
-    } else if (term.IsVariable()) {
-        out << term.variable_name_;
-    } else if (term.IsLambda()) {
-        out << "{l " << term.lambda_arg_name_ << " : " << *term.lambda_arg_type_
-            << ". " << *term.lambda_body_ << "}";
-    } else if (term.IsApplication()) {
-        out << "(" << *term.application_lhs_ << " <- " << *term.application_rhs_
-            << ")";
-    } else if (term.IsIf()) {
-        out << "if (" << *term.if_condition_ << ") then (" << *term.if_then_
-            << ") else (" << *term.if_else_ << ")";
-    } else if (term.IsTrue()) {
-        out << "true";
-    } else if (term.IsFalse()) {
-        out << "false";
-    } else {
-        out << "<ERROR>";
+    // Work items, last one first: either a term to print or, if term is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Term*, const char*>> stack{{&term, nullptr}};
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+        } else if (current->IsInvalid()) {
+            out << "<INVALID>";
+        } else if (current->IsVariable()) {
+            out << current->variable_name_;
+        } else if (current->IsLambda()) {
+            out << "{l " << current->lambda_arg_name_ << " : "
+                << *current->lambda_arg_type_ << ". ";
+            stack.push_back({nullptr, "}"});
+            stack.push_back({current->lambda_body_.get(), nullptr});
+        } else if (current->IsApplication()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->application_rhs_.get(), nullptr});
+            stack.push_back({nullptr, " <- "});
+            stack.push_back({current->application_lhs_.get(), nullptr});
+        } else if (current->IsIf()) {
+            out << "if (";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->if_else_.get(), nullptr});
+            stack.push_back({nullptr, ") else ("});
+            stack.push_back({current->if_then_.get(), nullptr});
+            stack.push_back({nullptr, ") then ("});
+            stack.push_back({current->if_condition_.get(), nullptr});
+        } else if (current->IsTrue()) {
+            out << "true";
+        } else if (current->IsFalse()) {
+            out << "false";
+        } else {
+            out << "<ERROR>";
+        }
     }
 
     return out;
@@ -813,6 +1130,7 @@ class Parser {
     Parser(std::istringstream&& in) : lexer_(std::move(in)) {}
 
     Term ParseProgram() {
+        allocation::PhaseScope scope{allocation::Phase::PARSING};
         Token next_token;
         std::vector<Term> term_stack;
         term_stack.emplace_back(Term());
@@ -1052,22 +1370,23 @@ class Parser {
         return {arg_name, std::move(ParseType())};
     }
 
+    /**
+     * Parses a type using an explicit stack for parenthesized types so that
+     * their nesting depth is not limited by the call stack.
+     */
     Type ParseType() {
-        std::vector<Type> parts;
+        // The parts of the arrow types being parsed, one list for each open
+        // parenthesis (innermost last).
+        std::vector<std::vector<Type>> parts_stack(1);
+
         while (true) {
             auto token = lexer_.NextToken();
 
             if (token.GetCategory() == Token::Category::KEYWORD_BOOL) {
-                parts.emplace_back(Type::SimpleBool());
+                parts_stack.back().emplace_back(Type::SimpleBool());
             } else if (token.GetCategory() == Token::Category::OPEN_PAREN) {
-                parts.emplace_back(ParseType());
-
-                if (lexer_.NextToken().GetCategory() !=
-                    Token::Category::CLOSE_PAREN) {
-                    std::ostringstream error_ss;
-                    error_ss << __LINE__ << ": Unexpected token: " << token;
-                    throw std::logic_error(error_ss.str());
-                }
+                parts_stack.emplace_back();
+                continue;
             } else {
                 std::ostringstream error_ss;
                 error_ss << __LINE__ << ": Unexpected token: " << token;
@@ -1076,6 +1395,16 @@ class Parser {
 
             token = lexer_.NextToken();
 
+            // Each ')' completes a parenthesized type, which is a part of the
+            // enclosing arrow type.
+            while (token.GetCategory() == Token::Category::CLOSE_PAREN &&
+                   parts_stack.size() > 1) {
+                Type type = CombineTypeParts(parts_stack.back());
+                parts_stack.pop_back();
+                parts_stack.back().emplace_back(std::move(type));
+                token = lexer_.NextToken();
+            }
+
             if (token.GetCategory() == Token::Category::LAMBDA_DOT) {
                 break;
             } else if (token.GetCategory() == Token::Category::CLOSE_PAREN) {
@@ -1088,6 +1417,20 @@ class Parser {
             }
         }
 
+        if (parts_stack.size() > 1) {
+            std::ostringstream error_ss;
+            error_ss << __LINE__ << ": Expected to parse a ')'.";
+            throw std::logic_error(error_ss.str());
+        }
+
+        return CombineTypeParts(parts_stack.back());
+    }
+
+    /**
+     * Combines the parts of the arrow type parts[0] -> parts[1] -> ... into one
+     * (right associative) type.
+     */
+    Type CombineTypeParts(std::vector<Type>& parts) {
         for (int i = parts.size() - 2; i >= 0; --i) {
             parts[i] = Type::FunctionType(
                 std::make_unique<Type>(std::move(parts[i])),
@@ -1115,127 +1458,401 @@ using parser::Term;
 using parser::Type;
 
 class TypeChecker {
-    using Context = std::deque<std::pair<std::string, Type*>>;
-
    public:
+    /**
+     * Computes the type of term bottom-up using an explicit stack so that
+     * arbitrarily deep terms can be type checked.
+     */
     Type TypeOf(const Term& term) {
-        Context ctx;
-        return TypeOf(ctx, term);
-    }
+        allocation::PhaseScope scope{allocation::Phase::TYPE_CHECKING};
+        // The bindings of the lambdas enclosing the term being visited,
+        // innermost last. So, a variable with de Bruijn index i refers to
+        // ctx[ctx.size() - 1 - i].
+        std::vector<std::pair<std::string, Type*>> ctx;
+        // The types of the visited sub-terms whose parents were not visited
+        // yet.
+        std::vector<Type> types;
+        // Each entry stores a term along with whether its sub-terms have
+        // already been pushed.
+        std::vector<std::pair<const Term*, bool>> stack{{&term, false}};
+
+        while (!stack.empty()) {
+            auto [current, expanded] = stack.back();
+
+            if (!expanded) {
+                stack.back().second = true;
+
+                if (current->IsLambda()) {
+                    ctx.push_back(
+                        {current->LambdaArgName(), &current->LambdaArgType()});
+                    stack.push_back({&current->LambdaBody(), false});
+                } else if (current->IsApplication()) {
+                    stack.push_back({&current->ApplicationRHS(), false});
+                    stack.push_back({&current->ApplicationLHS(), false});
+                } else if (current->IsIf()) {
+                    stack.push_back({&current->IfElse(), false});
+                    stack.push_back({&current->IfThen(), false});
+                    stack.push_back({&current->IfCondition(), false});
+                }
+
+                continue;
+            }
 
-    Type TypeOf(const Context& ctx, const Term& term) {
-        Type res = Type::IllTyped();
+            stack.pop_back();
+            Type res = Type::IllTyped();
 
-        if (term.IsTrue() || term.IsFalse()) {
-            res = Type::SimpleBool();
-        } else if (term.IsIf()) {
-            if (TypeOf(ctx, term.IfCondition()) == Type::SimpleBool()) {
-                Type then_type = TypeOf(ctx, term.IfThen());
+            if (current->IsTrue() || current->IsFalse()) {
+                res = Type::SimpleBool();
+            } else if (current->IsIf()) {
+                Type else_type = PopType(types);
+                Type then_type = PopType(types);
 
-                if (then_type == TypeOf(ctx, term.IfElse())) {
-                    res = then_type.Clone();
+                if (PopType(types) == Type::SimpleBool() &&
+                    then_type == else_type) {
+                    res = std::move(then_type);
                 }
-            }
-        } else if (term.IsLambda()) {
-            Context new_ctx =
-                AddBinding(ctx, term.LambdaArgName(), term.LambdaArgType());
-            Type return_type = TypeOf(new_ctx, term.LambdaBody());
-            res = Type::FunctionType(
-                std::make_unique<Type>(term.LambdaArgType().Clone()),
-                std::make_unique<Type>(return_type.Clone()));
-        } else if (term.IsApplication()) {
-            Type lhs_type = TypeOf(ctx, term.ApplicationLHS());
-            Type rhs_type = TypeOf(ctx, term.ApplicationRHS());
+            } else if (current->IsLambda()) {
+                ctx.pop_back();
+                res = Type::FunctionType(
+                    std::make_unique<Type>(current->LambdaArgType().Clone()),
+                    std::make_unique<Type>(PopType(types)));
+            } else if (current->IsApplication()) {
+                Type rhs_type = PopType(types);
+                Type lhs_type = PopType(types);
+
+                if (lhs_type.IsFunction() &&
+                    lhs_type.FunctionLHS() == rhs_type) {
+                    res = std::move(lhs_type.FunctionRHS());
+                }
+            } else if (current->IsVariable()) {
+                int idx = current->VariableDeBruijnIdx();
 
-            if (lhs_type.IsFunction() && lhs_type.FunctionLHS() == rhs_type) {
-                res = lhs_type.FunctionRHS().Clone();
+                if (idx >= 0 && idx < ctx.size() &&
+                    ctx[ctx.size() - 1 - idx].first ==
+                        current->VariableName()) {
+                    res = ctx[ctx.size() - 1 - idx].second->Clone();
+                }
             }
-        } else if (term.IsVariable()) {
-            int idx = term.VariableDeBruijnIdx();
 
-            if (idx >= 0 && idx < ctx.size() &&
-                ctx[idx].first == term.VariableName()) {
-                res = ctx[idx].second->Clone();
-            }
+            types.emplace_back(std::move(res));
         }
 
-        return res;
+        return PopType(types);
     }
 
    private:
-    Context AddBinding(const Context& current_ctx, std::string var_name,
-                       Type& type) {
-        Context new_ctx = current_ctx;
-        new_ctx.push_front({var_name, &type});
+    Type PopType(std::vector<Type>& types) {
+        Type type = std::move(types.back());
+        types.pop_back();
 
-        return new_ctx;
+        return type;
     }
 };
 }  // namespace type_checker
 
 namespace interpreter {
-class Interpreter {
-    using Term = parser::Term;
+/**
+ * Identifies how this interpreter evaluates programs and prints their results
+ * in caches of results (see result_cache/). Bump it whenever either changes.
+ */
+constexpr int kEngineVersion = 1;
+
+using budget::Budget;
+using budget::BudgetExceeded;
+using budget::BudgetMeter;
+
+/**
+ * Profiling policy of BasicInterpreter that records nothing. Its hooks are
+ * empty inline functions, so an unprofiled interpreter doesn't pay for them.
+ */
+struct NullProfiler {
+    void CountRule(const char*) {}
+
+    template <typename Operation>
+    void Time(const char*, Operation operation) {
+        operation();
+    }
 
+    void RecordTerm(const parser::Term&, std::size_t) {}
+
+    void RecordResult(const parser::Term&) {}
+};
+
+/**
+ * Profiling policy of BasicInterpreter that counts how often each reduction
+ * rule fires, measures the time spent in Shift() and Substitute() (which
+ * includes cloning the substituted terms) and tracks the largest term that
+ * evaluation produces.
+ */
+class Profiler {
    public:
-    std::pair<std::string, type_checker::Type> Interpret(Term& program) {
-        Eval(program);
-        type_checker::Type type = type_checker::TypeChecker().TypeOf(program);
+    // How many steps apart the depth of the evaluated term is measured.
+    static constexpr long long kDepthSampleInterval = 1024;
 
-        std::ostringstream ss;
-        ss << program;
+    void CountRule(const char* rule) { ++rule_counts_[rule]; }
 
-        return {ss.str(), std::move(type)};
+    template <typename Operation>
+    void Time(const char* name, Operation operation) {
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        operation_times_[name] += std::chrono::steady_clock::now() - start;
+    }
+
+    /**
+     * Records the term after a reduction step, given its size as counted by
+     * the budget meter. Measuring its depth takes a walk over the whole term,
+     * so that is only sampled every kDepthSampleInterval steps and on the
+     * result.
+     */
+    void RecordTerm(const parser::Term& term, std::size_t size) {
+        max_term_size_ = std::max(max_term_size_, size);
+
+        if (num_terms_++ % kDepthSampleInterval == 0) {
+            RecordResult(term);
+        }
+    }
+
+    void RecordResult(const parser::Term& term) {
+        max_term_depth_ = std::max(max_term_depth_, term.SizeAndDepth().second);
+    }
+
+    /**
+     * Prints the collected data and the peak memory usage of the process as a
+     * table.
+     */
+    void Print(std::ostream& out) const {
+        const int kNameWidth = 24;
+        out << std::left << std::setw(kNameWidth) << "Rule" << "Count\n";
+
+        for (const auto& [rule, count] : rule_counts_) {
+            out << std::setw(kNameWidth) << rule << count << "\n";
+        }
+
+        out << "\n" << std::setw(kNameWidth) << "Operation" << "Time (ms)\n";
+
+        for (const auto& [name, time] : operation_times_) {
+            out << std::setw(kNameWidth) << name
+                << std::chrono::duration<double, std::milli>(time).count()
+                << "\n";
+        }
+
+        out << "\n"
+            << std::setw(kNameWidth) << "Max term size" << max_term_size_
+            << " nodes\n"
+            << std::setw(kNameWidth) << "Max sampled depth" << max_term_depth_
+            << "\n"
+            << std::setw(kNameWidth) << "Peak memory" << PeakMemoryKiB()
+            << " KiB\n";
     }
 
    private:
-    void Eval(Term& term) {
-        try {
-            Eval1(term);
-            Eval(term);
-        } catch (std::invalid_argument&) {
+    static long PeakMemoryKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        // macOS reports ru_maxrss in bytes rather than KiB.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    std::map<std::string, long long> rule_counts_;
+    std::map<std::string, std::chrono::steady_clock::duration>
+        operation_times_;
+    std::size_t max_term_size_ = 0;
+    std::size_t max_term_depth_ = 0;
+    long long num_terms_ = 0;
+};
+
+/**
+ * Evaluates programs, reporting every reduction step to a ProfilingPolicy
+ * (NullProfiler or Profiler).
+ */
+template <typename ProfilingPolicy>
+class BasicInterpreter {
+    using Term = parser::Term;
+
+   public:
+    const ProfilingPolicy& GetProfiler() const { return profiler_; }
+
+    /**
+     * Limits every following evaluation to budget. Interpret() throws
+     * BudgetExceeded when an evaluation goes over it.
+     */
+    void SetBudget(const Budget& budget) { budget_ = budget; }
+
+    /**
+     * An evaluation of a term in place that can be suspended between any two
+     * reduction steps, so that a scheduler can interleave many evaluations on
+     * a few threads. The term must not be used otherwise until Resume()
+     * returned true.
+     *
+     * The evaluation context of the current redex is kept as an explicit
+     * stack of the sub-terms on the path from the term to the redex (i.e. a
+     * zipper over the term), which is all the state there is to suspend.
+     * After a reduction, the search for the next redex resumes at the reduced
+     * sub-term and only moves up as far as necessary instead of starting over
+     * at the term.
+     */
+    class Evaluation {
+       public:
+        Evaluation(BasicInterpreter& interpreter, Term& term)
+            : interpreter_(interpreter),
+              term_(term),
+              context_{&term},
+              meter_(interpreter.budget_) {
+            meter_.Start(term_);
+            interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
         }
+
+        /**
+         * Performs at most fuel (> 0) reduction steps and returns true once no
+         * evaluation rule applies anymore. Throws BudgetExceeded when the
+         * evaluation goes over the interpreter's budget.
+         */
+        bool Resume(long long fuel) {
+            meter_.Resume();
+
+            try {
+                while (!context_.empty()) {
+                    Term& focus = *context_.back();
+
+                    if (interpreter_.IsValue(focus)) {
+                        // Continue evaluating the enclosing term.
+                        context_.pop_back();
+                        continue;
+                    }
+
+                    Term* sub_term = interpreter_.Eval1(focus);
+
+                    if (sub_term) {
+                        if (interpreter_.IsValue(*sub_term)) {
+                            // The enclosing term is stuck.
+                            throw std::invalid_argument("No applicable rule.");
+                        }
+
+                        context_.push_back(sub_term);
+                    } else {
+                        meter_.Step();
+                        interpreter_.profiler_.RecordTerm(
+                            term_, meter_.GetTermNodes());
+
+                        if (--fuel <= 0) {
+                            return false;
+                        }
+                    }
+                }
+            } catch (std::invalid_argument&) {
+                context_.clear();
+            }
+
+            interpreter_.profiler_.RecordResult(term_);
+            meter_.Check();
+            return true;
+        }
+
+        /**
+         * Returns what Interpret() returns for the term once Resume() returned
+         * true.
+         */
+        std::pair<std::string, type_checker::Type> Result() const {
+            type_checker::Type type = type_checker::TypeChecker().TypeOf(term_);
+            std::ostringstream ss;
+            ss << term_;
+
+            return {ss.str(), std::move(type)};
+        }
+
+        /**
+         * The number of reduction steps performed so far.
+         */
+        long long GetSteps() const { return meter_.GetSteps(); }
+
+       private:
+        BasicInterpreter& interpreter_;
+        Term& term_;
+        std::vector<Term*> context_;
+        BudgetMeter<Term> meter_;
+    };
+
+    std::pair<std::string, type_checker::Type> Interpret(Term& program) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        Evaluation evaluation{*this, program};
+        evaluation.Resume(std::numeric_limits<long long>::max());
+        return evaluation.Result();
     }
 
-    void Eval1(Term& term) {
-        auto term_subst_top = [](Term& s, Term& t) {
+   private:
+    /**
+     * Performs a single evaluation step on term in place and returns nullptr
+     * if term is a redex. Otherwise, returns the sub-term that the congruence
+     * rules select to be evaluated next. Throws std::invalid_argument if no
+     * evaluation rule applies.
+     */
+    Term* Eval1(Term& term) {
+        auto term_subst_top = [this](Term& s, Term& t) {
             // Adjust the free variables in s by increasing their static
             // distances by 1. That's because s will now be embedded one level
             // deeper in t (i.e. t's bound variable will be replaced by s).
-            s.Shift(1);
-            t.Substitute(0, s);
+            profiler_.Time("Shift", [&s] { s.Shift(1); });
+            profiler_.Time("Substitute", [&] { t.Substitute(0, s); });
             // Because of the substitution, one level of abstraction was peeled
             // off. Account for that by decreasing the static distances of the
             // free variables in t by 1.
-            t.Shift(-1);
+            profiler_.Time("Shift", [&t] { t.Shift(-1); });
             // NOTE: For more details see: tapl,§6.3.
         };
 
         if (term.IsApplication() && term.ApplicationLHS().IsLambda() &&
             IsValue(term.ApplicationRHS())) {
+            profiler_.CountRule("E-AppAbs");
             term_subst_top(term.ApplicationRHS(),
                            term.ApplicationLHS().LambdaBody());
-            std::swap(term, term.ApplicationLHS().LambdaBody());
+            ReplaceBySubTerm(term, term.ApplicationLHS().LambdaBody());
+            return nullptr;
         } else if (term.IsApplication() && IsValue(term.ApplicationLHS())) {
-            Eval1(term.ApplicationRHS());
+            return &term.ApplicationRHS();
         } else if (term.IsApplication()) {
-            Eval1(term.ApplicationLHS());
+            return &term.ApplicationLHS();
         } else if (term.IsIf()) {
-            if (term.IfCondition() == Term::True()) {
-                std::swap(term, term.IfThen());
-            } else if (term.IfCondition() == Term::False()) {
-                std::swap(term, term.IfElse());
-            } else {
-                Eval1(term.IfCondition());
+            if (term.IfCondition().IsTrue()) {
+                profiler_.CountRule("E-IfTrue");
+                ReplaceBySubTerm(term, term.IfThen());
+                return nullptr;
+            } else if (term.IfCondition().IsFalse()) {
+                profiler_.CountRule("E-IfFalse");
+                ReplaceBySubTerm(term, term.IfElse());
+                return nullptr;
             }
-        } else {
-            throw std::invalid_argument("No applicable rule.");
+
+            return &term.IfCondition();
         }
+
+        throw std::invalid_argument("No applicable rule.");
+    }
+
+    /**
+     * Replaces term by its (direct or indirect) sub-term without copying the
+     * sub-term.
+     */
+    void ReplaceBySubTerm(Term& term, Term& sub_term) {
+        // sub_term is owned by term, so it has to be moved out before term is
+        // overwritten. (Swapping the two instead would make sub_term own the
+        // rest of term, which then is never freed.)
+        Term tmp = std::move(sub_term);
+        term = std::move(tmp);
     }
 
     bool IsValue(const Term& term) {
         return term.IsLambda() || term.IsVariable() || term.IsTrue() ||
                term.IsFalse();
     }
+
+    ProfilingPolicy profiler_;
+    Budget budget_;
 };
+
+using Interpreter = BasicInterpreter<NullProfiler>;
+using ProfilingInterpreter = BasicInterpreter<Profiler>;
 }  // namespace interpreter
@@ -1326,9 +1326,70 @@ void InitData() {
                             SimpleBoolUP())}});
 }
 
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 1000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::pair<std::string, Type> expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+    Type lambdas_type = Type::SimpleBool();
+
+    for (int i = 0; i < n; ++i) {
+        lambdas_type = Type::FunctionType(
+            SimpleBoolUP(), std::make_unique<Type>(std::move(lambdas_type)));
+    }
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l y:Bool. (l x:Bool.)^" + n_str + " y) true",
+        "(l y:Bool. " + Repeat("l x:Bool. ", n) + "y) true",
+        {Repeat("{l x : Bool. ", n) + "true" + Repeat("}", n),
+         std::move(lambdas_type)}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + n_str + " false (else true)^" + n_str,
+        Repeat("if true then ", n) + "false" + Repeat(" else true", n),
+        {"false", Type::SimpleBool()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "x^" + n_str + " x", Repeat("x ", n) + "x",
+        {Repeat("(", n) + "x" + Repeat(" <- x)", n), Type::IllTyped()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "l x:(^" + n_str + " Bool )^" + n_str + ". x",
+        "l x:" + Repeat("(", n) + "Bool" + Repeat(")", n) + ". x",
+        {"{l x : Bool. x}",
+         Type::FunctionType(SimpleBoolUP(), SimpleBoolUP())}});
+}
+
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests = kData.size() + kDeepTermData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -1379,9 +1440,28 @@ void Run() {
         }
     }
 
+    // Test that every stage handles terms nested deeper than the call stack
+    // could hold.
+    for (const auto& test : kDeepTermData) {
+        Term program = parser::Parser{std::istringstream{test.input_program_}}
+                           .ParseProgram();
+        bool is_clone_equal = program.Clone() == program;
+        auto actual_eval_res = Interpreter().Interpret(program);
+
+        if (!is_clone_equal ||
+            actual_eval_res.first != test.expected_eval_result_.first ||
+            actual_eval_res.second != test.expected_eval_result_.second) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
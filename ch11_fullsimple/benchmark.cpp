@@ -0,0 +1,112 @@
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../program_generator/generator.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+using parser::Type;
+
+// The number of programs generated for every size.
+constexpr int kNumPrograms = 20;
+
+/**
+ * The time each phase of the pipeline took on all programs of one size.
+ */
+struct Result {
+    std::chrono::duration<double> parse_{0};
+    std::chrono::duration<double> type_check_{0};
+    std::chrono::duration<double> eval_{0};
+    // The total number of nodes of all programs run.
+    long long num_nodes_ = 0;
+};
+
+/**
+ * Runs phase() and adds the time it takes to total.
+ */
+template <typename Phase>
+void Measure(std::chrono::duration<double>& total, Phase phase) {
+    auto start = std::chrono::steady_clock::now();
+    phase();
+    total += std::chrono::steady_clock::now() - start;
+}
+
+/**
+ * Runs programs through the pipeline repeatedly for at least min_duration.
+ */
+Result Run(const std::vector<std::string>& programs,
+           std::chrono::duration<double> min_duration) {
+    Result res;
+    interpreter::Interpreter interpreter;
+
+    while (res.parse_ + res.type_check_ + res.eval_ < min_duration) {
+        for (const auto& source : programs) {
+            parser::Term program;
+            Measure(res.parse_, [&] {
+                program =
+                    parser::Parser{std::istringstream{source}}.ParseProgram();
+            });
+            res.num_nodes_ += program.SizeAndDepth().first;
+            Measure(res.type_check_,
+                    [&] { type_checker::TypeChecker().TypeOf(program); });
+            Measure(res.eval_, [&] { interpreter.Interpret(program); });
+        }
+    }
+
+    return res;
+}
+
+}  // namespace
+
+/**
+ * Times parsing, type checking and evaluation on random well-typed programs of
+ * each size given as an argument (see program_generator/). The programs are
+ * generated from --seed, so runs with the same seed are comparable.
+ */
+int main(int argc, char* argv[]) {
+    std::vector<int> sizes;
+    std::uint64_t seed = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string{argv[i]} == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else {
+            sizes.push_back(std::stoi(argv[i]));
+        }
+    }
+
+    if (sizes.empty()) {
+        sizes = {1000, 10000};
+    }
+
+    for (int size : sizes) {
+        Type::Arena arena;
+        Type::Arena::Scope scope{arena};
+        std::vector<std::string> programs;
+
+        for (int i = 0; i < kNumPrograms; ++i) {
+            program_generator::Generator<Type> generator{seed + i};
+            programs.push_back(
+                generator.Generate(generator.RandomType(), size));
+        }
+
+        auto res = Run(programs, std::chrono::milliseconds(500));
+        std::cout << kNumPrograms << " programs of size " << size << ":\n"
+                  << std::fixed << std::setprecision(0);
+
+        for (auto [name, duration] : {std::pair{"parse", res.parse_},
+                                      std::pair{"type check", res.type_check_},
+                                      std::pair{"eval", res.eval_}}) {
+            std::cout << "    " << std::left << std::setw(12) << name
+                      << res.num_nodes_ / duration.count() << " nodes/s\n";
+        }
+    }
+
+    return 0;
+}
@@ -1,23 +1,206 @@
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
 
+#include "../corpus_runner/runner.hpp"
+#include "../result_cache/result_cache.hpp"
 #include "interpreter.hpp"
 
+/**
+ * Replaces the file at path by contents. The contents are written to a
+ * temporary file first, so a crash while writing leaves the previous file
+ * intact.
+ */
+void ReplaceFile(const std::string& contents, const std::string& path) {
+    std::string tmp_path = path + ".tmp";
+
+    {
+        std::ofstream out{tmp_path, std::ios::binary};
+        out << contents;
+
+        if (!out.flush()) {
+            throw std::runtime_error("Can't write " + tmp_path + ".");
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Can't replace " + path + ".");
+    }
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr
-            << "Error: expected input program as a command line argument.\n";
+    bool profile = false;
+    bool load_image = false;
+    std::string trace_path;
+    std::string cache_dir;
+    std::string image_path;
+    interpreter::Budget budget;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc - 1; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag == "--profile") {
+            profile = true;
+        } else if (flag == "--load-image") {
+            load_image = true;
+        } else if (flag == "--trace" || flag == "--cache" ||
+                   flag == "--max-steps" || flag == "--max-nodes" ||
+                   flag == "--timeout-ms" || flag == "--save-image") {
+            if (++arg_idx >= argc - 1) {
+                std::cerr << "Error: expected a value after " << flag << ".\n";
+                return 1;
+            }
+
+            std::string value = argv[arg_idx];
+
+            try {
+                if (flag == "--trace") {
+                    trace_path = value;
+                } else if (flag == "--cache") {
+                    cache_dir = value;
+                } else if (flag == "--save-image") {
+                    image_path = value;
+                } else if (flag == "--max-steps") {
+                    budget.max_steps_ = std::stoll(value);
+                } else if (flag == "--max-nodes") {
+                    budget.max_term_nodes_ = std::stoull(value);
+                } else {
+                    budget.max_time_ =
+                        std::chrono::milliseconds(std::stoll(value));
+                }
+            } catch (std::exception&) {
+                std::cerr << "Error: invalid value " << value << " for " << flag
+                          << ".\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+    }
+
+    if (arg_idx >= argc) {
+        std::cerr << "Error: expected input program (or program image with "
+                     "--load-image) as a command line argument.\n";
         return 1;
     }
 
-    parser::Parser parser{std::istringstream{argv[1]}};
+    tracing::Tracer tracer;
+    auto& trace = tracer.GetBuffer();
+
+    // A program run before with the same options is answered from the
+    // cache. Profiling is about doing the work and an image isn't a program's
+    // source, so both bypass the cache.
+    std::optional<result_cache::ResultCache> cache;
+    std::optional<result_cache::OutputRecorder> recorder;
+    std::string cache_key;
+
+    if (!cache_dir.empty() && !profile && !load_image) {
+        try {
+            cache.emplace(cache_dir);
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+            return 1;
+        }
+
+        cache_key = result_cache::MakeKey(
+            "ch11_fullsimple/" + std::to_string(interpreter::kEngineVersion),
+            "max-steps=" + std::to_string(budget.max_steps_) +
+                " max-nodes=" + std::to_string(budget.max_term_nodes_),
+            argv[arg_idx]);
+        auto output = trace.Record("cache lookup", 0,
+                                   [&] { return cache->Find(cache_key); });
+
+        if (output) {
+            std::cout << *output;
+
+            if (!trace_path.empty()) {
+                std::ofstream trace_file{trace_path};
+                tracer.Write(trace_file);
+            }
+
+            return 0;
+        }
+
+        // Record what is printed from here on to store it in the cache.
+        recorder.emplace(std::cout);
+    }
+
     type_checker::TypeChecker checker;
-    auto program = parser.ParseProgram();
-    std::cout << "   " << program << ": " << checker.TypeOf(program) << "\n";
+    parser::Term program;
+    parser::Type* type = nullptr;
 
-    interpreter::Interpreter interpreter;
-    auto res = interpreter.Interpret(program);
-    std::cout << "=> " << res.first << ": " << res.second << "\n";
+    try {
+        if (load_image) {
+            // The image is decoded straight from the mapped file, without
+            // lexing, parsing and type checking the program.
+            corpus_runner::MappedFile image{argv[arg_idx]};
+            parser::ImageReader reader{image.GetContents().data(),
+                                       image.GetContents().size()};
+            program = trace.Record("load image", 0,
+                                   [&] { return reader.ReadProgram(); });
+            type = &reader.ProgramType();
+        } else {
+            parser::Parser parser{std::istringstream{argv[arg_idx]}};
+            program =
+                trace.Record("parse", 0, [&] { return parser.ParseProgram(); });
+            type = &trace.Record("type check", 0, [&]() -> parser::Type& {
+                return checker.TypeOf(program);
+            });
 
-    return 0;
-}
+            if (!image_path.empty()) {
+                ReplaceFile(parser::ImageWriter().Write(program, *type),
+                            image_path);
+            }
+        }
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    std::cout << "   " << program << ": " << *type << "\n";
+
+    int status = 0;
 
+    try {
+        if (profile) {
+            interpreter::ProfilingInterpreter interpreter;
+            interpreter.SetBudget(budget);
+            auto res = trace.Record(
+                "eval", 0, [&] { return interpreter.Interpret(program); });
+            std::cout << "=> " << res.first << ": " << res.second << "\n";
+            interpreter.GetProfiler().Print(std::cerr);
+        } else {
+            interpreter::Interpreter interpreter;
+            interpreter.SetBudget(budget);
+            auto res = trace.Record(
+                "eval", 0, [&] { return interpreter.Interpret(program); });
+            std::cout << "=> " << res.first << ": " << res.second << "\n";
+        }
+    } catch (const interpreter::BudgetExceeded& error) {
+        std::cout << "=> " << error.what() << "\n";
+        status = 1;
+    }
+
+    if (recorder && status == 0) {
+        try {
+            cache->Insert(cache_key, recorder->GetOutput());
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+        }
+    }
+
+    if (allocation::kEnabled) {
+        allocation::Tracker::Print(std::cerr);
+    }
+
+    if (!trace_path.empty()) {
+        std::ofstream trace_file{trace_path};
+        tracer.Write(trace_file);
+    }
+
+    return status;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <optional>
 
+#include "../program_generator/generator.hpp"
 #include "interpreter.hpp"
 
 namespace lexer {
@@ -27,11 +28,18 @@ void Run();
 }
 }  // namespace interpreter
 
+namespace program_generator {
+namespace test {
+void Run();
+}
+}  // namespace program_generator
+
 int main() {
     lexer::test::Run();
     parser::test::Run();
     type_checker::test::Run();
     interpreter::test::Run();
+    program_generator::test::Run();
 
     return 0;
 }
@@ -1385,12 +1393,66 @@ void InitData() {
     kData.emplace_back(TestData{"{x=0, y=true}.y", Type::Bool()});
 }
 
+// Deep enough that reading an image by recursing once per nesting level
+// overflows the stack.
+const int kDeepImageDepth = 1000000;
+
+struct BadImageTestData {
+    std::string description_;
+    std::string image_;
+};
+
+std::vector<BadImageTestData> kBadImageData{};
+
+void InitBadImageData() {
+    // The image of "succ 0" ends with the tags of succ and 0, and Nat is the
+    // only type in its table.
+    Term program = Parser{std::istringstream{"succ 0"}}.ParseProgram();
+    std::string image = ImageWriter().Write(program, Type::Nat());
+    char succ_tag = image[image.size() - 2];
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"truncated", image.substr(0, image.size() - 1)});
+
+    std::string bad_version = image;
+    bad_version[kImageMagic.size()] = kImageVersion + 1;
+    kBadImageData.emplace_back(
+        BadImageTestData{"unsupported version", bad_version});
+
+    // The magic and the version are followed by the sizes of the (empty)
+    // string table and of the type table.
+    std::string bad_type_tag = image;
+    bad_type_tag[kImageMagic.size() + 3] = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid type tag", bad_type_tag});
+
+    std::string bad_term_tag = image;
+    bad_term_tag.back() = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid term tag", bad_term_tag});
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"trailing term", image + image.back()});
+
+    kBadImageData.emplace_back(BadImageTestData{
+        "succ^" + std::to_string(kDeepImageDepth) + " without an argument",
+        image.substr(0, image.size() - 2) +
+            std::string(kDeepImageDepth, succ_tag)});
+}
+
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Type Checker] Running " << kData.size()
+    InitBadImageData();
+
+    size_t total_num_tests = kData.size() + kBadImageData.size();
+
+    std::cout << color::kYellow << "[Type Checker] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
+    // Checks every program without clearing its cache in between, although
+    // later programs reuse the addresses of the earlier programs' nodes.
+    TypeChecker reused_checker;
 
     for (const auto& test : kData) {
         try {
@@ -1398,8 +1460,42 @@ void Run() {
             Term program = parser.ParseProgram();
             TypeChecker type_checker;
             Type& res = type_checker.TypeOf(program);
+            // Checking the program again is answered from the cache.
+            Type& cached_res = type_checker.TypeOf(program);
+            Type& reused_res = reused_checker.TypeOf(program);
+
+            // A program loaded from its image has the same terms and type.
+            std::string image = ImageWriter().Write(program, res);
+            ImageReader reader{image.data(), image.size()};
+            Term loaded_program = reader.ReadProgram();
+            Type& loaded_res = TypeChecker().TypeOf(loaded_program);
+            std::ostringstream program_str;
+            std::ostringstream loaded_program_str;
+            program_str << program;
+            loaded_program_str << loaded_program;
+
+            // Types interned in an arena of their own compare equal to the
+            // global ones, and the arena can be dropped with its program.
+            std::size_t num_global_types = Type::Arena::Current().Size();
+            bool arena_res_matches = false;
+            {
+                Type::Arena arena;
+                Type::Arena::Scope scope{arena};
+                Term arena_program =
+                    Parser{std::istringstream{test.input_program_}}
+                        .ParseProgram();
+                arena_res_matches =
+                    test.expected_type_ == TypeChecker().TypeOf(arena_program);
+            }
 
-            if (test.expected_type_ != res) {
+            if (!arena_res_matches ||
+                Type::Arena::Current().Size() != num_global_types ||
+                test.expected_type_ != res ||
+                test.expected_type_ != cached_res ||
+                test.expected_type_ != reused_res ||
+                test.expected_type_ != reader.ProgramType() ||
+                test.expected_type_ != loaded_res ||
+                program_str.str() != loaded_program_str.str()) {
                 std::cout << color::kRed << "Test failed:" << color::kReset
                           << "\n";
 
@@ -1431,9 +1527,31 @@ void Run() {
         }
     }
 
+    // Test that malformed images are rejected rather than crashing the reader.
+    for (const auto& test : kBadImageData) {
+        bool is_rejected = false;
+
+        try {
+            ImageReader{test.image_.data(), test.image_.size()}.ReadProgram();
+        } catch (std::invalid_argument&) {
+            is_rejected = true;
+        }
+
+        if (!is_rejected) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Image: " << test.description_ << "\n";
+
+            std::cout << color::kRed << "  The image was loaded."
+                      << color::kReset << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 
 }  // namespace test
@@ -1524,9 +1642,79 @@ void InitData() {
                  {"false", Type::Bool()}});
 }
 
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 1000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::pair<std::string, Type&> expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+    Type* lambdas_type = &Type::Bool();
+
+    for (int i = 0; i < n; ++i) {
+        lambdas_type = &Type::Function(Type::Bool(), *lambdas_type);
+    }
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "succ^" + n_str + " 0", Repeat("succ ", n) + "0",
+        {n_str, Type::Nat()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l y:Bool. (l x:Bool.)^" + n_str + " y) true",
+        "(l y:Bool. " + Repeat("l x:Bool. ", n) + "y) true",
+        {Repeat("{l x : Bool. ", n) + "true" + Repeat("}", n),
+         *lambdas_type}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + n_str + " false (else true)^" + n_str,
+        Repeat("if true then ", n) + "false" + Repeat(" else true", n),
+        {"false", Type::Bool()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "x^" + n_str + " x", Repeat("x ", n) + "x",
+        {Repeat("(", n) + "x" + Repeat(" <- x)", n), Type::IllTyped()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "l x:(^" + n_str + " Nat )^" + n_str + ". x",
+        "l x:" + Repeat("(", n) + "Nat" + Repeat(")", n) + ". x",
+        {"{l x : Nat. x}", Type::Function(Type::Nat(), Type::Nat())}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "((l r:{a:^" + n_str + " Nat }^" + n_str + ". r) {a=^" + n_str +
+            " 0 }^" + n_str + ").a^" + n_str,
+        "((l r:" + Repeat("{a:", n) + "Nat" + Repeat("}", n) + ". r) " +
+            Repeat("{a=", n) + "0" + Repeat("}", n) + ")" + Repeat(".a", n),
+        {"0", Type::Nat()}});
+}
+
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests = kData.size() + kDeepTermData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -1578,10 +1766,111 @@ void Run() {
         }
     }
 
+    for (const auto& test : kDeepTermData) {
+        Term program = parser::Parser{std::istringstream{test.input_program_}}
+                           .ParseProgram();
+        bool is_clone_equal = program.Clone() == program;
+        std::string image = parser::ImageWriter().Write(
+            program, test.expected_eval_result_.second);
+        bool is_loaded_equal =
+            parser::ImageReader{image.data(), image.size()}.ReadProgram() ==
+            program;
+        auto actual_eval_res = Interpreter().Interpret(program);
+
+        if (!is_clone_equal || !is_loaded_equal ||
+            actual_eval_res.first != test.expected_eval_result_.first ||
+            actual_eval_res.second != test.expected_eval_result_.second) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
 
+
+namespace program_generator {
+namespace test {
+
+using namespace utils::test;
+using parser::Type;
+
+/**
+ * Generates a program of a random type from every seed and checks that it
+ * parses, has that type and evaluates to a result of that type, and that the
+ * same seed generates the same program again.
+ */
+void Run() {
+    constexpr int kNumSeeds = 200;
+    const Options kOptions = {};
+    std::cout << color::kYellow << "[Generator] Running " << kNumSeeds
+              << " tests...\n"
+              << color::kReset;
+    int num_failed = 0;
+
+    for (int seed = 0; seed < kNumSeeds; ++seed) {
+        Type::Arena arena;
+        Type::Arena::Scope scope{arena};
+        Generator<Type> generator{static_cast<std::uint64_t>(seed), kOptions};
+        Type& type = generator.RandomType();
+        int size = 1 + seed * 7 % 300;
+        std::string program = generator.Generate(type, size);
+
+        Generator<Type> same_generator{static_cast<std::uint64_t>(seed),
+                                       kOptions};
+        Type& same_type = same_generator.RandomType();
+        bool reproducible = &same_type == &type &&
+                            same_generator.Generate(type, size) == program;
+
+        try {
+            parser::Term term =
+                parser::Parser{std::istringstream{program}}.ParseProgram();
+            Type& res = type_checker::TypeChecker().TypeOf(term);
+            auto eval_res = interpreter::Interpreter().Interpret(term);
+
+            if (!reproducible || res != type || eval_res.second != type) {
+                std::cout << color::kRed << "Test failed:" << color::kReset
+                          << "\n";
+
+                std::cout << "  Seed: " << seed << "\n";
+
+                std::cout << "  Input program: " << program << "\n";
+
+                std::cout << color::kGreen
+                          << "  Expected type: " << color::kReset << "\n"
+                          << "    " << type << "\n";
+
+                std::cout << color::kRed << "  Actual type: " << color::kReset
+                          << "\n    " << res << ", evaluated to "
+                          << eval_res.second << "\n";
+
+                ++num_failed;
+            }
+        } catch (std::exception& ex) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Seed: " << seed << "\n";
+
+            std::cout << "  Input program: " << program << "\n";
+
+            std::cout << color::kRed << "  Error: " << color::kReset
+                      << ex.what() << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    std::cout << color::kYellow << "Results: " << color::kReset
+              << (kNumSeeds - num_failed) << " out of " << kNumSeeds
+              << " tests passed.\n";
+}
+
+}  // namespace test
+}  // namespace program_generator
@@ -1,18 +1,32 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
 namespace lexer {
 struct Token {
     enum class Category {
@@ -85,13 +99,36 @@ const std::string kKeywordNat = "Nat";
 class Lexer {
    public:
     Lexer(std::istringstream&& in) {
-        std::istringstream iss(SurroundTokensBySpaces(std::move(in)));
-        token_strings_ =
-            std::vector<std::string>(std::istream_iterator<std::string>{iss},
-                                     std::istream_iterator<std::string>());
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
+        Tokenize(in.str());
+    }
+
+    /**
+     * Returns the offset in the source of the token last returned by
+     * NextToken() (the source's size for MARKER_END).
+     */
+    std::size_t TokenBegin() const {
+        std::size_t token = current_token_;
+
+        return token > 0 && token <= token_offsets_.size()
+                   ? token_offsets_[token - 1]
+                   : source_size_;
+    }
+
+    /**
+     * Returns the offset in the source just past the token last returned by
+     * NextToken().
+     */
+    std::size_t TokenEnd() const {
+        std::size_t token = current_token_;
+
+        return token > 0 && token <= token_offsets_.size()
+                   ? token_offsets_[token - 1] + token_strings_[token - 1].size()
+                   : source_size_;
     }
 
     Token NextToken() {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         Token token;
 
         if (current_token_ == token_strings_.size()) {
@@ -100,39 +137,42 @@ class Lexer {
             return token;
         }
 
-        std::unordered_map<std::string, Token::Category> token_str_to_cat = {
-            {kLambdaInputSymbol, Token::Category::LAMBDA},
+        static const std::unordered_map<std::string, Token::Category>
+            token_str_to_cat = {
+                {kLambdaInputSymbol, Token::Category::LAMBDA},
 
-            {".", Token::Category::DOT},
-            {",", Token::Category::COMMA},
-            {"=", Token::Category::EQUAL},
-            {"(", Token::Category::OPEN_PAREN},
-            {")", Token::Category::CLOSE_PAREN},
-            {"{", Token::Category::OPEN_BRACE},
-            {"}", Token::Category::CLOSE_BRACE},
-            {":", Token::Category::COLON},
-            {"->", Token::Category::ARROW},
+                {".", Token::Category::DOT},
+                {",", Token::Category::COMMA},
+                {"=", Token::Category::EQUAL},
+                {"(", Token::Category::OPEN_PAREN},
+                {")", Token::Category::CLOSE_PAREN},
+                {"{", Token::Category::OPEN_BRACE},
+                {"}", Token::Category::CLOSE_BRACE},
+                {":", Token::Category::COLON},
+                {"->", Token::Category::ARROW},
 
-            {"true", Token::Category::CONSTANT_TRUE},
-            {"false", Token::Category::CONSTANT_FALSE},
+                {"true", Token::Category::CONSTANT_TRUE},
+                {"false", Token::Category::CONSTANT_FALSE},
 
-            {kKeywordBool, Token::Category::KEYWORD_BOOL},
-            {"if", Token::Category::KEYWORD_IF},
-            {"then", Token::Category::KEYWORD_THEN},
-            {"else", Token::Category::KEYWORD_ELSE},
+                {kKeywordBool, Token::Category::KEYWORD_BOOL},
+                {"if", Token::Category::KEYWORD_IF},
+                {"then", Token::Category::KEYWORD_THEN},
+                {"else", Token::Category::KEYWORD_ELSE},
 
-            {"0", Token::Category::CONSTANT_ZERO},
+                {"0", Token::Category::CONSTANT_ZERO},
 
-            {kKeywordNat, Token::Category::KEYWORD_NAT},
-            {"succ", Token::Category::KEYWORD_SUCC},
-            {"pred", Token::Category::KEYWORD_PRED},
-            {"iszero", Token::Category::KEYWORD_ISZERO},
-        };
+                {kKeywordNat, Token::Category::KEYWORD_NAT},
+                {"succ", Token::Category::KEYWORD_SUCC},
+                {"pred", Token::Category::KEYWORD_PRED},
+                {"iszero", Token::Category::KEYWORD_ISZERO},
+            };
 
         auto token_string = token_strings_[current_token_];
 
-        if (token_str_to_cat.find(token_string) != std::end(token_str_to_cat)) {
-            token = Token(token_str_to_cat[token_string]);
+        auto cat_it = token_str_to_cat.find(token_string);
+
+        if (cat_it != std::end(token_str_to_cat)) {
+            token = Token(cat_it->second);
         } else if (IsIdentifierName(token_string)) {
             token = Token(Token::Category::IDENTIFIER, token_string);
         }
@@ -148,33 +188,52 @@ class Lexer {
         }
     }
 
+    /**
+     * Whether c is a character that ends any token it follows (i.e. a
+     * separator or whitespace).
+     */
+    static bool IsTokenBoundary(char c) {
+        return std::isspace(static_cast<unsigned char>(c)) || c == ':' ||
+               c == ',' || c == '.' || c == '=' || c == '(' || c == ')' ||
+               c == '{' || c == '}' || c == '-';
+    }
+
    private:
-    std::string SurroundTokensBySpaces(std::istringstream&& in) {
-        std::ostringstream processed_stream;
-        char c;
-
-        while (in.get(c)) {
-            // Check for one-character separators and surround them with spaces.
-            if (c == ':' || c == ',' || c == '.' || c == '=' || c == '(' ||
-                c == ')' || c == '{' || c == '}') {
-                processed_stream << " " << c << " ";
-            } else if (c == '-') {
-                // Check for the only two-character serparator '->' and surround
-                // it with spaces.
-                if (in.peek() == '>') {
-                    in.get(c);
-                    processed_stream << " -> ";
-                } else {
-                    // Just write '-' and let the lexing error be
-                    // discovered later.
-                    processed_stream << " - ";
+    /**
+     * Splits source into tokens at whitespace and around separators,
+     * recording the offset of each token.
+     */
+    void Tokenize(const std::string& source) {
+        source_size_ = source.size();
+
+        for (std::size_t i = 0; i < source.size();) {
+            char c = source[i];
+
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                ++i;
+                continue;
+            }
+
+            std::size_t length = 1;
+
+            if (c == '-') {
+                // The only two-character separator is '->'. A lone '-' is
+                // a token of its own, and the lexing error is discovered
+                // later.
+                if (i + 1 < source.size() && source[i + 1] == '>') {
+                    length = 2;
+                }
+            } else if (!IsTokenBoundary(c)) {
+                while (i + length < source.size() &&
+                       !IsTokenBoundary(source[i + length])) {
+                    ++length;
                 }
-            } else {
-                processed_stream << c;
             }
-        }
 
-        return processed_stream.str();
+            token_offsets_.push_back(i);
+            token_strings_.push_back(source.substr(i, length));
+            i += length;
+        }
     }
 
     bool IsIdentifierName(std::string token_text) {
@@ -189,6 +248,8 @@ class Lexer {
 
    private:
     std::vector<std::string> token_strings_;
+    std::vector<std::size_t> token_offsets_;
+    std::size_t source_size_ = 0;
     int current_token_ = 0;
 };
 
@@ -248,6 +309,80 @@ class Type {
     friend std::ostream& operator<<(std::ostream&, const Type&);
 
    public:
+    /**
+     * Owns the function and record types interned while it is the current
+     * arena of a thread (see Scope). Interned types only live as long as
+     * their arena, so a long-running process can drop an arena together with
+     * everything that refers to its types (e.g. a request's program, type
+     * checker and evaluation) instead of keeping every type it ever saw.
+     * Types interned outside of any Scope go to a global arena that is never
+     * dropped. The base types are global as well.
+     *
+     * Types of different arenas are distinct objects but compare equal with
+     * operator== if they are structurally equal. A type must not refer to
+     * the types of an arena that is dropped before its own.
+     */
+    class Arena {
+       public:
+        /**
+         * Makes an arena the current arena of this thread while it exists.
+         */
+        class Scope {
+           public:
+            explicit Scope(Arena& arena) : previous_(CurrentSlot()) {
+                CurrentSlot() = &arena;
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() { CurrentSlot() = previous_; }
+
+           private:
+            Arena* previous_;
+        };
+
+        Arena() = default;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        static Arena& Current() {
+            static Arena global;
+            Arena* current = CurrentSlot();
+
+            return current ? *current : global;
+        }
+
+        /**
+         * The number of types interned in the arena.
+         */
+        std::size_t Size() {
+            std::lock_guard<std::mutex> lock{mutex_};
+
+            return function_types_.size() + record_types_.size();
+        }
+
+       private:
+        friend class Type;
+
+        static Arena*& CurrentSlot() {
+            static thread_local Arena* current = nullptr;
+
+            return current;
+        }
+
+        // The labels and types of a record type's fields.
+        using RecordKey = std::vector<std::pair<std::string, const Type*>>;
+
+        std::mutex mutex_;
+        // The interned types by the types they consist of, so interning a
+        // type takes logarithmic time in the number of types of the arena.
+        std::map<std::pair<const Type*, const Type*>, std::unique_ptr<Type>>
+            function_types_;
+        std::map<RecordKey, std::unique_ptr<Type>> record_types_;
+    };
+
     static Type& Top() {
         static Type type;
         type.category_ = TypeCategory::TOP;
@@ -274,41 +409,40 @@ class Type {
     }
 
     static Type& Function(Type& lhs, Type& rhs) {
-        static std::vector<std::unique_ptr<Type>> type_pool;
-
-        auto result =
-            std::find_if(std::begin(type_pool), std::end(type_pool),
-                         [&](const std::unique_ptr<Type>& type) {
-                             return type->lhs_ == &lhs && type->rhs_ == &rhs;
-                         });
-
-        if (result != std::end(type_pool)) {
-            return **result;
+        Arena& arena = Arena::Current();
+        // An arena may be used by several threads (e.g. the global one by the
+        // evaluation server's workers).
+        std::lock_guard<std::mutex> lock{arena.mutex_};
+        auto& type = arena.function_types_[{&lhs, &rhs}];
+
+        if (!type) {
+            type.reset(new Type(lhs, rhs));
         }
 
-        type_pool.emplace_back(std::unique_ptr<Type>(new Type(lhs, rhs)));
-
-        return *type_pool.back();
+        return *type;
     }
 
     using RecordFields = std::unordered_map<std::string, Type&>;
 
     static Type& Record(RecordFields fields) {
-        static std::vector<std::unique_ptr<Type>> type_pool;
+        Arena& arena = Arena::Current();
+        std::lock_guard<std::mutex> lock{arena.mutex_};
+        Arena::RecordKey key;
 
-        auto result = std::find_if(std::begin(type_pool), std::end(type_pool),
-                                   [&](const std::unique_ptr<Type>& type) {
-                                       return type->record_fields_ == fields;
-                                   });
-
-        if (result != std::end(type_pool)) {
-            return **result;
+        for (const auto& [label, field_type] : fields) {
+            key.emplace_back(label, &field_type);
         }
 
-        type_pool.emplace_back(
-            std::unique_ptr<Type>(new Type(std::move(fields))));
+        // Equal sets of fields may be iterated in different orders.
+        std::sort(std::begin(key), std::end(key));
+
+        auto& type = arena.record_types_[std::move(key)];
 
-        return *type_pool.back();
+        if (!type) {
+            type.reset(new Type(std::move(fields)));
+        }
+
+        return *type;
     }
 
     Type(const Type&) = delete;
@@ -319,24 +453,54 @@ class Type {
 
     ~Type() = default;
 
+    /**
+     * Compares types structurally using an explicit stack, since the types of
+     * deeply nested terms are deeply nested as well.
+     */
     bool operator==(const Type& other) const {
-        if (category_ != other.category_) {
-            return false;
-        }
+        std::vector<std::pair<const Type*, const Type*>> stack{{this, &other}};
+
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
+
+            // A type interned in the same arena is the same object.
+            if (lhs == rhs) {
+                continue;
+            }
+
+            if (lhs->category_ != rhs->category_) {
+                return false;
+            }
+
+            if (lhs->category_ == TypeCategory::BASE) {
+                if (lhs->base_type_ != rhs->base_type_) {
+                    return false;
+                }
+            } else if (lhs->category_ == TypeCategory::FUNCTION) {
+                assert(lhs->lhs_ && lhs->rhs_ && rhs->lhs_ && rhs->rhs_);
+                stack.push_back({lhs->rhs_, rhs->rhs_});
+                stack.push_back({lhs->lhs_, rhs->lhs_});
+            } else if (lhs->category_ == TypeCategory::RECORD) {
+                const auto& rhs_fields = rhs->record_fields_;
+
+                if (lhs->record_fields_.size() != rhs_fields.size()) {
+                    return false;
+                }
+
+                for (const auto& [label, field_type] : lhs->record_fields_) {
+                    auto rhs_it = rhs_fields.find(label);
+
+                    if (rhs_it == std::end(rhs_fields)) {
+                        return false;
+                    }
 
-        switch (category_) {
-            case TypeCategory::TOP:
-                return other.category_ == TypeCategory::TOP;
-            case TypeCategory::ILL:
-                return other.category_ == TypeCategory::ILL;
-            case TypeCategory::BASE:
-                return base_type_ == other.base_type_;
-            case TypeCategory::FUNCTION:
-                assert(lhs_ && rhs_ && other.lhs_ && other.rhs_);
-                return (*lhs_ == *other.lhs_) && (*rhs_ == *other.rhs_);
-            case TypeCategory::RECORD:
-                return record_fields_ == other.record_fields_;
+                    stack.push_back({&field_type, &rhs_it->second});
+                }
+            }
         }
+
+        return true;
     }
 
     bool operator!=(const Type& other) const { return !(*this == other); }
@@ -416,40 +580,71 @@ class Type {
     RecordFields record_fields_{};
 };
 
+/**
+ * Prints type using an explicit stack, so that arbitrarily deep types can be
+ * printed.
+ */
 std::ostream& operator<<(std::ostream& out, const Type& type) {
-    if (type.IsTop()) {
-        out << lexer::kKeywordTop;
-    } else if (type.IsBool()) {
-        out << lexer::kKeywordBool;
-    } else if (type.IsNat()) {
-        out << lexer::kKeywordNat;
-    } else if (type.IsFunction()) {
-        out << "(" << *type.lhs_ << " "
-            << lexer::Token(lexer::Token::Category::ARROW) << " " << *type.rhs_
-            << ")";
-    } else if (type.IsRecord()) {
-        out << "{";
-
-        bool first = true;
-        for (auto& field : type.record_fields_) {
-            if (!first) {
-                out << ", ";
-            }
-
-            first = false;
-            out << field.first << ":" << field.second;
-        }
-
-        out << "}";
-    } else {
-        out << "Ⱦ";
+    std::ostringstream arrow_ss;
+    arrow_ss << " " << lexer::Token(lexer::Token::Category::ARROW) << " ";
+    const std::string arrow = arrow_ss.str();
+    // Work items, last one first: either a type to print or, if type is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Type*, std::string_view>> stack{{&type, {}}};
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+        } else if (current->IsTop()) {
+            out << lexer::kKeywordTop;
+        } else if (current->IsBool()) {
+            out << lexer::kKeywordBool;
+        } else if (current->IsNat()) {
+            out << lexer::kKeywordNat;
+        } else if (current->IsFunction()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->rhs_, {}});
+            stack.push_back({nullptr, arrow});
+            stack.push_back({current->lhs_, {}});
+        } else if (current->IsRecord()) {
+            out << "{";
+            stack.push_back({nullptr, "}"});
+            // The fields are pushed in reverse, so that they are printed in
+            // the order of record_fields_.
+            std::vector<std::pair<const Type*, std::string_view>> fields;
+            bool first = true;
+
+            for (auto& field : current->record_fields_) {
+                if (!first) {
+                    fields.push_back({nullptr, ", "});
+                }
+
+                first = false;
+                fields.push_back({nullptr, field.first});
+                fields.push_back({nullptr, ":"});
+                fields.push_back({&field.second, {}});
+            }
+
+            stack.insert(std::end(stack), fields.rbegin(), fields.rend());
+        } else {
+            out << "Ⱦ";
+        }
     }
 
     return out;
 }
 
-class Term {
+class ImageReader;
+class ImageWriter;
+
+class Term : private budget::Counted<Term> {
     friend std::ostream& operator<<(std::ostream&, const Term&);
+    friend class ImageReader;
+    friend class ImageWriter;
 
    public:
     static Term Lambda(std::string arg_name, Type& arg_type) {
@@ -458,6 +653,7 @@ class Term {
         result.lambda_arg_type_ = &arg_type;
         result.category_ = Category::LAMBDA;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -467,6 +663,8 @@ class Term {
         result.de_bruijn_idx_ = de_bruijn_idx;
         result.category_ = Category::VARIABLE;
 
+        result.UpdateFreeVariableBound();
+        result.UpdateIsValue();
         return result;
     }
 
@@ -477,6 +675,7 @@ class Term {
         result.application_lhs_ = std::move(lhs);
         result.application_rhs_ = std::move(rhs);
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -491,6 +690,7 @@ class Term {
         Term result;
         result.category_ = Category::TRUE;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -498,6 +698,7 @@ class Term {
         Term result;
         result.category_ = Category::FALSE;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -526,6 +727,7 @@ class Term {
         Term result;
         result.category_ = Category::ZERO;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -533,6 +735,7 @@ class Term {
         Term result;
         result.category_ = Category::RECORD;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -542,6 +745,7 @@ class Term {
         result.projection_label_ = label;
         result.category_ = Category::PROJECTION;
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -553,7 +757,29 @@ class Term {
     Term(Term&&) = default;
     Term& operator=(Term&&) = default;
 
-    ~Term() = default;
+    /**
+     * Destroys the sub-terms iteratively. The implicit destructor would recurse
+     * once per nesting level and overflow the stack for deep terms.
+     */
+    ~Term() {
+        std::vector<std::unique_ptr<Term>> pending;
+        DetachSubTerms(pending);
+
+        while (!pending.empty()) {
+            std::unique_ptr<Term> term = std::move(pending.back());
+            pending.pop_back();
+            // term is destroyed at the end of the iteration, after its
+            // sub-terms were detached.
+            term->DetachSubTerms(pending);
+        }
+    }
+
+    /**
+     * Returns an id that no other Term of the process had or will have, so
+     * unlike the Term's address it can key caches that outlive the Term. The
+     * id moves with the Term's content.
+     */
+    std::uint64_t GetId() const { return id_.Get(); }
 
     bool IsLambda() const { return category_ == Category::LAMBDA; }
 
@@ -581,6 +807,65 @@ class Term {
 
     bool IsProjection() const { return category_ == Category::PROJECTION; }
 
+    /**
+     * Whether this Term is a value, i.e. evaluation stops at it. Cached so that
+     * it can be checked in constant time, see UpdateIsValue().
+     */
+    bool IsValue() const { return is_value_; }
+
+    /**
+     * Whether this Term is a numeric value, i.e. 0 or succ of a numeric value.
+     */
+    bool IsNatValue() const { return is_nat_value_; }
+
+    /**
+     * Returns 1 + the largest de Bruijn index of the free variables of this
+     * Term (0 if it is closed).
+     */
+    int FreeVariableBound() const { return free_variable_bound_; }
+
+    /**
+     * Recalculates IsValue() and IsNatValue() from the ones of the direct
+     * sub-terms. Term keeps them up to date itself, except when a sub-term is
+     * rewritten in place (e.g. during evaluation); then this has to be called
+     * for the enclosing Terms, innermost first.
+     */
+    void UpdateIsValue() {
+        is_nat_value_ =
+            IsConstantZero() ||
+            (IsSucc() && unary_op_arg_ && unary_op_arg_->is_nat_value_);
+
+        if (IsRecord()) {
+            is_value_ = true;
+
+            for (auto& record_term : record_terms_) {
+                is_value_ = is_value_ && record_term->is_value_;
+            }
+        } else {
+            is_value_ = IsLambda() || IsVariable() || IsTrue() || IsFalse() ||
+                        is_nat_value_;
+        }
+    }
+
+    /**
+     * Recalculates FreeVariableBound() from the ones of the direct sub-terms.
+     * Like UpdateIsValue(), this has to be called for the Terms enclosing a
+     * sub-term that is replaced in place.
+     */
+    void UpdateFreeVariableBound() {
+        if (IsVariable()) {
+            free_variable_bound_ = std::max(de_bruijn_idx_ + 1, 0);
+            return;
+        }
+
+        int bound = 0;
+        ForEachSubterm([&bound](Term& sub_term, int num_binders) {
+            bound = std::max(bound,
+                             sub_term.free_variable_bound_ - num_binders);
+        });
+        free_variable_bound_ = bound;
+    }
+
     bool IsInvalid() const {
         if (IsLambda()) {
             return lambda_arg_name_.empty() || !lambda_arg_type_ ||
@@ -620,97 +905,20 @@ class Term {
                 "Term::Combine() received an invalid Term.");
         }
 
-        if (IsLambda()) {
-            if (lambda_body_) {
-                // If the lambda body was completely parsed, then combining this
-                // term and the argument term means applying this lambda to the
-                // argument.
-                if (is_complete_) {
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    lambda_body_ = nullptr;
-                    lambda_arg_name_ = "";
-                    is_complete_ = false;
-                } else {
-                    lambda_body_->Combine(std::move(term));
-                }
-            } else {
-                lambda_body_ = std::make_unique<Term>(std::move(term));
-            }
-        } else if (IsVariable()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
-
-            variable_name_ = "";
-        } else if (IsApplication()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
-        } else if (IsIf()) {
-            if (!if_condition_) {
-                if_condition_ = std::make_unique<Term>(std::move(term));
-            } else if (!if_then_) {
-                if_then_ = std::make_unique<Term>(std::move(term));
-            } else {
-                if (!if_else_) {
-                    if_else_ = std::make_unique<Term>(std::move(term));
-                } else {
-                    // If the if condition was completely parsed, then combining
-                    // this term and the argument term means applying this
-                    // lambda to the argument.
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    if_condition_ = nullptr;
-                    if_then_ = nullptr;
-                    if_else_ = nullptr;
-                }
-            }
-        } else if (IsSucc()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with succ(...).");
-            }
-        } else if (IsPred()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with pred(...).");
-            }
-        } else if (IsIsZero()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with iszero(...).");
-            }
-        } else if (IsTrue() || IsFalse() || IsConstantZero()) {
-            throw std::invalid_argument("Trying to combine with a constant.");
-        } else if (IsRecord()) {
-            if (is_complete_) {
-                throw std::logic_error(
-                    "Trying to combine with a complete Record.");
-            }
+        // A term combined into a lambda whose body is still being parsed is
+        // combined into the body instead. Walk down such bodies in a loop
+        // since they may be nested arbitrarily deep.
+        std::vector<Term*> path{this};
 
-            if (!IsRecordExpectingTerm()) {
-                throw std::logic_error(
-                    "Trying to combine with a Record while it isn't expecting "
-                    "a value.");
-            }
+        while (Term* sub_term = path.back()->IncompleteSubTerm()) {
+            path.push_back(sub_term);
+        }
 
-            record_terms_.push_back(std::make_unique<Term>(std::move(term)));
-        } else if (IsProjection()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
+        path.back()->CombineHere(std::move(term));
 
-            projection_label_ = "";
-        } else {
-            *this = std::move(term);
+        for (auto it = path.rbegin() + 1; it != path.rend(); ++it) {
+            (*it)->UpdateFreeVariableBound();
+            (*it)->UpdateIsValue();
         }
 
         return *this;
@@ -734,26 +942,39 @@ class Term {
      * distance amount. For an example use, see Term::Substitute(int, Term&).
      */
     void Shift(int distance) {
-        std::function<void(int, Term&)> walk = [&distance, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
             if (term.IsInvalid()) {
                 throw std::invalid_argument("Trying to shift an invalid term.");
             }
 
-            if (term.IsVariable()) {
-                if (term.de_bruijn_idx_ >= binding_context_size) {
-                    term.de_bruijn_idx_ += distance;
-                }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
+            // Skip sub-terms whose variables are all bound inside this Term.
+            if (term.free_variable_bound_ <= entry.binding_context_size) {
+                continue;
             }
-        };
 
-        walk(0, *this);
+            if (term.IsVariable()) {
+                term.de_bruijn_idx_ += distance;
+                term.UpdateFreeVariableBound();
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
+            }
+        }
     }
 
     /**
@@ -766,40 +987,45 @@ class Term {
                 "Trying to substitute using invalid terms.");
         }
 
-        std::function<void(int, Term&)> walk = [&variable, &sub, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                term.UpdateIsValue();
+                continue;
+            }
+
+            // Adjust variable according to the current binding depth before
+            // comparing it with term's free variables.
+            int term_variable = variable + entry.binding_context_size;
+
+            // Skip sub-terms in which variable doesn't occur.
+            if (term.free_variable_bound_ <= term_variable) {
+                continue;
+            }
+
             if (term.IsVariable()) {
-                // Adjust variable according to the current binding
-                // depth before comparing term's index.
-                if (term.de_bruijn_idx_ == variable + binding_context_size) {
+                if (term.de_bruijn_idx_ == term_variable) {
                     // Shift sub up by binding_context_size distance since sub
                     // is now substituted in binding_context_size deep context.
                     auto clone = sub.Clone();
-                    clone.Shift(binding_context_size);
+                    clone.Shift(entry.binding_context_size);
                     std::swap(term, clone);
                 }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
-            } else if (term.IsIf()) {
-                walk(binding_context_size, *term.if_condition_);
-                walk(binding_context_size, *term.if_then_);
-                walk(binding_context_size, *term.if_else_);
-            } else if (term.IsSucc()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsPred()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsIsZero()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsProjection()) {
-                walk(binding_context_size, *term.projection_term_);
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubterm([&](Term& sub_term, int num_binders) {
+                    stack.push_back(
+                        {&sub_term, entry.binding_context_size + num_binders,
+                         false});
+                });
             }
-        };
-
-        walk(0, *this);
+        }
     }
 
     Term& LambdaBody() const {
@@ -902,162 +1128,220 @@ class Term {
 
     std::string ProjectionLabel() const { return projection_label_; }
 
-    bool operator==(const Term& other) const {
-        if (IsLambda() && other.IsLambda()) {
-            return LambdaArgType() == other.LambdaArgType() &&
-                   LambdaBody() == other.LambdaBody();
-        }
-
-        if (IsVariable() && other.IsVariable()) {
-            return de_bruijn_idx_ == other.de_bruijn_idx_;
+    /**
+     * Returns the number of nodes of this Term and its depth (the number of
+     * nodes on its longest path from the root).
+     */
+    std::pair<std::size_t, std::size_t> SizeAndDepth() const {
+        std::size_t size = 0;
+        std::size_t depth = 0;
+        std::vector<std::pair<const Term*, std::size_t>> stack{{this, 1}};
+
+        while (!stack.empty()) {
+            auto [term, term_depth] = stack.back();
+            stack.pop_back();
+            ++size;
+            depth = std::max(depth, term_depth);
+            term->ForEachSubterm([&](const Term& sub_term, int) {
+                stack.push_back({&sub_term, term_depth + 1});
+            });
         }
 
-        if (IsApplication() && other.IsApplication()) {
-            return (ApplicationLHS() == other.ApplicationLHS()) &&
-                   (ApplicationRHS() == other.ApplicationRHS());
-        }
+        return {size, depth};
+    }
 
-        if (IsIf() && other.IsIf()) {
-            return (IfCondition() == other.IfCondition()) &&
-                   (IfThen() == other.IfThen()) && (IfElse() == other.IfElse());
-        }
+    bool operator==(const Term& other) const {
+        std::vector<std::pair<const Term*, const Term*>> stack{{this, &other}};
 
-        if (IsTrue() && other.IsTrue()) {
-            return true;
-        }
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
 
-        if (IsFalse() && other.IsFalse()) {
-            return true;
-        }
+            if (lhs->category_ != rhs->category_) {
+                return false;
+            }
 
-        if (IsSucc() && other.IsSucc()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
+            if (lhs->IsLambda()) {
+                if (lhs->LambdaArgType() != rhs->LambdaArgType()) {
+                    return false;
+                }
 
-        if (IsPred() && other.IsPred()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
-
-        if (IsIsZero() && other.IsIsZero()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
-
-        if (IsConstantZero() && other.IsConstantZero()) {
-            return true;
-        }
+                stack.push_back({&lhs->LambdaBody(), &rhs->LambdaBody()});
+            } else if (lhs->IsVariable()) {
+                if (lhs->de_bruijn_idx_ != rhs->de_bruijn_idx_) {
+                    return false;
+                }
+            } else if (lhs->IsApplication()) {
+                stack.push_back(
+                    {&lhs->ApplicationRHS(), &rhs->ApplicationRHS()});
+                stack.push_back(
+                    {&lhs->ApplicationLHS(), &rhs->ApplicationLHS()});
+            } else if (lhs->IsIf()) {
+                stack.push_back({&lhs->IfElse(), &rhs->IfElse()});
+                stack.push_back({&lhs->IfThen(), &rhs->IfThen()});
+                stack.push_back({&lhs->IfCondition(), &rhs->IfCondition()});
+            } else if (lhs->IsSucc() || lhs->IsPred() || lhs->IsIsZero()) {
+                stack.push_back({&lhs->UnaryOpArg(), &rhs->UnaryOpArg()});
+            } else if (lhs->IsRecord()) {
+                if (lhs->record_labels_ != rhs->record_labels_ ||
+                    lhs->record_terms_.size() != rhs->record_terms_.size()) {
+                    return false;
+                }
 
-        if (IsRecord() && other.IsRecord()) {
-            return record_labels_ == record_labels_ &&
-                   record_terms_ == record_terms_;
-        }
+                for (int i = lhs->record_terms_.size() - 1; i >= 0; --i) {
+                    stack.push_back({lhs->record_terms_[i].get(),
+                                     rhs->record_terms_[i].get()});
+                }
+            } else if (lhs->IsProjection()) {
+                if (lhs->projection_label_ != rhs->projection_label_) {
+                    return false;
+                }
 
-        if (IsProjection() && other.IsProjection()) {
-            return projection_label_ == other.projection_label_ &&
-                   *projection_term_ == *other.projection_term_;
+                stack.push_back(
+                    {lhs->projection_term_.get(), rhs->projection_term_.get()});
+            } else if (!lhs->IsTrue() && !lhs->IsFalse() &&
+                       !lhs->IsConstantZero()) {
+                return false;
+            }
         }
 
-        return false;
+        return true;
     }
 
     bool operator!=(const Term& other) const { return !(*this == other); }
 
     std::string ASTString(int indentation = 0) const {
         std::ostringstream out;
-        std::string prefix = std::string(indentation, '-');
-        std::string prefix_extra = std::string(indentation + 2, '-');
-
-        if (IsLambda()) {
-            out << prefix << "λ " << lambda_arg_name_ << ":"
-                << *lambda_arg_type_ << "\n";
-            out << lambda_body_->ASTString(indentation + 2);
-        } else if (IsVariable()) {
-            out << prefix << variable_name_ << "[" << de_bruijn_idx_ << "]";
-        } else if (IsApplication()) {
-            out << prefix << "<-\n";
-            out << application_lhs_->ASTString(indentation + 2) << "\n";
-            out << application_rhs_->ASTString(indentation + 2);
-        } else if (IsIf()) {
-            out << prefix << "if\n";
-            out << if_condition_->ASTString(indentation + 2) << "\n";
-            out << prefix << "then\n";
-            out << if_then_->ASTString(indentation + 2) << "\n";
-            out << prefix << "else\n";
-            out << if_else_->ASTString(indentation + 2);
-        } else if (IsTrue()) {
-            out << prefix << "true";
-        } else if (IsFalse()) {
-            out << prefix << "false";
-        } else if (IsSucc()) {
-            out << prefix << "succ\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsPred()) {
-            out << prefix << "pred\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsIsZero()) {
-            out << prefix << "iszero\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsConstantZero()) {
-            out << prefix << "0";
-        } else if (IsRecord()) {
-            out << prefix << "{\n";
+        // Work items, last one first: either a sub-term to print at some
+        // indentation or, if term is nullptr, a piece of text to print as is.
+        struct Item {
+            const Term* term;
+            int indentation;
+            std::string text;
+        };
+        std::vector<Item> stack{{this, indentation, ""}};
 
-            for (int i = 0; i < record_labels_.size(); ++i) {
-                out << prefix << "=\n";
+        while (!stack.empty()) {
+            Item item = std::move(stack.back());
+            stack.pop_back();
 
-                out << prefix_extra << record_labels_[i] << "\n";
-                out << record_terms_[i]->ASTString(indentation + 2) << "\n";
+            if (!item.term) {
+                out << item.text;
+                continue;
             }
 
-            out << prefix << "}";
-        } else if (IsProjection()) {
-            out << prefix << ".\n";
-            out << projection_term_->ASTString(indentation + 2) << "\n";
-            out << prefix_extra << projection_label_;
+            const Term& term = *item.term;
+            std::string prefix = std::string(item.indentation, '-');
+            std::string prefix_extra = std::string(item.indentation + 2, '-');
+            int sub = item.indentation + 2;
+
+            if (term.IsLambda()) {
+                out << prefix << "λ " << term.lambda_arg_name_ << ":"
+                    << *term.lambda_arg_type_ << "\n";
+                stack.push_back({term.lambda_body_.get(), sub, ""});
+            } else if (term.IsVariable()) {
+                out << prefix << term.variable_name_ << "["
+                    << term.de_bruijn_idx_ << "]";
+            } else if (term.IsApplication()) {
+                out << prefix << "<-\n";
+                stack.push_back({term.application_rhs_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n"});
+                stack.push_back({term.application_lhs_.get(), sub, ""});
+            } else if (term.IsIf()) {
+                out << prefix << "if\n";
+                stack.push_back({term.if_else_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "else\n"});
+                stack.push_back({term.if_then_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "then\n"});
+                stack.push_back({term.if_condition_.get(), sub, ""});
+            } else if (term.IsTrue()) {
+                out << prefix << "true";
+            } else if (term.IsFalse()) {
+                out << prefix << "false";
+            } else if (term.IsSucc() || term.IsPred() || term.IsIsZero()) {
+                out << prefix
+                    << (term.IsSucc()   ? "succ\n"
+                        : term.IsPred() ? "pred\n"
+                                        : "iszero\n");
+                stack.push_back({term.unary_op_arg_.get(), sub, ""});
+            } else if (term.IsConstantZero()) {
+                out << prefix << "0";
+            } else if (term.IsRecord()) {
+                out << prefix << "{\n";
+                stack.push_back({nullptr, 0, prefix + "}"});
+
+                for (int i = term.record_labels_.size() - 1; i >= 0; --i) {
+                    stack.push_back({nullptr, 0, "\n"});
+                    stack.push_back({term.record_terms_[i].get(), sub, ""});
+                    stack.push_back({nullptr, 0,
+                                     prefix + "=\n" + prefix_extra +
+                                         term.record_labels_[i] + "\n"});
+                }
+            } else if (term.IsProjection()) {
+                out << prefix << ".\n";
+                stack.push_back({nullptr, 0,
+                                 "\n" + prefix_extra + term.projection_label_});
+                stack.push_back({term.projection_term_.get(), sub, ""});
+            }
         }
 
         return out.str();
     }
 
+    /**
+     * Copies this Term iteratively so that arbitrarily deep terms can be
+     * cloned.
+     */
     Term Clone() const {
-        if (IsInvalid()) {
-            throw std::logic_error("Trying to clone an invalid term.");
-        }
+        Term clone;
+        // Pairs of an original term and its (so far empty) clone.
+        std::vector<std::pair<const Term*, Term*>> stack{{this, &clone}};
 
-        if (IsLambda()) {
-            return std::move(Lambda(lambda_arg_name_, *lambda_arg_type_)
-                                 .Combine(lambda_body_->Clone()));
-        } else if (IsVariable()) {
-            return Variable(variable_name_, de_bruijn_idx_);
-        } else if (IsApplication()) {
-            return Application(
-                std::make_unique<Term>(application_lhs_->Clone()),
-                std::make_unique<Term>(application_rhs_->Clone()));
-        } else if (IsTrue()) {
-            return Term::True();
-        } else if (IsFalse()) {
-            return Term::False();
-        } else if (IsConstantZero()) {
-            return Term::Zero();
-        } else if (IsSucc()) {
-            return std::move(Term::Succ().Combine(unary_op_arg_->Clone()));
-        } else if (IsSucc()) {
-            return std::move(Term::Pred().Combine(unary_op_arg_->Clone()));
-        } else if (IsIsZero()) {
-            return std::move(Term::IsZero().Combine(unary_op_arg_->Clone()));
-        } else if (IsRecord()) {
-            Term result = Term::Record();
+        while (!stack.empty()) {
+            auto [original, copy] = stack.back();
+            stack.pop_back();
 
-            for (int i = 0; i < record_labels_.size(); ++i) {
-                result.AddRecordLabel(record_labels_[i]);
-                result.Combine(record_terms_[i]->Clone());
+            if (original->IsInvalid()) {
+                throw std::logic_error("Trying to clone an invalid term.");
             }
 
-            return std::move(result);
+            copy->category_ = original->category_;
+            copy->lambda_arg_name_ = original->lambda_arg_name_;
+            copy->lambda_arg_type_ = original->lambda_arg_type_;
+            copy->variable_name_ = original->variable_name_;
+            copy->de_bruijn_idx_ = original->de_bruijn_idx_;
+            copy->record_labels_ = original->record_labels_;
+            copy->projection_label_ = original->projection_label_;
+            copy->free_variable_bound_ = original->free_variable_bound_;
+            copy->is_value_ = original->is_value_;
+            copy->is_nat_value_ = original->is_nat_value_;
+            copy->is_complete_ = original->is_complete_;
+
+            auto clone_sub_term = [&stack](const std::unique_ptr<Term>& from,
+                                           std::unique_ptr<Term>& to) {
+                if (from) {
+                    to = std::make_unique<Term>();
+                    stack.push_back({from.get(), to.get()});
+                }
+            };
+
+            clone_sub_term(original->lambda_body_, copy->lambda_body_);
+            clone_sub_term(original->application_lhs_, copy->application_lhs_);
+            clone_sub_term(original->application_rhs_, copy->application_rhs_);
+            clone_sub_term(original->if_condition_, copy->if_condition_);
+            clone_sub_term(original->if_then_, copy->if_then_);
+            clone_sub_term(original->if_else_, copy->if_else_);
+            clone_sub_term(original->unary_op_arg_, copy->unary_op_arg_);
+            clone_sub_term(original->projection_term_, copy->projection_term_);
+            copy->record_terms_.resize(original->record_terms_.size());
+
+            for (std::size_t i = 0; i < original->record_terms_.size(); ++i) {
+                clone_sub_term(original->record_terms_[i],
+                               copy->record_terms_[i]);
+            }
         }
 
-        std::ostringstream error_ss;
-        error_ss << "Couldn't clone term: " << *this;
-        throw std::logic_error(error_ss.str());
+        return clone;
     }
 
     bool IsRecordExpectingLabel() const {
@@ -1085,6 +1369,193 @@ class Term {
     bool is_complete_ = false;
 
    private:
+    /**
+     * An entry of the explicit stacks used by Shift() and Substitute().
+     */
+    struct WalkEntry {
+        Term* term;
+        // The number of binders between term and the Term being walked.
+        int binding_context_size;
+        // Whether term's sub-terms were walked already (i.e. term is visited
+        // for the second time to update its free_variable_bound_).
+        bool sub_terms_walked;
+    };
+
+    /**
+     * Combines term into this Term itself (see Combine()).
+     */
+    void CombineHere(Term&& term) {
+        if (IsLambda()) {
+            if (lambda_body_) {
+                // If the lambda body was completely parsed, then combining this
+                // term and the argument term means applying this lambda to the
+                // argument.
+                *this = Application(std::make_unique<Term>(std::move(*this)),
+                                    std::make_unique<Term>(std::move(term)));
+
+                lambda_body_ = nullptr;
+                lambda_arg_name_ = "";
+                is_complete_ = false;
+            } else {
+                lambda_body_ = std::make_unique<Term>(std::move(term));
+            }
+        } else if (IsVariable()) {
+            *this = Application(std::make_unique<Term>(std::move(*this)),
+                                std::make_unique<Term>(std::move(term)));
+
+            variable_name_ = "";
+        } else if (IsApplication()) {
+            *this = Application(std::make_unique<Term>(std::move(*this)),
+                                std::make_unique<Term>(std::move(term)));
+        } else if (IsIf()) {
+            if (!if_condition_) {
+                if_condition_ = std::make_unique<Term>(std::move(term));
+            } else if (!if_then_) {
+                if_then_ = std::make_unique<Term>(std::move(term));
+            } else {
+                if (!if_else_) {
+                    if_else_ = std::make_unique<Term>(std::move(term));
+                } else {
+                    // If the if condition was completely parsed, then combining
+                    // this term and the argument term means applying this
+                    // lambda to the argument.
+                    *this =
+                        Application(std::make_unique<Term>(std::move(*this)),
+                                    std::make_unique<Term>(std::move(term)));
+
+                    if_condition_ = nullptr;
+                    if_then_ = nullptr;
+                    if_else_ = nullptr;
+                }
+            }
+        } else if (IsSucc()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_unique<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with succ(...).");
+            }
+        } else if (IsPred()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_unique<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with pred(...).");
+            }
+        } else if (IsIsZero()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_unique<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with iszero(...).");
+            }
+        } else if (IsTrue() || IsFalse() || IsConstantZero()) {
+            throw std::invalid_argument("Trying to combine with a constant.");
+        } else if (IsRecord()) {
+            if (is_complete_) {
+                throw std::logic_error(
+                    "Trying to combine with a complete Record.");
+            }
+
+            if (!IsRecordExpectingTerm()) {
+                throw std::logic_error(
+                    "Trying to combine with a Record while it isn't expecting "
+                    "a value.");
+            }
+
+            record_terms_.push_back(std::make_unique<Term>(std::move(term)));
+        } else if (IsProjection()) {
+            *this = Application(std::make_unique<Term>(std::move(*this)),
+                                std::make_unique<Term>(std::move(term)));
+
+            projection_label_ = "";
+        } else {
+            *this = std::move(term);
+        }
+
+        if (IsRecord()) {
+            // Only the last field can have changed, so there is no need to
+            // visit all fields.
+            if (!record_terms_.empty()) {
+                free_variable_bound_ =
+                    std::max(free_variable_bound_,
+                             record_terms_.back()->free_variable_bound_);
+                is_value_ = is_value_ && record_terms_.back()->is_value_;
+            }
+        } else {
+            UpdateFreeVariableBound();
+            UpdateIsValue();
+        }
+    }
+
+    /**
+     * Returns the lambda body that is still being parsed and into which terms
+     * combined into this Term go, or nullptr if there is none.
+     */
+    Term* IncompleteSubTerm() const {
+        if (IsLambda() && lambda_body_ && !is_complete_) {
+            return lambda_body_.get();
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Moves the direct sub-terms of this Term to sub_terms.
+     */
+    void DetachSubTerms(std::vector<std::unique_ptr<Term>>& sub_terms) {
+        for (auto* sub_term :
+             {&lambda_body_, &application_lhs_, &application_rhs_,
+              &if_condition_, &if_then_, &if_else_, &unary_op_arg_,
+              &projection_term_}) {
+            if (*sub_term) {
+                sub_terms.push_back(std::move(*sub_term));
+            }
+        }
+
+        for (auto& record_term : record_terms_) {
+            if (record_term) {
+                sub_terms.push_back(std::move(record_term));
+            }
+        }
+
+        record_terms_.clear();
+    }
+
+    /**
+     * Calls visit(sub_term, num_binders) for each direct sub-term of this Term
+     * (that was parsed so far), where num_binders is the number of variables
+     * this Term binds around sub_term.
+     */
+    template <typename Visitor>
+    void ForEachSubterm(Visitor visit) const {
+        auto visit_if_parsed = [&visit](const std::unique_ptr<Term>& sub_term,
+                                        int num_binders) {
+            if (sub_term) {
+                visit(*sub_term, num_binders);
+            }
+        };
+
+        if (IsLambda()) {
+            visit_if_parsed(lambda_body_, 1);
+        } else if (IsApplication()) {
+            visit_if_parsed(application_lhs_, 0);
+            visit_if_parsed(application_rhs_, 0);
+        } else if (IsIf()) {
+            visit_if_parsed(if_condition_, 0);
+            visit_if_parsed(if_then_, 0);
+            visit_if_parsed(if_else_, 0);
+        } else if (IsSucc() || IsPred() || IsIsZero()) {
+            visit_if_parsed(unary_op_arg_, 0);
+        } else if (IsRecord()) {
+            for (auto& record_term : record_terms_) {
+                visit_if_parsed(record_term, 0);
+            }
+        } else if (IsProjection()) {
+            visit_if_parsed(projection_term_, 0);
+        }
+    }
+
     enum class Category {
         EMPTY,
         LAMBDA,
@@ -1101,6 +1572,45 @@ class Term {
         PROJECTION,
     };
 
+    /**
+     * A Term's id (see GetId()). A moved-from Term gets a fresh one.
+     */
+    class Id {
+       public:
+        Id() : value_(Next()) {}
+
+        Id(Id&& other) noexcept : value_(std::exchange(other.value_, Next())) {}
+
+        Id& operator=(Id&& other) noexcept {
+            value_ = std::exchange(other.value_, Next());
+            return *this;
+        }
+
+        std::uint64_t Get() const { return value_; }
+
+       private:
+        static std::uint64_t Next() noexcept {
+            // Ids are handed out to each thread in blocks, so threads creating
+            // Terms don't contend on one counter.
+            constexpr std::uint64_t kBlockSize = 4096;
+            static std::atomic<std::uint64_t> next_block{0};
+            thread_local std::uint64_t next = 0;
+            thread_local std::uint64_t end = 0;
+
+            if (next == end) {
+                next = next_block.fetch_add(kBlockSize,
+                                            std::memory_order_relaxed);
+                end = next + kBlockSize;
+            }
+
+            return next++;
+        }
+
+        std::uint64_t value_;
+    };
+
+    Id id_;
+
     Category category_ = Category::EMPTY;
 
     std::string lambda_arg_name_ = "";
@@ -1125,62 +1635,171 @@ class Term {
 
     std::unique_ptr<Term> projection_term_{};
     std::string projection_label_ = "";
+
+    // 1 + the largest de Bruijn index of the free variables of this Term (0 if
+    // the Term is closed). Sub-terms that are evaluated in place don't update
+    // it, which is fine since evaluation never introduces free variables. So
+    // it is always an upper bound that lets Shift() and Substitute() skip
+    // closed sub-terms.
+    int free_variable_bound_ = 0;
+
+    // Cached results of IsValue() and IsNatValue().
+    bool is_value_ = false;
+    bool is_nat_value_ = false;
 };
 
+/**
+ * Prints term using an explicit stack, so that printing takes linear time and
+ * arbitrarily deep terms can be printed.
+ */
 std::ostream& operator<<(std::ostream& out, const Term& term) {
-    if (term.IsInvalid()) {
-        out << "<INVALID>";
-    } else if (term.IsVariable()) {
-        out << term.variable_name_;
-    } else if (term.IsLambda()) {
-        out << "{l " << term.lambda_arg_name_ << " : " << *term.lambda_arg_type_
-            << ". " << *term.lambda_body_ << "}";
-    } else if (term.IsApplication()) {
-        out << "(" << *term.application_lhs_ << " <- " << *term.application_rhs_
-            << ")";
-    } else if (term.IsIf()) {
-        out << "if (" << *term.if_condition_ << ") then (" << *term.if_then_
-            << ") else (" << *term.if_else_ << ")";
-    } else if (term.IsTrue()) {
-        out << "true";
-    } else if (term.IsFalse()) {
-        out << "false";
-    } else if (term.IsSucc()) {
-        out << "succ (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsPred()) {
-        out << "pred (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsIsZero()) {
-        out << "iszero (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsConstantZero()) {
-        out << "0";
-    } else if (term.IsRecord()) {
-        out << "{";
-
-        for (int i = 0; i < term.record_terms_.size(); ++i) {
-            if (i > 0) {
-                out << ", ";
-            }
-
-            out << term.record_labels_[i] << "=" << *term.record_terms_[i];
-        }
-
-        out << "}";
-    } else if (term.IsProjection()) {
-        out << *term.projection_term_ << "." << term.projection_label_;
-    } else {
-        out << "<ERROR>";
+    // Work items, last one first: either a term to print or, if term is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Term*, std::string_view>> stack{{&term, {}}};
+    auto push_sub_term = [&stack](const Term& sub_term) {
+        stack.push_back({&sub_term, {}});
+    };
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+            continue;
+        }
+
+        if (current->IsInvalid()) {
+            out << "<INVALID>";
+        } else if (current->IsVariable()) {
+            out << current->variable_name_;
+        } else if (current->IsLambda()) {
+            out << "{l " << current->lambda_arg_name_ << " : "
+                << *current->lambda_arg_type_ << ". ";
+            stack.push_back({nullptr, "}"});
+            push_sub_term(*current->lambda_body_);
+        } else if (current->IsApplication()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            push_sub_term(*current->application_rhs_);
+            stack.push_back({nullptr, " <- "});
+            push_sub_term(*current->application_lhs_);
+        } else if (current->IsIf()) {
+            out << "if (";
+            stack.push_back({nullptr, ")"});
+            push_sub_term(*current->if_else_);
+            stack.push_back({nullptr, ") else ("});
+            push_sub_term(*current->if_then_);
+            stack.push_back({nullptr, ") then ("});
+            push_sub_term(*current->if_condition_);
+        } else if (current->IsTrue()) {
+            out << "true";
+        } else if (current->IsFalse()) {
+            out << "false";
+        } else if (current->IsSucc() || current->IsPred() ||
+                   current->IsIsZero()) {
+            out << (current->IsSucc()   ? "succ ("
+                    : current->IsPred() ? "pred ("
+                                        : "iszero (");
+            stack.push_back({nullptr, ")"});
+            push_sub_term(*current->unary_op_arg_);
+        } else if (current->IsConstantZero()) {
+            out << "0";
+        } else if (current->IsRecord()) {
+            out << "{";
+            stack.push_back({nullptr, "}"});
+
+            for (int i = current->record_terms_.size() - 1; i >= 0; --i) {
+                push_sub_term(*current->record_terms_[i]);
+                stack.push_back({nullptr, "="});
+                stack.push_back({nullptr, current->record_labels_[i]});
+
+                if (i > 0) {
+                    stack.push_back({nullptr, ", "});
+                }
+            }
+        } else if (current->IsProjection()) {
+            stack.push_back({nullptr, current->projection_label_});
+            stack.push_back({nullptr, "."});
+            push_sub_term(*current->projection_term_);
+        } else {
+            out << "<ERROR>";
+        }
     }
 
     return out;
 }
 
+/**
+ * The sub-terms that the parser parses like parenthesized ones, i.e. in a
+ * frame of their own that their closing delimiter completes: parenthesized
+ * terms, if conditions (between if and then), then branches (between then and
+ * else) and the terms of record fields (between = and , or }). Recorded by a
+ * Parser created with them, so that an edit inside one of them can be
+ * reparsed alone (see Parser::ParseSubTerm()).
+ */
+struct SourceGroups {
+    struct Group {
+        // The source offsets just past the opening delimiter and of the
+        // closing delimiter.
+        std::size_t begin;
+        std::size_t end;
+        // The id of the sub-term (see Term::GetId()).
+        std::uint64_t term_id;
+        // The innermost binder in scope (an index into binders, -1 if none).
+        int binder;
+        // The parser may go on combining terms into a parenthesized term
+        // (depending on its category) once it is closed. The other groups
+        // just fill a slot of the enclosing term.
+        bool is_parenthesized;
+    };
+
+    struct Binder {
+        std::string name;
+        // The enclosing binder (-1 if none, or for a sub-term, if it is
+        // bound around the sub-term).
+        int parent;
+    };
+
+    // In the order the groups are closed.
+    std::vector<Group> groups;
+    std::vector<Binder> binders;
+};
+
 class Parser {
     using Token = lexer::Token;
 
    public:
     Parser(std::istringstream&& in) : lexer_(std::move(in)) {}
 
-    Term ParseProgram() {
+    /**
+     * Creates a parser that records the groups of the parsed source in
+     * \p groups.
+     */
+    Parser(std::istringstream&& in, SourceGroups& groups)
+        : lexer_(std::move(in)), groups_(&groups) {}
+
+    Term ParseProgram() { return Parse({}, false); }
+
+    /**
+     * Parses the source as the contents of a group (see SourceGroups) in the
+     * scope of \p bound_variables (outermost first). The result is the
+     * sub-term that parsing a whole program with the same group would
+     * produce, as long as the source doesn't close the group itself (which
+     * throws).
+     */
+    Term ParseSubTerm(std::vector<std::string> bound_variables) {
+        return Parse(std::move(bound_variables), true);
+    }
+
+    /**
+     * bound_variables contains a list of bound variables in order of binding.
+     * For example, for a term λ x. λ y. x y, this list would eventually
+     * contains {"x" , "y"} in that order. This is used to assign de Bruijn
+     * indices/static distances to bound variables (ref: tapl,§6.1).
+     */
+    Term Parse(std::vector<std::string> bound_variables, bool is_sub_term) {
+        allocation::PhaseScope scope{allocation::Phase::PARSING};
         Token next_token;
         std::vector<Term> term_stack;
         term_stack.emplace_back(Term());
@@ -1190,11 +1809,15 @@ class Parser {
         // many Terms from term_stack should be popped (i.e. their parsing is
         // know to be complete).
         std::vector<int> stack_size_on_open_paren;
-        // Contains a list of bound variables in order of binding. For example,
-        // for a term λ x. λ y. x y, this list would eventually contains {"x" ,
-        // "y"} in that order. This is used to assign de Bruijn indices/static
-        // distances to bound variables (ref: tapl,§6.1).
-        std::vector<std::string> bound_variables;
+
+        if (is_sub_term) {
+            // Parse the sub-term as if it was enclosed in parentheses, which
+            // are closed once the whole source was parsed.
+            stack_size_on_open_paren.emplace_back(term_stack.size());
+            term_stack.emplace_back(Term());
+            ++balance_parens;
+            num_sub_term_groups_ = 1;
+        }
 
         while ((next_token = lexer_.NextToken()).GetCategory() !=
                Token::Category::MARKER_END) {
@@ -1203,6 +1826,7 @@ class Parser {
                     auto lambda_arg = ParseLambdaArg();
                     auto lambda_arg_name = lambda_arg.first;
                     bound_variables.push_back(lambda_arg_name);
+                    PushBinder(lambda_arg_name);
 
                     // If the current stack top is empty, use its slot for the
                     // lambda.
@@ -1301,13 +1925,14 @@ class Parser {
                     stack_size_on_open_paren.emplace_back(term_stack.size());
                     term_stack.emplace_back(Term());
                     ++balance_parens;
+                    OpenGroup(/*is_parenthesized=*/false);
 
                     break;
                 }
 
                 case Token::Category::KEYWORD_THEN: {
-                    UnwindStack(term_stack, stack_size_on_open_paren,
-                                bound_variables);
+                    CloseGroup(UnwindStack(term_stack, stack_size_on_open_paren,
+                                           bound_variables));
 
                     --balance_parens;
 
@@ -1318,13 +1943,14 @@ class Parser {
                     stack_size_on_open_paren.emplace_back(term_stack.size());
                     term_stack.emplace_back(Term());
                     ++balance_parens;
+                    OpenGroup(/*is_parenthesized=*/false);
 
                     break;
                 }
 
                 case Token::Category::KEYWORD_ELSE: {
-                    UnwindStack(term_stack, stack_size_on_open_paren,
-                                bound_variables);
+                    CloseGroup(UnwindStack(term_stack, stack_size_on_open_paren,
+                                           bound_variables));
 
                     --balance_parens;
 
@@ -1381,13 +2007,14 @@ class Parser {
                     stack_size_on_open_paren.emplace_back(term_stack.size());
                     term_stack.emplace_back(Term());
                     ++balance_parens;
+                    OpenGroup(/*is_parenthesized=*/true);
 
                     break;
                 }
 
                 case Token::Category::CLOSE_PAREN: {
-                    UnwindStack(term_stack, stack_size_on_open_paren,
-                                bound_variables);
+                    CloseGroup(UnwindStack(term_stack, stack_size_on_open_paren,
+                                           bound_variables));
 
                     --balance_parens;
 
@@ -1435,14 +2062,15 @@ class Parser {
                     stack_size_on_open_paren.emplace_back(term_stack.size());
                     term_stack.emplace_back(Term());
                     ++balance_parens;
+                    OpenGroup(/*is_parenthesized=*/false);
 
                     break;
                 }
 
                 case Token::Category::COMMA:
                 case Token::Category::CLOSE_BRACE: {
-                    UnwindStack(term_stack, stack_size_on_open_paren,
-                                bound_variables);
+                    CloseGroup(UnwindStack(term_stack, stack_size_on_open_paren,
+                                           bound_variables));
 
                     --balance_parens;
 
@@ -1482,11 +2110,16 @@ class Parser {
             }
         }
 
-        if (balance_parens != 0) {
+        if (balance_parens != (is_sub_term ? 1 : 0)) {
             throw std::invalid_argument(
                 "Invalid term: probably because a ( is not matched by a )");
         }
 
+        if (is_sub_term) {
+            num_sub_term_groups_ = 0;
+            UnwindStack(term_stack, stack_size_on_open_paren, bound_variables);
+        }
+
         while (term_stack.size() > 1) {
             CombineStackTop(term_stack);
         }
@@ -1498,9 +2131,21 @@ class Parser {
         return std::move(term_stack.back());
     }
 
-    void UnwindStack(std::vector<Term>& term_stack,
-                     std::vector<int>& stack_size_on_open_paren,
-                     std::vector<std::string>& bound_variables) {
+    /**
+     * Completes the innermost group and returns the id of its term (0 if
+     * there is no open group).
+     */
+    std::uint64_t UnwindStack(std::vector<Term>& term_stack,
+                              std::vector<int>& stack_size_on_open_paren,
+                              std::vector<std::string>& bound_variables) {
+        if (!stack_size_on_open_paren.empty() &&
+            stack_size_on_open_paren.size() <= num_sub_term_groups_) {
+            throw std::invalid_argument(
+                "Invalid sub-term: it closes the group it is parsed in.");
+        }
+
+        std::uint64_t term_id = 0;
+
         while (!term_stack.empty() && !stack_size_on_open_paren.empty() &&
                term_stack.size() > stack_size_on_open_paren.back()) {
             if (term_stack.back().IsLambda() &&
@@ -1511,6 +2156,13 @@ class Parser {
                 // λ's variable is no longer part of the current binding
                 // context, therefore pop it.
                 bound_variables.pop_back();
+                PopBinder();
+            }
+
+            if (term_stack.size() ==
+                static_cast<std::size_t>(stack_size_on_open_paren.back()) + 1) {
+                // The group's own frame.
+                term_id = term_stack.back().GetId();
             }
 
             CombineStackTop(term_stack);
@@ -1519,6 +2171,8 @@ class Parser {
         if (!stack_size_on_open_paren.empty()) {
             stack_size_on_open_paren.pop_back();
         }
+
+        return term_id;
     }
 
     void CombineStackTop(std::vector<Term>& term_stack) {
@@ -1549,126 +2203,686 @@ class Parser {
         return {arg_name, ParseType()};
     }
 
+    /**
+     * Parses a type iteratively so that arbitrarily deep parenthesized and
+     * record types can be parsed. Each frame on the stack is either the type
+     * being parsed, a parenthesized type or the type of a record's field.
+     */
     Type& ParseType() {
-        std::vector<Type*> parts;
-        while (true) {
-            auto token = lexer_.NextToken();
+        struct Frame {
+            enum class Kind { TOP, PAREN, FIELD };
 
-            if (token.GetCategory() == Token::Category::KEYWORD_BOOL) {
-                parts.emplace_back(&Type::Bool());
-            } else if (token.GetCategory() == Token::Category::KEYWORD_NAT) {
-                parts.emplace_back(&Type::Nat());
-            } else if (token.GetCategory() == Token::Category::OPEN_PAREN) {
-                parts.emplace_back(&ParseType());
+            Kind kind;
+            std::vector<Type*> parts{};
+            Type::RecordFields fields{};
+            std::string label = "";
+        };
 
-                if (lexer_.NextToken().GetCategory() !=
-                    Token::Category::CLOSE_PAREN) {
-                    std::ostringstream error_ss;
-                    error_ss << __LINE__ << ": Unexpected token: " << token;
-                    throw std::invalid_argument(error_ss.str());
-                }
-            } else if (token.GetCategory() == Token::Category::OPEN_BRACE) {
-                lexer_.PutBackToken();
-                parts.emplace_back(&ParseRecordType());
-            } else {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+        auto unexpected = [](const Token& token) {
+            std::ostringstream error_ss;
+            error_ss << __LINE__ << ": Unexpected token: " << token;
+            return std::invalid_argument(error_ss.str());
+        };
+
+        auto parse_label = [this, &unexpected](Frame& frame) {
+            Token token = lexer_.NextToken();
+
+            if (token.GetCategory() != Token::Category::IDENTIFIER) {
+                throw unexpected(token);
             }
 
+            frame.label = token.GetText();
             token = lexer_.NextToken();
 
-            if (token.GetCategory() == Token::Category::DOT) {
-                break;
+            if (token.GetCategory() != Token::Category::COLON) {
+                throw unexpected(token);
+            }
+        };
+
+        std::vector<Frame> stack{Frame{Frame::Kind::TOP}};
+        Type* atom = nullptr;
+
+        while (true) {
+            if (!atom) {
+                auto token = lexer_.NextToken();
+
+                if (token.GetCategory() == Token::Category::KEYWORD_BOOL) {
+                    atom = &Type::Bool();
+                } else if (token.GetCategory() ==
+                           Token::Category::KEYWORD_NAT) {
+                    atom = &Type::Nat();
+                } else if (token.GetCategory() ==
+                           Token::Category::OPEN_PAREN) {
+                    stack.push_back(Frame{Frame::Kind::PAREN});
+                    continue;
+                } else if (token.GetCategory() ==
+                           Token::Category::OPEN_BRACE) {
+                    stack.push_back(Frame{Frame::Kind::FIELD});
+                    parse_label(stack.back());
+                    continue;
+                } else {
+                    throw unexpected(token);
+                }
+            }
+
+            auto& frame = stack.back();
+            frame.parts.push_back(std::exchange(atom, nullptr));
+            auto token = lexer_.NextToken();
+
+            if (token.GetCategory() == Token::Category::ARROW) {
+                continue;
             } else if (token.GetCategory() == Token::Category::CLOSE_PAREN ||
                        token.GetCategory() == Token::Category::CLOSE_BRACE ||
                        token.GetCategory() == Token::Category::COMMA) {
                 lexer_.PutBackToken();
-                break;
-            } else if (token.GetCategory() != Token::Category::ARROW) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+            } else if (token.GetCategory() != Token::Category::DOT) {
+                throw unexpected(token);
+            }
+
+            // Types are right-associative, combine them accordingly.
+            for (int i = frame.parts.size() - 2; i >= 0; --i) {
+                frame.parts[i] =
+                    &Type::Function(*frame.parts[i], *frame.parts[i + 1]);
+            }
+
+            Type& type = *frame.parts[0];
+            frame.parts.clear();
+
+            if (frame.kind == Frame::Kind::TOP) {
+                return type;
+            }
+
+            token = lexer_.NextToken();
+
+            if (frame.kind == Frame::Kind::PAREN) {
+                if (token.GetCategory() != Token::Category::CLOSE_PAREN) {
+                    throw unexpected(token);
+                }
+
+                atom = &type;
+                stack.pop_back();
+            } else {
+                frame.fields.insert({frame.label, type});
+
+                if (token.GetCategory() == Token::Category::COMMA) {
+                    parse_label(frame);
+                } else if (token.GetCategory() ==
+                           Token::Category::CLOSE_BRACE) {
+                    atom = &Type::Record(std::move(frame.fields));
+                    stack.pop_back();
+                } else {
+                    throw unexpected(token);
+                }
             }
         }
+    }
+
+    Token::IdentifieySubCategory CalculateIdentifierSubCategoryFromContext(
+        Token token, const std::vector<Term>& term_stack) {
+        assert(token.GetCategory() == Token::Category::IDENTIFIER);
 
-        // Types are right-associative, combine them accordingly.
-        for (int i = parts.size() - 2; i >= 0; --i) {
-            parts[i] = &Type::Function(*parts[i], *parts[i + 1]);
+        if (term_stack.back().IsRecord() &&
+            term_stack.back().IsRecordExpectingLabel()) {
+            return Token::IdentifieySubCategory::RECORD_LABEL;
         }
 
-        return *parts[0];
+        return Token::IdentifieySubCategory::VARIABLE;
     }
 
-    Type& ParseRecordType() {
-        Token token = lexer_.NextToken();
+   private:
+    void OpenGroup(bool is_parenthesized) {
+        if (groups_) {
+            open_groups_.push_back(SourceGroups::Group{
+                lexer_.TokenEnd(), 0, 0, binder_, is_parenthesized});
+        }
+    }
 
-        if (token.GetCategory() != Token::Category::OPEN_BRACE) {
-            std::ostringstream error_ss;
-            error_ss << __LINE__ << ": Unexpected token: " << token;
-            throw std::invalid_argument(error_ss.str());
+    /**
+     * Records the innermost open group, whose closing delimiter was just
+     * read.
+     */
+    void CloseGroup(std::uint64_t term_id) {
+        if (!groups_ || open_groups_.empty()) {
+            return;
         }
 
-        Type::RecordFields fields;
-        token = lexer_.NextToken();
+        SourceGroups::Group group = open_groups_.back();
+        open_groups_.pop_back();
+        group.end = lexer_.TokenBegin();
+        group.term_id = term_id;
+        groups_->groups.push_back(group);
+    }
 
-        while (true) {
-            if (token.GetCategory() != Token::Category::IDENTIFIER) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+    void PushBinder(const std::string& name) {
+        if (groups_) {
+            groups_->binders.push_back(SourceGroups::Binder{name, binder_});
+            binder_ = groups_->binders.size() - 1;
+        }
+    }
+
+    void PopBinder() {
+        if (groups_) {
+            binder_ = groups_->binders[binder_].parent;
+        }
+    }
+
+    lexer::Lexer lexer_;
+    SourceGroups* groups_ = nullptr;
+    // The groups whose closing delimiter wasn't read yet, innermost last.
+    std::vector<SourceGroups::Group> open_groups_;
+    // The innermost binder in scope (see SourceGroups::Group::binder).
+    int binder_ = -1;
+    // 1 while a sub-term is parsed: the group enclosing it must not be
+    // closed by the sub-term itself.
+    std::size_t num_sub_term_groups_ = 0;
+};  // namespace parser
+
+/**
+ * Identifies (and versions) the binary program images written by ImageWriter.
+ */
+const std::string kImageMagic = "TAPL17";
+const std::uint8_t kImageVersion = 2;
+// Set in the tag byte of terms that the parser marked as complete.
+const std::uint8_t kImageCompleteFlag = 0x80;
+
+enum class ImageTypeTag : std::uint8_t {
+    ILL,
+    BOOL,
+    NAT,
+    FUNCTION,
+    RECORD,
+    TOP,
+};
+
+/**
+ * Writes a type checked program into a compact binary "program image" that
+ * ImageReader loads without lexing and parsing. An image consists of:
+ *  - kImageMagic followed by kImageVersion,
+ *  - a table of all names and labels in the program,
+ *  - a table of all types in the program, where each type only refers to
+ *    types that precede it,
+ *  - the index of the program's type,
+ *  - the program's terms in pre-order, where a record lists the labels of
+ *    its fields before the fields themselves.
+ *
+ * Integers are LEB128-encoded and strings and types are referred to by their
+ * table indices. Terms and types are walked iteratively, so deep programs
+ * don't overflow the stack.
+ */
+class ImageWriter {
+   public:
+    std::string Write(const Term& program, Type& program_type) {
+        strings_.clear();
+        string_indices_.clear();
+        types_.clear();
+        type_indices_.clear();
+
+        std::string terms;
+        WriteTerms(program, terms);
+        std::size_t program_type_idx = TypeIdx(program_type);
+
+        std::string image = kImageMagic;
+        image.push_back(kImageVersion);
+        WriteUInt(strings_.size(), image);
+
+        for (const auto& str : strings_) {
+            WriteUInt(str.size(), image);
+            image += str;
+        }
+
+        WriteUInt(type_indices_.size(), image);
+        image += types_;
+        WriteUInt(program_type_idx, image);
+        image += terms;
+
+        return image;
+    }
+
+   private:
+    /**
+     * Appends the terms of program to out in pre-order.
+     */
+    void WriteTerms(const Term& program, std::string& out) {
+        std::vector<const Term*> stack{&program};
+        auto push_subterm = [&stack](const std::unique_ptr<Term>& term) {
+            if (!term) {
+                throw std::invalid_argument(
+                    "Trying to write an incompletely parsed term.");
             }
 
-            std::string field_id = token.GetText();
+            stack.push_back(term.get());
+        };
 
-            token = lexer_.NextToken();
+        while (!stack.empty()) {
+            const Term& term = *stack.back();
+            stack.pop_back();
+            auto tag = static_cast<std::uint8_t>(term.category_);
+            out.push_back(term.is_complete_ ? tag | kImageCompleteFlag : tag);
+
+            // Sub-terms are pushed in reverse, so they are written in order.
+            switch (term.category_) {
+                case Term::Category::LAMBDA:
+                    WriteUInt(StringIdx(term.lambda_arg_name_), out);
+                    WriteUInt(TypeIdx(*term.lambda_arg_type_), out);
+                    push_subterm(term.lambda_body_);
+                    break;
+                case Term::Category::VARIABLE:
+                    WriteUInt(StringIdx(term.variable_name_), out);
+                    WriteUInt(ZigZag(term.de_bruijn_idx_), out);
+                    break;
+                case Term::Category::APPLICATION:
+                    push_subterm(term.application_rhs_);
+                    push_subterm(term.application_lhs_);
+                    break;
+                case Term::Category::IF:
+                    push_subterm(term.if_else_);
+                    push_subterm(term.if_then_);
+                    push_subterm(term.if_condition_);
+                    break;
+                case Term::Category::SUCC:
+                case Term::Category::PRED:
+                case Term::Category::ISZERO:
+                    push_subterm(term.unary_op_arg_);
+                    break;
+                case Term::Category::RECORD:
+                    if (term.record_terms_.size() !=
+                        term.record_labels_.size()) {
+                        throw std::invalid_argument(
+                            "Trying to write an incompletely parsed term.");
+                    }
 
-            if (token.GetCategory() != Token::Category::COLON) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+                    WriteUInt(term.record_labels_.size(), out);
+
+                    for (const auto& label : term.record_labels_) {
+                        WriteUInt(StringIdx(label), out);
+                    }
+
+                    for (auto it = term.record_terms_.rbegin();
+                         it != term.record_terms_.rend(); ++it) {
+                        push_subterm(*it);
+                    }
+
+                    break;
+                case Term::Category::PROJECTION:
+                    WriteUInt(StringIdx(term.projection_label_), out);
+                    push_subterm(term.projection_term_);
+                    break;
+                default:
+                    break;
             }
+        }
+    }
 
-            Type& type = ParseType();
-            token = lexer_.NextToken();
-            fields.insert({field_id, type});
+    std::size_t StringIdx(const std::string& str) {
+        auto it = string_indices_.find(str);
 
-            if (token.GetCategory() == Token::Category::CLOSE_BRACE) {
-                break;
-            } else if (token.GetCategory() == Token::Category::COMMA) {
-                token = lexer_.NextToken();
+        if (it != std::end(string_indices_)) {
+            return it->second;
+        }
+
+        strings_.push_back(str);
+
+        return string_indices_[str] = strings_.size() - 1;
+    }
+
+    /**
+     * Returns the index of \p type in the type table, appending it (after the
+     * types it refers to) if it is not in the table yet.
+     */
+    std::size_t TypeIdx(Type& type) {
+        // Each type is visited twice: first to push the types it refers to
+        // and then, once those are in the table, to append the type itself.
+        std::vector<std::pair<Type*, bool>> stack{{&type, false}};
+
+        while (!stack.empty()) {
+            auto [current, refs_appended] = stack.back();
+            stack.pop_back();
+
+            if (type_indices_.count(current)) {
                 continue;
-            } else {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+            }
+
+            if (refs_appended) {
+                AppendType(*current);
+                continue;
+            }
+
+            stack.push_back({current, true});
+
+            if (current->IsFunction()) {
+                stack.push_back({&current->FunctionRHS(), false});
+                stack.push_back({&current->FunctionLHS(), false});
+            } else if (current->IsRecord()) {
+                for (auto& field : current->GetRecordFields()) {
+                    stack.push_back({&field.second, false});
+                }
             }
         }
 
-        if (fields.empty()) {
-            std::ostringstream error_ss;
-            error_ss << __LINE__ << ": Invalid record.";
-            throw std::invalid_argument(error_ss.str());
+        return type_indices_.at(&type);
+    }
+
+    /**
+     * Appends type, whose referred types are in the table already, to the
+     * type table.
+     */
+    void AppendType(Type& type) {
+        if (type.IsBool()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::BOOL));
+        } else if (type.IsNat()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::NAT));
+        } else if (type.IsTop()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::TOP));
+        } else if (type.IsFunction()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::FUNCTION));
+            WriteUInt(type_indices_.at(&type.FunctionLHS()), types_);
+            WriteUInt(type_indices_.at(&type.FunctionRHS()), types_);
+        } else if (type.IsRecord()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::RECORD));
+            WriteUInt(type.GetRecordFields().size(), types_);
+
+            for (auto& field : type.GetRecordFields()) {
+                WriteUInt(StringIdx(field.first), types_);
+                WriteUInt(type_indices_.at(&field.second), types_);
+            }
+        } else {
+            types_.push_back(static_cast<char>(ImageTypeTag::ILL));
         }
 
-        return Type::Record(std::move(fields));
+        std::size_t idx = type_indices_.size();
+        type_indices_[&type] = idx;
     }
 
-    Token::IdentifieySubCategory CalculateIdentifierSubCategoryFromContext(
-        Token token, const std::vector<Term>& term_stack) {
-        assert(token.GetCategory() == Token::Category::IDENTIFIER);
+    static void WriteUInt(std::uint64_t value, std::string& out) {
+        do {
+            char byte = value & 0x7f;
+            value >>= 7;
+            out.push_back(value ? byte | 0x80 : byte);
+        } while (value);
+    }
 
-        if (term_stack.back().IsRecord() &&
-            term_stack.back().IsRecordExpectingLabel()) {
-            return Token::IdentifieySubCategory::RECORD_LABEL;
+    /**
+     * Maps signed to unsigned integers such that numbers with small absolute
+     * values stay small (0, -1, 1, -2, ... are mapped to 0, 1, 2, 3, ...).
+     */
+    static std::uint64_t ZigZag(std::int64_t value) {
+        std::uint64_t shifted = static_cast<std::uint64_t>(value) << 1;
+
+        return value < 0 ? ~shifted : shifted;
+    }
+
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, std::size_t> string_indices_;
+    // The serialized type table.
+    std::string types_;
+    std::unordered_map<const Type*, std::size_t> type_indices_;
+};
+
+/**
+ * Loads a program from an image written by ImageWriter.
+ *
+ * The image is decoded in a single pass straight from the given buffer, so
+ * it can be memory mapped from a file instead of being read into memory first.
+ */
+class ImageReader {
+   public:
+    /**
+     * \p data has to stay valid until ReadProgram() returns.
+     */
+    ImageReader(const char* data, std::size_t size)
+        : pos_(data), end_(data + size) {}
+
+    Term ReadProgram() {
+        if (Remaining() < kImageMagic.size() ||
+            std::string(pos_, kImageMagic.size()) != kImageMagic) {
+            throw std::invalid_argument("Not a program image.");
         }
 
-        return Token::IdentifieySubCategory::VARIABLE;
+        pos_ += kImageMagic.size();
+
+        if (ReadByte() != kImageVersion) {
+            throw std::invalid_argument("Unsupported program image version.");
+        }
+
+        std::size_t num_strings = ReadUInt();
+
+        for (std::size_t i = 0; i < num_strings; ++i) {
+            std::size_t size = ReadUInt();
+
+            if (Remaining() < size) {
+                throw std::invalid_argument("Truncated program image.");
+            }
+
+            strings_.emplace_back(pos_, size);
+            pos_ += size;
+        }
+
+        std::size_t num_types = ReadUInt();
+
+        for (std::size_t i = 0; i < num_types; ++i) {
+            ReadType();
+        }
+
+        program_type_ = &ReadTypeRef();
+
+        return ReadTerms();
     }
 
+    /**
+     * Returns the type the program was written with. Only valid after
+     * ReadProgram().
+     */
+    Type& ProgramType() const { return *program_type_; }
+
    private:
-    lexer::Lexer lexer_;
-};  // namespace parser
+    /**
+     * Reads the program's terms, which make up the rest of the image.
+     */
+    Term ReadTerms() {
+        // Decode the nodes first and then link them in reverse pre-order:
+        // that way the sub-terms of a node are the last ones completed when
+        // the node is reached.
+        std::vector<Term> nodes;
+
+        while (pos_ != end_) {
+            nodes.push_back(ReadNode());
+        }
+
+        std::vector<std::unique_ptr<Term>> completed;
+
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            auto term = std::make_unique<Term>(std::move(*it));
+
+            switch (term->category_) {
+                case Term::Category::LAMBDA:
+                    term->lambda_body_ = PopCompleted(completed);
+                    break;
+                case Term::Category::APPLICATION:
+                    term->application_lhs_ = PopCompleted(completed);
+                    term->application_rhs_ = PopCompleted(completed);
+                    break;
+                case Term::Category::IF:
+                    term->if_condition_ = PopCompleted(completed);
+                    term->if_then_ = PopCompleted(completed);
+                    term->if_else_ = PopCompleted(completed);
+                    break;
+                case Term::Category::SUCC:
+                case Term::Category::PRED:
+                case Term::Category::ISZERO:
+                    term->unary_op_arg_ = PopCompleted(completed);
+                    break;
+                case Term::Category::RECORD:
+                    for (std::size_t i = 0; i < term->record_labels_.size();
+                         ++i) {
+                        term->record_terms_.push_back(
+                            PopCompleted(completed));
+                    }
+
+                    break;
+                case Term::Category::PROJECTION:
+                    term->projection_term_ = PopCompleted(completed);
+                    break;
+                default:
+                    break;
+            }
+
+            term->UpdateFreeVariableBound();
+            term->UpdateIsValue();
+            completed.push_back(std::move(term));
+        }
+
+        if (completed.size() > 1) {
+            throw std::invalid_argument("Trailing bytes in program image.");
+        }
+
+        return std::move(*PopCompleted(completed));
+    }
+
+    /**
+     * Reads a single term without its sub-terms.
+     */
+    Term ReadNode() {
+        std::uint8_t tag = ReadByte();
+        Term term;
+        term.category_ = static_cast<Term::Category>(tag & ~kImageCompleteFlag);
+        term.is_complete_ = tag & kImageCompleteFlag;
+
+        if (term.category_ > Term::Category::PROJECTION) {
+            throw std::invalid_argument("Invalid term in program image.");
+        }
+
+        switch (term.category_) {
+            case Term::Category::LAMBDA:
+                term.lambda_arg_name_ = ReadString();
+                term.lambda_arg_type_ = &ReadTypeRef();
+                break;
+            case Term::Category::VARIABLE: {
+                term.variable_name_ = ReadString();
+                std::uint64_t idx = ReadUInt();
+                term.de_bruijn_idx_ = (idx >> 1) ^ -(idx & 1);
+                break;
+            }
+            case Term::Category::RECORD: {
+                std::size_t num_fields = ReadUInt();
+
+                for (std::size_t i = 0; i < num_fields; ++i) {
+                    term.record_labels_.push_back(ReadString());
+                }
+
+                break;
+            }
+            case Term::Category::PROJECTION:
+                term.projection_label_ = ReadString();
+                break;
+            default:
+                break;
+        }
+
+        return term;
+    }
+
+    static std::unique_ptr<Term> PopCompleted(
+        std::vector<std::unique_ptr<Term>>& completed) {
+        if (completed.empty()) {
+            throw std::invalid_argument("Truncated program image.");
+        }
+
+        auto term = std::move(completed.back());
+        completed.pop_back();
+
+        return term;
+    }
+
+    void ReadType() {
+        switch (static_cast<ImageTypeTag>(ReadByte())) {
+            case ImageTypeTag::ILL:
+                types_.push_back(&Type::IllTyped());
+                break;
+            case ImageTypeTag::BOOL:
+                types_.push_back(&Type::Bool());
+                break;
+            case ImageTypeTag::NAT:
+                types_.push_back(&Type::Nat());
+                break;
+            case ImageTypeTag::TOP:
+                types_.push_back(&Type::Top());
+                break;
+            case ImageTypeTag::FUNCTION: {
+                Type& lhs = ReadTypeRef();
+                Type& rhs = ReadTypeRef();
+                types_.push_back(&Type::Function(lhs, rhs));
+                break;
+            }
+            case ImageTypeTag::RECORD: {
+                Type::RecordFields fields;
+                std::size_t num_fields = ReadUInt();
+
+                for (std::size_t i = 0; i < num_fields; ++i) {
+                    std::string label = ReadString();
+                    Type& field_type = ReadTypeRef();
+                    fields.insert({label, field_type});
+                }
+
+                types_.push_back(&Type::Record(std::move(fields)));
+                break;
+            }
+            default:
+                throw std::invalid_argument("Invalid type in program image.");
+        }
+    }
+
+    Type& ReadTypeRef() {
+        std::uint64_t idx = ReadUInt();
+
+        if (idx >= types_.size()) {
+            throw std::invalid_argument("Invalid type in program image.");
+        }
+
+        return *types_[idx];
+    }
+
+    const std::string& ReadString() {
+        std::uint64_t idx = ReadUInt();
+
+        if (idx >= strings_.size()) {
+            throw std::invalid_argument("Invalid string in program image.");
+        }
+
+        return strings_[idx];
+    }
+
+    std::uint64_t ReadUInt() {
+        std::uint64_t value = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            std::uint8_t byte = ReadByte();
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+
+        throw std::invalid_argument("Invalid integer in program image.");
+    }
+
+    std::size_t Remaining() const { return end_ - pos_; }
+
+    std::uint8_t ReadByte() {
+        if (pos_ == end_) {
+            throw std::invalid_argument("Truncated program image.");
+        }
+
+        return *pos_++;
+    }
+
+    const char* pos_;
+    const char* end_;
+
+    std::vector<std::string> strings_;
+    std::vector<Type*> types_;
+    Type* program_type_ = nullptr;
+};
 }  // namespace parser
 
 namespace type_checker {
@@ -1678,48 +2892,71 @@ using parser::Type;
 class TypeChecker {
     using Context = std::deque<std::pair<std::string, Type*>>;
 
+    static constexpr std::size_t kMaxCachedBindings = 16;
+
    public:
     Type& TypeOf(const Term& term) {
+        allocation::PhaseScope scope{allocation::Phase::TYPE_CHECKING};
         Context ctx;
         return TypeOf(ctx, term);
     }
 
+    /**
+     * Drops all cached types. Types are cached per Term id (see
+     * TypeOf(const Context&, const Term&)), which a destroyed Term doesn't pass
+     * on to a new one, but this must be called once a type checked Term is
+     * modified in place (e.g. evaluated).
+     */
+    void ClearCache() { type_cache_.clear(); }
+
+    /**
+     * Drops the cached types of \p term only (i.e. not those of its sub-terms).
+     * Must be called before a single type checked Term node is modified in
+     * place while the rest of the program stays cached, and frees the entries
+     * of a node that is about to be destroyed.
+     */
+    void Forget(const Term& term) { type_cache_.erase(term.GetId()); }
+
     /**
      * Determines if \p s is a sub-type of \p t.
      *
      * @return true of \p s is sub-type of \p t, false otherwise.
      */
     bool IsSubtype(const Type& s, const Type& t) {
-        if (s == t) {
-            return true;
-        }
+        // Pairs of types of which the first must be a sub-type of the second.
+        // Nested types are checked using an explicit stack, since the types of
+        // deeply nested terms are deeply nested as well.
+        std::vector<std::pair<const Type*, const Type*>> stack{{&s, &t}};
 
-        if (s.IsRecord() && t.IsRecord()) {
-            for (const auto& t_field : t.GetRecordFields()) {
-                bool found_t_field_in_s = false;
+        while (!stack.empty()) {
+            auto [sub, super] = stack.back();
+            stack.pop_back();
 
-                for (const auto& s_field : s.GetRecordFields()) {
-                    if (t_field.first == s_field.first &&
-                        IsSubtype(s_field.second, t_field.second)) {
-                        found_t_field_in_s = true;
-                        break;
+            if (*sub == *super) {
+                continue;
+            }
+
+            if (sub->IsRecord() && super->IsRecord()) {
+                const auto& sub_fields = sub->GetRecordFields();
+
+                for (const auto& super_field : super->GetRecordFields()) {
+                    auto sub_it = sub_fields.find(super_field.first);
+
+                    if (sub_it == std::end(sub_fields)) {
+                        return false;
                     }
-                }
 
-                if (!found_t_field_in_s) {
-                    return false;
+                    stack.push_back({&sub_it->second, &super_field.second});
                 }
+            } else if (sub->IsFunction() && super->IsFunction()) {
+                stack.push_back({&sub->FunctionRHS(), &super->FunctionRHS()});
+                stack.push_back({&super->FunctionLHS(), &sub->FunctionLHS()});
+            } else {
+                return false;
             }
-
-            return true;
-        }
-
-        if (s.IsFunction() && t.IsFunction()) {
-            return IsSubtype(t.FunctionLHS(), s.FunctionLHS()) &&
-                   IsSubtype(s.FunctionRHS(), t.FunctionRHS());
         }
 
-        return false;
+        return true;
     }
 
     /**
@@ -1838,39 +3075,156 @@ class TypeChecker {
     }
 
    private:
+    /**
+     * Memoized version of CalculateTypeOf(). The type of a term depends only on
+     * the bindings of its free variables, so types are cached per Term id
+     * together with the innermost term.FreeVariableBound() bindings of the
+     * context they were calculated in. In particular, the type of a closed
+     * term is calculated only once regardless of its context. Terms that depend
+     * on more than kMaxCachedBindings bindings aren't cached, since copying
+     * those bindings would make type checking a term nested under many
+     * binders quadratic.
+     *
+     * The type is computed bottom-up using an explicit stack so that
+     * arbitrarily deep terms can be type checked.
+     */
     Type& TypeOf(const Context& ctx, const Term& term) {
-        Type* res = &Type::IllTyped();
+        // The bindings of the lambdas enclosing the term being visited,
+        // innermost first.
+        Context walk_ctx = ctx;
+        // The types of the visited sub-terms whose parents were not visited
+        // yet.
+        std::vector<Type*> types;
+        // Each entry stores a term along with whether its sub-terms have
+        // already been pushed.
+        std::vector<std::pair<const Term*, bool>> stack{{&term, false}};
+
+        while (!stack.empty()) {
+            auto [current, expanded] = stack.back();
+
+            if (!expanded) {
+                if (Type* cached = CachedTypeOf(walk_ctx, *current)) {
+                    stack.pop_back();
+                    types.push_back(cached);
+                    continue;
+                }
 
-        if (term.IsTrue() || term.IsFalse()) {
-            res = &Type::Bool();
+                stack.back().second = true;
+
+                if (current->IsLambda()) {
+                    walk_ctx.push_front(
+                        {current->LambdaArgName(), &current->LambdaArgType()});
+                }
+
+                PushSubTerms(*current, stack);
+                continue;
+            }
+
+            stack.pop_back();
+
+            if (current->IsLambda()) {
+                walk_ctx.pop_front();
+            }
+
+            Type& res = CalculateTypeOf(walk_ctx, *current, types);
+            std::size_t prefix_size = std::min<std::size_t>(
+                current->FreeVariableBound(), walk_ctx.size());
+
+            if (prefix_size <= kMaxCachedBindings) {
+                type_cache_[current->GetId()].push_back(
+                    {Context(std::begin(walk_ctx),
+                             std::begin(walk_ctx) + prefix_size),
+                     &res});
+            }
+
+            types.push_back(&res);
+        }
+
+        return *types.back();
+    }
+
+    /**
+     * Returns the cached type of term in ctx, or nullptr if there is none.
+     */
+    Type* CachedTypeOf(const Context& ctx, const Term& term) {
+        std::size_t prefix_size =
+            std::min<std::size_t>(term.FreeVariableBound(), ctx.size());
+        auto it = type_cache_.find(term.GetId());
+
+        if (prefix_size > kMaxCachedBindings || it == std::end(type_cache_)) {
+            return nullptr;
+        }
+
+        for (auto& entry : it->second) {
+            if (entry.ctx_prefix.size() == prefix_size &&
+                std::equal(std::begin(entry.ctx_prefix),
+                           std::end(entry.ctx_prefix), std::begin(ctx))) {
+                return entry.type;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Pushes the direct sub-terms of term on stack so that they are visited in
+     * order.
+     */
+    static void PushSubTerms(
+        const Term& term, std::vector<std::pair<const Term*, bool>>& stack) {
+        if (term.IsLambda()) {
+            stack.push_back({&term.LambdaBody(), false});
+        } else if (term.IsApplication()) {
+            stack.push_back({&term.ApplicationRHS(), false});
+            stack.push_back({&term.ApplicationLHS(), false});
+        } else if (term.IsIf()) {
+            stack.push_back({&term.IfElse(), false});
+            stack.push_back({&term.IfThen(), false});
+            stack.push_back({&term.IfCondition(), false});
+        } else if (term.IsSucc() || term.IsPred() || term.IsIsZero()) {
+            stack.push_back({&term.UnaryOpArg(), false});
+        } else if (term.IsRecord()) {
+            for (auto it = term.RecordTerms().rbegin();
+                 it != term.RecordTerms().rend(); ++it) {
+                stack.push_back({it->get(), false});
+            }
+        } else if (term.IsProjection()) {
+            stack.push_back({&term.ProjectionTerm(), false});
+        }
+    }
+
+    /**
+     * Calculates the type of term in ctx given the types of its direct
+     * sub-terms, which are popped from the back of types.
+     */
+    Type& CalculateTypeOf(const Context& ctx, const Term& term,
+                          std::vector<Type*>& types) {
+        Type* res = &Type::IllTyped();
+
+        if (term.IsTrue() || term.IsFalse()) {
+            res = &Type::Bool();
         } else if (term.IsConstantZero()) {
             res = &Type::Nat();
         } else if (term.IsIf()) {
-            if (TypeOf(ctx, term.IfCondition()) == Type::Bool()) {
-                Type& then_type = TypeOf(ctx, term.IfThen());
-                Type& else_type = TypeOf(ctx, term.IfElse());
-                return Join(then_type, else_type);
+            Type& else_type = PopType(types);
+            Type& then_type = PopType(types);
+
+            if (PopType(types) == Type::Bool()) {
+                res = &Join(then_type, else_type);
             }
         } else if (term.IsSucc() || term.IsPred()) {
-            auto& subterm_type = TypeOf(ctx, term.UnaryOpArg());
-
-            if (subterm_type == Type::Nat()) {
+            if (PopType(types) == Type::Nat()) {
                 res = &Type::Nat();
             }
         } else if (term.IsIsZero()) {
-            auto& subterm_type = TypeOf(ctx, term.UnaryOpArg());
-
-            if (subterm_type == Type::Nat()) {
+            if (PopType(types) == Type::Nat()) {
                 res = &Type::Bool();
             }
         } else if (term.IsLambda()) {
-            Context new_ctx =
-                AddBinding(ctx, term.LambdaArgName(), term.LambdaArgType());
-            Type& return_type = TypeOf(new_ctx, term.LambdaBody());
-            res = &Type::Function(term.LambdaArgType(), return_type);
+            res = &Type::Function(term.LambdaArgType(), PopType(types));
         } else if (term.IsApplication()) {
-            Type& lhs_type = TypeOf(ctx, term.ApplicationLHS());
-            Type& rhs_type = TypeOf(ctx, term.ApplicationRHS());
+            Type& rhs_type = PopType(types);
+            Type& lhs_type = PopType(types);
 
             if (lhs_type.IsFunction() &&
                 IsSubtype(rhs_type, lhs_type.FunctionLHS())) {
@@ -1884,23 +3238,25 @@ class TypeChecker {
                 res = ctx[idx].second;
             }
         } else if (term.IsRecord()) {
+            auto field_types = std::end(types) - term.RecordLabels().size();
             Type::RecordFields record_type_fields;
 
-            for (int i = 0; i < term.RecordLabels().size(); ++i) {
-                Type& field_type = TypeOf(ctx, *term.RecordTerms()[i]);
-
-                if (field_type.IsIllTyped()) {
+            for (std::size_t i = 0; i < term.RecordLabels().size(); ++i) {
+                if (field_types[i]->IsIllTyped()) {
                     break;
                 }
 
-                record_type_fields.insert({term.RecordLabels()[i], field_type});
+                record_type_fields.insert(
+                    {term.RecordLabels()[i], *field_types[i]});
             }
 
             if (record_type_fields.size() == term.RecordLabels().size()) {
                 res = &Type::Record(record_type_fields);
             }
+
+            types.erase(field_types, std::end(types));
         } else if (term.IsProjection()) {
-            Type& term_type = TypeOf(ctx, term.ProjectionTerm());
+            Type& term_type = PopType(types);
 
             if (term_type.IsRecord()) {
                 for (auto& field : term_type.GetRecordFields()) {
@@ -1915,171 +3271,966 @@ class TypeChecker {
         return *res;
     }
 
-    Context AddBinding(const Context& current_ctx, std::string var_name,
-                       Type& type) {
-        Context new_ctx = current_ctx;
-        new_ctx.push_front({var_name, &type});
+    Type& PopType(std::vector<Type*>& types) {
+        Type* type = types.back();
+        types.pop_back();
 
-        return new_ctx;
+        return *type;
     }
+
+    struct CacheEntry {
+        // The innermost bindings of the context in which type was calculated.
+        Context ctx_prefix;
+        Type* type;
+    };
+
+    std::unordered_map<std::uint64_t, std::vector<CacheEntry>> type_cache_;
+};
+
+/**
+ * Type checks a program that is edited in small steps (e.g. on every keystroke
+ * in an editor).
+ *
+ * An edit inside a group of the program (see parser::SourceGroups) reparses
+ * only the innermost group around it. Edits that can't be confined to a group
+ * (e.g. ones that close it, or that glue its contents to its delimiters)
+ * reparse the whole program instead.
+ *
+ * Either way, the new sub-term is diffed against the one it replaces
+ * top-down. Sub-terms that didn't change are moved from the old one into the
+ * new one, which keeps their nodes, and with them the types cached by the
+ * underlying TypeChecker, alive. Only the spine from the edited sub-terms up
+ * to the root is type checked again.
+ */
+class IncrementalTypeChecker {
+   public:
+    /**
+     * Type checks \p program, reusing whatever the previously checked program
+     * has in common with it.
+     *
+     * If \p program can't be parsed, the exception is propagated and the last
+     * successfully parsed program stays the one types are reused from.
+     */
+    Type& Check(std::string program) {
+        source_ = std::move(program);
+        // The groups of the previous program don't match the source anymore,
+        // so until it is parsed, edits have to reparse it whole.
+        regions_.clear();
+
+        parser::SourceGroups groups;
+        Term new_program =
+            parser::Parser{std::istringstream{source_}, groups}.ParseProgram();
+        num_reparsed_chars_ = source_.size();
+
+        binders_ = std::move(groups.binders);
+        Replace(program_, std::move(new_program), groups.groups);
+
+        return checker_.TypeOf(program_);
+    }
+
+    /**
+     * Replaces \p length characters of the current program, starting at
+     * \p offset, by \p text and type checks the result.
+     */
+    Type& Edit(std::size_t offset, std::size_t length,
+               const std::string& text) {
+        if (offset > source_.size()) {
+            throw std::out_of_range("Edit offset is past the program's end.");
+        }
+
+        length = std::min(length, source_.size() - offset);
+        std::string program = source_;
+        program.replace(offset, length, text);
+
+        const Region* region = InnermostRegion(offset, length);
+
+        if (region == nullptr) {
+            return Check(std::move(program));
+        }
+
+        std::size_t begin = region->begin;
+        std::size_t end = region->end;
+        Term& term = *region->term;
+        int binder = region->binder;
+        std::string contents =
+            program.substr(begin, end - length + text.size() - begin);
+
+        // A word (e.g. a variable) right at either end of the contents would
+        // be lexed together with a delimiter that is a word too (if, then or
+        // else).
+        if (!contents.empty() &&
+            ((!lexer::Lexer::IsTokenBoundary(source_[begin - 1]) &&
+              !lexer::Lexer::IsTokenBoundary(contents.front())) ||
+             (!lexer::Lexer::IsTokenBoundary(source_[end]) &&
+              !lexer::Lexer::IsTokenBoundary(contents.back())))) {
+            return Check(std::move(program));
+        }
+
+        parser::SourceGroups groups;
+        Term sub_term;
+
+        try {
+            sub_term = parser::Parser{std::istringstream{contents}, groups}
+                           .ParseSubTerm(BoundVariables(binder));
+        } catch (std::logic_error&) {
+            // E.g. the edit closes the group, which only the whole program
+            // can tell how to parse.
+            return Check(std::move(program));
+        }
+
+        // Once a parenthesized term is closed, the parser may combine the
+        // terms that follow it into it, depending on its category.
+        if (region->is_parenthesized && Category(sub_term) != Category(term)) {
+            return Check(std::move(program));
+        }
+
+        source_ = std::move(program);
+        num_reparsed_chars_ = contents.size();
+
+        int binder_offset = static_cast<int>(binders_.size());
+
+        for (auto& sub_term_binder : groups.binders) {
+            binders_.push_back({std::move(sub_term_binder.name),
+                                sub_term_binder.parent < 0
+                                    ? binder
+                                    : sub_term_binder.parent + binder_offset});
+        }
+
+        for (auto& group : groups.groups) {
+            group.begin += begin;
+            group.end += begin;
+            group.binder =
+                group.binder < 0 ? binder : group.binder + binder_offset;
+        }
+
+        ShiftRegions(begin, end, end - length + text.size());
+        Replace(term, std::move(sub_term), groups.groups);
+
+        return checker_.TypeOf(program_);
+    }
+
+    const std::string& Program() const { return source_; }
+
+    const Term& ProgramTerm() const { return program_; }
+
+    /**
+     * Returns the number of maximal unchanged sub-terms that the last check
+     * reused from the part of the previous program it reparsed.
+     */
+    std::size_t NumReusedTerms() const { return num_reused_terms_; }
+
+    /**
+     * Returns the number of characters of the program that the last check
+     * reparsed.
+     */
+    std::size_t NumReparsedChars() const { return num_reparsed_chars_; }
+
+   private:
+    /**
+     * A group of the source (see parser::SourceGroups) and the sub-term of
+     * program_ it was parsed into.
+     */
+    struct Region {
+        std::size_t begin;
+        std::size_t end;
+        Term* term;
+        int binder;
+        bool is_parenthesized;
+    };
+
+    /**
+     * Returns the innermost region whose contents include the \p length
+     * characters at \p offset, or nullptr if there is none.
+     */
+    const Region* InnermostRegion(std::size_t offset, std::size_t length) {
+        const Region* innermost = nullptr;
+
+        for (const auto& region : regions_) {
+            if (region.begin <= offset && offset + length <= region.end &&
+                (innermost == nullptr ||
+                 region.end - region.begin <
+                     innermost->end - innermost->begin)) {
+                innermost = &region;
+            }
+        }
+
+        return innermost;
+    }
+
+    /**
+     * Returns the names of the variables bound around the sub-terms of
+     * \p binder's scope, outermost first.
+     */
+    std::vector<std::string> BoundVariables(int binder) {
+        std::vector<std::string> names;
+
+        for (; binder >= 0; binder = binders_[binder].parent) {
+            names.push_back(binders_[binder].name);
+        }
+
+        std::reverse(names.begin(), names.end());
+
+        return names;
+    }
+
+    /**
+     * Updates regions_ for the contents of the region at [\p begin, \p end)
+     * being replaced by ones that end at \p new_end: the regions inside it are
+     * dropped and the ones after its start are moved.
+     */
+    void ShiftRegions(std::size_t begin, std::size_t end,
+                      std::size_t new_end) {
+        std::vector<Region> regions;
+        regions.reserve(regions_.size());
+
+        for (auto region : regions_) {
+            if (region.begin > begin && region.end <= end) {
+                continue;
+            }
+
+            if (region.begin > end) {
+                region.begin = region.begin - end + new_end;
+            }
+
+            if (region.end >= end) {
+                region.end = region.end - end + new_end;
+            }
+
+            regions.push_back(region);
+        }
+
+        regions_ = std::move(regions);
+    }
+
+    /**
+     * Replaces \p old_term, a sub-term of program_ (or program_ itself), by
+     * \p new_term, reusing the sub-terms of \p old_term that didn't change,
+     * and adds a region for each of \p groups, which new_term was parsed
+     * with.
+     */
+    void Replace(Term& old_term, Term new_term,
+                 const std::vector<parser::SourceGroups::Group>& groups) {
+        ForEachSubTerm(old_term, [this](Term& term) {
+            for (Term* child : Children(term)) {
+                parents_.erase(child);
+            }
+        });
+
+        // Reused sub-terms keep their old ids, so the groups' ids are mapped
+        // to the ids their sub-terms end up with.
+        std::unordered_map<std::uint64_t, std::uint64_t> group_ids;
+
+        for (const auto& group : groups) {
+            group_ids[group.term_id] = group.term_id;
+        }
+
+        num_reused_terms_ = 0;
+        Reuse(old_term, new_term, group_ids);
+        old_term = std::move(new_term);
+
+        std::unordered_map<std::uint64_t, Term*> group_terms;
+
+        for (const auto& [new_id, id] : group_ids) {
+            group_terms[id] = nullptr;
+        }
+
+        ForEachSubTerm(old_term, [this, &group_terms](Term& term) {
+            auto group_term = group_terms.find(term.GetId());
+
+            if (group_term != group_terms.end()) {
+                group_term->second = &term;
+            }
+
+            for (Term* child : Children(term)) {
+                parents_[child] = &term;
+            }
+        });
+
+        for (const auto& group : groups) {
+            Term* term = group_terms[group_ids[group.term_id]];
+
+            // The parser may drop a group's term (e.g. the parenthesized
+            // constant of (0) l x:Nat. x), which leaves nothing to replace.
+            if (term != nullptr) {
+                regions_.push_back({group.begin, group.end, term, group.binder,
+                                    group.is_parenthesized});
+            }
+        }
+
+        for (auto parent = parents_.find(&old_term); parent != parents_.end();
+             parent = parents_.find(parent->second)) {
+            Term& term = *parent->second;
+            term.UpdateFreeVariableBound();
+            term.UpdateIsValue();
+            checker_.Forget(term);
+        }
+    }
+
+    /**
+     * Calculates a structural hash for \p term and all its sub-terms.
+     */
+    std::unordered_map<const Term*, std::size_t> Hash(const Term& term) {
+        std::unordered_map<const Term*, std::size_t> hashes;
+        // The second member tells whether the children are hashed already.
+        std::vector<std::pair<const Term*, bool>> stack{{&term, false}};
+
+        while (!stack.empty()) {
+            auto [current, are_children_hashed] = stack.back();
+            stack.pop_back();
+
+            if (!are_children_hashed) {
+                stack.push_back({current, true});
+
+                for (const Term* child : Children(*current)) {
+                    stack.push_back({child, false});
+                }
+
+                continue;
+            }
+
+            std::size_t hash = ShallowHash(*current);
+
+            for (const Term* child : Children(*current)) {
+                hash = hash * 31 + hashes.at(child);
+            }
+
+            hashes[current] = hash;
+        }
+
+        return hashes;
+    }
+
+    /**
+     * Moves the sub-terms of \p old_term that didn't change into \p new_term
+     * and invalidates the cached types of everything else in \p old_term.
+     * \p group_ids is updated for the group sub-terms that are replaced by
+     * the old ones.
+     */
+    void Reuse(Term& old_term, Term& new_term,
+               std::unordered_map<std::uint64_t, std::uint64_t>& group_ids) {
+        auto old_hashes = Hash(old_term);
+        auto new_hashes = Hash(new_term);
+        std::vector<std::pair<Term*, Term*>> stack{{&old_term, &new_term}};
+
+        while (!stack.empty()) {
+            auto [old_sub_term, new_sub_term] = stack.back();
+            stack.pop_back();
+
+            if (old_hashes.at(old_sub_term) == new_hashes.at(new_sub_term) &&
+                IsIdentical(*old_sub_term, *new_sub_term, group_ids)) {
+                // The ids move with the nodes, so the whole sub-term stays
+                // cached.
+                std::swap(*old_sub_term, *new_sub_term);
+                ++num_reused_terms_;
+
+                continue;
+            }
+
+            auto old_children = Children(*old_sub_term);
+            auto new_children = Children(*new_sub_term);
+
+            if (IsShallowIdentical(*old_sub_term, *new_sub_term) &&
+                old_children.size() == new_children.size()) {
+                for (std::size_t i = 0; i < old_children.size(); ++i) {
+                    stack.push_back({old_children[i], new_children[i]});
+                }
+
+                checker_.Forget(*old_sub_term);
+            } else {
+                ForEachSubTerm(*old_sub_term,
+                               [this](Term& term) { checker_.Forget(term); });
+            }
+        }
+    }
+
+    /**
+     * Calls \p visit for \p term and all its sub-terms.
+     */
+    template <typename Visit>
+    void ForEachSubTerm(Term& term, Visit visit) {
+        std::vector<Term*> stack{&term};
+
+        while (!stack.empty()) {
+            Term* current = stack.back();
+            stack.pop_back();
+            visit(*current);
+
+            for (Term* child : Children(*current)) {
+                stack.push_back(child);
+            }
+        }
+    }
+
+    /**
+     * Like Term::operator== but also compares names (which the type checker
+     * relies on). If the terms are identical, the ids in \p group_ids of
+     * \p rhs's sub-terms are mapped to the ones of the matching sub-terms of
+     * \p lhs.
+     */
+    bool IsIdentical(const Term& lhs, const Term& rhs,
+                     std::unordered_map<std::uint64_t, std::uint64_t>&
+                         group_ids) {
+        std::vector<std::pair<const Term*, const Term*>> pairs;
+        std::vector<std::pair<const Term*, const Term*>> stack{{&lhs, &rhs}};
+
+        while (!stack.empty()) {
+            auto [lhs_sub_term, rhs_sub_term] = stack.back();
+            stack.pop_back();
+
+            if (!IsShallowIdentical(*lhs_sub_term, *rhs_sub_term)) {
+                return false;
+            }
+
+            auto lhs_children = Children(*lhs_sub_term);
+            auto rhs_children = Children(*rhs_sub_term);
+
+            if (lhs_children.size() != rhs_children.size()) {
+                return false;
+            }
+
+            for (std::size_t i = 0; i < lhs_children.size(); ++i) {
+                stack.push_back({lhs_children[i], rhs_children[i]});
+            }
+
+            if (group_ids.count(rhs_sub_term->GetId()) != 0) {
+                pairs.push_back({lhs_sub_term, rhs_sub_term});
+            }
+        }
+
+        for (auto [lhs_sub_term, rhs_sub_term] : pairs) {
+            group_ids[rhs_sub_term->GetId()] = lhs_sub_term->GetId();
+        }
+
+        return true;
+    }
+
+    /**
+     * Compares the node data of \p lhs and \p rhs, ignoring their sub-terms.
+     */
+    bool IsShallowIdentical(const Term& lhs, const Term& rhs) {
+        if (Category(lhs) != Category(rhs)) {
+            return false;
+        }
+
+        if (lhs.IsLambda()) {
+            return lhs.LambdaArgName() == rhs.LambdaArgName() &&
+                   &lhs.LambdaArgType() == &rhs.LambdaArgType();
+        }
+
+        if (lhs.IsVariable()) {
+            return lhs.VariableName() == rhs.VariableName() &&
+                   lhs.VariableDeBruijnIdx() == rhs.VariableDeBruijnIdx();
+        }
+
+        if (lhs.IsRecord()) {
+            return lhs.RecordLabels() == rhs.RecordLabels();
+        }
+
+        if (lhs.IsProjection()) {
+            return lhs.ProjectionLabel() == rhs.ProjectionLabel();
+        }
+
+        return true;
+    }
+
+    std::size_t ShallowHash(const Term& term) {
+        std::hash<std::string> string_hash;
+        std::size_t hash = Category(term);
+
+        if (term.IsLambda()) {
+            hash = hash * 31 + string_hash(term.LambdaArgName());
+            hash = hash * 31 + std::hash<Type*>{}(&term.LambdaArgType());
+        } else if (term.IsVariable()) {
+            hash = hash * 31 + string_hash(term.VariableName());
+            hash = hash * 31 + term.VariableDeBruijnIdx();
+        } else if (term.IsRecord()) {
+            for (const auto& label : term.RecordLabels()) {
+                hash = hash * 31 + string_hash(label);
+            }
+        } else if (term.IsProjection()) {
+            hash = hash * 31 + string_hash(term.ProjectionLabel());
+        }
+
+        return hash;
+    }
+
+    int Category(const Term& term) {
+        const bool categories[] = {
+            term.IsLambda(),
+            term.IsVariable(),
+            term.IsApplication(),
+            term.IsIf(),
+            term.IsTrue(),
+            term.IsFalse(),
+            term.IsSucc(),
+            term.IsPred(),
+            term.IsIsZero(),
+            term.IsConstantZero(),
+            term.IsRecord(),
+            term.IsProjection(),
+        };
+
+        return std::find(std::begin(categories), std::end(categories), true) -
+               std::begin(categories);
+    }
+
+    std::vector<Term*> Children(const Term& term) {
+        if (term.IsLambda()) {
+            return {&term.LambdaBody()};
+        }
+
+        if (term.IsApplication()) {
+            return {&term.ApplicationLHS(), &term.ApplicationRHS()};
+        }
+
+        if (term.IsIf()) {
+            return {&term.IfCondition(), &term.IfThen(), &term.IfElse()};
+        }
+
+        if (term.IsSucc() || term.IsPred() || term.IsIsZero()) {
+            return {&term.UnaryOpArg()};
+        }
+
+        if (term.IsProjection()) {
+            return {&term.ProjectionTerm()};
+        }
+
+        std::vector<Term*> children;
+
+        if (term.IsRecord()) {
+            for (const auto& record_term : term.RecordTerms()) {
+                children.push_back(record_term.get());
+            }
+        }
+
+        return children;
+    }
+
+    std::string source_;
+    Term program_;
+    // The groups of source_ (empty if it couldn't be parsed).
+    std::vector<Region> regions_;
+    std::vector<parser::SourceGroups::Binder> binders_;
+    // The enclosing Term of each sub-term of program_.
+    std::unordered_map<const Term*, Term*> parents_;
+    TypeChecker checker_;
+    std::size_t num_reused_terms_ = 0;
+    std::size_t num_reparsed_chars_ = 0;
 };
 }  // namespace type_checker
 
 namespace interpreter {
-class Interpreter {
-    using Term = parser::Term;
+/**
+ * Identifies how this interpreter evaluates programs and prints their results
+ * in caches of results (see result_cache/). Bump it whenever either changes.
+ */
+constexpr int kEngineVersion = 2;
+
+using budget::Budget;
+using budget::BudgetExceeded;
+using budget::BudgetMeter;
+
+/**
+ * Profiling policy of BasicInterpreter that records nothing. Its hooks are
+ * empty inline functions, so an unprofiled interpreter doesn't pay for them.
+ */
+struct NullProfiler {
+    void CountRule(const char*) {}
+
+    template <typename Operation>
+    void Time(const char*, Operation operation) {
+        operation();
+    }
+
+    void RecordTerm(const parser::Term&, std::size_t) {}
+
+    void RecordResult(const parser::Term&) {}
+};
 
+/**
+ * Profiling policy of BasicInterpreter that counts how often each reduction
+ * rule fires, measures the time spent in Shift() and Substitute() (which
+ * includes cloning the substituted terms) and tracks the largest term that
+ * evaluation produces.
+ */
+class Profiler {
    public:
-    std::pair<std::string, type_checker::Type&> Interpret(Term& program) {
-        type_checker::Type& type = type_checker::TypeChecker().TypeOf(program);
+    // How many steps apart the depth of the evaluated term is measured.
+    static constexpr long long kDepthSampleInterval = 1024;
+
+    void CountRule(const char* rule) { ++rule_counts_[rule]; }
+
+    template <typename Operation>
+    void Time(const char* name, Operation operation) {
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        operation_times_[name] += std::chrono::steady_clock::now() - start;
+    }
+
+    /**
+     * Records the term after a reduction step, given its size as counted by
+     * the budget meter. Measuring its depth takes a walk over the whole term,
+     * so that is only sampled every kDepthSampleInterval steps and on the
+     * result.
+     */
+    void RecordTerm(const parser::Term& term, std::size_t size) {
+        max_term_size_ = std::max(max_term_size_, size);
 
-        if (!type.IsIllTyped()) {
-            Eval(program);
+        if (num_terms_++ % kDepthSampleInterval == 0) {
+            RecordResult(term);
         }
+    }
 
-        std::ostringstream ss;
-        ss << program;
+    void RecordResult(const parser::Term& term) {
+        max_term_depth_ = std::max(max_term_depth_, term.SizeAndDepth().second);
+    }
 
-        auto term_str = ss.str();
+    /**
+     * Prints the collected data and the peak memory usage of the process as a
+     * table.
+     */
+    void Print(std::ostream& out) const {
+        const int kNameWidth = 24;
+        out << std::left << std::setw(kNameWidth) << "Rule" << "Count\n";
 
-        if (IsNatValue(program)) {
-            std::size_t start_pos = 0;
-            int num = 0;
+        for (const auto& [rule, count] : rule_counts_) {
+            out << std::setw(kNameWidth) << rule << count << "\n";
+        }
 
-            while ((start_pos = term_str.find("succ", start_pos)) !=
-                   std::string::npos) {
-                ++num;
-                ++start_pos;
-            }
+        out << "\n" << std::setw(kNameWidth) << "Operation" << "Time (ms)\n";
 
-            term_str = std::to_string(num);
+        for (const auto& [name, time] : operation_times_) {
+            out << std::setw(kNameWidth) << name
+                << std::chrono::duration<double, std::milli>(time).count()
+                << "\n";
         }
 
-        return {term_str, type};
+        out << "\n"
+            << std::setw(kNameWidth) << "Max term size" << max_term_size_
+            << " nodes\n"
+            << std::setw(kNameWidth) << "Max sampled depth" << max_term_depth_
+            << "\n"
+            << std::setw(kNameWidth) << "Peak memory" << PeakMemoryKiB()
+            << " KiB\n";
     }
 
    private:
-    void Eval(Term& term) {
-        try {
-            Eval1(term);
-            Eval(term);
-        } catch (std::invalid_argument&) {
+    static long PeakMemoryKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        // macOS reports ru_maxrss in bytes rather than KiB.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    std::map<std::string, long long> rule_counts_;
+    std::map<std::string, std::chrono::steady_clock::duration>
+        operation_times_;
+    std::size_t max_term_size_ = 0;
+    std::size_t max_term_depth_ = 0;
+    long long num_terms_ = 0;
+};
+
+/**
+ * Evaluates programs, reporting every reduction step to a ProfilingPolicy
+ * (NullProfiler or Profiler).
+ */
+template <typename ProfilingPolicy>
+class BasicInterpreter {
+    using Term = parser::Term;
+
+   public:
+    const ProfilingPolicy& GetProfiler() const { return profiler_; }
+
+    /**
+     * Limits every following evaluation to budget. Interpret() throws
+     * BudgetExceeded when an evaluation goes over it.
+     */
+    void SetBudget(const Budget& budget) { budget_ = budget; }
+
+    /**
+     * An evaluation of a term in place that can be suspended between any two
+     * reduction steps, so that a scheduler can interleave many evaluations on
+     * a few threads. The term must not be used otherwise until Resume()
+     * returned true.
+     *
+     * The evaluation context of the current redex is kept as an explicit
+     * stack of the sub-terms on the path from the term to the redex (i.e. a
+     * zipper over the term), which is all the state there is to suspend.
+     * After a reduction, the search for the next redex resumes at the reduced
+     * sub-term and only moves up as far as necessary instead of starting over
+     * at the term.
+     */
+    class Evaluation {
+       public:
+        /**
+         * Type checks term using checker and, if it is well typed, prepares to
+         * evaluate it.
+         */
+        Evaluation(BasicInterpreter& interpreter, Term& term,
+                   type_checker::TypeChecker& checker)
+            : interpreter_(interpreter),
+              term_(term),
+              type_(checker.TypeOf(term)),
+              meter_(interpreter.budget_) {
+            if (!type_.IsIllTyped()) {
+                // Evaluation rewrites the program in place which invalidates
+                // the types cached for its sub-terms.
+                checker.ClearCache();
+                context_.push_back(&term_);
+                meter_.Start(term_);
+                interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
+            }
+        }
+
+        /**
+         * Performs at most fuel (> 0) reduction steps and returns true once no
+         * evaluation rule applies anymore. Throws BudgetExceeded when the
+         * evaluation goes over the interpreter's budget.
+         */
+        bool Resume(long long fuel) {
+            meter_.Resume();
+
+            try {
+                while (!context_.empty()) {
+                    Term& focus = *context_.back();
+
+                    if (focus.IsValue()) {
+                        // Continue evaluating the enclosing term, whose cached
+                        // value flags are outdated now that focus was
+                        // evaluated.
+                        context_.pop_back();
+
+                        if (!context_.empty()) {
+                            context_.back()->UpdateIsValue();
+                        }
+
+                        continue;
+                    }
+
+                    Term* sub_term = interpreter_.Eval1(focus);
+
+                    if (sub_term) {
+                        if (sub_term->IsValue()) {
+                            // The enclosing term is stuck.
+                            throw std::invalid_argument("No applicable rule.");
+                        }
+
+                        context_.push_back(sub_term);
+                    } else {
+                        meter_.Step();
+                        interpreter_.profiler_.RecordTerm(
+                            term_, meter_.GetTermNodes());
+
+                        if (--fuel <= 0) {
+                            return false;
+                        }
+                    }
+                }
+            } catch (std::invalid_argument&) {
+                // Evaluation is stuck before getting back to the terms
+                // enclosing the focus, so their cached value flags still have
+                // to be updated.
+                UpdateContextIsValue();
+                context_.clear();
+            } catch (BudgetExceeded&) {
+                // Same for a partially evaluated term.
+                UpdateContextIsValue();
+                throw;
+            }
+
+            interpreter_.profiler_.RecordResult(term_);
+            meter_.Check();
+            return true;
+        }
+
+        /**
+         * Returns what Interpret() returns for the term once Resume() returned
+         * true.
+         */
+        std::pair<std::string, type_checker::Type&> Result() {
+            std::ostringstream ss;
+
+            if (term_.IsNatValue()) {
+                ss << interpreter_.NatValue(term_);
+            } else {
+                ss << term_;
+            }
+
+            return {ss.str(), type_};
         }
+
+        /**
+         * The number of reduction steps performed so far.
+         */
+        long long GetSteps() const { return meter_.GetSteps(); }
+
+       private:
+        void UpdateContextIsValue() {
+            for (auto it = context_.rbegin(); it != context_.rend(); ++it) {
+                (*it)->UpdateIsValue();
+            }
+        }
+
+        BasicInterpreter& interpreter_;
+        Term& term_;
+        type_checker::Type& type_;
+        std::vector<Term*> context_;
+        BudgetMeter<Term> meter_;
+    };
+
+    std::pair<std::string, type_checker::Type&> Interpret(Term& program) {
+        type_checker::TypeChecker checker;
+
+        return Interpret(program, checker);
+    }
+
+    /**
+     * Same as Interpret(Term&) but type checks \p program using \p checker so
+     * that types cached by earlier checks (e.g. of the same program) are
+     * reused.
+     */
+    std::pair<std::string, type_checker::Type&> Interpret(
+        Term& program, type_checker::TypeChecker& checker) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        Evaluation evaluation{*this, program, checker};
+        evaluation.Resume(std::numeric_limits<long long>::max());
+        return evaluation.Result();
     }
 
-    void Eval1(Term& term) {
-        auto term_subst_top = [](Term& s, Term& t) {
+   private:
+    /**
+     * Performs a single evaluation step on term in place and returns nullptr
+     * if term is a redex. Otherwise, returns the sub-term that the congruence
+     * rules select to be evaluated next. Throws std::invalid_argument if no
+     * evaluation rule applies.
+     */
+    Term* Eval1(Term& term) {
+        auto term_subst_top = [this](Term& s, Term& t) {
             // Adjust the free variables in s by increasing their static
             // distances by 1. That's because s will now be embedded one level
             // deeper in t (i.e. t's bound variable will be replaced by s).
-            s.Shift(1);
-            t.Substitute(0, s);
+            profiler_.Time("Shift", [&s] { s.Shift(1); });
+            profiler_.Time("Substitute", [&] { t.Substitute(0, s); });
             // Because of the substitution, one level of abstraction was peeled
             // off. Account for that by decreasing the static distances of the
             // free variables in t by 1.
-            t.Shift(-1);
+            profiler_.Time("Shift", [&t] { t.Shift(-1); });
             // NOTE: For more details see: tapl,§6.3.
         };
 
         if (term.IsApplication() && term.ApplicationLHS().IsLambda() &&
-            IsValue(term.ApplicationRHS())) {
+            term.ApplicationRHS().IsValue()) {
+            profiler_.CountRule("E-AppAbs");
             term_subst_top(term.ApplicationRHS(),
                            term.ApplicationLHS().LambdaBody());
-            std::swap(term, term.ApplicationLHS().LambdaBody());
-        } else if (term.IsApplication() && IsValue(term.ApplicationLHS())) {
-            Eval1(term.ApplicationRHS());
+            ReplaceBySubTerm(term, term.ApplicationLHS().LambdaBody());
+            return nullptr;
+        } else if (term.IsApplication() && term.ApplicationLHS().IsValue()) {
+            return &term.ApplicationRHS();
         } else if (term.IsApplication()) {
-            Eval1(term.ApplicationLHS());
+            return &term.ApplicationLHS();
         } else if (term.IsIf()) {
             if (term.IfCondition() == Term::True()) {
-                std::swap(term, term.IfThen());
+                profiler_.CountRule("E-IfTrue");
+                ReplaceBySubTerm(term, term.IfThen());
+                return nullptr;
             } else if (term.IfCondition() == Term::False()) {
-                std::swap(term, term.IfElse());
-            } else {
-                Eval1(term.IfCondition());
+                profiler_.CountRule("E-IfFalse");
+                ReplaceBySubTerm(term, term.IfElse());
+                return nullptr;
             }
+
+            return &term.IfCondition();
         } else if (term.IsSucc()) {
-            Eval1(term.UnaryOpArg());
+            return &term.UnaryOpArg();
         } else if (term.IsPred()) {
             auto& pred_arg = term.UnaryOpArg();
 
             if (pred_arg.IsConstantZero()) {
-                std::swap(term, term.UnaryOpArg());
-            } else if (pred_arg.IsSucc()) {
-                if (IsNatValue(pred_arg)) {
-                    std::swap(term, pred_arg.UnaryOpArg());
-                } else {
-                    Eval1(pred_arg);
-                }
-            } else {
-                Eval1(pred_arg);
+                profiler_.CountRule("E-PredZero");
+                ReplaceBySubTerm(term, pred_arg);
+                return nullptr;
+            } else if (pred_arg.IsSucc() && pred_arg.IsNatValue()) {
+                profiler_.CountRule("E-PredSucc");
+                ReplaceBySubTerm(term, pred_arg.UnaryOpArg());
+                return nullptr;
             }
+
+            return &pred_arg;
         } else if (term.IsIsZero()) {
             auto& iszero_arg = term.UnaryOpArg();
 
             if (iszero_arg.IsConstantZero()) {
-                auto temp = Term::True();
-                std::swap(term, temp);
-            } else if (iszero_arg.IsSucc()) {
-                if (IsNatValue(iszero_arg)) {
-                    auto temp = Term::False();
-                    std::swap(term, temp);
-                } else {
-                    Eval1(iszero_arg);
-                }
-            } else {
-                Eval1(iszero_arg);
+                profiler_.CountRule("E-IsZeroZero");
+                term = Term::True();
+                return nullptr;
+            } else if (iszero_arg.IsSucc() && iszero_arg.IsNatValue()) {
+                profiler_.CountRule("E-IsZeroSucc");
+                term = Term::False();
+                return nullptr;
             }
+
+            return &iszero_arg;
         } else if (term.IsProjection()) {
             Term& projection_term = term.ProjectionTerm();
 
-            if (IsRecordValue(projection_term)) {
-                for (int i = 0; i < projection_term.RecordLabels().size();
-                     ++i) {
-                    if (projection_term.RecordLabels()[i] ==
-                        term.ProjectionLabel()) {
-                        std::swap(term, *projection_term.RecordTerms()[i]);
+            if (!projection_term.IsValue()) {
+                return &projection_term;
+            }
 
-                        break;
-                    }
+            for (int i = 0; i < projection_term.RecordLabels().size(); ++i) {
+                if (projection_term.RecordLabels()[i] ==
+                    term.ProjectionLabel()) {
+                    profiler_.CountRule("E-ProjRcd");
+                    ReplaceBySubTerm(term, *projection_term.RecordTerms()[i]);
+                    return nullptr;
                 }
-            } else {
-                Eval1(projection_term);
             }
         } else if (term.IsRecord()) {
             for (auto& record_term : term.RecordTerms()) {
-                if (!IsValue(*record_term)) {
-                    Eval1(*record_term);
-                    break;
+                if (!record_term->IsValue()) {
+                    return &*record_term;
                 }
             }
-        } else {
-            throw std::invalid_argument("No applicable rule.");
         }
-    }
 
-    bool IsNatValue(const Term& term) {
-        return term.IsConstantZero() ||
-               (term.IsSucc() && IsNatValue(term.UnaryOpArg()));
+        throw std::invalid_argument("No applicable rule.");
     }
 
-    bool IsRecordValue(const Term& term) {
-        if (!term.IsRecord()) {
-            return false;
-        }
+    /**
+     * Returns the number that the numeric value term represents.
+     */
+    std::size_t NatValue(const Term& term) {
+        std::size_t value = 0;
 
-        for (auto& record_term : term.RecordTerms()) {
-            if (!IsValue(*record_term)) {
-                return false;
-            }
+        for (const Term* current = &term; current->IsSucc();
+             current = &current->UnaryOpArg()) {
+            ++value;
         }
 
-        return true;
+        return value;
     }
 
-    bool IsValue(const Term& term) {
-        return term.IsLambda() || term.IsVariable() || term.IsTrue() ||
-               term.IsFalse() || IsNatValue(term) || IsRecordValue(term);
+    /**
+     * Replaces term by its (direct or indirect) sub-term without copying the
+     * sub-term.
+     */
+    void ReplaceBySubTerm(Term& term, Term& sub_term) {
+        // sub_term is owned by term, so it has to be moved out before term is
+        // overwritten. (Swapping the two instead would make sub_term own the
+        // rest of term, which then is never freed.)
+        Term tmp = std::move(sub_term);
+        term = std::move(tmp);
     }
+
+    ProfilingPolicy profiler_;
+    Budget budget_;
 };
+
+using Interpreter = BasicInterpreter<NullProfiler>;
+using ProfilingInterpreter = BasicInterpreter<Profiler>;
 }  // namespace interpreter
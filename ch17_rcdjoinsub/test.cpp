@@ -2,6 +2,7 @@
 #include <iostream>
 #include <optional>
 
+#include "../program_generator/generator.hpp"
 #include "interpreter.hpp"
 
 namespace lexer {
@@ -28,11 +29,18 @@ void Run();
 }
 }  // namespace interpreter
 
+namespace program_generator {
+namespace test {
+void Run();
+}
+}  // namespace program_generator
+
 int main() {
     lexer::test::Run();
     parser::test::Run();
     type_checker::test::Run();
     interpreter::test::Run();
+    program_generator::test::Run();
 
     return 0;
 }
@@ -1117,7 +1125,7 @@ void InitData() {
 
     auto record5 = Term::Record();
     record5.AddRecordLabel("x");
-    record5.Combine(Term::Zero());
+    record5.Combine(Succ(Term::Zero()));
     kData.emplace_back(TestData{
         "(l r:{x:Nat}. r.x) {x=succ 0}",
         Term::Application(LambdaUP("r", Type::Record({{"x", Type::Nat()}}),
@@ -1555,19 +1563,145 @@ void InitJoinData() {
     }
 }
 
+struct IncrementalTestData {
+    // The edit replaces the first occurrence of old_text_ in the current
+    // program by new_text_.
+    std::string old_text_;
+    std::string new_text_;
+    // nullptr if the edited program is expected to be rejected by the parser.
+    Type* expected_type_;
+    // Only checked if the edited program is parsed.
+    std::size_t expected_num_reparsed_chars_;
+    std::size_t expected_num_reused_terms_;
+};
+
+const std::string kIncrementalProgram = "(l x:Nat. {a=x, b=iszero x}) 0";
+
+std::vector<IncrementalTestData> kIncrementalData{};
+
+void InitIncrementalData() {
+    // Only the term of field b is reparsed.
+    kIncrementalData.emplace_back(IncrementalTestData{
+        "iszero x", "x",
+        &Type::Record({{"a", Type::Nat()}, {"b", Type::Nat()}}), 1, 0});
+
+    // The parenthesized abstraction is reparsed, and none of it is reused
+    // since the type of its body depends on the changed binder.
+    kIncrementalData.emplace_back(
+        IncrementalTestData{"x:Nat", "x:Bool", &Type::IllTyped(), 20, 0});
+
+    // The argument isn't in any group, so the whole program is reparsed, and
+    // the abstraction is reused.
+    kIncrementalData.emplace_back(IncrementalTestData{
+        ") 0", ") true",
+        &Type::Record({{"a", Type::Bool()}, {"b", Type::Bool()}}), 27, 1});
+
+    // The edit spans a brace, so the enclosing parenthesized term is
+    // reparsed, which reuses the term of field b.
+    kIncrementalData.emplace_back(
+        IncrementalTestData{"{a=x", "{a=y", &Type::IllTyped(), 20, 1});
+
+    kIncrementalData.emplace_back(IncrementalTestData{
+        "{a=y", "{a=x",
+        &Type::Record({{"a", Type::Bool()}, {"b", Type::Bool()}}), 20, 1});
+
+    kIncrementalData.emplace_back(
+        IncrementalTestData{"(l", "((l", nullptr, 0, 0});
+
+    // Reused from the last program that was parsed.
+    kIncrementalData.emplace_back(IncrementalTestData{
+        "true", "true)",
+        &Type::Record({{"a", Type::Bool()}, {"b", Type::Bool()}}), 29, 1});
+
+    // Renaming the binder alone makes the unchanged variable terms ill-typed.
+    kIncrementalData.emplace_back(
+        IncrementalTestData{"l x", "l z", &Type::IllTyped(), 20, 0});
+
+    kIncrementalData.emplace_back(IncrementalTestData{
+        "{a=x, b=x}", "{a=z, b=z}.b", &Type::Bool(), 22, 0});
+}
+
+// Deep enough that reading an image by recursing once per nesting level
+// overflows the stack.
+const int kDeepImageDepth = 1000000;
+
+// The number of fields of the large program that is edited incrementally.
+const int kNumIncrementalFields = 2000;
+
+// Labels are letters only: fa, fb, ..., fz, fab, ...
+std::string IncrementalFieldLabel(int i) {
+    std::string label = "f";
+
+    do {
+        label += static_cast<char>('a' + i % 26);
+        i /= 26;
+    } while (i != 0);
+
+    return label;
+}
+
+struct BadImageTestData {
+    std::string description_;
+    std::string image_;
+};
+
+std::vector<BadImageTestData> kBadImageData{};
+
+void InitBadImageData() {
+    // The image of "succ 0" ends with the tags of succ and 0, and Nat is the
+    // only type in its table.
+    Term program = Parser{std::istringstream{"succ 0"}}.ParseProgram();
+    std::string image = ImageWriter().Write(program, Type::Nat());
+    char succ_tag = image[image.size() - 2];
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"truncated", image.substr(0, image.size() - 1)});
+
+    std::string bad_version = image;
+    bad_version[kImageMagic.size()] = kImageVersion + 1;
+    kBadImageData.emplace_back(
+        BadImageTestData{"unsupported version", bad_version});
+
+    // The magic and the version are followed by the sizes of the (empty)
+    // string table and of the type table.
+    std::string bad_type_tag = image;
+    bad_type_tag[kImageMagic.size() + 3] = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid type tag", bad_type_tag});
+
+    std::string bad_term_tag = image;
+    bad_term_tag.back() = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid term tag", bad_term_tag});
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"trailing term", image + image.back()});
+
+    kBadImageData.emplace_back(BadImageTestData{
+        "succ^" + std::to_string(kDeepImageDepth) + " without an argument",
+        image.substr(0, image.size() - 2) +
+            std::string(kDeepImageDepth, succ_tag)});
+}
+
 void Run() {
     InitData();
     InitSubtypingData();
     InitJoinData();
+    InitIncrementalData();
+    InitBadImageData();
 
-    size_t total_num_tests =
-        kData.size() + kSubtypingData.size() + kJoinData.size();
+    size_t total_num_tests = kData.size() + kSubtypingData.size() +
+                             kJoinData.size() + kIncrementalData.size() +
+                             2 + kBadImageData.size();
 
     // Test type checking.
     std::cout << color::kYellow << "[Type Checker] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
+    // Checks every program without clearing its cache in between, although
+    // later programs reuse the addresses of the earlier programs' nodes.
+    TypeChecker reused_checker;
 
     for (const auto& test : kData) {
         try {
@@ -1575,8 +1709,42 @@ void Run() {
             Term program = parser.ParseProgram();
             TypeChecker type_checker;
             Type& res = type_checker.TypeOf(program);
+            // Checking the program again is answered from the cache.
+            Type& cached_res = type_checker.TypeOf(program);
+            Type& reused_res = reused_checker.TypeOf(program);
+
+            // A program loaded from its image has the same terms and type.
+            std::string image = ImageWriter().Write(program, res);
+            ImageReader reader{image.data(), image.size()};
+            Term loaded_program = reader.ReadProgram();
+            Type& loaded_res = TypeChecker().TypeOf(loaded_program);
+            std::ostringstream program_str;
+            std::ostringstream loaded_program_str;
+            program_str << program;
+            loaded_program_str << loaded_program;
+
+            // Types interned in an arena of their own compare equal to the
+            // global ones, and the arena can be dropped with its program.
+            std::size_t num_global_types = Type::Arena::Current().Size();
+            bool arena_res_matches = false;
+            {
+                Type::Arena arena;
+                Type::Arena::Scope scope{arena};
+                Term arena_program =
+                    Parser{std::istringstream{test.input_program_}}
+                        .ParseProgram();
+                arena_res_matches =
+                    test.expected_type_ == TypeChecker().TypeOf(arena_program);
+            }
 
-            if (test.expected_type_ != res) {
+            if (!arena_res_matches ||
+                Type::Arena::Current().Size() != num_global_types ||
+                test.expected_type_ != res ||
+                test.expected_type_ != cached_res ||
+                test.expected_type_ != reused_res ||
+                test.expected_type_ != reader.ProgramType() ||
+                test.expected_type_ != loaded_res ||
+                program_str.str() != loaded_program_str.str()) {
                 std::cout << color::kRed << "Test failed:" << color::kReset
                           << "\n";
 
@@ -1646,6 +1814,152 @@ void Run() {
         }
     }
 
+    // Test incremental type checking of an edited program.
+    IncrementalTypeChecker incremental_checker;
+    std::string program = kIncrementalProgram;
+    incremental_checker.Check(program);
+
+    for (const auto& test : kIncrementalData) {
+        program.replace(program.find(test.old_text_), test.old_text_.size(),
+                        test.new_text_);
+        Type* res = nullptr;
+
+        try {
+            res = &incremental_checker.Edit(
+                incremental_checker.Program().find(test.old_text_),
+                test.old_text_.size(), test.new_text_);
+        } catch (std::exception& ex) {
+        }
+
+        if (res != test.expected_type_ ||
+            incremental_checker.Program() != program ||
+            (res != nullptr && (incremental_checker.NumReparsedChars() !=
+                                    test.expected_num_reparsed_chars_ ||
+                                incremental_checker.NumReusedTerms() !=
+                                    test.expected_num_reused_terms_))) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Edited program: " << program << "\n";
+
+            std::cout << color::kGreen << "  Expected type: " << color::kReset
+                      << "\n    "
+                      << (test.expected_type_ ? *test.expected_type_
+                                              : Type::IllTyped())
+                      << (test.expected_type_ ? "" : " (parsing fails)")
+                      << "\n";
+
+            std::cout << color::kRed << "  Actual type: " << color::kReset
+                      << "\n    " << (res ? *res : Type::IllTyped())
+                      << (res ? "" : " (parsing fails)") << "\n";
+
+            std::cout << "  Reparsed characters: "
+                      << incremental_checker.NumReparsedChars()
+                      << " (expected " << test.expected_num_reparsed_chars_
+                      << "), reused terms: "
+                      << incremental_checker.NumReusedTerms() << " (expected "
+                      << test.expected_num_reused_terms_ << ")\n";
+            ++num_failed;
+        }
+    }
+
+    // Test that editing a large program reparses only the edited group and
+    // gives the type that checking it from scratch gives.
+    {
+        std::string large_program = "(l y:Bool. {";
+
+        for (int i = 0; i < kNumIncrementalFields; ++i) {
+            large_program += (i == 0 ? "" : ", ") + IncrementalFieldLabel(i) +
+                             "=(l x:Nat. {a=iszero x, b=succ x}) 0";
+        }
+
+        large_program += "}) true";
+
+        IncrementalTypeChecker large_checker;
+        large_checker.Check(large_program);
+        std::string field = IncrementalFieldLabel(kNumIncrementalFields / 2) +
+                            "=(l x:Nat. {a=iszero x";
+        Type& edited_type = large_checker.Edit(
+            large_checker.Program().find(field) + field.size() - 11, 11,
+            "{a=pred x");
+        Type& edited_full_type =
+            TypeChecker{}.TypeOf(Parser{std::istringstream{
+                                            large_checker.Program()}}
+                                     .ParseProgram());
+
+        // The edit spans a brace, so the field's abstraction
+        // "l x:Nat. {a=pred x, b=succ x}" is reparsed.
+        if (&edited_type != &edited_full_type ||
+            large_checker.NumReparsedChars() != 29 ||
+            large_checker.NumReusedTerms() != 1) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Edited a field of a record with "
+                      << kNumIncrementalFields << " fields.\n";
+
+            std::cout << color::kRed << "  Reparsed characters: "
+                      << color::kReset << large_checker.NumReparsedChars()
+                      << " (expected 29), reused terms: "
+                      << large_checker.NumReusedTerms() << " (expected 1)\n";
+            ++num_failed;
+        }
+    }
+
+    // Test that the walks over a deeply nested program don't recurse once per
+    // nesting level.
+    {
+        std::string deep_program;
+
+        for (int i = 0; i < kDeepImageDepth; ++i) {
+            deep_program += "succ ";
+        }
+
+        deep_program += "(pred 0)";
+
+        IncrementalTypeChecker deep_checker;
+        Type* res = nullptr;
+
+        try {
+            deep_checker.Check(deep_program);
+            res = &deep_checker.Edit(deep_checker.Program().find("0)"), 1,
+                                     "succ 0");
+        } catch (std::exception& ex) {
+        }
+
+        if (res != &Type::Nat() || deep_checker.NumReparsedChars() != 11) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Edited a program nested " << kDeepImageDepth
+                      << " levels deep.\n";
+
+            std::cout << color::kRed << "  Actual type: " << color::kReset
+                      << "\n    " << (res ? *res : Type::IllTyped())
+                      << (res ? "" : " (parsing fails)") << "\n";
+            ++num_failed;
+        }
+    }
+
+    // Test that malformed images are rejected rather than crashing the reader.
+    for (const auto& test : kBadImageData) {
+        bool is_rejected = false;
+
+        try {
+            ImageReader{test.image_.data(), test.image_.size()}.ReadProgram();
+        } catch (std::invalid_argument&) {
+            is_rejected = true;
+        }
+
+        if (!is_rejected) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Image: " << test.description_ << "\n";
+
+            std::cout << color::kRed << "  The image was loaded."
+                      << color::kReset << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
               << (total_num_tests - num_failed) << " out of " << total_num_tests
               << " tests passed.\n";
@@ -1742,11 +2056,98 @@ void InitData() {
     kData.emplace_back(
         TestData{"(l r:{a:{x:Nat}}. r.a.x) {a={x=succ 0, y=true}, b=false}",
                  {"1", Type::Nat()}});
+
+    kData.emplace_back(
+        TestData{"(l x:Nat. {a=x, b=succ x}.b) 0", {"1", Type::Nat()}});
+}
+
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 1000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::pair<std::string, Type&> expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+    Type* lambdas_type = &Type::Bool();
+
+    for (int i = 0; i < n; ++i) {
+        lambdas_type = &Type::Function(Type::Bool(), *lambdas_type);
+    }
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "succ^" + n_str + " 0", Repeat("succ ", n) + "0",
+        {n_str, Type::Nat()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l y:Bool. (l x:Bool.)^" + n_str + " y) true",
+        "(l y:Bool. " + Repeat("l x:Bool. ", n) + "y) true",
+        {Repeat("{l x : Bool. ", n) + "true" + Repeat("}", n),
+         *lambdas_type}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + n_str + " false (else true)^" + n_str,
+        Repeat("if true then ", n) + "false" + Repeat(" else true", n),
+        {"false", Type::Bool()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "x^" + n_str + " x", Repeat("x ", n) + "x",
+        {Repeat("(", n) + "x" + Repeat(" <- x)", n), Type::IllTyped()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "l x:(^" + n_str + " Nat )^" + n_str + ". x",
+        "l x:" + Repeat("(", n) + "Nat" + Repeat(")", n) + ". x",
+        {"{l x : Nat. x}", Type::Function(Type::Nat(), Type::Nat())}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "((l r:{a:^" + n_str + " Nat }^" + n_str + ". r) {a=^" + n_str +
+            " 0 }^" + n_str + ").a^" + n_str,
+        "((l r:" + Repeat("{a:", n) + "Nat" + Repeat("}", n) + ". r) " +
+            Repeat("{a=", n) + "0" + Repeat("}", n) + ")" + Repeat(".a", n),
+        {"0", Type::Nat()}});
+
+    Type* record_type = &Type::Nat();
+
+    for (int i = 0; i < n; ++i) {
+        record_type = &Type::Record({{"a", *record_type}});
+    }
+
+    // The argument is a sub-type of the parameter at every nesting level.
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l r:{a:^" + n_str + " Nat }^" + n_str + ". r) {b=true, a=^" +
+            n_str + " 0 }^" + n_str,
+        "(l r:" + Repeat("{a:", n) + "Nat" + Repeat("}", n) + ". r) " +
+            Repeat("{b=true, a=", n) + "0" + Repeat("}", n),
+        {Repeat("{b=true, a=", n) + "0" + Repeat("}", n), *record_type}});
 }
 
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    size_t total_num_tests = kData.size() + kDeepTermData.size();
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -1798,9 +2199,110 @@ void Run() {
         }
     }
 
+    for (const auto& test : kDeepTermData) {
+        Term program = parser::Parser{std::istringstream{test.input_program_}}
+                           .ParseProgram();
+        bool is_clone_equal = program.Clone() == program;
+        std::string image = parser::ImageWriter().Write(
+            program, test.expected_eval_result_.second);
+        bool is_loaded_equal =
+            parser::ImageReader{image.data(), image.size()}.ReadProgram() ==
+            program;
+        auto actual_eval_res = Interpreter().Interpret(program);
+
+        if (!is_clone_equal || !is_loaded_equal ||
+            actual_eval_res.first != test.expected_eval_result_.first ||
+            actual_eval_res.second != test.expected_eval_result_.second) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
+
+namespace program_generator {
+namespace test {
+
+using namespace utils::test;
+using parser::Type;
+
+/**
+ * Generates a program of a random type from every seed and checks that it
+ * parses, has that type and evaluates to a result of that type, and that the
+ * same seed generates the same program again.
+ */
+void Run() {
+    constexpr int kNumSeeds = 200;
+    const Options kOptions = {false, true};
+    std::cout << color::kYellow << "[Generator] Running " << kNumSeeds
+              << " tests...\n"
+              << color::kReset;
+    int num_failed = 0;
+
+    for (int seed = 0; seed < kNumSeeds; ++seed) {
+        Type::Arena arena;
+        Type::Arena::Scope scope{arena};
+        Generator<Type> generator{static_cast<std::uint64_t>(seed), kOptions};
+        Type& type = generator.RandomType();
+        int size = 1 + seed * 7 % 300;
+        std::string program = generator.Generate(type, size);
+
+        Generator<Type> same_generator{static_cast<std::uint64_t>(seed),
+                                       kOptions};
+        Type& same_type = same_generator.RandomType();
+        bool reproducible = &same_type == &type &&
+                            same_generator.Generate(type, size) == program;
+
+        try {
+            parser::Term term =
+                parser::Parser{std::istringstream{program}}.ParseProgram();
+            Type& res = type_checker::TypeChecker().TypeOf(term);
+            auto eval_res = interpreter::Interpreter().Interpret(term);
+
+            if (!reproducible || res != type || eval_res.second != type) {
+                std::cout << color::kRed << "Test failed:" << color::kReset
+                          << "\n";
+
+                std::cout << "  Seed: " << seed << "\n";
+
+                std::cout << "  Input program: " << program << "\n";
+
+                std::cout << color::kGreen
+                          << "  Expected type: " << color::kReset << "\n"
+                          << "    " << type << "\n";
+
+                std::cout << color::kRed << "  Actual type: " << color::kReset
+                          << "\n    " << res << ", evaluated to "
+                          << eval_res.second << "\n";
+
+                ++num_failed;
+            }
+        } catch (std::exception& ex) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Seed: " << seed << "\n";
+
+            std::cout << "  Input program: " << program << "\n";
+
+            std::cout << color::kRed << "  Error: " << color::kReset
+                      << ex.what() << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    std::cout << color::kYellow << "Results: " << color::kReset
+              << (kNumSeeds - num_failed) << " out of " << kNumSeeds
+              << " tests passed.\n";
+}
+
+}  // namespace test
+}  // namespace program_generator
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../complexity_fuzzer/fuzzer.hpp"
+#include "interpreter.hpp"
+
+namespace {
+
+using complexity_fuzzer::Join;
+using complexity_fuzzer::Name;
+using complexity_fuzzer::Repeat;
+
+/**
+ * Returns the seconds parsing, type checking and evaluating source take. The
+ * types are interned in an arena of their own, so that the types of earlier
+ * programs don't slow down interning.
+ */
+std::vector<double> Measure(const std::string& source) {
+    parser::Type::Arena arena;
+    parser::Type::Arena::Scope scope{arena};
+    parser::Term program;
+    type_checker::TypeChecker checker;
+    interpreter::Interpreter interpreter;
+    double parse_time = complexity_fuzzer::Seconds([&] {
+        program =
+            parser::Parser{std::istringstream{source}}.ParseProgram();
+    });
+    double type_check_time = complexity_fuzzer::Seconds(
+        [&] { checker.TypeOf(program); });
+    // Reuses the types the type check cached, so that the evaluation doesn't
+    // type check the program again.
+    double eval_time = complexity_fuzzer::Seconds(
+        [&] { interpreter.Interpret(program, checker); });
+
+    return {parse_time, type_check_time, eval_time};
+}
+
+std::string Fields(int n, const std::string& value) {
+    return Join(n, [&](int i) { return Name(i) + value; }, ", ");
+}
+
+const std::vector<complexity_fuzzer::Family> kFamilies = {
+    {"numeral", [](int n) { return Repeat("succ ", n) + "0"; }},
+    {"record width",
+     [](int n) { return "{" + Fields(n, "=0") + "}." + Name(n - 1); }},
+    {"let chain",
+     [](int n) {
+         return Join(n,
+                     [](int i) {
+                         return "let " + Name(i) + " = " +
+                                (i > 0 ? Name(i - 1) : "0") + " in ";
+                     },
+                     "") +
+                Name(n - 1);
+     }},
+    {"reference nesting",
+     [](int n) { return Repeat("!", n) + Repeat("ref ", n) + "0"; }},
+    {"nested records",
+     [](int n) {
+         return Repeat("{a=", n) + "0" + Repeat("}", n) + Repeat(".a", n);
+     }},
+    {"lambda nesting", [](int n) { return Repeat("l x:Nat. ", n) + "x"; }},
+    {"application spine",
+     [](int n) {
+         return "(" + Repeat("l x:Nat. ", n) + "x)" + Repeat(" 0", n);
+     }},
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    complexity_fuzzer::Options options;
+
+    if (!complexity_fuzzer::ParseOptions(argc, argv, options, std::cerr)) {
+        return 1;
+    }
+
+    complexity_fuzzer::Fuzzer fuzzer{"ch18_fullref",
+                                     {"parse", "type check", "eval"},
+                                     Measure,
+                                     options};
+    return fuzzer.Run(kFamilies, std::cout) > 0 ? 1 : 0;
+}
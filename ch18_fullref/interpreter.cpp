@@ -1,23 +1,308 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <type_traits>
 
+#include "../corpus_runner/runner.hpp"
+#include "../result_cache/result_cache.hpp"
 #include "interpreter.hpp"
 
+/**
+ * Where to save checkpoints of the evaluation (nowhere if path_ is empty) and
+ * every how many steps.
+ */
+struct CheckpointOptions {
+    std::string path_;
+    long long interval_ = 10000000;
+};
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+
+    if (!in) {
+        throw std::runtime_error("Can't read " + path + ".");
+    }
+
+    return {std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()};
+}
+
+/**
+ * Replaces the file at path by contents (e.g. a checkpoint). The contents are
+ * written to a temporary file first, so a crash while writing leaves the
+ * previous file intact.
+ */
+void ReplaceFile(const std::string& contents, const std::string& path) {
+    std::string tmp_path = path + ".tmp";
+
+    {
+        std::ofstream out{tmp_path, std::ios::binary};
+        out << contents;
+
+        if (!out.flush()) {
+            throw std::runtime_error("Can't write " + tmp_path + ".");
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Can't replace " + path + ".");
+    }
+}
+
+/**
+ * Evaluates start.term_ with an Interpreter limited to budget, recording the
+ * evaluation in trace,
+ * prints the result and, for a ProfilingInterpreter, the profile. If
+ * start.type_ is set, start was loaded from a checkpoint or a program image
+ * and the evaluation continues from there without type checking the term
+ * again.
+ */
+template <typename Interpreter>
+void Evaluate(interpreter::Checkpoint& start,
+              type_checker::TypeChecker& checker,
+              parser::HashConsTable& hash_cons_table, bool hash_cons,
+              const interpreter::Budget& budget,
+              const CheckpointOptions& checkpointing,
+              tracing::Tracer::Buffer& trace) {
+    using Evaluation = typename Interpreter::Evaluation;
+    Interpreter interpreter =
+        hash_cons ? Interpreter{hash_cons_table} : Interpreter{};
+    interpreter.SetBudget(budget);
+    auto res = trace.Record("eval", 0, [&] {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        Evaluation evaluation =
+            start.type_ ? Evaluation{interpreter, start.term_, *start.type_,
+                                     start.steps_}
+                        : Evaluation{interpreter, start.term_, checker};
+        long long fuel = checkpointing.path_.empty()
+                             ? std::numeric_limits<long long>::max()
+                             : checkpointing.interval_;
+
+        while (!evaluation.Resume(fuel)) {
+            ReplaceFile(evaluation.Snapshot(), checkpointing.path_);
+        }
+
+        return evaluation.Result();
+    });
+    std::cout << "=> " << res.first << ": " << res.second << "\n";
+
+    if constexpr (std::is_same_v<Interpreter,
+                                 interpreter::ProfilingInterpreter>) {
+        interpreter.GetProfiler().Print(std::cerr);
+    }
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr
-            << "Error: expected input program as a command line argument.\n";
+    bool hash_cons = false;
+    bool profile = false;
+    bool resume = false;
+    bool load_image = false;
+    std::string trace_path;
+    std::string cache_dir;
+    std::string image_path;
+    CheckpointOptions checkpointing;
+    interpreter::Budget budget;
+    int arg_idx = 1;
+
+    for (; arg_idx < argc - 1; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag == "--hash-cons") {
+            hash_cons = true;
+        } else if (flag == "--profile") {
+            profile = true;
+        } else if (flag == "--resume") {
+            resume = true;
+        } else if (flag == "--load-image") {
+            load_image = true;
+        } else if (flag == "--trace" || flag == "--cache" ||
+                   flag == "--max-steps" || flag == "--max-nodes" ||
+                   flag == "--timeout-ms" || flag == "--save-image" ||
+                   flag == "--checkpoint" || flag == "--checkpoint-every") {
+            if (++arg_idx >= argc - 1) {
+                std::cerr << "Error: expected a value after " << flag << ".\n";
+                return 1;
+            }
+
+            std::string value = argv[arg_idx];
+
+            try {
+                if (flag == "--trace") {
+                    trace_path = value;
+                } else if (flag == "--cache") {
+                    cache_dir = value;
+                } else if (flag == "--save-image") {
+                    image_path = value;
+                } else if (flag == "--checkpoint") {
+                    checkpointing.path_ = value;
+                } else if (flag == "--checkpoint-every") {
+                    checkpointing.interval_ = std::stoll(value);
+                } else if (flag == "--max-steps") {
+                    budget.max_steps_ = std::stoll(value);
+                } else if (flag == "--max-nodes") {
+                    budget.max_term_nodes_ = std::stoull(value);
+                } else {
+                    budget.max_time_ =
+                        std::chrono::milliseconds(std::stoll(value));
+                }
+            } catch (std::exception&) {
+                std::cerr << "Error: invalid value " << value << " for " << flag
+                          << ".\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Error: unknown option " << flag << ".\n";
+            return 1;
+        }
+    }
+
+    if (arg_idx >= argc) {
+        std::cerr << "Error: expected input program (or checkpoint file with "
+                     "--resume, or program image with --load-image) as a "
+                     "command line argument.\n";
+        return 1;
+    }
+
+    if (resume && load_image) {
+        std::cerr << "Error: --resume and --load-image can't be combined.\n";
         return 1;
     }
 
-    parser::Parser parser{std::istringstream{argv[1]}};
+    tracing::Tracer tracer;
+    auto& trace = tracer.GetBuffer();
+
+    // A program run before with the same options is answered from the
+    // cache. Profiling is about doing the work and neither a checkpoint nor
+    // an image is a program's source, so they bypass the cache.
+    std::optional<result_cache::ResultCache> cache;
+    std::optional<result_cache::OutputRecorder> recorder;
+    std::string cache_key;
+
+    if (!cache_dir.empty() && !profile && !resume && !load_image) {
+        try {
+            cache.emplace(cache_dir);
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+            return 1;
+        }
+
+        cache_key = result_cache::MakeKey(
+            "ch18_fullref/" + std::to_string(interpreter::kEngineVersion),
+            std::string(hash_cons ? "hash-cons " : "") + "max-steps=" +
+                std::to_string(budget.max_steps_) + " max-nodes=" +
+                std::to_string(budget.max_term_nodes_),
+            argv[arg_idx]);
+        auto output = trace.Record("cache lookup", 0,
+                                   [&] { return cache->Find(cache_key); });
+
+        if (output) {
+            std::cout << *output;
+
+            if (!trace_path.empty()) {
+                std::ofstream trace_file{trace_path};
+                tracer.Write(trace_file);
+            }
+
+            return 0;
+        }
+
+        // Record what is printed from here on to store it in the cache.
+        recorder.emplace(std::cout);
+    }
+
+    parser::HashConsTable hash_cons_table;
     type_checker::TypeChecker checker;
-    auto program = parser.ParseProgram();
-    std::cout << "   " << program << ": " << checker.TypeOf(program) << "\n";
+    interpreter::Checkpoint start;
 
-    interpreter::Interpreter interpreter;
-    auto res = interpreter.Interpret(program);
-    std::cout << "=> " << res.first << ": " << res.second << "\n";
+    try {
+        if (resume) {
+            start = trace.Record("load checkpoint", 0, [&] {
+                return interpreter::ReadCheckpoint(ReadFile(argv[arg_idx]));
+            });
+            std::cout << "   " << start.term_ << ": " << *start.type_ << "\n";
+        } else if (load_image) {
+            // The image is decoded straight from the mapped file, without
+            // lexing, parsing and type checking the program.
+            corpus_runner::MappedFile image{argv[arg_idx]};
+            parser::ImageReader reader{image.GetContents().data(),
+                                       image.GetContents().size()};
+            start.term_ = trace.Record("load image", 0,
+                                       [&] { return reader.ReadProgram(); });
+            start.type_ = &reader.ProgramType();
 
-    return 0;
-}
+            if (hash_cons) {
+                start.term_ = hash_cons_table.Intern(std::move(start.term_));
+            }
+
+            std::cout << "   " << start.term_ << ": " << *start.type_ << "\n";
+        } else {
+            parser::Parser parser =
+                hash_cons ? parser::Parser{std::istringstream{argv[arg_idx]},
+                                           hash_cons_table}
+                          : parser::Parser{std::istringstream{argv[arg_idx]}};
+            start.term_ = trace.Record("parse", 0,
+                                       [&] { return parser.ParseProgram(); });
+            auto& type = trace.Record("type check", 0, [&]() -> parser::Type& {
+                return checker.TypeOf(start.term_);
+            });
+            std::cout << "   " << start.term_ << ": " << type << "\n";
+
+            if (!image_path.empty()) {
+                ReplaceFile(parser::ImageWriter().Write(start.term_, type),
+                            image_path);
+            }
+        }
+    } catch (std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+
+    if (hash_cons) {
+        std::cerr << "hash-consing: " << hash_cons_table.GetStats()
+                  << " (dedup ratio " << hash_cons_table.DedupRatio()
+                  << ")\n";
+    }
+
+    int status = 0;
+
+    try {
+        if (profile) {
+            Evaluate<interpreter::ProfilingInterpreter>(
+                start, checker, hash_cons_table, hash_cons, budget,
+                checkpointing, trace);
+        } else {
+            Evaluate<interpreter::Interpreter>(start, checker, hash_cons_table,
+                                               hash_cons, budget,
+                                               checkpointing, trace);
+        }
+    } catch (const interpreter::BudgetExceeded& error) {
+        std::cout << "=> " << error.what() << "\n";
+        status = 1;
+    } catch (const std::runtime_error& error) {
+        std::cerr << "Error: " << error.what() << "\n";
+        status = 1;
+    }
 
+    if (recorder && status == 0) {
+        try {
+            cache->Insert(cache_key, recorder->GetOutput());
+        } catch (std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+        }
+    }
+
+    if (allocation::kEnabled) {
+        allocation::Tracker::Print(std::cerr);
+    }
+
+    if (!trace_path.empty()) {
+        std::ofstream trace_file{trace_path};
+        tracer.Write(trace_file);
+    }
+
+    return status;
+}
@@ -1,18 +1,33 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
 namespace lexer {
 struct Token {
     enum class Category {
@@ -102,6 +117,7 @@ const std::string kKeywordUnitType = "Unit";
 class Lexer {
    public:
     Lexer(std::istringstream&& in) {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         std::istringstream iss(SurroundTokensBySpaces(std::move(in)));
         token_strings_ =
             std::vector<std::string>(std::istream_iterator<std::string>{iss},
@@ -109,6 +125,7 @@ class Lexer {
     }
 
     Token NextToken() {
+        allocation::PhaseScope scope{allocation::Phase::LEXING};
         Token token;
 
         if (current_token_ == token_strings_.size()) {
@@ -295,6 +312,82 @@ class Type {
     friend std::ostream& operator<<(std::ostream&, const Type&);
 
    public:
+    /**
+     * Owns the function, record and ref types interned while it is the
+     * current arena of a thread (see Scope). Interned types only live as long
+     * as their arena, so a long-running process can drop an arena together
+     * with everything that refers to its types (e.g. a request's program,
+     * type checker and evaluation) instead of keeping every type it ever saw.
+     * Types interned outside of any Scope go to a global arena that is never
+     * dropped. The base types are global as well.
+     *
+     * Types of different arenas are distinct objects but compare equal with
+     * operator== if they are structurally equal. A type must not refer to
+     * the types of an arena that is dropped before its own.
+     */
+    class Arena {
+       public:
+        /**
+         * Makes an arena the current arena of this thread while it exists.
+         */
+        class Scope {
+           public:
+            explicit Scope(Arena& arena) : previous_(CurrentSlot()) {
+                CurrentSlot() = &arena;
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() { CurrentSlot() = previous_; }
+
+           private:
+            Arena* previous_;
+        };
+
+        Arena() = default;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        static Arena& Current() {
+            static Arena global;
+            Arena* current = CurrentSlot();
+
+            return current ? *current : global;
+        }
+
+        /**
+         * The number of types interned in the arena.
+         */
+        std::size_t Size() {
+            std::lock_guard<std::mutex> lock{mutex_};
+
+            return function_types_.size() + record_types_.size() +
+                   ref_types_.size();
+        }
+
+       private:
+        friend class Type;
+
+        static Arena*& CurrentSlot() {
+            static thread_local Arena* current = nullptr;
+
+            return current;
+        }
+
+        // The labels and types of a record type's fields.
+        using RecordKey = std::vector<std::pair<std::string, const Type*>>;
+
+        std::mutex mutex_;
+        // The interned types by the types they consist of, so interning a
+        // type takes logarithmic time in the number of types of the arena.
+        std::map<std::pair<const Type*, const Type*>, std::unique_ptr<Type>>
+            function_types_;
+        std::map<RecordKey, std::unique_ptr<Type>> record_types_;
+        std::map<const Type*, std::unique_ptr<Type>> ref_types_;
+    };
+
     static Type& Top() {
         static Type type;
         type.category_ = TypeCategory::TOP;
@@ -327,58 +420,51 @@ class Type {
     }
 
     static Type& Function(Type& lhs, Type& rhs) {
-        static std::vector<std::unique_ptr<Type>> type_pool;
-
-        auto result =
-            std::find_if(std::begin(type_pool), std::end(type_pool),
-                         [&](const std::unique_ptr<Type>& type) {
-                             return type->lhs_ == &lhs && type->rhs_ == &rhs;
-                         });
-
-        if (result != std::end(type_pool)) {
-            return **result;
+        Arena& arena = Arena::Current();
+        // An arena may be used by several threads (e.g. the global one by the
+        // evaluation server's workers).
+        std::lock_guard<std::mutex> lock{arena.mutex_};
+        auto& type = arena.function_types_[{&lhs, &rhs}];
+
+        if (!type) {
+            type.reset(new Type(lhs, rhs));
         }
 
-        type_pool.emplace_back(std::unique_ptr<Type>(new Type(lhs, rhs)));
-
-        return *type_pool.back();
+        return *type;
     }
 
     using RecordFields = std::unordered_map<std::string, Type&>;
 
     static Type& Record(RecordFields fields) {
-        static std::vector<std::unique_ptr<Type>> type_pool;
-
-        auto result = std::find_if(std::begin(type_pool), std::end(type_pool),
-                                   [&](const std::unique_ptr<Type>& type) {
-                                       return type->record_fields_ == fields;
-                                   });
+        Arena& arena = Arena::Current();
+        std::lock_guard<std::mutex> lock{arena.mutex_};
+        Arena::RecordKey key;
 
-        if (result != std::end(type_pool)) {
-            return **result;
+        for (const auto& [label, field_type] : fields) {
+            key.emplace_back(label, &field_type);
         }
 
-        type_pool.emplace_back(
-            std::unique_ptr<Type>(new Type(std::move(fields))));
+        // Equal sets of fields may be iterated in different orders.
+        std::sort(std::begin(key), std::end(key));
+        auto& type = arena.record_types_[std::move(key)];
+
+        if (!type) {
+            type.reset(new Type(std::move(fields)));
+        }
 
-        return *type_pool.back();
+        return *type;
     }
 
     static Type& Ref(Type& ref_type) {
-        static std::vector<std::unique_ptr<Type>> type_pool;
+        Arena& arena = Arena::Current();
+        std::lock_guard<std::mutex> lock{arena.mutex_};
+        auto& type = arena.ref_types_[&ref_type];
 
-        auto result = std::find_if(std::begin(type_pool), std::end(type_pool),
-                                   [&](const std::unique_ptr<Type>& type) {
-                                       return type->ref_type_ == &ref_type;
-                                   });
-
-        if (result != std::end(type_pool)) {
-            return **result;
+        if (!type) {
+            type.reset(new Type(&ref_type));
         }
 
-        type_pool.emplace_back(std::unique_ptr<Type>(new Type(&ref_type)));
-
-        return *type_pool.back();
+        return *type;
     }
 
     Type(const Type&) = delete;
@@ -389,26 +475,56 @@ class Type {
 
     ~Type() = default;
 
+    /**
+     * Compares types structurally using an explicit stack, since the types of
+     * deeply nested terms are deeply nested as well.
+     */
     bool operator==(const Type& other) const {
-        if (category_ != other.category_) {
-            return false;
-        }
+        std::vector<std::pair<const Type*, const Type*>> stack{{this, &other}};
+
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
+
+            // A type interned in the same arena is the same object.
+            if (lhs == rhs) {
+                continue;
+            }
+
+            if (lhs->category_ != rhs->category_) {
+                return false;
+            }
+
+            if (lhs->category_ == TypeCategory::BASE) {
+                if (lhs->base_type_ != rhs->base_type_) {
+                    return false;
+                }
+            } else if (lhs->category_ == TypeCategory::FUNCTION) {
+                assert(lhs->lhs_ && lhs->rhs_ && rhs->lhs_ && rhs->rhs_);
+                stack.push_back({lhs->rhs_, rhs->rhs_});
+                stack.push_back({lhs->lhs_, rhs->lhs_});
+            } else if (lhs->category_ == TypeCategory::REF) {
+                stack.push_back({lhs->ref_type_, rhs->ref_type_});
+            } else if (lhs->category_ == TypeCategory::RECORD) {
+                const auto& rhs_fields = rhs->record_fields_;
+
+                if (lhs->record_fields_.size() != rhs_fields.size()) {
+                    return false;
+                }
+
+                for (const auto& [label, field_type] : lhs->record_fields_) {
+                    auto rhs_it = rhs_fields.find(label);
+
+                    if (rhs_it == std::end(rhs_fields)) {
+                        return false;
+                    }
 
-        switch (category_) {
-            case TypeCategory::TOP:
-                return other.category_ == TypeCategory::TOP;
-            case TypeCategory::ILL:
-                return other.category_ == TypeCategory::ILL;
-            case TypeCategory::BASE:
-                return base_type_ == other.base_type_;
-            case TypeCategory::FUNCTION:
-                assert(lhs_ && rhs_ && other.lhs_ && other.rhs_);
-                return (*lhs_ == *other.lhs_) && (*rhs_ == *other.rhs_);
-            case TypeCategory::REF:
-                return *ref_type_ == *other.ref_type_;
-            case TypeCategory::RECORD:
-                return record_fields_ == other.record_fields_;
+                    stack.push_back({&field_type, &rhs_it->second});
+                }
+            }
         }
+
+        return true;
     }
 
     bool operator!=(const Type& other) const { return !(*this == other); }
@@ -508,44 +624,77 @@ class Type {
     Type* ref_type_ = nullptr;
 };
 
+/**
+ * Prints type using an explicit stack, so that arbitrarily deep types can be
+ * printed.
+ */
 std::ostream& operator<<(std::ostream& out, const Type& type) {
-    if (type.IsTop()) {
-        out << lexer::kKeywordTop;
-    } else if (type.IsBool()) {
-        out << lexer::kKeywordBool;
-    } else if (type.IsNat()) {
-        out << lexer::kKeywordNat;
-    } else if (type.IsUnit()) {
-        out << lexer::kKeywordUnitType;
-    } else if (type.IsFunction()) {
-        out << "(" << *type.lhs_ << " "
-            << lexer::Token(lexer::Token::Category::ARROW) << " " << *type.rhs_
-            << ")";
-    } else if (type.IsRecord()) {
-        out << "{";
-
-        bool first = true;
-        for (auto& field : type.record_fields_) {
-            if (!first) {
-                out << ", ";
-            }
-
-            first = false;
-            out << field.first << ":" << field.second;
-        }
-
-        out << "}";
-    } else if (type.IsRef()) {
-        out << "Ref " << *type.ref_type_;
-    } else {
-        out << "Ⱦ";
+    std::ostringstream arrow_ss;
+    arrow_ss << " " << lexer::Token(lexer::Token::Category::ARROW) << " ";
+    const std::string arrow = arrow_ss.str();
+    // Work items, last one first: either a type to print or, if type is
+    // nullptr, a piece of text to print as is.
+    std::vector<std::pair<const Type*, std::string_view>> stack{{&type, {}}};
+
+    while (!stack.empty()) {
+        auto [current, text] = stack.back();
+        stack.pop_back();
+
+        if (!current) {
+            out << text;
+        } else if (current->IsTop()) {
+            out << lexer::kKeywordTop;
+        } else if (current->IsBool()) {
+            out << lexer::kKeywordBool;
+        } else if (current->IsNat()) {
+            out << lexer::kKeywordNat;
+        } else if (current->IsUnit()) {
+            out << lexer::kKeywordUnitType;
+        } else if (current->IsFunction()) {
+            out << "(";
+            stack.push_back({nullptr, ")"});
+            stack.push_back({current->rhs_, {}});
+            stack.push_back({nullptr, arrow});
+            stack.push_back({current->lhs_, {}});
+        } else if (current->IsRecord()) {
+            out << "{";
+            stack.push_back({nullptr, "}"});
+            // The fields are pushed in reverse, so that they are printed in
+            // the order of record_fields_.
+            std::vector<std::pair<const Type*, std::string_view>> fields;
+            bool first = true;
+
+            for (auto& field : current->record_fields_) {
+                if (!first) {
+                    fields.push_back({nullptr, ", "});
+                }
+
+                first = false;
+                fields.push_back({nullptr, field.first});
+                fields.push_back({nullptr, ":"});
+                fields.push_back({&field.second, {}});
+            }
+
+            stack.insert(std::end(stack), fields.rbegin(), fields.rend());
+        } else if (current->IsRef()) {
+            out << "Ref ";
+            stack.push_back({current->ref_type_, {}});
+        } else {
+            out << "Ⱦ";
+        }
     }
 
     return out;
 }
 
-class Term {
+class ImageReader;
+class ImageWriter;
+
+class Term : private budget::Counted<Term> {
     friend std::ostream& operator<<(std::ostream&, const Term&);
+    friend class HashConsTable;
+    friend class ImageReader;
+    friend class ImageWriter;
 
    public:
     static Term Lambda(std::string arg_name, Type& arg_type) {
@@ -554,6 +703,7 @@ class Term {
         result.lambda_arg_type_ = &arg_type;
         result.category_ = Category::LAMBDA;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -563,16 +713,19 @@ class Term {
         result.de_bruijn_idx_ = de_bruijn_idx;
         result.category_ = Category::VARIABLE;
 
+        result.UpdateFreeVariableBound();
+        result.UpdateIsValue();
         return result;
     }
 
-    static Term Application(std::unique_ptr<Term> lhs,
-                            std::unique_ptr<Term> rhs) {
+    static Term Application(std::shared_ptr<Term> lhs,
+                            std::shared_ptr<Term> rhs) {
         Term result;
         result.category_ = Category::APPLICATION;
         result.application_lhs_ = std::move(lhs);
         result.application_rhs_ = std::move(rhs);
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -587,6 +740,7 @@ class Term {
         Term result;
         result.category_ = Category::TRUE;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -594,6 +748,7 @@ class Term {
         Term result;
         result.category_ = Category::FALSE;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -622,6 +777,7 @@ class Term {
         Term result;
         result.category_ = Category::ZERO;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -629,15 +785,17 @@ class Term {
         Term result;
         result.category_ = Category::RECORD;
 
+        result.UpdateIsValue();
         return result;
     }
 
-    static Term Projection(std::unique_ptr<Term> term, std::string label) {
+    static Term Projection(std::shared_ptr<Term> term, std::string label) {
         Term result;
         result.projection_term_ = std::move(term);
         result.projection_label_ = label;
         result.category_ = Category::PROJECTION;
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -663,11 +821,12 @@ class Term {
         return result;
     }
 
-    static Term Assignment(std::unique_ptr<Term> lhs) {
+    static Term Assignment(std::shared_ptr<Term> lhs) {
         Term result;
         result.assignment_lhs_ = std::move(lhs);
         result.category_ = Category::ASSIGNMENT;
 
+        result.UpdateFreeVariableBound();
         return result;
     }
 
@@ -675,6 +834,7 @@ class Term {
         Term result;
         result.category_ = Category::UNIT;
 
+        result.UpdateIsValue();
         return result;
     }
 
@@ -686,7 +846,32 @@ class Term {
     Term(Term&&) = default;
     Term& operator=(Term&&) = default;
 
-    ~Term() = default;
+    /**
+     * Destroys the sub-terms iteratively. The implicit destructor would recurse
+     * once per nesting level and overflow the stack for deep terms.
+     */
+    ~Term() {
+        std::vector<std::shared_ptr<Term>> pending;
+        DetachSubTerms(pending);
+
+        while (!pending.empty()) {
+            std::shared_ptr<Term> term = std::move(pending.back());
+            pending.pop_back();
+
+            // term is destroyed at the end of the iteration, after its
+            // sub-terms were detached, unless other Terms share it.
+            if (term.use_count() == 1) {
+                term->DetachSubTerms(pending);
+            }
+        }
+    }
+
+    /**
+     * Returns an id that no other Term of the process had or will have, so
+     * unlike the Term's address it can key caches that outlive the Term. The
+     * id moves with the Term's content.
+     */
+    std::uint64_t GetId() const { return id_.Get(); }
 
     bool IsLambda() const { return category_ == Category::LAMBDA; }
 
@@ -724,6 +909,47 @@ class Term {
 
     bool IsUnit() const { return category_ == Category::UNIT; }
 
+    /**
+     * Whether this Term is a value, i.e. evaluation stops at it. Cached so that
+     * it can be checked in constant time, see UpdateIsValue().
+     */
+    bool IsValue() const { return is_value_; }
+
+    /**
+     * Whether this Term is a numeric value, i.e. 0 or succ of a numeric value.
+     */
+    bool IsNatValue() const { return is_nat_value_; }
+
+    /**
+     * Returns 1 + the largest de Bruijn index of the free variables of this
+     * Term (0 if it is closed).
+     */
+    int FreeVariableBound() const { return free_variable_bound_; }
+
+    /**
+     * Recalculates IsValue() and IsNatValue() from the ones of the direct
+     * sub-terms. Term keeps them up to date itself, except when a sub-term is
+     * rewritten in place (e.g. during evaluation); then this has to be called
+     * for the enclosing Terms, innermost first.
+     */
+    void UpdateIsValue() {
+        is_nat_value_ =
+            IsConstantZero() ||
+            (IsSucc() && unary_op_arg_ && unary_op_arg_->is_nat_value_);
+
+        if (IsRecord()) {
+            is_value_ = true;
+
+            for (auto& record_term : record_terms_) {
+                is_value_ = is_value_ && record_term->is_value_;
+            }
+        } else {
+            is_value_ = IsLambda() || IsVariable() || IsTrue() || IsFalse() ||
+                        is_nat_value_ ||
+                    IsUnit();
+        }
+    }
+
     bool IsInvalid() const {
         if (IsLambda()) {
             return lambda_arg_name_.empty() || !lambda_arg_type_ ||
@@ -769,158 +995,31 @@ class Term {
                 "Term::Combine() received an invalid Term.");
         }
 
-        if (IsLambda()) {
-            if (lambda_body_) {
-                // If the lambda body was completely parsed, then combining this
-                // term and the argument term means applying this lambda to the
-                // argument.
-                if (is_complete_) {
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    lambda_body_ = nullptr;
-                    lambda_arg_name_ = "";
-                    is_complete_ = false;
-                } else {
-                    lambda_body_->Combine(std::move(term));
-                }
-            } else {
-                lambda_body_ = std::make_unique<Term>(std::move(term));
-            }
-        } else if (IsVariable()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
-
-            variable_name_ = "";
-        } else if (IsApplication()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
-        } else if (IsIf()) {
-            if (!if_condition_) {
-                if_condition_ = std::make_unique<Term>(std::move(term));
-            } else if (!if_then_) {
-                if_then_ = std::make_unique<Term>(std::move(term));
-            } else {
-                if (!if_else_) {
-                    if_else_ = std::make_unique<Term>(std::move(term));
-                } else {
-                    // If the if condition was completely parsed, then combining
-                    // this term and the argument term means applying this
-                    // lambda to the argument.
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-
-                    if_condition_ = nullptr;
-                    if_then_ = nullptr;
-                    if_else_ = nullptr;
-                }
-            }
-        } else if (IsSucc()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with succ(...).");
-            }
-        } else if (IsPred()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with pred(...).");
-            }
-        } else if (IsIsZero()) {
-            if (!unary_op_arg_) {
-                unary_op_arg_ = std::make_unique<Term>(std::move(term));
-            } else {
-                throw std::invalid_argument(
-                    "Trying to combine with iszero(...).");
-            }
-        } else if (IsTrue() || IsFalse() || IsConstantZero() || IsUnit()) {
-            throw std::invalid_argument("Trying to combine with a constant.");
-        } else if (IsRecord()) {
-            if (is_complete_) {
-                throw std::logic_error(
-                    "Trying to combine with a complete Record.");
-            }
-
-            if (!IsRecordExpectingTerm()) {
-                throw std::logic_error(
-                    "Trying to combine with a Record while it isn't expecting "
-                    "a value.");
-            }
+        // A term combined into a lambda whose body is still being parsed is
+        // combined into the body instead. Walk down such bodies in a loop
+        // since they may be nested arbitrarily deep.
+        std::vector<Term*> path{this};
 
-            record_terms_.push_back(std::make_unique<Term>(std::move(term)));
-        } else if (IsProjection()) {
-            *this = Application(std::make_unique<Term>(std::move(*this)),
-                                std::make_unique<Term>(std::move(term)));
+        while (Term* sub_term = path.back()->IncompleteSubTerm()) {
+            path.push_back(sub_term);
+        }
 
-            projection_label_ = "";
-        } else if (IsLet()) {
-            if (!let_bound_term_) {
-                let_bound_term_ = std::make_unique<Term>(std::move(term));
-            } else {
-                if (!let_body_term_) {
-                    let_body_term_ = std::make_unique<Term>(std::move(term));
-                } else {
-                    // If the let binding term was completely parsed, then
-                    // combining this term and the argument term means applying
-                    // this lambda to the argument.
-                    *this =
-                        Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
+        path.back()->CombineHere(std::move(term));
 
-                    let_bound_term_ = nullptr;
-                    let_body_term_ = nullptr;
-                }
-            }
-        } else if (IsRef()) {
-            if (!ref_term_) {
-                ref_term_ = std::make_unique<Term>(std::move(term));
-            } else {
-                // If the ref term was completely parsed, then combining
-                // this term and the argument term means applying this
-                // lambda to the argument.
-                *this = Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-            }
-        } else if (IsDeref()) {
-            if (!deref_term_) {
-                deref_term_ = std::make_unique<Term>(std::move(term));
-            } else {
-                // If the de-ref term was completely parsed, then combining
-                // this term and the argument term means applying this
-                // lambda to the argument.
-                *this = Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-            }
-        } else if (IsAssignment()) {
-            if (!assignment_lhs_) {
-                throw std::logic_error("Combining with an empty assignment.");
-            } else if (!assignment_rhs_) {
-                assignment_rhs_ = std::make_unique<Term>(std::move(term));
-            } else {
-                // If the assignment term was completely parsed, then combining
-                // this term and the argument term means applying this
-                // lambda to the argument.
-                *this = Application(std::make_unique<Term>(std::move(*this)),
-                                    std::make_unique<Term>(std::move(term)));
-            }
-        } else {
-            *this = std::move(term);
+        for (auto it = path.rbegin() + 1; it != path.rend(); ++it) {
+            (*it)->UpdateFreeVariableBound();
+            (*it)->UpdateIsValue();
         }
 
         return *this;
     }
 
     void ConvertToProjection(std::string label) {
-        *this = Projection(std::make_unique<Term>(std::move(*this)), label);
+        *this = Projection(std::make_shared<Term>(std::move(*this)), label);
     }
 
     void ConvertToAssignment() {
-        *this = Assignment(std::make_unique<Term>(std::move(*this)));
+        *this = Assignment(std::make_shared<Term>(std::move(*this)));
     }
 
     void AddRecordLabel(std::string label) {
@@ -936,26 +1035,46 @@ class Term {
      * distance amount. For an example use, see Term::Substitute(int, Term&).
      */
     void Shift(int distance) {
-        std::function<void(int, Term&)> walk = [&distance, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                continue;
+            }
+
             if (term.IsInvalid()) {
                 throw std::invalid_argument("Trying to shift an invalid term.");
             }
 
-            if (term.IsVariable()) {
-                if (term.de_bruijn_idx_ >= binding_context_size) {
-                    term.de_bruijn_idx_ += distance;
-                }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
+            // Skip sub-terms whose variables are all bound inside this Term.
+            if (term.free_variable_bound_ <= entry.binding_context_size) {
+                continue;
             }
-        };
 
-        walk(0, *this);
+            if (term.IsVariable()) {
+                term.de_bruijn_idx_ += distance;
+                term.UpdateFreeVariableBound();
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubtermSlot([&](std::shared_ptr<Term>& sub_term,
+                                            int num_binders) {
+                    int binding_context_size =
+                        entry.binding_context_size + num_binders;
+                    // Only the sub-terms that are going to change are copied
+                    // if they are shared.
+                    Term* next = sub_term->free_variable_bound_ >
+                                         binding_context_size
+                                     ? &Unshare(sub_term)
+                                     : sub_term.get();
+                    stack.push_back({next, binding_context_size, false});
+                });
+            }
+        }
     }
 
     /**
@@ -968,46 +1087,51 @@ class Term {
                 "Trying to substitute using invalid terms.");
         }
 
-        std::function<void(int, Term&)> walk = [&variable, &sub, &walk](
-                                                   int binding_context_size,
-                                                   Term& term) {
+        std::vector<WalkEntry> stack = {{this, 0, false}};
+
+        while (!stack.empty()) {
+            WalkEntry entry = stack.back();
+            stack.pop_back();
+            Term& term = *entry.term;
+
+            if (entry.sub_terms_walked) {
+                term.UpdateFreeVariableBound();
+                term.UpdateIsValue();
+                continue;
+            }
+
+            // Adjust variable according to the current binding depth before
+            // comparing it with term's free variables.
+            int term_variable = variable + entry.binding_context_size;
+
+            // Skip sub-terms in which variable doesn't occur.
+            if (term.free_variable_bound_ <= term_variable) {
+                continue;
+            }
+
             if (term.IsVariable()) {
-                // Adjust variable according to the current binding
-                // depth before comparing term's index.
-                if (term.de_bruijn_idx_ == variable + binding_context_size) {
+                if (term.de_bruijn_idx_ == term_variable) {
                     // Shift sub up by binding_context_size distance since sub
                     // is now substituted in binding_context_size deep context.
                     auto clone = sub.Clone();
-                    clone.Shift(binding_context_size);
+                    clone.Shift(entry.binding_context_size);
                     std::swap(term, clone);
                 }
-            } else if (term.IsLambda()) {
-                walk(binding_context_size + 1, *term.lambda_body_);
-            } else if (term.IsLet()) {
-                walk(binding_context_size + 1, *term.let_bound_term_);
-                walk(binding_context_size + 1, *term.let_body_term_);
-            } else if (term.IsApplication()) {
-                walk(binding_context_size, *term.application_lhs_);
-                walk(binding_context_size, *term.application_rhs_);
-            } else if (term.IsIf()) {
-                walk(binding_context_size, *term.if_condition_);
-                walk(binding_context_size, *term.if_then_);
-                walk(binding_context_size, *term.if_else_);
-            } else if (term.IsSucc()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsPred()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsIsZero()) {
-                walk(binding_context_size, *term.unary_op_arg_);
-            } else if (term.IsProjection()) {
-                walk(binding_context_size, *term.projection_term_);
-            } else if (term.IsLet()) {
-                walk(binding_context_size, *term.let_bound_term_);
-                walk(binding_context_size, *term.let_body_term_);
+            } else {
+                stack.push_back({&term, entry.binding_context_size, true});
+                term.ForEachSubtermSlot([&](std::shared_ptr<Term>& sub_term,
+                                            int num_binders) {
+                    int binding_context_size =
+                        entry.binding_context_size + num_binders;
+                    // Same as in Shift().
+                    Term* next = sub_term->free_variable_bound_ >
+                                         variable + binding_context_size
+                                     ? &Unshare(sub_term)
+                                     : sub_term.get();
+                    stack.push_back({next, binding_context_size, false});
+                });
             }
-        };
-
-        walk(0, *this);
+        }
     }
 
     Term& LambdaBody() const {
@@ -1102,7 +1226,7 @@ class Term {
         return record_labels_;
     }
 
-    const std::vector<std::unique_ptr<Term>>& RecordTerms() const {
+    const std::vector<std::shared_ptr<Term>>& RecordTerms() const {
         return record_terms_;
     }
 
@@ -1124,204 +1248,280 @@ class Term {
 
     Term& AssignmentRHS() const { return *assignment_rhs_; }
 
-    bool operator==(const Term& other) const {
-        if (IsLambda() && other.IsLambda()) {
-            return LambdaArgType() == other.LambdaArgType() &&
-                   LambdaBody() == other.LambdaBody();
-        }
+    /**
+     * Returns the number of distinct nodes of this Term (a hash-consed
+     * sub-term is counted once however often it is shared) and its depth (the
+     * number of nodes on its longest path from the root).
+     */
+    std::pair<std::size_t, std::size_t> SizeAndDepth() const {
+        struct Entry {
+            const Term* term;
+            bool sub_terms_walked;
+            // The size of depths when the sub-terms of term were pushed.
+            std::size_t depths_begin;
+        };
 
-        if (IsVariable() && other.IsVariable()) {
-            return de_bruijn_idx_ == other.de_bruijn_idx_;
-        }
+        std::size_t size = 0;
+        // The depths of the sub-terms walked so far that are waiting for
+        // their parent to be walked.
+        std::vector<std::size_t> depths;
+        // The depths of the hash-consed sub-terms walked so far, so that a
+        // shared sub-term is walked only once.
+        std::unordered_map<const Term*, std::size_t> hash_consed_depths;
+        std::vector<Entry> stack{{this, false, 0}};
 
-        if (IsApplication() && other.IsApplication()) {
-            return (ApplicationLHS() == other.ApplicationLHS()) &&
-                   (ApplicationRHS() == other.ApplicationRHS());
-        }
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Term* term = entry.term;
 
-        if (IsIf() && other.IsIf()) {
-            return (IfCondition() == other.IfCondition()) &&
-                   (IfThen() == other.IfThen()) && (IfElse() == other.IfElse());
-        }
+            if (entry.sub_terms_walked) {
+                std::size_t depth = 0;
 
-        if (IsTrue() && other.IsTrue()) {
-            return true;
-        }
+                for (std::size_t i = entry.depths_begin; i < depths.size();
+                     ++i) {
+                    depth = std::max(depth, depths[i]);
+                }
 
-        if (IsFalse() && other.IsFalse()) {
-            return true;
-        }
+                depths.resize(entry.depths_begin);
+                depths.push_back(depth + 1);
 
-        if (IsSucc() && other.IsSucc()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
+                if (term->is_hash_consed_) {
+                    hash_consed_depths[term] = depth + 1;
+                }
 
-        if (IsPred() && other.IsPred()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
+                continue;
+            }
 
-        if (IsIsZero() && other.IsIsZero()) {
-            return UnaryOpArg() == other.UnaryOpArg();
-        }
+            if (term->is_hash_consed_) {
+                auto it = hash_consed_depths.find(term);
 
-        if (IsConstantZero() && other.IsConstantZero()) {
-            return true;
-        }
+                if (it != hash_consed_depths.end()) {
+                    depths.push_back(it->second);
+                    continue;
+                }
+            }
 
-        if (IsRecord() && other.IsRecord()) {
-            return record_labels_ == record_labels_ &&
-                   record_terms_ == record_terms_;
+            ++size;
+            stack.push_back({term, true, depths.size()});
+            term->ForEachSubterm([&](const Term& sub_term, int) {
+                stack.push_back({&sub_term, false, 0});
+            });
         }
 
-        if (IsProjection() && other.IsProjection()) {
-            return projection_label_ == other.projection_label_ &&
-                   *projection_term_ == *other.projection_term_;
-        }
+        return {size, depths.back()};
+    }
 
-        if (IsLet() && other.IsLet()) {
-            return let_binding_name_ == other.let_binding_name_ &&
-                   *let_bound_term_ == *other.let_bound_term_ &&
-                   *let_body_term_ == *other.let_body_term_;
-        }
+    bool operator==(const Term& other) const {
+        std::vector<std::pair<const Term*, const Term*>> stack{{this, &other}};
 
-        if (IsRef() && other.IsRef()) {
-            return *ref_term_ == *other.ref_term_;
-        }
+        while (!stack.empty()) {
+            auto [lhs, rhs] = stack.back();
+            stack.pop_back();
 
-        if (IsDeref() && other.IsDeref()) {
-            return *deref_term_ == *other.deref_term_;
-        }
+            // Hash-consed sub-terms may be the same object.
+            if (lhs == rhs) {
+                continue;
+            }
 
-        if (IsAssignment() && other.IsAssignment()) {
-            return *assignment_lhs_ == *other.assignment_lhs_ &&
-                   *assignment_rhs_ == *other.assignment_rhs_;
-        }
+            if (lhs->category_ != rhs->category_ ||
+                (lhs->IsLambda() &&
+                 lhs->LambdaArgType() != rhs->LambdaArgType()) ||
+                (lhs->IsVariable() &&
+                 lhs->de_bruijn_idx_ != rhs->de_bruijn_idx_) ||
+                lhs->record_labels_ != rhs->record_labels_ ||
+                lhs->projection_label_ != rhs->projection_label_ ||
+                lhs->let_binding_name_ != rhs->let_binding_name_) {
+                return false;
+            }
 
-        if (IsUnit() && other.IsUnit()) {
-            return true;
+            if (lhs->IsInvalid() || rhs->IsInvalid() || lhs->IsEmpty()) {
+                return false;
+            }
+
+            auto lhs_children = const_cast<Term*>(lhs)->Children();
+            auto rhs_children = const_cast<Term*>(rhs)->Children();
+
+            if (lhs_children.size() != rhs_children.size()) {
+                return false;
+            }
+
+            for (int i = lhs_children.size() - 1; i >= 0; --i) {
+                stack.push_back(
+                    {lhs_children[i]->get(), rhs_children[i]->get()});
+            }
         }
 
-        return false;
+        return true;
     }
 
     bool operator!=(const Term& other) const { return !(*this == other); }
 
     std::string ASTString(int indentation = 0) const {
         std::ostringstream out;
-        std::string prefix = std::string(indentation, '-');
-        std::string prefix_extra = std::string(indentation + 2, '-');
-
-        if (IsLambda()) {
-            out << prefix << "λ " << lambda_arg_name_ << ":"
-                << *lambda_arg_type_ << "\n";
-            out << lambda_body_->ASTString(indentation + 2);
-        } else if (IsVariable()) {
-            out << prefix << variable_name_ << "[" << de_bruijn_idx_ << "]";
-        } else if (IsApplication()) {
-            out << prefix << "<-\n";
-            out << application_lhs_->ASTString(indentation + 2) << "\n";
-            out << application_rhs_->ASTString(indentation + 2);
-        } else if (IsIf()) {
-            out << prefix << "if\n";
-            out << if_condition_->ASTString(indentation + 2) << "\n";
-            out << prefix << "then\n";
-            out << if_then_->ASTString(indentation + 2) << "\n";
-            out << prefix << "else\n";
-            out << if_else_->ASTString(indentation + 2);
-        } else if (IsTrue()) {
-            out << prefix << "true";
-        } else if (IsFalse()) {
-            out << prefix << "false";
-        } else if (IsSucc()) {
-            out << prefix << "succ\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsPred()) {
-            out << prefix << "pred\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsIsZero()) {
-            out << prefix << "iszero\n";
-            out << unary_op_arg_->ASTString(indentation + 2);
-        } else if (IsConstantZero()) {
-            out << prefix << "0";
-        } else if (IsRecord()) {
-            out << prefix << "{\n";
+        // Work items, last one first: either a sub-term to print at some
+        // indentation or, if term is nullptr, a piece of text to print as is.
+        struct Item {
+            const Term* term;
+            int indentation;
+            std::string text;
+        };
+        std::vector<Item> stack{{this, indentation, ""}};
 
-            for (int i = 0; i < record_labels_.size(); ++i) {
-                out << prefix << "=\n";
+        while (!stack.empty()) {
+            Item item = std::move(stack.back());
+            stack.pop_back();
 
-                out << prefix_extra << record_labels_[i] << "\n";
-                out << record_terms_[i]->ASTString(indentation + 2) << "\n";
+            if (!item.term) {
+                out << item.text;
+                continue;
             }
 
-            out << prefix << "}";
-        } else if (IsProjection()) {
-            out << prefix << ".\n";
-            out << projection_term_->ASTString(indentation + 2) << "\n";
-            out << prefix_extra << projection_label_;
-        } else if (IsLet()) {
-            out << prefix << "let\n";
-            out << prefix_extra << let_binding_name_ << "\n";
-            out << prefix << "=\n";
-            out << let_bound_term_->ASTString(indentation + 2) << "\n";
-            out << prefix << "in\n";
-            out << let_body_term_->ASTString(indentation + 2);
-        } else if (IsRef()) {
-            out << prefix << "ref\n";
-            out << ref_term_->ASTString(indentation + 2);
-        } else if (IsDeref()) {
-            out << prefix << "!\n";
-            out << ref_term_->ASTString(indentation + 2);
-        } else if (IsAssignment()) {
-            out << prefix << ":=\n";
-            out << assignment_lhs_->ASTString(indentation + 2) << "\n";
-            out << assignment_rhs_->ASTString(indentation + 2);
-        } else if (IsUnit()) {
-            out << prefix << "unit";
+            const Term& term = *item.term;
+            std::string prefix = std::string(item.indentation, '-');
+            std::string prefix_extra = std::string(item.indentation + 2, '-');
+            int sub = item.indentation + 2;
+
+            if (term.IsLambda()) {
+                out << prefix << "λ " << term.lambda_arg_name_ << ":"
+                    << *term.lambda_arg_type_ << "\n";
+                stack.push_back({term.lambda_body_.get(), sub, ""});
+            } else if (term.IsVariable()) {
+                out << prefix << term.variable_name_ << "["
+                    << term.de_bruijn_idx_ << "]";
+            } else if (term.IsApplication()) {
+                out << prefix << "<-\n";
+                stack.push_back({term.application_rhs_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n"});
+                stack.push_back({term.application_lhs_.get(), sub, ""});
+            } else if (term.IsIf()) {
+                out << prefix << "if\n";
+                stack.push_back({term.if_else_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "else\n"});
+                stack.push_back({term.if_then_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "then\n"});
+                stack.push_back({term.if_condition_.get(), sub, ""});
+            } else if (term.IsTrue()) {
+                out << prefix << "true";
+            } else if (term.IsFalse()) {
+                out << prefix << "false";
+            } else if (term.IsSucc() || term.IsPred() || term.IsIsZero()) {
+                out << prefix
+                    << (term.IsSucc()   ? "succ\n"
+                        : term.IsPred() ? "pred\n"
+                                        : "iszero\n");
+                stack.push_back({term.unary_op_arg_.get(), sub, ""});
+            } else if (term.IsConstantZero()) {
+                out << prefix << "0";
+            } else if (term.IsRecord()) {
+                out << prefix << "{\n";
+                stack.push_back({nullptr, 0, prefix + "}"});
+
+                for (int i = term.record_labels_.size() - 1; i >= 0; --i) {
+                    stack.push_back({nullptr, 0, "\n"});
+                    stack.push_back({term.record_terms_[i].get(), sub, ""});
+                    stack.push_back({nullptr, 0,
+                                     prefix + "=\n" + prefix_extra +
+                                         term.record_labels_[i] + "\n"});
+                }
+            } else if (term.IsProjection()) {
+                out << prefix << ".\n";
+                stack.push_back({nullptr, 0,
+                                 "\n" + prefix_extra + term.projection_label_});
+                stack.push_back({term.projection_term_.get(), sub, ""});
+            } else if (term.IsLet()) {
+                out << prefix << "let\n";
+                out << prefix_extra << term.let_binding_name_ << "\n";
+                out << prefix << "=\n";
+                stack.push_back({term.let_body_term_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n" + prefix + "in\n"});
+                stack.push_back({term.let_bound_term_.get(), sub, ""});
+            } else if (term.IsRef()) {
+                out << prefix << "ref\n";
+                stack.push_back({term.ref_term_.get(), sub, ""});
+            } else if (term.IsDeref()) {
+                out << prefix << "!\n";
+                stack.push_back({term.deref_term_.get(), sub, ""});
+            } else if (term.IsAssignment()) {
+                out << prefix << ":=\n";
+                stack.push_back({term.assignment_rhs_.get(), sub, ""});
+                stack.push_back({nullptr, 0, "\n"});
+                stack.push_back({term.assignment_lhs_.get(), sub, ""});
+            } else if (term.IsUnit()) {
+                out << prefix << "unit";
+            }
         }
 
         return out.str();
     }
 
+    /**
+     * Copies this Term iteratively so that arbitrarily deep terms can be
+     * cloned. Hash-consed sub-terms are immutable, so the copy shares them
+     * instead of copying them.
+     */
     Term Clone() const {
-        if (IsInvalid()) {
-            throw std::logic_error("Trying to clone an invalid term.");
+        Term clone;
+        // Pairs of an original term and its (so far empty) clone.
+        std::vector<std::pair<const Term*, Term*>> stack{{this, &clone}};
+
+        while (!stack.empty()) {
+            auto [original, copy] = stack.back();
+            stack.pop_back();
+
+            if (original->IsInvalid()) {
+                throw std::logic_error("Trying to clone an invalid term.");
+            }
+
+            *copy = original->ShallowCopy();
+
+            // The slots of copy hold the same sub-terms as the ones of
+            // original, in the same order. Replace them by clones.
+            for (auto child : copy->Children()) {
+                if ((*child)->is_hash_consed_) {
+                    continue;
+                }
+
+                const Term* original_child = child->get();
+                *child = std::make_shared<Term>();
+                stack.push_back({original_child, child->get()});
+            }
         }
 
-        if (IsLambda()) {
-            return std::move(Lambda(lambda_arg_name_, *lambda_arg_type_)
-                                 .Combine(lambda_body_->Clone()));
-        } else if (IsVariable()) {
-            return Variable(variable_name_, de_bruijn_idx_);
-        } else if (IsApplication()) {
-            return Application(
-                std::make_unique<Term>(application_lhs_->Clone()),
-                std::make_unique<Term>(application_rhs_->Clone()));
-        } else if (IsTrue()) {
-            return Term::True();
-        } else if (IsFalse()) {
-            return Term::False();
-        } else if (IsConstantZero()) {
-            return Term::Zero();
-        } else if (IsSucc()) {
-            return std::move(Term::Succ().Combine(unary_op_arg_->Clone()));
-        } else if (IsSucc()) {
-            return std::move(Term::Pred().Combine(unary_op_arg_->Clone()));
-        } else if (IsIsZero()) {
-            return std::move(Term::IsZero().Combine(unary_op_arg_->Clone()));
-        } else if (IsRecord()) {
-            Term result = Term::Record();
+        return clone;
+    }
+
+    bool IsHashConsed() const { return is_hash_consed_; }
 
-            for (int i = 0; i < record_labels_.size(); ++i) {
-                result.AddRecordLabel(record_labels_[i]);
-                result.Combine(record_terms_[i]->Clone());
+    /**
+     * Sub-terms of a Term can be shared with other Terms (see HashConsTable).
+     * Since evaluation rewrites terms in place, this replaces the direct
+     * sub-term \p sub_term of this Term by a private copy of its node if it
+     * is shared (i.e. copy-on-write) and returns the sub-term that can be
+     * safely mutated. Its own sub-terms stay shared until they are unshared
+     * in turn.
+     */
+    Term& UnshareSubTerm(Term& sub_term) {
+        for (auto child : Children()) {
+            if (child->get() == &sub_term) {
+                return Unshare(*child);
             }
+        }
+
+        throw std::logic_error("Not a direct sub-term of the term.");
+    }
 
-            return std::move(result);
+    /**
+     * Moves this Term out of the Term owning it, which is about to be
+     * overwritten. A hash-consed Term must not be moved from, so its node is
+     * copied instead.
+     */
+    Term Take() {
+        if (is_hash_consed_) {
+            return ShallowCopy();
         }
 
-        std::ostringstream error_ss;
-        error_ss << "Couldn't clone term: " << *this;
-        throw std::logic_error(error_ss.str());
+        return std::move(*this);
     }
 
     bool IsRecordExpectingLabel() const {
@@ -1346,9 +1546,613 @@ class Term {
         return diff == 1;
     }
 
+    /**
+     * Prints this Term like operator<< but without expanding sub-terms that
+     * occur more than once in it (e.g. after hash-consing), so that the output
+     * stays linear in the number of distinct nodes. Each such closed sub-term
+     * is printed once, bound to a fresh name by a let that encloses the rest:
+     *
+     * let (t0) = ({l x : Nat. x}) in ({a=t0, b=t0})
+     *
+     * The names (t0, t1, ...) skip the names of the variables in this Term, so
+     * a binder in it can't shadow them. Shared sub-terms with free variables
+     * are expanded since their meaning depends on where they occur.
+     */
+    void PrintShared(std::ostream& out) const {
+        // The number of references to each node from the (distinct) nodes of
+        // this Term.
+        std::unordered_map<const Term*, int> num_refs;
+        std::unordered_map<const Term*, bool> is_visited;
+        // The names bound or referred to in this Term.
+        std::unordered_set<std::string_view> var_names;
+        // The nodes in an order in which sub-terms come before their parents.
+        std::vector<const Term*> order;
+        // Pairs of a node and whether its sub-terms were visited already.
+        std::vector<std::pair<const Term*, bool>> stack{{this, false}};
+
+        while (!stack.empty()) {
+            auto [current, sub_terms_visited] = stack.back();
+            stack.pop_back();
+
+            if (sub_terms_visited) {
+                order.push_back(current);
+                continue;
+            }
+
+            if (is_visited[current]) {
+                continue;
+            }
+
+            is_visited[current] = true;
+
+            if (current->IsVariable()) {
+                var_names.insert(current->variable_name_);
+            } else if (current->IsLambda()) {
+                var_names.insert(current->lambda_arg_name_);
+            } else if (current->IsLet()) {
+                var_names.insert(current->let_binding_name_);
+            }
+
+            stack.push_back({current, true});
+            current->ForEachSubterm([&](const Term& sub_term, int) {
+                ++num_refs[&sub_term];
+                stack.push_back({&sub_term, false});
+            });
+        }
+
+        std::unordered_map<const Term*, std::string> names;
+        int next_name = 0;
+
+        for (const Term* node : order) {
+            bool is_leaf = true;
+            node->ForEachSubterm(
+                [&is_leaf](const Term&, int) { is_leaf = false; });
+
+            if (num_refs[node] < 2 || is_leaf ||
+                node->free_variable_bound_ > 0) {
+                continue;
+            }
+
+            std::string name;
+
+            do {
+                name = "t" + std::to_string(next_name++);
+            } while (var_names.count(name) != 0);
+
+            out << "let (" << name << ") = (";
+            node->Print(out, names);
+            out << ") in (";
+            names.emplace(node, std::move(name));
+        }
+
+        Print(out, names);
+        out << std::string(names.size(), ')');
+    }
+
     bool is_complete_ = false;
 
    private:
+    /**
+     * Prints this Term using an explicit stack, so that printing takes linear
+     * time and arbitrarily deep terms can be printed. Sub-terms in names are
+     * printed as their names.
+     */
+    void Print(
+        std::ostream& out,
+        const std::unordered_map<const Term*, std::string>& names) const {
+        // Work items, last one first: either a term to print or, if term is
+        // nullptr, a piece of text to print as is.
+        std::vector<std::pair<const Term*, std::string_view>> stack{
+            {this, {}}};
+        auto push_sub_term = [&stack, &names](const Term& sub_term) {
+            auto name = names.find(&sub_term);
+
+            if (name != names.end()) {
+                stack.push_back({nullptr, name->second});
+            } else {
+                stack.push_back({&sub_term, {}});
+            }
+        };
+
+        while (!stack.empty()) {
+            auto [current, text] = stack.back();
+            stack.pop_back();
+
+            if (!current) {
+                out << text;
+                continue;
+            }
+
+            if (current->IsInvalid()) {
+                out << "<INVALID>";
+            } else if (current->IsVariable()) {
+                out << current->variable_name_;
+            } else if (current->IsLambda()) {
+                out << "{l " << current->lambda_arg_name_ << " : "
+                    << *current->lambda_arg_type_ << ". ";
+                stack.push_back({nullptr, "}"});
+                push_sub_term(*current->lambda_body_);
+            } else if (current->IsApplication()) {
+                out << "(";
+                stack.push_back({nullptr, ")"});
+                push_sub_term(*current->application_rhs_);
+                stack.push_back({nullptr, " <- "});
+                push_sub_term(*current->application_lhs_);
+            } else if (current->IsIf()) {
+                out << "if (";
+                stack.push_back({nullptr, ")"});
+                push_sub_term(*current->if_else_);
+                stack.push_back({nullptr, ") else ("});
+                push_sub_term(*current->if_then_);
+                stack.push_back({nullptr, ") then ("});
+                push_sub_term(*current->if_condition_);
+            } else if (current->IsTrue()) {
+                out << "true";
+            } else if (current->IsFalse()) {
+                out << "false";
+            } else if (current->IsSucc() || current->IsPred() ||
+                       current->IsIsZero()) {
+                out << (current->IsSucc()   ? "succ ("
+                        : current->IsPred() ? "pred ("
+                                            : "iszero (");
+                stack.push_back({nullptr, ")"});
+                push_sub_term(*current->unary_op_arg_);
+            } else if (current->IsConstantZero()) {
+                out << "0";
+            } else if (current->IsRecord()) {
+                out << "{";
+                stack.push_back({nullptr, "}"});
+
+                for (int i = current->record_terms_.size() - 1; i >= 0; --i) {
+                    push_sub_term(*current->record_terms_[i]);
+                    stack.push_back({nullptr, "="});
+                    stack.push_back({nullptr, current->record_labels_[i]});
+
+                    if (i > 0) {
+                        stack.push_back({nullptr, ", "});
+                    }
+                }
+            } else if (current->IsProjection()) {
+                stack.push_back({nullptr, current->projection_label_});
+                stack.push_back({nullptr, "."});
+                push_sub_term(*current->projection_term_);
+            } else if (current->IsLet()) {
+                out << "let (" << current->let_binding_name_ << ") = (";
+                stack.push_back({nullptr, ")"});
+                push_sub_term(*current->let_body_term_);
+                stack.push_back({nullptr, ") in ("});
+                push_sub_term(*current->let_bound_term_);
+            } else if (current->IsRef()) {
+                out << "ref ";
+                push_sub_term(*current->ref_term_);
+            } else if (current->IsDeref()) {
+                out << "! ";
+                push_sub_term(*current->deref_term_);
+            } else if (current->IsAssignment()) {
+                out << "(";
+                stack.push_back({nullptr, ")"});
+                push_sub_term(*current->assignment_rhs_);
+                stack.push_back({nullptr, ") := ("});
+                push_sub_term(*current->assignment_lhs_);
+            } else if (current->IsUnit()) {
+                out << "unit";
+            } else {
+                out << "<ERROR>";
+            }
+        }
+    }
+
+    /**
+     * Combines term into this Term itself (see Combine()).
+     */
+    void CombineHere(Term&& term) {
+        if (IsLambda()) {
+            if (lambda_body_) {
+                // If the lambda body was completely parsed, then combining this
+                // term and the argument term means applying this lambda to the
+                // argument.
+                *this = Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+
+                lambda_body_ = nullptr;
+                lambda_arg_name_ = "";
+                is_complete_ = false;
+            } else {
+                lambda_body_ = std::make_shared<Term>(std::move(term));
+            }
+        } else if (IsVariable()) {
+            *this = Application(std::make_shared<Term>(std::move(*this)),
+                                std::make_shared<Term>(std::move(term)));
+
+            variable_name_ = "";
+        } else if (IsApplication()) {
+            *this = Application(std::make_shared<Term>(std::move(*this)),
+                                std::make_shared<Term>(std::move(term)));
+        } else if (IsIf()) {
+            if (!if_condition_) {
+                if_condition_ = std::make_shared<Term>(std::move(term));
+            } else if (!if_then_) {
+                if_then_ = std::make_shared<Term>(std::move(term));
+            } else {
+                if (!if_else_) {
+                    if_else_ = std::make_shared<Term>(std::move(term));
+                } else {
+                    // If the if condition was completely parsed, then combining
+                    // this term and the argument term means applying this
+                    // lambda to the argument.
+                    *this =
+                        Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+
+                    if_condition_ = nullptr;
+                    if_then_ = nullptr;
+                    if_else_ = nullptr;
+                }
+            }
+        } else if (IsSucc()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_shared<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with succ(...).");
+            }
+        } else if (IsPred()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_shared<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with pred(...).");
+            }
+        } else if (IsIsZero()) {
+            if (!unary_op_arg_) {
+                unary_op_arg_ = std::make_shared<Term>(std::move(term));
+            } else {
+                throw std::invalid_argument(
+                    "Trying to combine with iszero(...).");
+            }
+        } else if (IsTrue() || IsFalse() || IsConstantZero() || IsUnit()) {
+            throw std::invalid_argument("Trying to combine with a constant.");
+        } else if (IsRecord()) {
+            if (is_complete_) {
+                throw std::logic_error(
+                    "Trying to combine with a complete Record.");
+            }
+
+            if (!IsRecordExpectingTerm()) {
+                throw std::logic_error(
+                    "Trying to combine with a Record while it isn't expecting "
+                    "a value.");
+            }
+
+            record_terms_.push_back(std::make_shared<Term>(std::move(term)));
+        } else if (IsProjection()) {
+            *this = Application(std::make_shared<Term>(std::move(*this)),
+                                std::make_shared<Term>(std::move(term)));
+
+            projection_label_ = "";
+        } else if (IsLet()) {
+            if (!let_bound_term_) {
+                let_bound_term_ = std::make_shared<Term>(std::move(term));
+            } else {
+                if (!let_body_term_) {
+                    let_body_term_ = std::make_shared<Term>(std::move(term));
+                } else {
+                    // If the let binding term was completely parsed, then
+                    // combining this term and the argument term means applying
+                    // this lambda to the argument.
+                    *this =
+                        Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+
+                    let_bound_term_ = nullptr;
+                    let_body_term_ = nullptr;
+                }
+            }
+        } else if (IsRef()) {
+            if (!ref_term_) {
+                ref_term_ = std::make_shared<Term>(std::move(term));
+            } else {
+                // If the ref term was completely parsed, then combining
+                // this term and the argument term means applying this
+                // lambda to the argument.
+                *this = Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+            }
+        } else if (IsDeref()) {
+            if (!deref_term_) {
+                deref_term_ = std::make_shared<Term>(std::move(term));
+            } else {
+                // If the de-ref term was completely parsed, then combining
+                // this term and the argument term means applying this
+                // lambda to the argument.
+                *this = Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+            }
+        } else if (IsAssignment()) {
+            if (!assignment_lhs_) {
+                throw std::logic_error("Combining with an empty assignment.");
+            } else if (!assignment_rhs_) {
+                assignment_rhs_ = std::make_shared<Term>(std::move(term));
+            } else {
+                // If the assignment term was completely parsed, then combining
+                // this term and the argument term means applying this
+                // lambda to the argument.
+                *this = Application(std::make_shared<Term>(std::move(*this)),
+                                    std::make_shared<Term>(std::move(term)));
+            }
+        } else {
+            *this = std::move(term);
+        }
+
+        if (IsRecord()) {
+            // Only the last field can have changed, so there is no need to
+            // visit all fields.
+            if (!record_terms_.empty()) {
+                free_variable_bound_ =
+                    std::max(free_variable_bound_,
+                             record_terms_.back()->free_variable_bound_);
+                is_value_ = is_value_ && record_terms_.back()->is_value_;
+            }
+        } else {
+            UpdateFreeVariableBound();
+            UpdateIsValue();
+        }
+    }
+
+    /**
+     * Returns the lambda body that is still being parsed and into which terms
+     * combined into this Term go, or nullptr if there is none.
+     */
+    Term* IncompleteSubTerm() const {
+        if (IsLambda() && lambda_body_ && !is_complete_) {
+            return lambda_body_.get();
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Moves the direct sub-terms of this Term to sub_terms.
+     */
+    void DetachSubTerms(std::vector<std::shared_ptr<Term>>& sub_terms) {
+        for (auto* sub_term :
+             {&lambda_body_, &application_lhs_, &application_rhs_,
+              &if_condition_, &if_then_, &if_else_, &unary_op_arg_,
+              &projection_term_, &let_bound_term_, &let_body_term_, &ref_term_,
+              &deref_term_, &assignment_lhs_, &assignment_rhs_}) {
+            if (*sub_term) {
+                sub_terms.push_back(std::move(*sub_term));
+            }
+        }
+
+        for (auto& record_term : record_terms_) {
+            if (record_term) {
+                sub_terms.push_back(std::move(record_term));
+            }
+        }
+
+        record_terms_.clear();
+    }
+
+    /**
+     * An entry of the explicit stacks used by Shift() and Substitute().
+     */
+    struct WalkEntry {
+        Term* term;
+        // The number of binders between term and the Term being walked.
+        int binding_context_size;
+        // Whether term's sub-terms were walked already (i.e. term is visited
+        // for the second time to update its free_variable_bound_).
+        bool sub_terms_walked;
+    };
+
+    /**
+     * Calls visit(sub_term, num_binders) for each direct sub-term of this Term
+     * (that was parsed so far), where num_binders is the number of variables
+     * this Term binds around sub_term.
+     */
+    template <typename Visitor>
+    void ForEachSubterm(Visitor visit) const {
+        const_cast<Term*>(this)->ForEachSubtermSlot(
+            [&visit](std::shared_ptr<Term>& sub_term, int num_binders) {
+                visit(*sub_term, num_binders);
+            });
+    }
+
+    /**
+     * Same as ForEachSubterm() but passes the slot holding each sub-term, so
+     * that visit can replace it (see Unshare()).
+     */
+    template <typename Visitor>
+    void ForEachSubtermSlot(Visitor visit) {
+        auto visit_if_parsed = [&visit](std::shared_ptr<Term>& sub_term,
+                                        int num_binders) {
+            if (sub_term) {
+                visit(sub_term, num_binders);
+            }
+        };
+
+        if (IsLambda()) {
+            visit_if_parsed(lambda_body_, 1);
+        } else if (IsApplication()) {
+            visit_if_parsed(application_lhs_, 0);
+            visit_if_parsed(application_rhs_, 0);
+        } else if (IsIf()) {
+            visit_if_parsed(if_condition_, 0);
+            visit_if_parsed(if_then_, 0);
+            visit_if_parsed(if_else_, 0);
+        } else if (IsSucc() || IsPred() || IsIsZero()) {
+            visit_if_parsed(unary_op_arg_, 0);
+        } else if (IsRecord()) {
+            for (auto& record_term : record_terms_) {
+                visit_if_parsed(record_term, 0);
+            }
+        } else if (IsProjection()) {
+            visit_if_parsed(projection_term_, 0);
+        } else if (IsLet()) {
+            // The let binding is visible in both the bound term and the body.
+            visit_if_parsed(let_bound_term_, 1);
+            visit_if_parsed(let_body_term_, 1);
+        } else if (IsRef()) {
+            visit_if_parsed(ref_term_, 0);
+        } else if (IsDeref()) {
+            visit_if_parsed(deref_term_, 0);
+        } else if (IsAssignment()) {
+            visit_if_parsed(assignment_lhs_, 0);
+            visit_if_parsed(assignment_rhs_, 0);
+        }
+    }
+
+    /**
+     * Replaces the hash-consed Term in \p slot by a private copy of its node
+     * (which still shares the sub-terms) and returns the Term in slot.
+     */
+    static Term& Unshare(std::shared_ptr<Term>& slot) {
+        if (slot->is_hash_consed_) {
+            slot = std::make_shared<Term>(slot->ShallowCopy());
+        }
+
+        return *slot;
+    }
+
+    /**
+     * Recalculates free_variable_bound_ from the ones of the sub-terms.
+     */
+    void UpdateFreeVariableBound() {
+        if (IsVariable()) {
+            free_variable_bound_ = std::max(de_bruijn_idx_ + 1, 0);
+            return;
+        }
+
+        int bound = 0;
+        ForEachSubterm([&bound](Term& sub_term, int num_binders) {
+            bound = std::max(bound,
+                             sub_term.free_variable_bound_ - num_binders);
+        });
+        free_variable_bound_ = bound;
+    }
+
+    /**
+     * Returns the slots holding the (direct) sub-terms of this Term in the
+     * order they appear in the source program.
+     */
+    std::vector<std::shared_ptr<Term>*> Children() {
+        std::vector<std::shared_ptr<Term>*> children;
+
+        for (auto child :
+             {&lambda_body_, &application_lhs_, &application_rhs_,
+              &if_condition_, &if_then_, &if_else_, &unary_op_arg_,
+              &projection_term_, &let_bound_term_, &let_body_term_, &ref_term_,
+              &deref_term_, &assignment_lhs_, &assignment_rhs_}) {
+            if (*child) {
+                children.push_back(child);
+            }
+        }
+
+        for (auto& record_term : record_terms_) {
+            children.push_back(&record_term);
+        }
+
+        return children;
+    }
+
+    /**
+     * Hashes the contents of this Term node only; sub-terms contribute their
+     * identity (i.e. address) rather than their structure. Used for
+     * hash-consing where sub-terms are already canonical.
+     */
+    std::size_t ShallowHash() const {
+        std::size_t hash = static_cast<std::size_t>(category_);
+        auto combine = [&hash](std::size_t value) {
+            hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        };
+
+        combine(std::hash<std::string>()(lambda_arg_name_));
+        combine(std::hash<const Type*>()(lambda_arg_type_));
+        combine(std::hash<std::string>()(variable_name_));
+        combine(std::hash<int>()(de_bruijn_idx_));
+        combine(std::hash<std::string>()(projection_label_));
+        combine(std::hash<std::string>()(let_binding_name_));
+
+        for (auto& label : record_labels_) {
+            combine(std::hash<std::string>()(label));
+        }
+
+        for (auto child : const_cast<Term*>(this)->Children()) {
+            combine(std::hash<const Term*>()(child->get()));
+        }
+
+        return hash;
+    }
+
+    /**
+     * Compares the contents of this Term node with \p other. Sub-terms are
+     * compared by identity (see ShallowHash()).
+     */
+    bool ShallowEquals(const Term& other) const {
+        if (category_ != other.category_ ||
+            lambda_arg_name_ != other.lambda_arg_name_ ||
+            lambda_arg_type_ != other.lambda_arg_type_ ||
+            variable_name_ != other.variable_name_ ||
+            de_bruijn_idx_ != other.de_bruijn_idx_ ||
+            projection_label_ != other.projection_label_ ||
+            let_binding_name_ != other.let_binding_name_ ||
+            record_labels_ != other.record_labels_) {
+            return false;
+        }
+
+        auto children = const_cast<Term*>(this)->Children();
+        auto other_children = const_cast<Term&>(other).Children();
+
+        if (children.size() != other_children.size()) {
+            return false;
+        }
+
+        for (int i = 0; i < children.size(); ++i) {
+            if (*children[i] != *other_children[i]) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Creates a copy of this Term node that shares all sub-terms with it.
+     */
+    Term ShallowCopy() const {
+        Term result;
+        result.is_complete_ = is_complete_;
+        result.category_ = category_;
+        result.lambda_arg_name_ = lambda_arg_name_;
+        result.lambda_arg_type_ = lambda_arg_type_;
+        result.lambda_body_ = lambda_body_;
+        result.variable_name_ = variable_name_;
+        result.de_bruijn_idx_ = de_bruijn_idx_;
+        result.application_lhs_ = application_lhs_;
+        result.application_rhs_ = application_rhs_;
+        result.if_condition_ = if_condition_;
+        result.if_then_ = if_then_;
+        result.if_else_ = if_else_;
+        result.unary_op_arg_ = unary_op_arg_;
+        result.record_labels_ = record_labels_;
+        result.record_terms_ = record_terms_;
+        result.projection_term_ = projection_term_;
+        result.projection_label_ = projection_label_;
+        result.let_binding_name_ = let_binding_name_;
+        result.let_bound_term_ = let_bound_term_;
+        result.let_body_term_ = let_body_term_;
+        result.ref_term_ = ref_term_;
+        result.deref_term_ = deref_term_;
+        result.assignment_lhs_ = assignment_lhs_;
+        result.assignment_rhs_ = assignment_rhs_;
+        result.free_variable_bound_ = free_variable_bound_;
+        result.is_value_ = is_value_;
+        result.is_nat_value_ = is_nat_value_;
+
+        return result;
+    }
+
     enum class Category {
         EMPTY,
         LAMBDA,
@@ -1370,98 +2174,239 @@ class Term {
         UNIT,
     };
 
+    /**
+     * A Term's id (see GetId()). A moved-from Term gets a fresh one.
+     */
+    class Id {
+       public:
+        Id() : value_(Next()) {}
+
+        Id(Id&& other) noexcept : value_(std::exchange(other.value_, Next())) {}
+
+        Id& operator=(Id&& other) noexcept {
+            value_ = std::exchange(other.value_, Next());
+            return *this;
+        }
+
+        std::uint64_t Get() const { return value_; }
+
+       private:
+        static std::uint64_t Next() noexcept {
+            // Ids are handed out to each thread in blocks, so threads creating
+            // Terms don't contend on one counter.
+            constexpr std::uint64_t kBlockSize = 4096;
+            static std::atomic<std::uint64_t> next_block{0};
+            thread_local std::uint64_t next = 0;
+            thread_local std::uint64_t end = 0;
+
+            if (next == end) {
+                next = next_block.fetch_add(kBlockSize,
+                                            std::memory_order_relaxed);
+                end = next + kBlockSize;
+            }
+
+            return next++;
+        }
+
+        std::uint64_t value_;
+    };
+
+    Id id_;
+
     Category category_ = Category::EMPTY;
 
-    std::string lambda_arg_name_ = "";
-    Type* lambda_arg_type_ = nullptr;
-    std::unique_ptr<Term> lambda_body_{};
-    // Marks whether parsing for the body of the lambda term is finished or not.
+    std::string lambda_arg_name_ = "";
+    Type* lambda_arg_type_ = nullptr;
+    std::shared_ptr<Term> lambda_body_{};
+    // Marks whether parsing for the body of the lambda term is finished or not.
+
+    std::string variable_name_ = "";
+    int de_bruijn_idx_ = -1;
+
+    std::shared_ptr<Term> application_lhs_{};
+    std::shared_ptr<Term> application_rhs_{};
+
+    std::shared_ptr<Term> if_condition_{};
+    std::shared_ptr<Term> if_then_{};
+    std::shared_ptr<Term> if_else_{};
+
+    std::shared_ptr<Term> unary_op_arg_{};
+
+    std::vector<std::string> record_labels_{};
+    std::vector<std::shared_ptr<Term>> record_terms_{};
+
+    std::shared_ptr<Term> projection_term_{};
+    std::string projection_label_ = "";
+
+    std::string let_binding_name_ = "";
+    std::shared_ptr<Term> let_bound_term_{};
+    std::shared_ptr<Term> let_body_term_{};
+
+    std::shared_ptr<Term> ref_term_{};
+
+    std::shared_ptr<Term> deref_term_{};
+
+    std::shared_ptr<Term> assignment_lhs_{};
+    std::shared_ptr<Term> assignment_rhs_{};
+
+    // Marks whether this Term is the canonical copy of its structure owned by
+    // a HashConsTable (and hence must not be mutated). The sub-terms of a
+    // hash-consed Term are hash-consed as well.
+    bool is_hash_consed_ = false;
+
+    // 1 + the largest de Bruijn index of the free variables of this Term (0 if
+    // the Term is closed). Sub-terms that are evaluated in place don't update
+    // it, which is fine since evaluation never introduces free variables. So
+    // it is always an upper bound that lets Shift() and Substitute() skip
+    // closed sub-terms.
+    int free_variable_bound_ = 0;
+
+    // Cached results of IsValue() and IsNatValue().
+    bool is_value_ = false;
+    bool is_nat_value_ = false;
+};
+
+std::ostream& operator<<(std::ostream& out, const Term& term) {
+    term.Print(out, {});
+
+    return out;
+}
+
+/**
+ * Deduplicates structurally equal Terms (hash-consing): every distinct
+ * sub-term is stored once as an immutable canonical node and shared by all
+ * Terms that contain it. For example, interning
+ *
+ * {a=l x:Nat. x, b=l x:Nat. x}
+ *
+ * stores a single copy of the lambda term (and its body).
+ *
+ * Canonical nodes are owned (in part) by the table and must not be mutated;
+ * evaluation copies only the nodes it rewrites (see Term::UnshareSubTerm()).
+ *
+ * The table keeps at most max_nodes canonical nodes (plus the ones of the
+ * Term being interned) alive: once it is full, it is cleared before the next
+ * Term is interned. Terms interned before stay valid (and immutable), they
+ * just aren't deduplicated with the ones interned after.
+ */
+class HashConsTable {
+   public:
+    static constexpr std::size_t kDefaultMaxNodes = 1 << 20;
+
+    struct Stats {
+        // Number of Term nodes passed through Intern().
+        std::size_t num_nodes = 0;
+        // Number of distinct (canonical) Term nodes added to the table.
+        std::size_t num_unique_nodes = 0;
+    };
+
+    explicit HashConsTable(std::size_t max_nodes = kDefaultMaxNodes)
+        : max_nodes_(max_nodes) {}
+
+    /**
+     * Replaces all sub-terms of \p term by their canonical copies, adding
+     * new canonical nodes to the table as needed.
+     */
+    Term Intern(Term&& term) {
+        if (num_stored_nodes_ >= max_nodes_) {
+            Clear();
+        }
+
+        auto root = std::make_shared<Term>(std::move(term));
+        InternNode(root);
+
+        return root->ShallowCopy();
+    }
+
+    /**
+     * Drops all canonical nodes from the table (see the class comment).
+     */
+    void Clear() {
+        buckets_.clear();
+        num_stored_nodes_ = 0;
+    }
+
+    /**
+     * The number of canonical nodes currently stored in the table.
+     */
+    std::size_t Size() const { return num_stored_nodes_; }
+
+    const Stats& GetStats() const { return stats_; }
 
-    std::string variable_name_ = "";
-    int de_bruijn_idx_ = -1;
+    /**
+     * Returns how many Term nodes were interned per canonical node stored in
+     * the table (1.0 means no duplication was found).
+     */
+    double DedupRatio() const {
+        if (stats_.num_unique_nodes == 0) {
+            return 1.0;
+        }
 
-    std::unique_ptr<Term> application_lhs_{};
-    std::unique_ptr<Term> application_rhs_{};
+        return static_cast<double>(stats_.num_nodes) / stats_.num_unique_nodes;
+    }
 
-    std::unique_ptr<Term> if_condition_{};
-    std::unique_ptr<Term> if_then_{};
-    std::unique_ptr<Term> if_else_{};
+   private:
+    void InternNode(std::shared_ptr<Term>& root) {
+        // Children are interned before their parent so that a node can be
+        // compared with (and hashed by) the identities of its sub-terms. The
+        // slots of the nodes are walked using an explicit stack so that
+        // arbitrarily deep terms can be interned.
+        std::vector<std::pair<std::shared_ptr<Term>*, bool>> stack{
+            {&root, false}};
+
+        while (!stack.empty()) {
+            auto [slot, children_interned] = stack.back();
+            stack.pop_back();
+            std::shared_ptr<Term>& node = *slot;
+
+            if (!children_interned) {
+                ++stats_.num_nodes;
+
+                if (node->is_hash_consed_) {
+                    continue;
+                }
 
-    std::unique_ptr<Term> unary_op_arg_{};
+                stack.push_back({slot, true});
+                auto children = node->Children();
 
-    std::vector<std::string> record_labels_{};
-    std::vector<std::unique_ptr<Term>> record_terms_{};
+                for (auto it = children.rbegin(); it != children.rend();
+                     ++it) {
+                    stack.push_back({*it, false});
+                }
 
-    std::unique_ptr<Term> projection_term_{};
-    std::string projection_label_ = "";
+                continue;
+            }
 
-    std::string let_binding_name_ = "";
-    std::unique_ptr<Term> let_bound_term_{};
-    std::unique_ptr<Term> let_body_term_{};
+            auto& bucket = buckets_[node->ShallowHash()];
+            auto canonical_node = std::find_if(
+                bucket.begin(), bucket.end(),
+                [&node](const std::shared_ptr<Term>& candidate) {
+                    return candidate->ShallowEquals(*node);
+                });
 
-    std::unique_ptr<Term> ref_term_{};
+            if (canonical_node != bucket.end()) {
+                node = *canonical_node;
+                continue;
+            }
 
-    std::unique_ptr<Term> deref_term_{};
+            node->is_hash_consed_ = true;
+            bucket.push_back(node);
+            ++num_stored_nodes_;
+            ++stats_.num_unique_nodes;
+        }
+    }
 
-    std::unique_ptr<Term> assignment_lhs_{};
-    std::unique_ptr<Term> assignment_rhs_{};
+    std::unordered_map<std::size_t, std::vector<std::shared_ptr<Term>>>
+        buckets_;
+    std::size_t max_nodes_;
+    std::size_t num_stored_nodes_ = 0;
+    Stats stats_;
 };
 
-std::ostream& operator<<(std::ostream& out, const Term& term) {
-    if (term.IsInvalid()) {
-        out << "<INVALID>";
-    } else if (term.IsVariable()) {
-        out << term.variable_name_;
-    } else if (term.IsLambda()) {
-        out << "{l " << term.lambda_arg_name_ << " : " << *term.lambda_arg_type_
-            << ". " << *term.lambda_body_ << "}";
-    } else if (term.IsApplication()) {
-        out << "(" << *term.application_lhs_ << " <- " << *term.application_rhs_
-            << ")";
-    } else if (term.IsIf()) {
-        out << "if (" << *term.if_condition_ << ") then (" << *term.if_then_
-            << ") else (" << *term.if_else_ << ")";
-    } else if (term.IsTrue()) {
-        out << "true";
-    } else if (term.IsFalse()) {
-        out << "false";
-    } else if (term.IsSucc()) {
-        out << "succ (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsPred()) {
-        out << "pred (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsIsZero()) {
-        out << "iszero (" << *term.unary_op_arg_ << ")";
-    } else if (term.IsConstantZero()) {
-        out << "0";
-    } else if (term.IsRecord()) {
-        out << "{";
-
-        for (int i = 0; i < term.record_terms_.size(); ++i) {
-            if (i > 0) {
-                out << ", ";
-            }
-
-            out << term.record_labels_[i] << "=" << *term.record_terms_[i];
-        }
-
-        out << "}";
-    } else if (term.IsProjection()) {
-        out << *term.projection_term_ << "." << term.projection_label_;
-    } else if (term.IsLet()) {
-        out << "let (" << term.let_binding_name_ << ") = ("
-            << *term.let_bound_term_ << ") in (" << *term.let_body_term_ << ")";
-    } else if (term.IsRef()) {
-        out << "ref " << *term.ref_term_;
-    } else if (term.IsDeref()) {
-        out << "! " << *term.deref_term_;
-    } else if (term.IsAssignment()) {
-        out << "(" << *term.assignment_lhs_ << ") := (" << *term.assignment_rhs_
-            << ")";
-    } else if (term.IsUnit()) {
-        out << "unit";
-    } else {
-        out << "<ERROR>";
-    }
+std::ostream& operator<<(std::ostream& out,
+                         const HashConsTable::Stats& stats) {
+    out << stats.num_nodes << " nodes, " << stats.num_unique_nodes
+        << " unique";
 
     return out;
 }
@@ -1472,7 +2417,15 @@ class Parser {
    public:
     Parser(std::istringstream&& in) : lexer_(std::move(in)) {}
 
+    /**
+     * Creates a parser in hash-consing mode: structurally equal sub-terms of
+     * parsed programs are shared through \p hash_cons_table.
+     */
+    Parser(std::istringstream&& in, HashConsTable& hash_cons_table)
+        : lexer_(std::move(in)), hash_cons_table_(&hash_cons_table) {}
+
     Term ParseProgram() {
+        allocation::PhaseScope scope{allocation::Phase::PARSING};
         Token next_token;
         std::vector<Term> term_stack;
         term_stack.emplace_back(Term());
@@ -1844,7 +2797,9 @@ class Parser {
 
                     term_stack.back().ConvertToAssignment();
 
-                    stack_size_on_open_paren.emplace_back(term_stack.size());
+                    // The right-hand side extends to the end of the enclosing
+                    // term, so it is unwound along with it rather than having
+                    // a marker of its own on stack_size_on_open_paren.
                     term_stack.emplace_back(Term());
 
                     break;
@@ -1877,6 +2832,10 @@ class Parser {
             throw std::invalid_argument("Invalid term.");
         }
 
+        if (hash_cons_table_) {
+            return hash_cons_table_->Intern(std::move(term_stack.back()));
+        }
+
         return std::move(term_stack.back());
     }
 
@@ -1895,7 +2854,12 @@ class Parser {
                 bound_variables.pop_back();
             }
 
-            if (term_stack.back().IsLet()) {
+            if (term_stack.back().IsLet() &&
+                !term_stack.back().is_complete_) {
+                // Mark the let as complete so that its variable is popped only
+                // once, even if the let is unwound again as part of an
+                // enclosing term (e.g. an if branch).
+                term_stack.back().MarkAsComplete();
                 // let-binding's variable is no longer part of the current
                 // binding context, therefore pop it.
                 bound_variables.pop_back();
@@ -1944,133 +2908,707 @@ class Parser {
         return {arg_name, type};
     }
 
+    /**
+     * Parses a type iteratively so that arbitrarily deep parenthesized and
+     * record types can be parsed. Each frame on the stack is either the type
+     * being parsed, a parenthesized type, the type of a record's field or the
+     * type referred to by a Ref type.
+     */
     Type& ParseType() {
-        std::vector<Type*> parts;
+        struct Frame {
+            enum class Kind { TOP, PAREN, FIELD, REF };
+
+            Kind kind;
+            std::vector<Type*> parts{};
+            Type::RecordFields fields{};
+            std::string label = "";
+        };
+
+        auto unexpected = [](const Token& token) {
+            std::ostringstream error_ss;
+            error_ss << __LINE__ << ": Unexpected token: " << token;
+            return std::invalid_argument(error_ss.str());
+        };
+
+        auto parse_label = [this, &unexpected](Frame& frame) {
+            Token token = lexer_.NextToken();
+
+            if (token.GetCategory() != Token::Category::IDENTIFIER) {
+                throw unexpected(token);
+            }
+
+            frame.label = token.GetText();
+            token = lexer_.NextToken();
+
+            if (token.GetCategory() != Token::Category::COLON) {
+                throw unexpected(token);
+            }
+        };
+
+        std::vector<Frame> stack{Frame{Frame::Kind::TOP}};
+        Type* atom = nullptr;
+
         while (true) {
+            if (!atom) {
+                auto token = lexer_.NextToken();
+
+                if (token.GetCategory() == Token::Category::KEYWORD_BOOL) {
+                    atom = &Type::Bool();
+                } else if (token.GetCategory() ==
+                           Token::Category::KEYWORD_NAT) {
+                    atom = &Type::Nat();
+                } else if (token.GetCategory() ==
+                           Token::Category::KEYWORD_UNIT_TYPE) {
+                    atom = &Type::Unit();
+                } else if (token.GetCategory() ==
+                           Token::Category::OPEN_PAREN) {
+                    stack.push_back(Frame{Frame::Kind::PAREN});
+                    continue;
+                } else if (token.GetCategory() ==
+                           Token::Category::OPEN_BRACE) {
+                    stack.push_back(Frame{Frame::Kind::FIELD});
+                    parse_label(stack.back());
+                    continue;
+                } else if (token.GetCategory() ==
+                           Token::Category::KEYWORD_REF_TYPE) {
+                    stack.push_back(Frame{Frame::Kind::REF});
+                    continue;
+                } else {
+                    throw unexpected(token);
+                }
+            }
+
+            auto& frame = stack.back();
+            frame.parts.push_back(std::exchange(atom, nullptr));
             auto token = lexer_.NextToken();
 
-            if (token.GetCategory() == Token::Category::KEYWORD_BOOL) {
-                parts.emplace_back(&Type::Bool());
-            } else if (token.GetCategory() == Token::Category::KEYWORD_NAT) {
-                parts.emplace_back(&Type::Nat());
-            } else if (token.GetCategory() ==
-                       Token::Category::KEYWORD_UNIT_TYPE) {
-                parts.emplace_back(&Type::Unit());
-            } else if (token.GetCategory() == Token::Category::OPEN_PAREN) {
-                parts.emplace_back(&ParseType());
-
-                if (lexer_.NextToken().GetCategory() !=
-                    Token::Category::CLOSE_PAREN) {
-                    std::ostringstream error_ss;
-                    error_ss << __LINE__ << ": Unexpected token: " << token;
-                    throw std::invalid_argument(error_ss.str());
-                }
-            } else if (token.GetCategory() == Token::Category::OPEN_BRACE) {
+            if (token.GetCategory() == Token::Category::ARROW) {
+                continue;
+            } else if (token.GetCategory() == Token::Category::DOT ||
+                       token.GetCategory() == Token::Category::CLOSE_PAREN ||
+                       token.GetCategory() == Token::Category::CLOSE_BRACE ||
+                       token.GetCategory() == Token::Category::COMMA) {
                 lexer_.PutBackToken();
-                parts.emplace_back(&ParseRecordType());
-            } else if (token.GetCategory() ==
-                       Token::Category::KEYWORD_REF_TYPE) {
-                parts.emplace_back(&Type::Ref(ParseType()));
             } else {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+                throw unexpected(token);
+            }
+
+            // Types are right-associative, combine them accordingly.
+            for (int i = frame.parts.size() - 2; i >= 0; --i) {
+                frame.parts[i] =
+                    &Type::Function(*frame.parts[i], *frame.parts[i + 1]);
+            }
+
+            Type& type = *frame.parts[0];
+            frame.parts.clear();
+
+            if (frame.kind == Frame::Kind::TOP) {
+                return type;
+            } else if (frame.kind == Frame::Kind::REF) {
+                // The token that ended the referred type ends the enclosing
+                // type's part as well.
+                atom = &Type::Ref(type);
+                stack.pop_back();
+                continue;
             }
 
             token = lexer_.NextToken();
 
-            if (token.GetCategory() == Token::Category::DOT) {
-                lexer_.PutBackToken();
+            if (frame.kind == Frame::Kind::PAREN) {
+                if (token.GetCategory() != Token::Category::CLOSE_PAREN) {
+                    throw unexpected(token);
+                }
+
+                atom = &type;
+                stack.pop_back();
+            } else {
+                frame.fields.insert({frame.label, type});
+
+                if (token.GetCategory() == Token::Category::COMMA) {
+                    parse_label(frame);
+                } else if (token.GetCategory() ==
+                           Token::Category::CLOSE_BRACE) {
+                    atom = &Type::Record(std::move(frame.fields));
+                    stack.pop_back();
+                } else {
+                    throw unexpected(token);
+                }
+            }
+        }
+    }
+
+    Token::IdentifieySubCategory CalculateIdentifierSubCategoryFromContext(
+        Token token, const std::vector<Term>& term_stack) {
+        assert(token.GetCategory() == Token::Category::IDENTIFIER);
+
+        if (term_stack.back().IsRecord() &&
+            term_stack.back().IsRecordExpectingLabel()) {
+            return Token::IdentifieySubCategory::RECORD_LABEL;
+        }
+
+        return Token::IdentifieySubCategory::VARIABLE;
+    }
+
+   private:
+    lexer::Lexer lexer_;
+    HashConsTable* hash_cons_table_ = nullptr;
+};  // namespace parser
+
+/**
+ * Identifies (and versions) the binary program images written by ImageWriter.
+ */
+const std::string kImageMagic = "TAPL18";
+const std::uint8_t kImageVersion = 2;
+// Set in the tag byte of terms that the parser marked as complete.
+const std::uint8_t kImageCompleteFlag = 0x80;
+
+enum class ImageTypeTag : std::uint8_t {
+    ILL,
+    BOOL,
+    NAT,
+    FUNCTION,
+    RECORD,
+    TOP,
+    UNIT,
+    REF,
+};
+
+/**
+ * Writes a type checked program into a compact binary "program image" that
+ * ImageReader loads without lexing and parsing. An image consists of:
+ *  - kImageMagic followed by kImageVersion,
+ *  - a table of all names and labels in the program,
+ *  - a table of all types in the program, where each type only refers to
+ *    types that precede it,
+ *  - the index of the program's type,
+ *  - the program's terms in pre-order, where a record lists the labels of
+ *    its fields before the fields themselves.
+ *
+ * Integers are LEB128-encoded and strings and types are referred to by their
+ * table indices. Terms and types are walked iteratively, so deep programs
+ * don't overflow the stack.
+ *
+ * Sub-terms shared by a hash-consed program are written once per occurrence.
+ */
+class ImageWriter {
+   public:
+    std::string Write(const Term& program, Type& program_type) {
+        strings_.clear();
+        string_indices_.clear();
+        types_.clear();
+        type_indices_.clear();
+
+        std::string terms;
+        WriteTerms(program, terms);
+        std::size_t program_type_idx = TypeIdx(program_type);
+
+        std::string image = kImageMagic;
+        image.push_back(kImageVersion);
+        WriteUInt(strings_.size(), image);
+
+        for (const auto& str : strings_) {
+            WriteUInt(str.size(), image);
+            image += str;
+        }
+
+        WriteUInt(type_indices_.size(), image);
+        image += types_;
+        WriteUInt(program_type_idx, image);
+        image += terms;
+
+        return image;
+    }
+
+   private:
+    /**
+     * Appends the terms of program to out in pre-order.
+     */
+    void WriteTerms(const Term& program, std::string& out) {
+        std::vector<const Term*> stack{&program};
+        auto push_subterm = [&stack](const std::shared_ptr<Term>& term) {
+            if (!term) {
+                throw std::invalid_argument(
+                    "Trying to write an incompletely parsed term.");
+            }
+
+            stack.push_back(term.get());
+        };
+
+        while (!stack.empty()) {
+            const Term& term = *stack.back();
+            stack.pop_back();
+            auto tag = static_cast<std::uint8_t>(term.category_);
+            out.push_back(term.is_complete_ ? tag | kImageCompleteFlag : tag);
+
+            // Sub-terms are pushed in reverse, so they are written in order.
+            switch (term.category_) {
+                case Term::Category::LAMBDA:
+                    WriteUInt(StringIdx(term.lambda_arg_name_), out);
+                    WriteUInt(TypeIdx(*term.lambda_arg_type_), out);
+                    push_subterm(term.lambda_body_);
+                    break;
+                case Term::Category::VARIABLE:
+                    WriteUInt(StringIdx(term.variable_name_), out);
+                    WriteUInt(ZigZag(term.de_bruijn_idx_), out);
+                    break;
+                case Term::Category::APPLICATION:
+                    push_subterm(term.application_rhs_);
+                    push_subterm(term.application_lhs_);
+                    break;
+                case Term::Category::IF:
+                    push_subterm(term.if_else_);
+                    push_subterm(term.if_then_);
+                    push_subterm(term.if_condition_);
+                    break;
+                case Term::Category::SUCC:
+                case Term::Category::PRED:
+                case Term::Category::ISZERO:
+                    push_subterm(term.unary_op_arg_);
+                    break;
+                case Term::Category::RECORD:
+                    if (term.record_terms_.size() !=
+                        term.record_labels_.size()) {
+                        throw std::invalid_argument(
+                            "Trying to write an incompletely parsed term.");
+                    }
+
+                    WriteUInt(term.record_labels_.size(), out);
+
+                    for (const auto& label : term.record_labels_) {
+                        WriteUInt(StringIdx(label), out);
+                    }
+
+                    for (auto it = term.record_terms_.rbegin();
+                         it != term.record_terms_.rend(); ++it) {
+                        push_subterm(*it);
+                    }
+
+                    break;
+                case Term::Category::PROJECTION:
+                    WriteUInt(StringIdx(term.projection_label_), out);
+                    push_subterm(term.projection_term_);
+                    break;
+                case Term::Category::LET:
+                    WriteUInt(StringIdx(term.let_binding_name_), out);
+                    push_subterm(term.let_body_term_);
+                    push_subterm(term.let_bound_term_);
+                    break;
+                case Term::Category::REF:
+                    push_subterm(term.ref_term_);
+                    break;
+                case Term::Category::DEREF:
+                    push_subterm(term.deref_term_);
+                    break;
+                case Term::Category::ASSIGNMENT:
+                    push_subterm(term.assignment_rhs_);
+                    push_subterm(term.assignment_lhs_);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    std::size_t StringIdx(const std::string& str) {
+        auto it = string_indices_.find(str);
+
+        if (it != std::end(string_indices_)) {
+            return it->second;
+        }
+
+        strings_.push_back(str);
+
+        return string_indices_[str] = strings_.size() - 1;
+    }
+
+    /**
+     * Returns the index of \p type in the type table, appending it (after the
+     * types it refers to) if it is not in the table yet.
+     */
+    std::size_t TypeIdx(Type& type) {
+        // Each type is visited twice: first to push the types it refers to
+        // and then, once those are in the table, to append the type itself.
+        std::vector<std::pair<Type*, bool>> stack{{&type, false}};
+
+        while (!stack.empty()) {
+            auto [current, refs_appended] = stack.back();
+            stack.pop_back();
+
+            if (type_indices_.count(current)) {
+                continue;
+            }
+
+            if (refs_appended) {
+                AppendType(*current);
+                continue;
+            }
+
+            stack.push_back({current, true});
+
+            if (current->IsFunction()) {
+                stack.push_back({&current->FunctionRHS(), false});
+                stack.push_back({&current->FunctionLHS(), false});
+            } else if (current->IsRecord()) {
+                for (auto& field : current->GetRecordFields()) {
+                    stack.push_back({&field.second, false});
+                }
+            } else if (current->IsRef()) {
+                stack.push_back({&current->RefType(), false});
+            }
+        }
+
+        return type_indices_.at(&type);
+    }
+
+    /**
+     * Appends type, whose referred types are in the table already, to the
+     * type table.
+     */
+    void AppendType(Type& type) {
+        if (type.IsBool()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::BOOL));
+        } else if (type.IsNat()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::NAT));
+        } else if (type.IsTop()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::TOP));
+        } else if (type.IsUnit()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::UNIT));
+        } else if (type.IsFunction()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::FUNCTION));
+            WriteUInt(type_indices_.at(&type.FunctionLHS()), types_);
+            WriteUInt(type_indices_.at(&type.FunctionRHS()), types_);
+        } else if (type.IsRecord()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::RECORD));
+            WriteUInt(type.GetRecordFields().size(), types_);
+
+            for (auto& field : type.GetRecordFields()) {
+                WriteUInt(StringIdx(field.first), types_);
+                WriteUInt(type_indices_.at(&field.second), types_);
+            }
+        } else if (type.IsRef()) {
+            types_.push_back(static_cast<char>(ImageTypeTag::REF));
+            WriteUInt(type_indices_.at(&type.RefType()), types_);
+        } else {
+            types_.push_back(static_cast<char>(ImageTypeTag::ILL));
+        }
+
+        std::size_t idx = type_indices_.size();
+        type_indices_[&type] = idx;
+    }
+
+    static void WriteUInt(std::uint64_t value, std::string& out) {
+        do {
+            char byte = value & 0x7f;
+            value >>= 7;
+            out.push_back(value ? byte | 0x80 : byte);
+        } while (value);
+    }
+
+    /**
+     * Maps signed to unsigned integers such that numbers with small absolute
+     * values stay small (0, -1, 1, -2, ... are mapped to 0, 1, 2, 3, ...).
+     */
+    static std::uint64_t ZigZag(std::int64_t value) {
+        std::uint64_t shifted = static_cast<std::uint64_t>(value) << 1;
+
+        return value < 0 ? ~shifted : shifted;
+    }
+
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, std::size_t> string_indices_;
+    // The serialized type table.
+    std::string types_;
+    std::unordered_map<const Type*, std::size_t> type_indices_;
+};
+
+/**
+ * Loads a program from an image written by ImageWriter.
+ *
+ * The image is decoded in a single pass straight from the given buffer, so
+ * it can be memory mapped from a file instead of being read into memory first.
+ */
+class ImageReader {
+   public:
+    /**
+     * \p data has to stay valid until ReadProgram() returns.
+     */
+    ImageReader(const char* data, std::size_t size)
+        : pos_(data), end_(data + size) {}
+
+    Term ReadProgram() {
+        if (Remaining() < kImageMagic.size() ||
+            std::string(pos_, kImageMagic.size()) != kImageMagic) {
+            throw std::invalid_argument("Not a program image.");
+        }
+
+        pos_ += kImageMagic.size();
+
+        if (ReadByte() != kImageVersion) {
+            throw std::invalid_argument("Unsupported program image version.");
+        }
+
+        std::size_t num_strings = ReadUInt();
+
+        for (std::size_t i = 0; i < num_strings; ++i) {
+            std::size_t size = ReadUInt();
+
+            if (Remaining() < size) {
+                throw std::invalid_argument("Truncated program image.");
+            }
+
+            strings_.emplace_back(pos_, size);
+            pos_ += size;
+        }
+
+        std::size_t num_types = ReadUInt();
+
+        for (std::size_t i = 0; i < num_types; ++i) {
+            ReadType();
+        }
+
+        program_type_ = &ReadTypeRef();
+
+        return ReadTerms();
+    }
+
+    /**
+     * Returns the type the program was written with. Only valid after
+     * ReadProgram().
+     */
+    Type& ProgramType() const { return *program_type_; }
+
+   private:
+    /**
+     * Reads the program's terms, which make up the rest of the image.
+     */
+    Term ReadTerms() {
+        // Decode the nodes first and then link them in reverse pre-order:
+        // that way the sub-terms of a node are the last ones completed when
+        // the node is reached.
+        std::vector<Term> nodes;
+
+        while (pos_ != end_) {
+            nodes.push_back(ReadNode());
+        }
+
+        std::vector<std::shared_ptr<Term>> completed;
+
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+            auto term = std::make_shared<Term>(std::move(*it));
+
+            switch (term->category_) {
+                case Term::Category::LAMBDA:
+                    term->lambda_body_ = PopCompleted(completed);
+                    break;
+                case Term::Category::APPLICATION:
+                    term->application_lhs_ = PopCompleted(completed);
+                    term->application_rhs_ = PopCompleted(completed);
+                    break;
+                case Term::Category::IF:
+                    term->if_condition_ = PopCompleted(completed);
+                    term->if_then_ = PopCompleted(completed);
+                    term->if_else_ = PopCompleted(completed);
+                    break;
+                case Term::Category::SUCC:
+                case Term::Category::PRED:
+                case Term::Category::ISZERO:
+                    term->unary_op_arg_ = PopCompleted(completed);
+                    break;
+                case Term::Category::RECORD:
+                    for (std::size_t i = 0; i < term->record_labels_.size();
+                         ++i) {
+                        term->record_terms_.push_back(
+                            PopCompleted(completed));
+                    }
+
+                    break;
+                case Term::Category::PROJECTION:
+                    term->projection_term_ = PopCompleted(completed);
+                    break;
+                case Term::Category::LET:
+                    term->let_bound_term_ = PopCompleted(completed);
+                    term->let_body_term_ = PopCompleted(completed);
+                    break;
+                case Term::Category::REF:
+                    term->ref_term_ = PopCompleted(completed);
+                    break;
+                case Term::Category::DEREF:
+                    term->deref_term_ = PopCompleted(completed);
+                    break;
+                case Term::Category::ASSIGNMENT:
+                    term->assignment_lhs_ = PopCompleted(completed);
+                    term->assignment_rhs_ = PopCompleted(completed);
+                    break;
+                default:
+                    break;
+            }
+
+            term->UpdateFreeVariableBound();
+            term->UpdateIsValue();
+            completed.push_back(std::move(term));
+        }
+
+        if (completed.size() > 1) {
+            throw std::invalid_argument("Trailing bytes in program image.");
+        }
+
+        return std::move(*PopCompleted(completed));
+    }
+
+    /**
+     * Reads a single term without its sub-terms.
+     */
+    Term ReadNode() {
+        std::uint8_t tag = ReadByte();
+        Term term;
+        term.category_ = static_cast<Term::Category>(tag & ~kImageCompleteFlag);
+        term.is_complete_ = tag & kImageCompleteFlag;
+
+        if (term.category_ > Term::Category::UNIT) {
+            throw std::invalid_argument("Invalid term in program image.");
+        }
+
+        switch (term.category_) {
+            case Term::Category::LAMBDA:
+                term.lambda_arg_name_ = ReadString();
+                term.lambda_arg_type_ = &ReadTypeRef();
                 break;
-            } else if (token.GetCategory() == Token::Category::CLOSE_PAREN ||
-                       token.GetCategory() == Token::Category::CLOSE_BRACE ||
-                       token.GetCategory() == Token::Category::COMMA) {
-                lexer_.PutBackToken();
+            case Term::Category::VARIABLE: {
+                term.variable_name_ = ReadString();
+                std::uint64_t idx = ReadUInt();
+                term.de_bruijn_idx_ = (idx >> 1) ^ -(idx & 1);
+                break;
+            }
+            case Term::Category::RECORD: {
+                std::size_t num_fields = ReadUInt();
+
+                for (std::size_t i = 0; i < num_fields; ++i) {
+                    term.record_labels_.push_back(ReadString());
+                }
+
+                break;
+            }
+            case Term::Category::PROJECTION:
+                term.projection_label_ = ReadString();
+                break;
+            case Term::Category::LET:
+                term.let_binding_name_ = ReadString();
+                break;
+            default:
+                break;
+        }
+
+        return term;
+    }
+
+    static std::shared_ptr<Term> PopCompleted(
+        std::vector<std::shared_ptr<Term>>& completed) {
+        if (completed.empty()) {
+            throw std::invalid_argument("Truncated program image.");
+        }
+
+        auto term = std::move(completed.back());
+        completed.pop_back();
+
+        return term;
+    }
+
+    void ReadType() {
+        switch (static_cast<ImageTypeTag>(ReadByte())) {
+            case ImageTypeTag::ILL:
+                types_.push_back(&Type::IllTyped());
+                break;
+            case ImageTypeTag::BOOL:
+                types_.push_back(&Type::Bool());
+                break;
+            case ImageTypeTag::NAT:
+                types_.push_back(&Type::Nat());
+                break;
+            case ImageTypeTag::TOP:
+                types_.push_back(&Type::Top());
+                break;
+            case ImageTypeTag::UNIT:
+                types_.push_back(&Type::Unit());
+                break;
+            case ImageTypeTag::FUNCTION: {
+                Type& lhs = ReadTypeRef();
+                Type& rhs = ReadTypeRef();
+                types_.push_back(&Type::Function(lhs, rhs));
                 break;
-            } else if (token.GetCategory() != Token::Category::ARROW) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
             }
-        }
+            case ImageTypeTag::RECORD: {
+                Type::RecordFields fields;
+                std::size_t num_fields = ReadUInt();
+
+                for (std::size_t i = 0; i < num_fields; ++i) {
+                    std::string label = ReadString();
+                    Type& field_type = ReadTypeRef();
+                    fields.insert({label, field_type});
+                }
 
-        // Types are right-associative, combine them accordingly.
-        for (int i = parts.size() - 2; i >= 0; --i) {
-            parts[i] = &Type::Function(*parts[i], *parts[i + 1]);
+                types_.push_back(&Type::Record(std::move(fields)));
+                break;
+            }
+            case ImageTypeTag::REF:
+                types_.push_back(&Type::Ref(ReadTypeRef()));
+                break;
+            default:
+                throw std::invalid_argument("Invalid type in program image.");
         }
-
-        return *parts[0];
     }
 
-    Type& ParseRecordType() {
-        Token token = lexer_.NextToken();
+    Type& ReadTypeRef() {
+        std::uint64_t idx = ReadUInt();
 
-        if (token.GetCategory() != Token::Category::OPEN_BRACE) {
-            std::ostringstream error_ss;
-            error_ss << __LINE__ << ": Unexpected token: " << token;
-            throw std::invalid_argument(error_ss.str());
+        if (idx >= types_.size()) {
+            throw std::invalid_argument("Invalid type in program image.");
         }
 
-        Type::RecordFields fields;
-        token = lexer_.NextToken();
+        return *types_[idx];
+    }
 
-        while (true) {
-            if (token.GetCategory() != Token::Category::IDENTIFIER) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
-            }
+    const std::string& ReadString() {
+        std::uint64_t idx = ReadUInt();
 
-            std::string field_id = token.GetText();
+        if (idx >= strings_.size()) {
+            throw std::invalid_argument("Invalid string in program image.");
+        }
 
-            token = lexer_.NextToken();
+        return strings_[idx];
+    }
 
-            if (token.GetCategory() != Token::Category::COLON) {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
-            }
+    std::uint64_t ReadUInt() {
+        std::uint64_t value = 0;
 
-            Type& type = ParseType();
-            token = lexer_.NextToken();
-            fields.insert({field_id, type});
+        for (int shift = 0; shift < 64; shift += 7) {
+            std::uint8_t byte = ReadByte();
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
 
-            if (token.GetCategory() == Token::Category::CLOSE_BRACE) {
-                break;
-            } else if (token.GetCategory() == Token::Category::COMMA) {
-                token = lexer_.NextToken();
-                continue;
-            } else {
-                std::ostringstream error_ss;
-                error_ss << __LINE__ << ": Unexpected token: " << token;
-                throw std::invalid_argument(error_ss.str());
+            if (!(byte & 0x80)) {
+                return value;
             }
         }
 
-        if (fields.empty()) {
-            std::ostringstream error_ss;
-            error_ss << __LINE__ << ": Invalid record.";
-            throw std::invalid_argument(error_ss.str());
-        }
-
-        return Type::Record(std::move(fields));
+        throw std::invalid_argument("Invalid integer in program image.");
     }
 
-    Token::IdentifieySubCategory CalculateIdentifierSubCategoryFromContext(
-        Token token, const std::vector<Term>& term_stack) {
-        assert(token.GetCategory() == Token::Category::IDENTIFIER);
+    std::size_t Remaining() const { return end_ - pos_; }
 
-        if (term_stack.back().IsRecord() &&
-            term_stack.back().IsRecordExpectingLabel()) {
-            return Token::IdentifieySubCategory::RECORD_LABEL;
+    std::uint8_t ReadByte() {
+        if (pos_ == end_) {
+            throw std::invalid_argument("Truncated program image.");
         }
 
-        return Token::IdentifieySubCategory::VARIABLE;
+        return *pos_++;
     }
 
-   private:
-    lexer::Lexer lexer_;
-};  // namespace parser
+    const char* pos_;
+    const char* end_;
+
+    std::vector<std::string> strings_;
+    std::vector<Type*> types_;
+    Type* program_type_ = nullptr;
+};
 }  // namespace parser
 
 namespace type_checker {
@@ -2089,48 +3627,63 @@ using parser::Type;
 class TypeChecker {
     using Context = std::deque<std::pair<std::string, Type*>>;
 
+    static constexpr std::size_t kMaxCachedBindings = 16;
+
    public:
     Type& TypeOf(const Term& term) {
+        allocation::PhaseScope scope{allocation::Phase::TYPE_CHECKING};
         Context ctx;
         return TypeOf(ctx, term);
     }
 
+    /**
+     * Drops all cached types. Types are cached per Term id (see
+     * TypeOf(const Context&, const Term&)), which a destroyed Term doesn't pass
+     * on to a new one, but this must be called once a type checked Term is
+     * modified in place (e.g. evaluated).
+     */
+    void ClearCache() { type_cache_.clear(); }
+
     /**
      * Determines if \p s is a sub-type of \p t.
      *
      * @return true of \p s is sub-type of \p t, false otherwise.
      */
     bool IsSubtype(const Type& s, const Type& t) {
-        if (s == t) {
-            return true;
-        }
+        // Pairs of types of which the first must be a sub-type of the second.
+        // Nested types are checked using an explicit stack, since the types of
+        // deeply nested terms are deeply nested as well.
+        std::vector<std::pair<const Type*, const Type*>> stack{{&s, &t}};
 
-        if (s.IsRecord() && t.IsRecord()) {
-            for (const auto& t_field : t.GetRecordFields()) {
-                bool found_t_field_in_s = false;
+        while (!stack.empty()) {
+            auto [sub, super] = stack.back();
+            stack.pop_back();
 
-                for (const auto& s_field : s.GetRecordFields()) {
-                    if (t_field.first == s_field.first &&
-                        IsSubtype(s_field.second, t_field.second)) {
-                        found_t_field_in_s = true;
-                        break;
+            if (*sub == *super) {
+                continue;
+            }
+
+            if (sub->IsRecord() && super->IsRecord()) {
+                const auto& sub_fields = sub->GetRecordFields();
+
+                for (const auto& super_field : super->GetRecordFields()) {
+                    auto sub_it = sub_fields.find(super_field.first);
+
+                    if (sub_it == std::end(sub_fields)) {
+                        return false;
                     }
-                }
 
-                if (!found_t_field_in_s) {
-                    return false;
+                    stack.push_back({&sub_it->second, &super_field.second});
                 }
+            } else if (sub->IsFunction() && super->IsFunction()) {
+                stack.push_back({&sub->FunctionRHS(), &super->FunctionRHS()});
+                stack.push_back({&super->FunctionLHS(), &sub->FunctionLHS()});
+            } else {
+                return false;
             }
-
-            return true;
         }
 
-        if (s.IsFunction() && t.IsFunction()) {
-            return IsSubtype(t.FunctionLHS(), s.FunctionLHS()) &&
-                   IsSubtype(s.FunctionRHS(), t.FunctionRHS());
-        }
-
-        return false;
+        return true;
     }
 
     /**
@@ -2249,7 +3802,162 @@ class TypeChecker {
     }
 
    private:
+    /**
+     * How far the visit of a term on TypeOf()'s stack got: its sub-terms are
+     * pushed on ENTER and its type is calculated on EXIT. A let's body is only
+     * pushed on LET_BODY, once the type of its binding is known.
+     */
+    enum class Visit { ENTER, LET_BODY, EXIT };
+
+    /**
+     * Memoized version of CalculateTypeOf(). The type of a term depends only on
+     * the bindings of its free variables, so types are cached per Term id
+     * together with the innermost term.FreeVariableBound() bindings of the
+     * context they were calculated in. In particular, the type of a closed
+     * term is calculated only once regardless of its context. Terms that depend
+     * on more than kMaxCachedBindings bindings aren't cached, since copying
+     * those bindings would make type checking a term nested under many
+     * binders quadratic.
+     *
+     * The type is computed bottom-up using an explicit stack so that
+     * arbitrarily deep terms can be type checked.
+     */
     Type& TypeOf(const Context& ctx, const Term& term) {
+        // The bindings of the lambdas and lets enclosing the term being
+        // visited, innermost first.
+        Context walk_ctx = ctx;
+        // The types of the visited sub-terms whose parents were not visited
+        // yet.
+        std::vector<Type*> types;
+        std::vector<std::pair<const Term*, Visit>> stack{
+            {&term, Visit::ENTER}};
+
+        while (!stack.empty()) {
+            auto [current, visit] = stack.back();
+
+            if (visit == Visit::ENTER) {
+                if (Type* cached = CachedTypeOf(walk_ctx, *current)) {
+                    stack.pop_back();
+                    types.push_back(cached);
+                    continue;
+                }
+
+                if (current->IsLet()) {
+                    // The bound term sees the binding, but not its type.
+                    walk_ctx.push_front(
+                        {current->LetBindingName(), &Type::IllTyped()});
+                    stack.back().second = Visit::LET_BODY;
+                    stack.push_back({&current->LetBoundTerm(), Visit::ENTER});
+                    continue;
+                }
+
+                if (current->IsLambda()) {
+                    walk_ctx.push_front(
+                        {current->LambdaArgName(), &current->LambdaArgType()});
+                }
+
+                stack.back().second = Visit::EXIT;
+                PushSubTerms(*current, stack);
+                continue;
+            }
+
+            if (visit == Visit::LET_BODY) {
+                walk_ctx[0].second = types.back();
+                stack.back().second = Visit::EXIT;
+                stack.push_back({&current->LetBodyTerm(), Visit::ENTER});
+                continue;
+            }
+
+            stack.pop_back();
+
+            if (current->IsLambda() || current->IsLet()) {
+                walk_ctx.pop_front();
+            }
+
+            Type& res = CalculateTypeOf(walk_ctx, *current, types);
+            std::size_t prefix_size = std::min<std::size_t>(
+                current->FreeVariableBound(), walk_ctx.size());
+
+            if (prefix_size <= kMaxCachedBindings) {
+                type_cache_[current->GetId()].push_back(
+                    {Context(std::begin(walk_ctx),
+                             std::begin(walk_ctx) + prefix_size),
+                     &res});
+            }
+
+            types.push_back(&res);
+        }
+
+        return *types.back();
+    }
+
+    /**
+     * Returns the cached type of term in ctx, or nullptr if there is none.
+     */
+    Type* CachedTypeOf(const Context& ctx, const Term& term) {
+        std::size_t prefix_size =
+            std::min<std::size_t>(term.FreeVariableBound(), ctx.size());
+        auto it = type_cache_.find(term.GetId());
+
+        if (prefix_size > kMaxCachedBindings || it == std::end(type_cache_)) {
+            return nullptr;
+        }
+
+        for (auto& entry : it->second) {
+            if (entry.ctx_prefix.size() == prefix_size &&
+                std::equal(std::begin(entry.ctx_prefix),
+                           std::end(entry.ctx_prefix), std::begin(ctx))) {
+                return entry.type;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Pushes the direct sub-terms of term (except the ones of a let, see
+     * TypeOf()) on stack so that they are visited in order.
+     */
+    static void PushSubTerms(
+        const Term& term, std::vector<std::pair<const Term*, Visit>>& stack) {
+        auto push = [&stack](const Term& sub_term) {
+            stack.push_back({&sub_term, Visit::ENTER});
+        };
+
+        if (term.IsLambda()) {
+            push(term.LambdaBody());
+        } else if (term.IsApplication()) {
+            push(term.ApplicationRHS());
+            push(term.ApplicationLHS());
+        } else if (term.IsIf()) {
+            push(term.IfElse());
+            push(term.IfThen());
+            push(term.IfCondition());
+        } else if (term.IsSucc() || term.IsPred() || term.IsIsZero()) {
+            push(term.UnaryOpArg());
+        } else if (term.IsRecord()) {
+            for (auto it = term.RecordTerms().rbegin();
+                 it != term.RecordTerms().rend(); ++it) {
+                push(**it);
+            }
+        } else if (term.IsProjection()) {
+            push(term.ProjectionTerm());
+        } else if (term.IsRef()) {
+            push(term.RefTerm());
+        } else if (term.IsDeref()) {
+            push(term.DerefTerm());
+        } else if (term.IsAssignment()) {
+            push(term.AssignmentRHS());
+            push(term.AssignmentLHS());
+        }
+    }
+
+    /**
+     * Calculates the type of term in ctx given the types of its direct
+     * sub-terms, which are popped from the back of types.
+     */
+    Type& CalculateTypeOf(const Context& ctx, const Term& term,
+                          std::vector<Type*>& types) {
         Type* res = &Type::IllTyped();
 
         if (term.IsTrue() || term.IsFalse()) {
@@ -2257,37 +3965,29 @@ class TypeChecker {
         } else if (term.IsConstantZero()) {
             res = &Type::Nat();
         } else if (term.IsIf()) {
-            if (TypeOf(ctx, term.IfCondition()) == Type::Bool()) {
-                Type& then_type = TypeOf(ctx, term.IfThen());
-                Type& else_type = TypeOf(ctx, term.IfElse());
-                return Join(then_type, else_type);
+            Type& else_type = PopType(types);
+            Type& then_type = PopType(types);
+
+            if (PopType(types) == Type::Bool()) {
+                res = &Join(then_type, else_type);
             }
         } else if (term.IsSucc() || term.IsPred()) {
-            auto& subterm_type = TypeOf(ctx, term.UnaryOpArg());
-
-            if (subterm_type == Type::Nat()) {
+            if (PopType(types) == Type::Nat()) {
                 res = &Type::Nat();
             }
         } else if (term.IsIsZero()) {
-            auto& subterm_type = TypeOf(ctx, term.UnaryOpArg());
-
-            if (subterm_type == Type::Nat()) {
+            if (PopType(types) == Type::Nat()) {
                 res = &Type::Bool();
             }
         } else if (term.IsLambda()) {
-            Context new_ctx =
-                AddBinding(ctx, term.LambdaArgName(), term.LambdaArgType());
-            Type& return_type = TypeOf(new_ctx, term.LambdaBody());
-            res = &Type::Function(term.LambdaArgType(), return_type);
+            res = &Type::Function(term.LambdaArgType(), PopType(types));
         } else if (term.IsLet()) {
-            Context new_ctx =
-                AddBinding(ctx, term.LetBindingName(), Type::IllTyped());
-            Type& let_bound_type = TypeOf(new_ctx, term.LetBoundTerm());
-            new_ctx[0].second = &let_bound_type;
-            res = &TypeOf(new_ctx, term.LetBodyTerm());
+            res = &PopType(types);
+            // The type of the bound term.
+            PopType(types);
         } else if (term.IsApplication()) {
-            Type& lhs_type = TypeOf(ctx, term.ApplicationLHS());
-            Type& rhs_type = TypeOf(ctx, term.ApplicationRHS());
+            Type& rhs_type = PopType(types);
+            Type& lhs_type = PopType(types);
 
             if (lhs_type.IsFunction() &&
                 IsSubtype(rhs_type, lhs_type.FunctionLHS())) {
@@ -2301,23 +4001,25 @@ class TypeChecker {
                 res = ctx[idx].second;
             }
         } else if (term.IsRecord()) {
+            auto field_types = std::end(types) - term.RecordLabels().size();
             Type::RecordFields record_type_fields;
 
-            for (int i = 0; i < term.RecordLabels().size(); ++i) {
-                Type& field_type = TypeOf(ctx, *term.RecordTerms()[i]);
-
-                if (field_type.IsIllTyped()) {
+            for (std::size_t i = 0; i < term.RecordLabels().size(); ++i) {
+                if (field_types[i]->IsIllTyped()) {
                     break;
                 }
 
-                record_type_fields.insert({term.RecordLabels()[i], field_type});
+                record_type_fields.insert(
+                    {term.RecordLabels()[i], *field_types[i]});
             }
 
             if (record_type_fields.size() == term.RecordLabels().size()) {
                 res = &Type::Record(record_type_fields);
             }
+
+            types.erase(field_types, std::end(types));
         } else if (term.IsProjection()) {
-            Type& term_type = TypeOf(ctx, term.ProjectionTerm());
+            Type& term_type = PopType(types);
 
             if (term_type.IsRecord()) {
                 for (auto& field : term_type.GetRecordFields()) {
@@ -2330,20 +4032,20 @@ class TypeChecker {
         } else if (term.IsUnit()) {
             res = &Type::Unit();
         } else if (term.IsRef()) {
-            Type& ref_term_type = TypeOf(ctx, term.RefTerm());
+            Type& ref_term_type = PopType(types);
 
             if (!ref_term_type.IsIllTyped()) {
                 res = &Type::Ref(ref_term_type);
             }
         } else if (term.IsDeref()) {
-            Type& deref_term_type = TypeOf(ctx, term.DerefTerm());
+            Type& deref_term_type = PopType(types);
 
             if (deref_term_type.IsRef()) {
                 res = &deref_term_type.RefType();
             }
         } else if (term.IsAssignment()) {
-            Type& lhs_type = TypeOf(ctx, term.AssignmentLHS());
-            Type& rhs_type = TypeOf(ctx, term.AssignmentRHS());
+            Type& rhs_type = PopType(types);
+            Type& lhs_type = PopType(types);
 
             if (lhs_type.IsRef() && lhs_type.RefType() == rhs_type) {
                 res = &Type::Unit();
@@ -2353,177 +4055,554 @@ class TypeChecker {
         return *res;
     }
 
-    Context AddBinding(const Context& current_ctx, std::string var_name,
-                       Type& type) {
-        Context new_ctx = current_ctx;
-        new_ctx.push_front({var_name, &type});
+    Type& PopType(std::vector<Type*>& types) {
+        Type* type = types.back();
+        types.pop_back();
 
-        return new_ctx;
+        return *type;
     }
+
+    struct CacheEntry {
+        // The innermost bindings of the context in which type was calculated.
+        Context ctx_prefix;
+        Type* type;
+    };
+
+    std::unordered_map<std::uint64_t, std::vector<CacheEntry>> type_cache_;
 };
 }  // namespace type_checker
 
 namespace interpreter {
-class Interpreter {
-    using Term = parser::Term;
+/**
+ * Identifies how this interpreter evaluates programs and prints their results
+ * in caches of results (see result_cache/). Bump it whenever either changes.
+ */
+constexpr int kEngineVersion = 3;
+
+using budget::Budget;
+using budget::BudgetExceeded;
+using budget::BudgetMeter;
+
+/**
+ * Identifies (and versions) the checkpoints written by WriteCheckpoint().
+ */
+const std::string kCheckpointMagic = "TAPL18CK";
+
+/**
+ * An evaluation in progress: the program as far as it is reduced, its type
+ * and the number of steps that took. The interpreter has no store (references
+ * aren't evaluated), so that is the whole state.
+ */
+struct Checkpoint {
+    parser::Term term_;
+    type_checker::Type* type_ = nullptr;
+    long long steps_ = 0;
+};
+
+/**
+ * Encodes a checkpoint as kCheckpointMagic, the number of steps (8 bytes,
+ * little endian) and the program image of the term. So the cost of a
+ * checkpoint is proportional to the size of the term, however long the
+ * evaluation ran.
+ */
+std::string WriteCheckpoint(const parser::Term& term, type_checker::Type& type,
+                            long long steps) {
+    std::string checkpoint = kCheckpointMagic;
+
+    for (int i = 0; i < 8; ++i) {
+        checkpoint.push_back(static_cast<std::uint64_t>(steps) >> (8 * i));
+    }
+
+    return checkpoint + parser::ImageWriter().Write(term, type);
+}
+
+/**
+ * Decodes a checkpoint written by WriteCheckpoint(). Throws
+ * std::invalid_argument if data isn't one.
+ */
+Checkpoint ReadCheckpoint(const std::string& data) {
+    std::size_t header_size = kCheckpointMagic.size() + 8;
+
+    if (data.size() < header_size ||
+        data.compare(0, kCheckpointMagic.size(), kCheckpointMagic) != 0) {
+        throw std::invalid_argument("Not a checkpoint.");
+    }
+
+    std::uint64_t steps = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        steps |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(
+                     data[kCheckpointMagic.size() + i]))
+                 << (8 * i);
+    }
+
+    parser::ImageReader reader{data.data() + header_size,
+                               data.size() - header_size};
+    parser::Term term = reader.ReadProgram();
+
+    return {std::move(term), &reader.ProgramType(),
+            static_cast<long long>(steps)};
+}
+
+/**
+ * Profiling policy of BasicInterpreter that records nothing. Its hooks are
+ * empty inline functions, so an unprofiled interpreter doesn't pay for them.
+ */
+struct NullProfiler {
+    void CountRule(const char*) {}
+
+    template <typename Operation>
+    void Time(const char*, Operation operation) {
+        operation();
+    }
+
+    void RecordTerm(const parser::Term&, std::size_t) {}
+
+    void RecordResult(const parser::Term&) {}
+};
 
+/**
+ * Profiling policy of BasicInterpreter that counts how often each reduction
+ * rule fires, measures the time spent in Shift() and Substitute() (which
+ * includes cloning the substituted terms) and tracks the largest term that
+ * evaluation produces.
+ */
+class Profiler {
    public:
-    std::pair<std::string, type_checker::Type&> Interpret(Term& program) {
-        type_checker::Type& type = type_checker::TypeChecker().TypeOf(program);
+    // How many steps apart the depth of the evaluated term is measured.
+    static constexpr long long kDepthSampleInterval = 1024;
+
+    void CountRule(const char* rule) { ++rule_counts_[rule]; }
+
+    template <typename Operation>
+    void Time(const char* name, Operation operation) {
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        operation_times_[name] += std::chrono::steady_clock::now() - start;
+    }
 
-        if (!type.IsIllTyped()) {
-            Eval(program);
+    /**
+     * Records the term after a reduction step, given its size as counted by
+     * the budget meter. Measuring its depth takes a walk over the whole term,
+     * so that is only sampled every kDepthSampleInterval steps and on the
+     * result.
+     */
+    void RecordTerm(const parser::Term& term, std::size_t size) {
+        max_term_size_ = std::max(max_term_size_, size);
+
+        if (num_terms_++ % kDepthSampleInterval == 0) {
+            RecordResult(term);
         }
+    }
 
-        std::ostringstream ss;
-        ss << program;
+    void RecordResult(const parser::Term& term) {
+        max_term_depth_ = std::max(max_term_depth_, term.SizeAndDepth().second);
+    }
 
-        auto term_str = ss.str();
+    /**
+     * Prints the collected data and the peak memory usage of the process as a
+     * table.
+     */
+    void Print(std::ostream& out) const {
+        const int kNameWidth = 24;
+        out << std::left << std::setw(kNameWidth) << "Rule" << "Count\n";
 
-        if (IsNatValue(program)) {
-            std::size_t start_pos = 0;
-            int num = 0;
+        for (const auto& [rule, count] : rule_counts_) {
+            out << std::setw(kNameWidth) << rule << count << "\n";
+        }
 
-            while ((start_pos = term_str.find("succ", start_pos)) !=
-                   std::string::npos) {
-                ++num;
-                ++start_pos;
-            }
+        out << "\n" << std::setw(kNameWidth) << "Operation" << "Time (ms)\n";
 
-            term_str = std::to_string(num);
+        for (const auto& [name, time] : operation_times_) {
+            out << std::setw(kNameWidth) << name
+                << std::chrono::duration<double, std::milli>(time).count()
+                << "\n";
         }
 
-        return {term_str, type};
+        out << "\n"
+            << std::setw(kNameWidth) << "Max term size" << max_term_size_
+            << " nodes\n"
+            << std::setw(kNameWidth) << "Max sampled depth" << max_term_depth_
+            << "\n"
+            << std::setw(kNameWidth) << "Peak memory" << PeakMemoryKiB()
+            << " KiB\n";
     }
 
    private:
-    void Eval(Term& term) {
-        try {
-            Eval1(term);
-            Eval(term);
-        } catch (std::invalid_argument&) {
+    static long PeakMemoryKiB() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        // macOS reports ru_maxrss in bytes rather than KiB.
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    std::map<std::string, long long> rule_counts_;
+    std::map<std::string, std::chrono::steady_clock::duration>
+        operation_times_;
+    std::size_t max_term_size_ = 0;
+    std::size_t max_term_depth_ = 0;
+    long long num_terms_ = 0;
+};
+
+/**
+ * Evaluates programs, reporting every reduction step to a ProfilingPolicy
+ * (NullProfiler or Profiler).
+ */
+template <typename ProfilingPolicy>
+class BasicInterpreter {
+    using Term = parser::Term;
+
+   public:
+    BasicInterpreter() = default;
+
+    /**
+     * Creates an interpreter in hash-consing mode: the normal forms computed
+     * by Interpret() are deduplicated through \p hash_cons_table.
+     */
+    BasicInterpreter(parser::HashConsTable& hash_cons_table)
+        : hash_cons_table_(&hash_cons_table) {}
+
+    const ProfilingPolicy& GetProfiler() const { return profiler_; }
+
+    /**
+     * Limits every following evaluation to budget. Interpret() throws
+     * BudgetExceeded when an evaluation goes over it.
+     */
+    void SetBudget(const Budget& budget) { budget_ = budget; }
+
+    /**
+     * An evaluation of a term in place that can be suspended between any two
+     * reduction steps, so that a scheduler can interleave many evaluations on
+     * a few threads. The term must not be used otherwise until Resume()
+     * returned true.
+     *
+     * The evaluation context of the current redex is kept as an explicit
+     * stack of the sub-terms on the path from the term to the redex (i.e. a
+     * zipper over the term), which is all the state there is to suspend.
+     * After a reduction, the search for the next redex resumes at the reduced
+     * sub-term and only moves up as far as necessary instead of starting over
+     * at the term.
+     */
+    class Evaluation {
+       public:
+        /**
+         * Type checks term using checker and, if it is well typed, prepares to
+         * evaluate it.
+         */
+        Evaluation(BasicInterpreter& interpreter, Term& term,
+                   type_checker::TypeChecker& checker)
+            : interpreter_(interpreter),
+              term_(term),
+              type_(checker.TypeOf(term)),
+              meter_(interpreter.budget_) {
+            if (!type_.IsIllTyped()) {
+                // Evaluation rewrites the program in place which invalidates
+                // the types cached for its sub-terms. (Sub-terms shared with
+                // other programs through hash-consing are copied as they are
+                // rewritten, see Resume() and Eval1().)
+                checker.ClearCache();
+                context_.push_back(&term_);
+                meter_.Start(term_);
+                interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
+            }
+        }
+
+        /**
+         * Resumes the evaluation of term, which has type type and took steps
+         * reduction steps before it was checkpointed.
+         */
+        Evaluation(BasicInterpreter& interpreter, Term& term,
+                   type_checker::Type& type, long long steps)
+            : interpreter_(interpreter),
+              term_(term),
+              type_(type),
+              meter_(interpreter.budget_, steps) {
+            if (!type_.IsIllTyped()) {
+                context_.push_back(&term_);
+                meter_.Start(term_);
+                interpreter_.profiler_.RecordTerm(term_, meter_.GetTermNodes());
+            }
+        }
+
+        /**
+         * Performs at most fuel (> 0) reduction steps and returns true once no
+         * evaluation rule applies anymore. Throws BudgetExceeded when the
+         * evaluation goes over the interpreter's budget.
+         */
+        bool Resume(long long fuel) {
+            meter_.Resume();
+
+            try {
+                while (!context_.empty()) {
+                    Term& focus = *context_.back();
+
+                    if (focus.IsValue()) {
+                        // Continue evaluating the enclosing term, whose cached
+                        // value flags are outdated now that focus was
+                        // evaluated.
+                        context_.pop_back();
+
+                        if (!context_.empty()) {
+                            context_.back()->UpdateIsValue();
+                        }
+
+                        continue;
+                    }
+
+                    Term* sub_term = interpreter_.Eval1(focus);
+
+                    if (sub_term) {
+                        if (sub_term->IsValue()) {
+                            // The enclosing term is stuck.
+                            throw std::invalid_argument("No applicable rule.");
+                        }
+
+                        // Only the path to the redex is copied if it is shared.
+                        context_.push_back(&focus.UnshareSubTerm(*sub_term));
+                    } else {
+                        meter_.Step();
+                        interpreter_.profiler_.RecordTerm(
+                            term_, meter_.GetTermNodes());
+
+                        if (--fuel <= 0) {
+                            return false;
+                        }
+                    }
+                }
+            } catch (std::invalid_argument&) {
+                // Evaluation is stuck before getting back to the terms
+                // enclosing the focus, so their cached value flags still have
+                // to be updated.
+                UpdateContextIsValue();
+                context_.clear();
+            } catch (BudgetExceeded&) {
+                // Same for a partially evaluated term.
+                UpdateContextIsValue();
+                throw;
+            }
+
+            interpreter_.profiler_.RecordResult(term_);
+            meter_.Check();
+            return true;
+        }
+
+        /**
+         * Returns what Interpret() returns for the term once Resume() returned
+         * true.
+         */
+        std::pair<std::string, type_checker::Type&> Result() {
+            if (!type_.IsIllTyped() && interpreter_.hash_cons_table_) {
+                term_ = interpreter_.hash_cons_table_->Intern(std::move(term_));
+            }
+
+            std::ostringstream ss;
+
+            if (term_.IsNatValue()) {
+                ss << interpreter_.NatValue(term_);
+            } else if (interpreter_.hash_cons_table_) {
+                // The normal form shares sub-terms, print each only once.
+                term_.PrintShared(ss);
+            } else {
+                ss << term_;
+            }
+
+            return {ss.str(), type_};
         }
+
+        /**
+         * The number of reduction steps performed so far.
+         */
+        long long GetSteps() const { return meter_.GetSteps(); }
+
+        /**
+         * Returns a checkpoint of the evaluation from which a new Evaluation
+         * continues with the same result. The evaluation context isn't part
+         * of it: evaluation is deterministic, so the search for the next
+         * redex from the term finds the same one.
+         */
+        std::string Snapshot() const {
+            return WriteCheckpoint(term_, type_, GetSteps());
+        }
+
+       private:
+        void UpdateContextIsValue() {
+            for (auto it = context_.rbegin(); it != context_.rend(); ++it) {
+                (*it)->UpdateIsValue();
+            }
+        }
+
+        BasicInterpreter& interpreter_;
+        Term& term_;
+        type_checker::Type& type_;
+        std::vector<Term*> context_;
+        BudgetMeter<Term> meter_;
+    };
+
+    std::pair<std::string, type_checker::Type&> Interpret(Term& program) {
+        type_checker::TypeChecker checker;
+
+        return Interpret(program, checker);
+    }
+
+    /**
+     * Same as Interpret(Term&) but type checks \p program using \p checker so
+     * that types cached by earlier checks (e.g. of the same program) are
+     * reused.
+     */
+    std::pair<std::string, type_checker::Type&> Interpret(
+        Term& program, type_checker::TypeChecker& checker) {
+        allocation::PhaseScope scope{allocation::Phase::EVALUATION};
+        Evaluation evaluation{*this, program, checker};
+        evaluation.Resume(std::numeric_limits<long long>::max());
+        return evaluation.Result();
     }
 
-    void Eval1(Term& term) {
-        auto term_subst_top = [](Term& s, Term& t) {
+   private:
+    /**
+     * Performs a single evaluation step on term in place and returns nullptr
+     * if term is a redex. Otherwise, returns the sub-term that the congruence
+     * rules select to be evaluated next. Throws std::invalid_argument if no
+     * evaluation rule applies.
+     */
+    Term* Eval1(Term& term) {
+        auto term_subst_top = [this](Term& s, Term& t) {
             // Adjust the free variables in s by increasing their static
             // distances by 1. That's because s will now be embedded one level
             // deeper in t (i.e. t's bound variable will be replaced by s).
-            s.Shift(1);
-            t.Substitute(0, s);
+            profiler_.Time("Shift", [&s] { s.Shift(1); });
+            profiler_.Time("Substitute", [&] { t.Substitute(0, s); });
             // Because of the substitution, one level of abstraction was peeled
             // off. Account for that by decreasing the static distances of the
             // free variables in t by 1.
-            t.Shift(-1);
+            profiler_.Time("Shift", [&t] { t.Shift(-1); });
             // NOTE: For more details see: tapl,§6.3.
         };
 
         if (term.IsApplication() && term.ApplicationLHS().IsLambda() &&
-            IsValue(term.ApplicationRHS())) {
-            term_subst_top(term.ApplicationRHS(),
-                           term.ApplicationLHS().LambdaBody());
-            std::swap(term, term.ApplicationLHS().LambdaBody());
-        } else if (term.IsApplication() && IsValue(term.ApplicationLHS())) {
-            Eval1(term.ApplicationRHS());
+            term.ApplicationRHS().IsValue()) {
+            profiler_.CountRule("E-AppAbs");
+            Term body = term.ApplicationLHS().LambdaBody().Take();
+            Term arg = term.ApplicationRHS().Take();
+            term_subst_top(arg, body);
+            term = std::move(body);
+            return nullptr;
+        } else if (term.IsApplication() && term.ApplicationLHS().IsValue()) {
+            return &term.ApplicationRHS();
         } else if (term.IsApplication()) {
-            Eval1(term.ApplicationLHS());
-        } else if (term.IsLet() && IsValue(term.LetBoundTerm())) {
-            term_subst_top(term.LetBoundTerm(), term.LetBodyTerm());
-            std::swap(term, term.LetBodyTerm());
+            return &term.ApplicationLHS();
+        } else if (term.IsLet() && term.LetBoundTerm().IsValue()) {
+            profiler_.CountRule("E-LetV");
+            Term body = term.LetBodyTerm().Take();
+            Term bound_term = term.LetBoundTerm().Take();
+            term_subst_top(bound_term, body);
+            term = std::move(body);
+            return nullptr;
         } else if (term.IsLet()) {
-            Eval1(term.LetBoundTerm());
+            return &term.LetBoundTerm();
         } else if (term.IsIf()) {
             if (term.IfCondition() == Term::True()) {
-                std::swap(term, term.IfThen());
+                profiler_.CountRule("E-IfTrue");
+                ReplaceBySubTerm(term, term.IfThen());
+                return nullptr;
             } else if (term.IfCondition() == Term::False()) {
-                std::swap(term, term.IfElse());
-            } else {
-                Eval1(term.IfCondition());
+                profiler_.CountRule("E-IfFalse");
+                ReplaceBySubTerm(term, term.IfElse());
+                return nullptr;
             }
+
+            return &term.IfCondition();
         } else if (term.IsSucc()) {
-            Eval1(term.UnaryOpArg());
+            return &term.UnaryOpArg();
         } else if (term.IsPred()) {
             auto& pred_arg = term.UnaryOpArg();
 
             if (pred_arg.IsConstantZero()) {
-                std::swap(term, term.UnaryOpArg());
-            } else if (pred_arg.IsSucc()) {
-                if (IsNatValue(pred_arg)) {
-                    std::swap(term, pred_arg.UnaryOpArg());
-                } else {
-                    Eval1(pred_arg);
-                }
-            } else {
-                Eval1(pred_arg);
+                profiler_.CountRule("E-PredZero");
+                ReplaceBySubTerm(term, pred_arg);
+                return nullptr;
+            } else if (pred_arg.IsSucc() && pred_arg.IsNatValue()) {
+                profiler_.CountRule("E-PredSucc");
+                ReplaceBySubTerm(term, pred_arg.UnaryOpArg());
+                return nullptr;
             }
+
+            return &pred_arg;
         } else if (term.IsIsZero()) {
             auto& iszero_arg = term.UnaryOpArg();
 
             if (iszero_arg.IsConstantZero()) {
-                auto temp = Term::True();
-                std::swap(term, temp);
-            } else if (iszero_arg.IsSucc()) {
-                if (IsNatValue(iszero_arg)) {
-                    auto temp = Term::False();
-                    std::swap(term, temp);
-                } else {
-                    Eval1(iszero_arg);
-                }
-            } else {
-                Eval1(iszero_arg);
+                profiler_.CountRule("E-IsZeroZero");
+                term = Term::True();
+                return nullptr;
+            } else if (iszero_arg.IsSucc() && iszero_arg.IsNatValue()) {
+                profiler_.CountRule("E-IsZeroSucc");
+                term = Term::False();
+                return nullptr;
             }
+
+            return &iszero_arg;
         } else if (term.IsProjection()) {
             Term& projection_term = term.ProjectionTerm();
 
-            if (IsRecordValue(projection_term)) {
-                for (int i = 0; i < projection_term.RecordLabels().size();
-                     ++i) {
-                    if (projection_term.RecordLabels()[i] ==
-                        term.ProjectionLabel()) {
-                        std::swap(term, *projection_term.RecordTerms()[i]);
+            if (!projection_term.IsValue()) {
+                return &projection_term;
+            }
 
-                        break;
-                    }
+            for (int i = 0; i < projection_term.RecordLabels().size(); ++i) {
+                if (projection_term.RecordLabels()[i] ==
+                    term.ProjectionLabel()) {
+                    profiler_.CountRule("E-ProjRcd");
+                    ReplaceBySubTerm(term, *projection_term.RecordTerms()[i]);
+                    return nullptr;
                 }
-            } else {
-                Eval1(projection_term);
             }
-        } else if (term.IsRecord() && !IsRecordValue(term)) {
+        } else if (term.IsRecord()) {
             for (auto& record_term : term.RecordTerms()) {
-                if (!IsValue(*record_term)) {
-                    Eval1(*record_term);
-                    break;
+                if (!record_term->IsValue()) {
+                    return &*record_term;
                 }
             }
-        } else {
-            throw std::invalid_argument("No applicable rule.");
         }
-    }
 
-    bool IsNatValue(const Term& term) {
-        return term.IsConstantZero() ||
-               (term.IsSucc() && IsNatValue(term.UnaryOpArg()));
+        throw std::invalid_argument("No applicable rule.");
     }
 
-    bool IsRecordValue(const Term& term) {
-        if (!term.IsRecord()) {
-            return false;
-        }
+    /**
+     * Returns the number that the numeric value term represents.
+     */
+    std::size_t NatValue(const Term& term) {
+        std::size_t value = 0;
 
-        for (auto& record_term : term.RecordTerms()) {
-            if (!IsValue(*record_term)) {
-                return false;
-            }
+        for (const Term* current = &term; current->IsSucc();
+             current = &current->UnaryOpArg()) {
+            ++value;
         }
 
-        return true;
+        return value;
     }
 
-    bool IsValue(const Term& term) {
-        return term.IsLambda() || term.IsVariable() || term.IsTrue() ||
-               term.IsFalse() || IsNatValue(term) || IsRecordValue(term) ||
-               term.IsUnit();
+    /**
+     * Replaces term by its (direct or indirect) sub-term without copying the
+     * sub-term (but its node, if it is hash-consed).
+     */
+    void ReplaceBySubTerm(Term& term, Term& sub_term) {
+        // sub_term is owned by term, so it has to be moved out before term is
+        // overwritten. (Swapping the two instead would make sub_term own the
+        // rest of term, which then is never freed.)
+        Term tmp = sub_term.Take();
+        term = std::move(tmp);
     }
+
+    parser::HashConsTable* hash_cons_table_ = nullptr;
+
+    ProfilingPolicy profiler_;
+    Budget budget_;
 };
+
+using Interpreter = BasicInterpreter<NullProfiler>;
+using ProfilingInterpreter = BasicInterpreter<Profiler>;
 }  // namespace interpreter
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <optional>
 
+#include "../program_generator/generator.hpp"
 #include "interpreter.hpp"
 
 namespace lexer {
@@ -28,11 +29,18 @@ void Run();
 }
 }  // namespace interpreter
 
+namespace program_generator {
+namespace test {
+void Run();
+}
+}  // namespace program_generator
+
 int main() {
     lexer::test::Run();
     parser::test::Run();
     type_checker::test::Run();
     interpreter::test::Run();
+    program_generator::test::Run();
 
     return 0;
 }
@@ -1170,7 +1178,7 @@ void InitData() {
 
     auto record5 = Term::Record();
     record5.AddRecordLabel("x");
-    record5.Combine(Term::Zero());
+    record5.Combine(Succ(Term::Zero()));
     kData.emplace_back(TestData{
         "(l r:{x:Nat}. r.x) {x=succ 0}",
         Term::Application(LambdaUP("r", Type::Record({{"x", Type::Nat()}}),
@@ -1311,9 +1319,49 @@ void InitData() {
     kData.emplace_back(TestData{"l x: (Ref Bool ->) Nat. 0"});
 }
 
+struct HashConsTestData {
+    std::string input_program_;
+    std::size_t expected_num_unique_nodes_;
+    // The hash-consed AST printed by Term::PrintShared().
+    std::string expected_shared_string_;
+};
+
+std::vector<HashConsTestData> kHashConsData{};
+
+void InitHashConsData() {
+    kHashConsData.emplace_back(HashConsTestData{"x", 1, "x"});
+    kHashConsData.emplace_back(HashConsTestData{"x x", 2, "(x <- x)"});
+    kHashConsData.emplace_back(
+        HashConsTestData{"succ succ 0", 3, "succ (succ (0))"});
+    kHashConsData.emplace_back(
+        HashConsTestData{"{a=l x:Nat. x, b=l x:Nat. x}", 3,
+                         "let (t0) = ({l x : Nat. x}) in ({a=t0, b=t0})"});
+    // Same structure but different argument types are not merged.
+    kHashConsData.emplace_back(
+        HashConsTestData{"{a=l x:Nat. x, b=l x:Bool. x}", 4,
+                         "{a={l x : Nat. x}, b={l x : Bool. x}}"});
+    kHashConsData.emplace_back(HashConsTestData{
+        "(l r:{a:Nat->Nat, b:Nat->Nat}. r.b) {a=l x:Nat. succ x, b=l x:Nat. "
+        "succ x}",
+        8,
+        "let (t0) = ({l x : Nat. succ (x)}) in (({l r : {b:(Nat -> Nat), "
+        "a:(Nat -> Nat)}. r.b} <- {a=t0, b=t0}))"});
+    // Shared sub-terms with free variables (here f) are not named.
+    kHashConsData.emplace_back(HashConsTestData{
+        "let f = l x:Nat. succ x in {a=f (f 0), b=f (f 0), c=f 0}", 9,
+        "let (f) = ({l x : Nat. succ (x)}) in ({a=(f <- (f <- 0)), b=(f <- "
+        "(f <- 0)), c=(f <- 0)})"});
+}
+
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Parser] Running " << kData.size()
+    InitHashConsData();
+
+    // The one with a loaded image and the one with a full table are run
+    // separately below.
+    size_t total_num_tests = kData.size() + kHashConsData.size() + 2;
+
+    std::cout << color::kYellow << "[Parser] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -1379,9 +1427,132 @@ void Run() {
         }
     }
 
+    // Test hash-consing: the hash-consed AST must be equal to the regular
+    // one, must survive evaluation, and should be interned only once.
+    for (const auto& test : kHashConsData) {
+        HashConsTable table;
+        Term expected =
+            Parser{std::istringstream{test.input_program_}}.ParseProgram();
+        Term res = Parser{std::istringstream{test.input_program_}, table}
+                       .ParseProgram();
+        auto num_unique_nodes = table.GetStats().num_unique_nodes;
+        std::ostringstream shared_string;
+        res.PrintShared(shared_string);
+
+        Term evaluated =
+            Parser{std::istringstream{test.input_program_}, table}
+                .ParseProgram();
+        interpreter::Interpreter().Interpret(evaluated);
+        Term reparsed = Parser{std::istringstream{test.input_program_}, table}
+                            .ParseProgram();
+
+        if (expected != res || expected != reparsed ||
+            num_unique_nodes != test.expected_num_unique_nodes_ ||
+            shared_string.str() != test.expected_shared_string_) {
+            std::cout << color::kRed << "Test failed:" << color::kReset
+                      << "\n";
+
+            std::cout << "  Input program: " << test.input_program_ << "\n";
+
+            std::cout << color::kGreen
+                      << "  Expected unique nodes: " << color::kReset
+                      << test.expected_num_unique_nodes_ << "\n";
+
+            std::cout << color::kRed
+                      << "  Actual unique nodes: " << color::kReset
+                      << num_unique_nodes << "\n";
+
+            std::cout << color::kGreen
+                      << "  Expected shared string: " << color::kReset
+                      << test.expected_shared_string_ << "\n";
+
+            std::cout << color::kRed
+                      << "  Actual shared string: " << color::kReset
+                      << shared_string.str() << "\n";
+
+            std::cout << color::kRed << "  Actual AST: " << color::kReset
+                      << "\n"
+                      << reparsed.ASTString(4) << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    // Shared sub-terms aren't named like the variables of the program, which
+    // (unlike parsed ones) can have any name in a loaded image.
+    {
+        std::string source = "{a=l x:Nat. x, b=l x:Nat. x}";
+        Term program = Parser{std::istringstream{source}}.ParseProgram();
+        std::string image = ImageWriter().Write(
+            program, type_checker::TypeChecker().TypeOf(program));
+        // Renames x, whose entry in the string table comes first.
+        image.replace(image.find(std::string{"\x01x"}), 2, "\x02t0");
+        HashConsTable table;
+        std::ostringstream shared_string;
+        table.Intern(ImageReader{image.data(), image.size()}.ReadProgram())
+            .PrintShared(shared_string);
+        const std::string expected_shared_string =
+            "let (t1) = ({l t0 : Nat. t0}) in ({a=t1, b=t1})";
+
+        if (shared_string.str() != expected_shared_string) {
+            std::cout << color::kRed << "Test failed:" << color::kReset
+                      << "\n";
+
+            std::cout << color::kGreen
+                      << "  Expected shared string: " << color::kReset
+                      << expected_shared_string << "\n";
+
+            std::cout << color::kRed
+                      << "  Actual shared string: " << color::kReset
+                      << shared_string.str() << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    // A full table is cleared, and the Terms interned before stay valid.
+    {
+        const std::size_t max_nodes = 8;
+        HashConsTable table{max_nodes};
+        std::vector<std::string> sources;
+        std::vector<Term> interned;
+        bool is_bounded = true;
+
+        for (std::string nat = "0"; sources.size() < 10;
+             nat = "succ " + nat) {
+            sources.push_back("{a=" + nat + ", b=iszero " + nat + "}");
+            Term program =
+                Parser{std::istringstream{sources.back()}}.ParseProgram();
+            auto num_nodes = program.SizeAndDepth().first;
+            interned.push_back(table.Intern(std::move(program)));
+            is_bounded = is_bounded && table.Size() <= max_nodes + num_nodes;
+        }
+
+        bool is_valid = true;
+
+        for (std::size_t i = 0; i < sources.size(); ++i) {
+            is_valid = is_valid &&
+                       interned[i] ==
+                           Parser{std::istringstream{sources[i]}}.ParseProgram();
+        }
+
+        if (!is_bounded || !is_valid) {
+            std::cout << color::kRed << "Test failed:" << color::kReset
+                      << "\n";
+
+            std::cout << "  Interning into a table of " << max_nodes
+                      << " nodes: "
+                      << (is_bounded ? "changed interned terms"
+                                     : "went over the limit")
+                      << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 
 }  // namespace test
@@ -1603,6 +1774,15 @@ void InitData() {
                  Type::Function(Type::Bool(), Type::Ref(Type::Bool()))});
 
     kData.emplace_back(TestData{"(l x:Nat. ref x) 0", Type::Ref(Type::Nat())});
+
+    // When hash-consed, "l y:Nat. x" is shared by both fields but has a
+    // different type in each.
+    Type& nat_to_nat = Type::Function(Type::Nat(), Type::Nat());
+    Type& nat_to_bool = Type::Function(Type::Nat(), Type::Bool());
+    kData.emplace_back(TestData{
+        "{a=l x:Nat. l y:Nat. x, b=l x:Bool. l y:Nat. x}",
+        Type::Record({{"a", Type::Function(Type::Nat(), nat_to_nat)},
+                      {"b", Type::Function(Type::Bool(), nat_to_bool)}})});
 }
 
 struct SubtypingTestData {
@@ -1776,19 +1956,70 @@ void InitJoinData() {
     }
 }
 
+// Deep enough that reading an image by recursing once per nesting level
+// overflows the stack.
+const int kDeepImageDepth = 1000000;
+
+struct BadImageTestData {
+    std::string description_;
+    std::string image_;
+};
+
+std::vector<BadImageTestData> kBadImageData{};
+
+void InitBadImageData() {
+    // The image of "succ 0" ends with the tags of succ and 0, and Nat is the
+    // only type in its table.
+    Term program = Parser{std::istringstream{"succ 0"}}.ParseProgram();
+    std::string image = ImageWriter().Write(program, Type::Nat());
+    char succ_tag = image[image.size() - 2];
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"truncated", image.substr(0, image.size() - 1)});
+
+    std::string bad_version = image;
+    bad_version[kImageMagic.size()] = kImageVersion + 1;
+    kBadImageData.emplace_back(
+        BadImageTestData{"unsupported version", bad_version});
+
+    // The magic and the version are followed by the sizes of the (empty)
+    // string table and of the type table.
+    std::string bad_type_tag = image;
+    bad_type_tag[kImageMagic.size() + 3] = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid type tag", bad_type_tag});
+
+    std::string bad_term_tag = image;
+    bad_term_tag.back() = 0x7f;
+    kBadImageData.emplace_back(
+        BadImageTestData{"invalid term tag", bad_term_tag});
+
+    kBadImageData.emplace_back(
+        BadImageTestData{"trailing term", image + image.back()});
+
+    kBadImageData.emplace_back(BadImageTestData{
+        "succ^" + std::to_string(kDeepImageDepth) + " without an argument",
+        image.substr(0, image.size() - 2) +
+            std::string(kDeepImageDepth, succ_tag)});
+}
+
 void Run() {
     InitData();
     InitSubtypingData();
     InitJoinData();
+    InitBadImageData();
 
-    size_t total_num_tests =
-        kData.size() + kSubtypingData.size() + kJoinData.size();
+    size_t total_num_tests = kData.size() + kSubtypingData.size() +
+                             kJoinData.size() + kBadImageData.size();
 
     // Test type checking.
     std::cout << color::kYellow << "[Type Checker] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
+    // Checks every program without clearing its cache in between, although
+    // later programs reuse the addresses of the earlier programs' nodes.
+    TypeChecker reused_checker;
 
     for (const auto& test : kData) {
         try {
@@ -1796,8 +2027,51 @@ void Run() {
             Term program = parser.ParseProgram();
             TypeChecker type_checker;
             Type& res = type_checker.TypeOf(program);
+            // Checking the program again is answered from the cache.
+            Type& cached_res = type_checker.TypeOf(program);
+            Type& reused_res = reused_checker.TypeOf(program);
+
+            // Sub-terms of a hash-consed program can be shared between
+            // different contexts.
+            HashConsTable table;
+            Term hash_consed_program =
+                Parser{std::istringstream{test.input_program_}, table}
+                    .ParseProgram();
+            Type& hash_consed_res = TypeChecker().TypeOf(hash_consed_program);
+
+            // A program loaded from its image has the same terms and type.
+            std::string image = ImageWriter().Write(program, res);
+            ImageReader reader{image.data(), image.size()};
+            Term loaded_program = reader.ReadProgram();
+            Type& loaded_res = TypeChecker().TypeOf(loaded_program);
+            std::ostringstream program_str;
+            std::ostringstream loaded_program_str;
+            program_str << program;
+            loaded_program_str << loaded_program;
+
+            // Types interned in an arena of their own compare equal to the
+            // global ones, and the arena can be dropped with its program.
+            std::size_t num_global_types = Type::Arena::Current().Size();
+            bool arena_res_matches = false;
+            {
+                Type::Arena arena;
+                Type::Arena::Scope scope{arena};
+                Term arena_program =
+                    Parser{std::istringstream{test.input_program_}}
+                        .ParseProgram();
+                arena_res_matches =
+                    test.expected_type_ == TypeChecker().TypeOf(arena_program);
+            }
 
-            if (test.expected_type_ != res) {
+            if (!arena_res_matches ||
+                Type::Arena::Current().Size() != num_global_types ||
+                test.expected_type_ != res ||
+                test.expected_type_ != cached_res ||
+                test.expected_type_ != reused_res ||
+                test.expected_type_ != hash_consed_res ||
+                test.expected_type_ != reader.ProgramType() ||
+                test.expected_type_ != loaded_res ||
+                program_str.str() != loaded_program_str.str()) {
                 std::cout << color::kRed << "Test failed:" << color::kReset
                           << "\n";
 
@@ -1867,6 +2141,28 @@ void Run() {
         }
     }
 
+    // Test that malformed images are rejected rather than crashing the reader.
+    for (const auto& test : kBadImageData) {
+        bool is_rejected = false;
+
+        try {
+            ImageReader{test.image_.data(), test.image_.size()}.ReadProgram();
+        } catch (std::invalid_argument&) {
+            is_rejected = true;
+        }
+
+        if (!is_rejected) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Image: " << test.description_ << "\n";
+
+            std::cout << color::kRed << "  The image was loaded."
+                      << color::kReset << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
               << (total_num_tests - num_failed) << " out of " << total_num_tests
               << " tests passed.\n";
@@ -1988,11 +2284,137 @@ void InitData() {
 
     kData.emplace_back(TestData{
         "{x=unit}", {"{x=unit}", Type::Record({{"x", Type::Unit()}})}});
+
+    kData.emplace_back(TestData{"let f = l x:Nat. succ x in {a=f 0}.a",
+                                {"1", Type::Nat()}});
+}
+
+/**
+ * Evaluates program one step at a time, continuing each step from a
+ * checkpoint of the previous one.
+ */
+std::pair<std::string, Type&> EvaluateFromCheckpoints(Term program) {
+    Interpreter interpreter;
+    Checkpoint checkpoint{std::move(program)};
+    checkpoint.type_ = &TypeChecker().TypeOf(checkpoint.term_);
+
+    while (true) {
+        Interpreter::Evaluation evaluation{interpreter, checkpoint.term_,
+                                           *checkpoint.type_,
+                                           checkpoint.steps_};
+
+        if (evaluation.Resume(1)) {
+            return evaluation.Result();
+        }
+
+        checkpoint = ReadCheckpoint(evaluation.Snapshot());
+    }
+}
+
+// Deep enough that processing a term by recursing once per nesting level
+// overflows the stack.
+const int kDeepTermDepth = 1000000;
+
+struct DeepTermTestData {
+    // The program is too long to be printed when a test fails, so it is
+    // described instead.
+    std::string description_;
+    std::string input_program_;
+    std::pair<std::string, Type&> expected_eval_result_;
+};
+
+std::vector<DeepTermTestData> kDeepTermData{};
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+    res.reserve(str.size() * n);
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+void InitDeepTermData() {
+    const int n = kDeepTermDepth;
+    std::string n_str = std::to_string(n);
+    Type* lambdas_type = &Type::Bool();
+
+    for (int i = 0; i < n; ++i) {
+        lambdas_type = &Type::Function(Type::Bool(), *lambdas_type);
+    }
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "succ^" + n_str + " 0", Repeat("succ ", n) + "0",
+        {n_str, Type::Nat()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l y:Bool. (l x:Bool.)^" + n_str + " y) true",
+        "(l y:Bool. " + Repeat("l x:Bool. ", n) + "y) true",
+        {Repeat("{l x : Bool. ", n) + "true" + Repeat("}", n),
+         *lambdas_type}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(if true then)^" + n_str + " false (else true)^" + n_str,
+        Repeat("if true then ", n) + "false" + Repeat(" else true", n),
+        {"false", Type::Bool()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "x^" + n_str + " x", Repeat("x ", n) + "x",
+        {Repeat("(", n) + "x" + Repeat(" <- x)", n), Type::IllTyped()}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "l x:(^" + n_str + " Nat )^" + n_str + ". x",
+        "l x:" + Repeat("(", n) + "Nat" + Repeat(")", n) + ". x",
+        {"{l x : Nat. x}", Type::Function(Type::Nat(), Type::Nat())}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "((l r:{a:^" + n_str + " Nat }^" + n_str + ". r) {a=^" + n_str +
+            " 0 }^" + n_str + ").a^" + n_str,
+        "((l r:" + Repeat("{a:", n) + "Nat" + Repeat("}", n) + ". r) " +
+            Repeat("{a=", n) + "0" + Repeat("}", n) + ")" + Repeat(".a", n),
+        {"0", Type::Nat()}});
+
+    Type* record_type = &Type::Nat();
+
+    for (int i = 0; i < n; ++i) {
+        record_type = &Type::Record({{"a", *record_type}});
+    }
+
+    // The argument is a sub-type of the parameter at every nesting level.
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(l r:{a:^" + n_str + " Nat }^" + n_str + ". r) {b=true, a=^" +
+            n_str + " 0 }^" + n_str,
+        "(l r:" + Repeat("{a:", n) + "Nat" + Repeat("}", n) + ". r) " +
+            Repeat("{b=true, a=", n) + "0" + Repeat("}", n),
+        {Repeat("{b=true, a=", n) + "0" + Repeat("}", n), *record_type}});
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "(let x = 0 in)^" + n_str + " x", Repeat("let x = 0 in ", n) + "x",
+        {"0", Type::Nat()}});
+
+    Type* ref_type = &Type::Nat();
+
+    for (int i = 0; i < n; ++i) {
+        ref_type = &Type::Ref(*ref_type);
+    }
+
+    kDeepTermData.emplace_back(DeepTermTestData{
+        "l r:Ref^" + n_str + " Nat. !^" + n_str + " r",
+        "l r:" + Repeat("Ref ", n) + "Nat. " + Repeat("! ", n) + "r",
+        {"{l r : " + Repeat("Ref ", n) + "Nat. " + Repeat("! ", n) + "r}",
+         Type::Function(*ref_type, Type::Nat())}});
 }
 
 void Run() {
     InitData();
-    std::cout << color::kYellow << "[Interpreter] Running " << kData.size()
+    InitDeepTermData();
+
+    // The one with a deeply shared program is run separately below.
+    size_t total_num_tests = kData.size() + kDeepTermData.size() + 1;
+
+    std::cout << color::kYellow << "[Interpreter] Running " << total_num_tests
               << " tests...\n"
               << color::kReset;
     int num_failed = 0;
@@ -2004,10 +2426,16 @@ void Run() {
             Term program =
                 parser::Parser{std::istringstream{test.input_program_}}
                     .ParseProgram();
+            Term resumed_program = program.Clone();
             auto actual_eval_res = interpreter.Interpret(program);
+            // An evaluation resumed from checkpoints ends in the same term.
+            auto resumed_eval_res =
+                EvaluateFromCheckpoints(std::move(resumed_program));
 
             if (actual_eval_res.first != test.expected_eval_result_.first ||
-                actual_eval_res.second != test.expected_eval_result_.second) {
+                actual_eval_res.second != test.expected_eval_result_.second ||
+                resumed_eval_res.first != actual_eval_res.first ||
+                resumed_eval_res.second != actual_eval_res.second) {
                 std::cout << color::kRed << "Test failed:" << color::kReset
                           << "\n";
 
@@ -2044,9 +2472,155 @@ void Run() {
         }
     }
 
+    for (const auto& test : kDeepTermData) {
+        Term program = parser::Parser{std::istringstream{test.input_program_}}
+                           .ParseProgram();
+        bool is_clone_equal = program.Clone() == program;
+        std::string image = parser::ImageWriter().Write(
+            program, test.expected_eval_result_.second);
+        bool is_loaded_equal =
+            parser::ImageReader{image.data(), image.size()}.ReadProgram() ==
+            program;
+        parser::HashConsTable table;
+        Term interned = table.Intern(program.Clone());
+        auto actual_eval_res = Interpreter().Interpret(program);
+        auto interned_eval_res = Interpreter().Interpret(interned);
+
+        if (!is_clone_equal || !is_loaded_equal ||
+            actual_eval_res.first != test.expected_eval_result_.first ||
+            actual_eval_res.second != test.expected_eval_result_.second ||
+            interned_eval_res.first != test.expected_eval_result_.first) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: " << test.description_ << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    // if true then 0 else t_n, where t_0 = 0 and t_(i+1) = k t_i t_i for
+    // k = l a:Nat. l b:Nat. a. Both occurrences of t_i share the same
+    // hash-consed term, so the program has 2^n nodes as a tree but only about
+    // 2 * n distinct ones, and evaluating it must not copy the tree.
+    {
+        const int n = 40;
+        parser::HashConsTable table;
+        auto k = std::make_shared<Term>(
+            table.Intern(parser::Parser{std::istringstream{"l a:Nat. l b:Nat. a"}}
+                             .ParseProgram()));
+        auto t = std::make_shared<Term>(table.Intern(
+            parser::Parser{std::istringstream{"0"}}.ParseProgram()));
+
+        for (int i = 0; i < n; ++i) {
+            auto lhs = std::make_shared<Term>(Term::Application(k, t));
+            t = std::make_shared<Term>(
+                table.Intern(Term::Application(lhs, t)));
+        }
+
+        Term program = Term::If();
+        program.Combine(Term::True()).Combine(Term::Zero()).Combine(
+            std::move(*t));
+        auto num_nodes = program.SizeAndDepth().first;
+        auto actual_eval_res = Interpreter().Interpret(program);
+
+        if (num_nodes > 3 * n || actual_eval_res.first != "0" ||
+            actual_eval_res.second != Type::Nat()) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Input program: if true then 0 else t_" << n
+                      << " (with " << num_nodes << " distinct nodes)\n";
+
+            std::cout << color::kRed
+                      << "  Actual evaluation result: " << color::kReset
+                      << actual_eval_res.first << ": " << actual_eval_res.second
+                      << "\n";
+
+            ++num_failed;
+        }
+    }
+
     std::cout << color::kYellow << "Results: " << color::kReset
-              << (kData.size() - num_failed) << " out of " << kData.size()
-              << " tests passed.\n";
+              << (total_num_tests - num_failed) << " out of "
+              << total_num_tests << " tests passed.\n";
 }
 }  // namespace test
 }  // namespace interpreter
+
+namespace program_generator {
+namespace test {
+
+using namespace utils::test;
+using parser::Type;
+
+/**
+ * Generates a program of a random type from every seed and checks that it
+ * parses, has that type and evaluates to a result of that type, and that the
+ * same seed generates the same program again.
+ */
+void Run() {
+    constexpr int kNumSeeds = 200;
+    const Options kOptions = {true, true};
+    std::cout << color::kYellow << "[Generator] Running " << kNumSeeds
+              << " tests...\n"
+              << color::kReset;
+    int num_failed = 0;
+
+    for (int seed = 0; seed < kNumSeeds; ++seed) {
+        Type::Arena arena;
+        Type::Arena::Scope scope{arena};
+        Generator<Type> generator{static_cast<std::uint64_t>(seed), kOptions};
+        Type& type = generator.RandomType();
+        int size = 1 + seed * 7 % 300;
+        std::string program = generator.Generate(type, size);
+
+        Generator<Type> same_generator{static_cast<std::uint64_t>(seed),
+                                       kOptions};
+        Type& same_type = same_generator.RandomType();
+        bool reproducible = &same_type == &type &&
+                            same_generator.Generate(type, size) == program;
+
+        try {
+            parser::Term term =
+                parser::Parser{std::istringstream{program}}.ParseProgram();
+            Type& res = type_checker::TypeChecker().TypeOf(term);
+            auto eval_res = interpreter::Interpreter().Interpret(term);
+
+            if (!reproducible || res != type || eval_res.second != type) {
+                std::cout << color::kRed << "Test failed:" << color::kReset
+                          << "\n";
+
+                std::cout << "  Seed: " << seed << "\n";
+
+                std::cout << "  Input program: " << program << "\n";
+
+                std::cout << color::kGreen
+                          << "  Expected type: " << color::kReset << "\n"
+                          << "    " << type << "\n";
+
+                std::cout << color::kRed << "  Actual type: " << color::kReset
+                          << "\n    " << res << ", evaluated to "
+                          << eval_res.second << "\n";
+
+                ++num_failed;
+            }
+        } catch (std::exception& ex) {
+            std::cout << color::kRed << "Test failed:" << color::kReset << "\n";
+
+            std::cout << "  Seed: " << seed << "\n";
+
+            std::cout << "  Input program: " << program << "\n";
+
+            std::cout << color::kRed << "  Error: " << color::kReset
+                      << ex.what() << "\n";
+
+            ++num_failed;
+        }
+    }
+
+    std::cout << color::kYellow << "Results: " << color::kReset
+              << (kNumSeeds - num_failed) << " out of " << kNumSeeds
+              << " tests passed.\n";
+}
+
+}  // namespace test
+}  // namespace program_generator
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+/**
+ * Looks for pipeline phases whose running time grows faster than the size of
+ * their input. Each chapter describes families of programs that grow along
+ * one size parameter (nesting depth, record width, application spine length,
+ * numeral size, ...) and how to time its phases on one program; this header
+ * does the rest and doesn't depend on the chapter:
+ *
+ *  1. For every family, time the phases on the programs of sizes 1, 2, 4, ...
+ *     until one phase takes longer than a per-program budget or the family's
+ *     largest size is reached.
+ *  2. For every phase, fit t = c * n^k through the largest sizes (the ones
+ *     too fast to time reliably are left out) and flag it if k exceeds the
+ *     configured exponent.
+ *  3. For every flagged phase, bisect for the smallest program of the family
+ *     on which the phase takes at least a target time, and save it as the
+ *     phase's worst-case input: the smallest reproducer of the slowdown.
+ */
+namespace complexity_fuzzer {
+/**
+ * make_(n) returns the program of size n.
+ */
+struct Family {
+    std::string name_;
+    std::function<std::string(int)> make_;
+    int max_size_ = 1 << 16;
+};
+
+struct Options {
+    // Phases that grow faster than n^max_exponent_ are flagged. Cache misses
+    // on large terms push even linear phases up to about n^1.4.
+    double max_exponent_ = 1.5;
+    // Stop growing a family once a phase takes this long on one program.
+    std::chrono::duration<double> sample_budget_{0.5};
+    // The saved worst-case input of a flagged phase is the smallest program of
+    // its family on which the phase takes at least this long.
+    std::chrono::duration<double> target_time_{0.1};
+    // Where worst-case inputs are saved; nowhere if empty.
+    std::string out_dir_;
+};
+
+/**
+ * The items item(0), ..., item(n - 1) separated by separator.
+ *
+ * Join() and Name() are only used by the chapters whose families have named
+ * parts (variables, record labels), so they are inline rather than internal,
+ * which would warn about them being unused in the other chapters.
+ */
+inline std::string Join(int n, const std::function<std::string(int)>& item,
+                        const std::string& separator) {
+    std::string res;
+
+    for (int i = 0; i < n; ++i) {
+        res += (i > 0 ? separator : "") + item(i);
+    }
+
+    return res;
+}
+
+/**
+ * A distinct identifier for every i (x, xa, xb, ..., xz, xaa, ...). Identifiers
+ * may only contain letters, and no keyword starts with an x.
+ */
+inline std::string Name(int i) {
+    std::string suffix;
+
+    for (; i > 0; i = (i - 1) / 26) {
+        suffix.insert(suffix.begin(), static_cast<char>('a' + (i - 1) % 26));
+    }
+
+    return "x" + suffix;
+}
+
+namespace {
+
+std::string Repeat(const std::string& str, int n) {
+    std::string res;
+
+    for (int i = 0; i < n; ++i) {
+        res += str;
+    }
+
+    return res;
+}
+
+/**
+ * The slope of the least-squares line through the points (log n, log t),
+ * that is the k of the best fit of t = c * n^k.
+ */
+double FitExponent(const std::vector<std::pair<double, double>>& points) {
+    double mean_x = 0;
+    double mean_y = 0;
+
+    for (auto [n, t] : points) {
+        mean_x += std::log(n) / points.size();
+        mean_y += std::log(t) / points.size();
+    }
+
+    double covariance = 0;
+    double variance = 0;
+
+    for (auto [n, t] : points) {
+        covariance += (std::log(n) - mean_x) * (std::log(t) - mean_y);
+        variance += (std::log(n) - mean_x) * (std::log(n) - mean_x);
+    }
+
+    return variance > 0 ? covariance / variance : 0;
+}
+
+/**
+ * Returns the seconds it takes to call f.
+ */
+template <typename F>
+double Seconds(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+/**
+ * Reads the flags --max-exponent, --budget-ms, --target-ms and --out that
+ * every chapter's fuzz driver takes into options. Returns false after
+ * printing an error to err if a flag is unknown or lacks its value.
+ */
+bool ParseOptions(int argc, char* argv[], Options& options,
+                  std::ostream& err) {
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+        std::string flag = argv[arg_idx];
+
+        if (flag != "--max-exponent" && flag != "--budget-ms" &&
+            flag != "--target-ms" && flag != "--out") {
+            err << "Error: unknown option " << flag << ".\n";
+            return false;
+        }
+
+        if (++arg_idx >= argc) {
+            err << "Error: expected a value after " << flag << ".\n";
+            return false;
+        }
+
+        std::string value = argv[arg_idx];
+
+        if (flag == "--max-exponent") {
+            options.max_exponent_ = std::stod(value);
+        } else if (flag == "--budget-ms") {
+            options.sample_budget_ = std::chrono::milliseconds(std::stoll(value));
+        } else if (flag == "--target-ms") {
+            options.target_time_ = std::chrono::milliseconds(std::stoll(value));
+        } else {
+            options.out_dir_ = value;
+        }
+    }
+
+    return true;
+}
+
+}  // namespace
+
+/**
+ * measure(program) runs the phases on program once and returns the seconds
+ * each took, in the order of the phase names. It may throw std::exception,
+ * which skips the rest of the family.
+ */
+template <typename Measure>
+class Fuzzer {
+   public:
+    Fuzzer(std::string chapter, std::vector<std::string> phases,
+           Measure measure, Options options)
+        : chapter_(std::move(chapter)),
+          phases_(std::move(phases)),
+          measure_(std::move(measure)),
+          options_(std::move(options)) {}
+
+    /**
+     * Reports the growth of every phase on every family to out and returns
+     * the number of flagged phases.
+     */
+    int Run(const std::vector<Family>& families, std::ostream& out) {
+        int num_flagged = 0;
+
+        for (const Family& family : families) {
+            std::vector<std::pair<int, std::vector<double>>> samples;
+
+            try {
+                for (int n = 1; n <= family.max_size_; n *= 2) {
+                    samples.emplace_back(n, Sample(family.make_(n)));
+                    const auto& times = samples.back().second;
+
+                    if (*std::max_element(times.begin(), times.end()) >
+                        options_.sample_budget_.count()) {
+                        break;
+                    }
+                }
+            } catch (std::exception& ex) {
+                out << family.name_ << ": error at size "
+                    << samples.size() + 1 << ": " << ex.what() << std::endl;
+                continue;
+            }
+
+            for (std::size_t phase = 0; phase < phases_.size(); ++phase) {
+                num_flagged += Report(family, phase, samples, out);
+            }
+        }
+
+        return num_flagged;
+    }
+
+   private:
+    // Times below this are mostly noise and overhead.
+    static constexpr double kMinFitTime = 50e-6;
+    // The number of largest sizes the exponent is fit through.
+    static constexpr std::size_t kNumFitPoints = 4;
+    // The phases recurse on the nesting of the program, so deeply nested
+    // programs need far more stack than the main thread has.
+    static constexpr std::size_t kStackSize = std::size_t{1} << 30;
+
+    /**
+     * Calls measure_ on program on a thread with a stack of kStackSize and
+     * returns what it returns or rethrows what it throws.
+     */
+    std::vector<double> MeasureOnLargeStack(const std::string& program) {
+        struct Call {
+            Fuzzer& fuzzer_;
+            const std::string& program_;
+            std::vector<double> res_;
+            std::exception_ptr error_;
+        };
+
+        Call call{*this, program, {}, nullptr};
+        auto run = [](void* arg) -> void* {
+            Call& call = *static_cast<Call*>(arg);
+
+            try {
+                call.res_ = call.fuzzer_.measure_(call.program_);
+            } catch (...) {
+                call.error_ = std::current_exception();
+            }
+
+            return nullptr;
+        };
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, kStackSize);
+        pthread_t thread;
+        int error = pthread_create(&thread, &attr, run, &call);
+        pthread_attr_destroy(&attr);
+
+        if (error != 0) {
+            throw std::system_error(error, std::generic_category(),
+                                    "Can't start a measurement thread");
+        }
+
+        pthread_join(thread, nullptr);
+
+        if (call.error_) {
+            std::rethrow_exception(call.error_);
+        }
+
+        return call.res_;
+    }
+
+    /**
+     * Times the phases on program, repeatedly if it is fast, and returns the
+     * shortest time of each.
+     */
+    std::vector<double> Sample(const std::string& program) {
+        std::vector<double> best;
+        auto start = std::chrono::steady_clock::now();
+
+        for (int run = 0;
+             run < 5 && (run == 0 || std::chrono::steady_clock::now() - start <
+                                         std::chrono::milliseconds(20));
+             ++run) {
+            auto times = MeasureOnLargeStack(program);
+
+            if (best.empty()) {
+                best = times;
+            }
+
+            for (std::size_t i = 0; i < times.size(); ++i) {
+                best[i] = std::min(best[i], times[i]);
+            }
+        }
+
+        return best;
+    }
+
+    /**
+     * Prints the fit of phase on family and saves its worst-case input if it
+     * is flagged. Returns whether it is.
+     */
+    bool Report(const Family& family, std::size_t phase,
+                const std::vector<std::pair<int, std::vector<double>>>& samples,
+                std::ostream& out) {
+        std::vector<std::pair<double, double>> points;
+
+        for (const auto& [n, times] : samples) {
+            if (times[phase] >= kMinFitTime) {
+                points.emplace_back(n, times[phase]);
+            }
+        }
+
+        if (points.size() > kNumFitPoints) {
+            points.erase(points.begin(), points.end() - kNumFitPoints);
+        }
+
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << std::left
+             << std::setw(28) << family.name_ << std::setw(12)
+             << phases_[phase] << "n <= " << std::setw(8)
+             << samples.back().first << std::right << std::setw(10)
+             << samples.back().second[phase] * 1e3 << " ms  ";
+
+        if (points.size() < 3) {
+            out << line.str() << "too fast to fit" << std::endl;
+            return false;
+        }
+
+        double exponent = FitExponent(points);
+        line << "n^" << exponent;
+
+        if (exponent <= options_.max_exponent_) {
+            out << line.str() << std::endl;
+            return false;
+        }
+
+        auto [n, time] = Minimize(family, phase, samples);
+        line << "  SUPER-LINEAR, worst case n = " << n << " (" << time * 1e3
+             << " ms)";
+
+        if (!options_.out_dir_.empty()) {
+            std::string path = options_.out_dir_ + "/" + chapter_ + "." +
+                               Slug(family.name_) + "." + Slug(phases_[phase]) +
+                               ".txt";
+            std::error_code error;
+            std::filesystem::create_directories(options_.out_dir_, error);
+            std::ofstream file{path};
+            file << family.make_(n) << "\n";
+            line << (file ? " saved to " + path : " not saved to " + path);
+        }
+
+        out << line.str() << std::endl;
+        return true;
+    }
+
+    /**
+     * Returns the smallest size on which phase takes at least the target time
+     * (within a few percent), along with that time, or the largest sampled
+     * size if none does.
+     */
+    std::pair<int, double> Minimize(
+        const Family& family, std::size_t phase,
+        const std::vector<std::pair<int, std::vector<double>>>& samples) {
+        double target = options_.target_time_.count();
+        auto slow = std::find_if(samples.begin(), samples.end(),
+                                 [&](const auto& sample) {
+                                     return sample.second[phase] >= target;
+                                 });
+
+        if (slow == samples.end()) {
+            return {samples.back().first, samples.back().second[phase]};
+        }
+
+        int lo = slow == samples.begin() ? 0 : (slow - 1)->first;
+        int hi = slow->first;
+        double hi_time = slow->second[phase];
+
+        while (hi - lo > std::max(1, hi / 32)) {
+            int mid = lo + (hi - lo) / 2;
+            double time = Sample(family.make_(mid))[phase];
+
+            if (time >= target) {
+                hi = mid;
+                hi_time = time;
+            } else {
+                lo = mid;
+            }
+        }
+
+        return {hi, hi_time};
+    }
+
+    static std::string Slug(const std::string& name) {
+        std::string slug = name;
+        std::replace_if(
+            slug.begin(), slug.end(),
+            [](char c) { return !std::isalnum(static_cast<unsigned char>(c)); },
+            '-');
+        return slug;
+    }
+
+    std::string chapter_;
+    std::vector<std::string> phases_;
+    Measure measure_;
+    Options options_;
+};
+}  // namespace complexity_fuzzer
@@ -0,0 +1,525 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "runner.hpp"
+
+/**
+ * Runs a stream of programs, one per line, through a pipeline of threads:
+ *
+ *     reader -> parse workers -> check/eval workers -> writer
+ *
+ * so that reading and parsing the next programs overlaps evaluating the
+ * current ones. The stages are connected by bounded lock-free queues; a
+ * stage whose output queue is full waits, which throttles the stages before
+ * it down to the pace of the slowest one. The writer prints results in the
+ * format of the corpus runner and in input order, as soon as all earlier
+ * programs have been written.
+ */
+namespace corpus_runner {
+/**
+ * A multi-producer multi-consumer queue of at most capacity items (rounded up
+ * to a power of two) after D. Vyukov's bounded MPMC queue: every cell has a
+ * sequence number that tells producers and consumers whose turn it is, so
+ * pushes and pops only contend on one atomic each.
+ */
+template <typename T>
+class BoundedQueue {
+   public:
+    explicit BoundedQueue(std::size_t capacity) {
+        std::size_t size = 2;
+
+        while (size < capacity) {
+            size *= 2;
+        }
+
+        cells_.reset(new Cell[size]);
+        mask_ = size - 1;
+
+        for (std::size_t i = 0; i < size; ++i) {
+            cells_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * Moves value into the queue unless it is full.
+     */
+    bool TryPush(T& value) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true) {
+            cell = &cells_[pos & mask_];
+            std::size_t sequence =
+                cell->sequence_.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence) -
+                        static_cast<std::intptr_t>(pos);
+
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value_ = std::move(value);
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Moves the oldest item into value unless the queue is empty.
+     */
+    bool TryPop(T& value) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        while (true) {
+            cell = &cells_[pos & mask_];
+            std::size_t sequence =
+                cell->sequence_.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(sequence) -
+                        static_cast<std::intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->value_);
+        cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Called once nothing more will be pushed.
+     */
+    void Close() { closed_.store(true, std::memory_order_release); }
+
+    bool IsClosed() const { return closed_.load(std::memory_order_acquire); }
+
+   private:
+    struct Cell {
+        std::atomic<std::size_t> sequence_;
+        T value_;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+    std::atomic<bool> closed_{false};
+};
+
+/**
+ * Where the threads of a stage spent their time.
+ */
+struct StageStats {
+    std::string name_;
+    int num_threads_ = 0;
+    long long num_items_ = 0;
+    // Working on items.
+    std::chrono::nanoseconds busy_time_{0};
+    // Waiting for input.
+    std::chrono::nanoseconds starved_time_{0};
+    // Waiting for room in the output queue.
+    std::chrono::nanoseconds blocked_time_{0};
+
+    void Add(const StageStats& other) {
+        num_items_ += other.num_items_;
+        busy_time_ += other.busy_time_;
+        starved_time_ += other.starved_time_;
+        blocked_time_ += other.blocked_time_;
+    }
+};
+
+struct PipelineStats {
+    long long num_results_[3] = {0, 0, 0};
+    std::chrono::nanoseconds wall_time_{0};
+    std::vector<StageStats> stages_;
+
+    void Print(std::ostream& out) const {
+        long long num_programs =
+            num_results_[0] + num_results_[1] + num_results_[2];
+        double seconds = std::chrono::duration<double>(wall_time_).count();
+
+        out << "programs: " << num_programs << " (ok " << num_results_[0]
+            << ", error " << num_results_[1] << ", budget " << num_results_[2]
+            << ")\n";
+        out << "wall time: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   wall_time_)
+                   .count()
+            << " ms, "
+            << static_cast<long long>(seconds > 0 ? num_programs / seconds : 0)
+            << " programs/s\n";
+
+        for (const StageStats& stage : stages_) {
+            // The share of the stage's thread time spent on each.
+            auto percent = [&](std::chrono::nanoseconds time) {
+                double total = static_cast<double>(wall_time_.count()) *
+                               stage.num_threads_;
+                return total > 0 ? static_cast<int>(100 * time.count() / total)
+                                 : 0;
+            };
+
+            out << "  " << stage.name_ << " x" << stage.num_threads_
+                << ": busy " << percent(stage.busy_time_)
+                << "%, starved " << percent(stage.starved_time_)
+                << "%, blocked " << percent(stage.blocked_time_) << "%\n";
+        }
+    }
+};
+
+/**
+ * parse takes the source of a program and returns it parsed (any movable
+ * type), evaluate takes that and returns its Result. Both may throw
+ * std::exception for programs that don't parse or type check, and both are
+ * called from several threads at once.
+ */
+template <typename Parse, typename Evaluate>
+class Pipeline {
+   public:
+    Pipeline(int num_parse_threads, int num_eval_threads, std::size_t capacity,
+             Parse parse, Evaluate evaluate)
+        : num_parse_threads_(std::max(1, num_parse_threads)),
+          num_eval_threads_(std::max(1, num_eval_threads)),
+          capacity_(std::max<std::size_t>(capacity, 2)),
+          parse_(std::move(parse)),
+          evaluate_(std::move(evaluate)) {}
+
+    /**
+     * Records a span for every program each parse and check/eval thread
+     * works on, on a track per thread. Must be called before Run().
+     */
+    void SetTracer(tracing::Tracer& tracer) { tracer_ = &tracer; }
+
+    /**
+     * Runs the programs read from in until its end and writes their results
+     * to out.
+     */
+    PipelineStats Run(std::istream& in, std::ostream& out) {
+        auto start = Clock::now();
+        BoundedQueue<Source> sources{capacity_};
+        BoundedQueue<Parsed> parsed{capacity_};
+        BoundedQueue<Evaluated> results{capacity_};
+        std::atomic<std::uint64_t> num_written{0};
+        std::atomic<int> num_parsers{num_parse_threads_};
+        std::atomic<int> num_evaluators{num_eval_threads_};
+        // One per thread, so that the threads don't share counters.
+        std::vector<StageStats> reader_stats(1), parser_stats(num_parse_threads_),
+            evaluator_stats(num_eval_threads_), writer_stats(1);
+        std::vector<std::thread> threads;
+
+        threads.emplace_back([&] {
+            Read(in, sources, num_written, reader_stats[0]);
+        });
+
+        for (int i = 0; i < num_parse_threads_; ++i) {
+            threads.emplace_back([&, i] {
+                ParseAll(sources, parsed, parser_stats[i], GetTrace("parse"));
+
+                if (--num_parsers == 0) {
+                    parsed.Close();
+                }
+            });
+        }
+
+        for (int i = 0; i < num_eval_threads_; ++i) {
+            threads.emplace_back([&, i] {
+                EvaluateAll(parsed, results, evaluator_stats[i],
+                            GetTrace("check/eval"));
+
+                if (--num_evaluators == 0) {
+                    results.Close();
+                }
+            });
+        }
+
+        PipelineStats stats;
+        Write(results, out, num_written, stats, writer_stats[0]);
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        stats.wall_time_ = Clock::now() - start;
+        stats.stages_.push_back(Merge("read", reader_stats));
+        stats.stages_.push_back(Merge("parse", parser_stats));
+        stats.stages_.push_back(Merge("check/eval", evaluator_stats));
+        stats.stages_.push_back(Merge("write", writer_stats));
+        return stats;
+    }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    using Program =
+        std::decay_t<std::invoke_result_t<Parse&, const std::string&>>;
+
+    struct Source {
+        std::uint64_t sequence_ = 0;
+        std::string text_;
+    };
+
+    struct Parsed {
+        std::uint64_t sequence_ = 0;
+        std::optional<Program> program_;
+        // Why there is no program.
+        std::string error_;
+    };
+
+    struct Evaluated {
+        std::uint64_t sequence_ = 0;
+        Result result_;
+    };
+
+    /**
+     * Returns a trace buffer for the calling thread, or null if tracing is
+     * off.
+     */
+    tracing::Tracer::Buffer* GetTrace(const char* role) {
+        return tracer_ ? &tracer_->GetBuffer(role) : nullptr;
+    }
+
+    /**
+     * Waits until there is room for item in queue.
+     */
+    template <typename T>
+    static void Push(BoundedQueue<T>& queue, T item, StageStats& stats) {
+        auto start = Clock::now();
+
+        for (int attempt = 0; !queue.TryPush(item); ++attempt) {
+            Backoff(attempt);
+        }
+
+        stats.blocked_time_ += Clock::now() - start;
+    }
+
+    /**
+     * Waits for an item from queue. Returns false once queue is closed and
+     * empty. on_empty is called whenever the queue runs empty.
+     */
+    template <typename T, typename OnEmpty>
+    static bool Pop(BoundedQueue<T>& queue, T& item, StageStats& stats,
+                    OnEmpty on_empty) {
+        auto start = Clock::now();
+        bool popped = true;
+
+        for (int attempt = 0; !queue.TryPop(item); ++attempt) {
+            if (attempt == 0) {
+                on_empty();
+            }
+
+            if (queue.IsClosed()) {
+                // Everything pushed before the queue was closed is visible
+                // once the close is, so one more try tells whether it is
+                // drained.
+                popped = queue.TryPop(item);
+                break;
+            }
+
+            Backoff(attempt);
+        }
+
+        stats.starved_time_ += Clock::now() - start;
+        return popped;
+    }
+
+    template <typename T>
+    static bool Pop(BoundedQueue<T>& queue, T& item, StageStats& stats) {
+        return Pop(queue, item, stats, [] {});
+    }
+
+    /**
+     * Spins briefly, then yields, then sleeps, so that a waiting thread
+     * neither adds latency to short waits nor burns a core on long ones.
+     */
+    static void Backoff(int attempt) {
+        if (attempt < 16) {
+            return;
+        }
+
+        if (attempt < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    /**
+     * Reads the programs of in. Doesn't get more than a few queues' worth
+     * ahead of the writer, which holds the results that arrive out of order
+     * until the earlier ones are written.
+     */
+    void Read(std::istream& in, BoundedQueue<Source>& sources,
+              const std::atomic<std::uint64_t>& num_written,
+              StageStats& stats) {
+        std::uint64_t window = 4 * capacity_;
+        std::uint64_t sequence = 0;
+        std::string line;
+
+        while (true) {
+            auto start = Clock::now();
+
+            if (!std::getline(in, line)) {
+                stats.busy_time_ += Clock::now() - start;
+                break;
+            }
+
+            stats.busy_time_ += Clock::now() - start;
+
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+
+            start = Clock::now();
+
+            for (int attempt = 0;
+                 sequence - num_written.load(std::memory_order_acquire) >=
+                 window;
+                 ++attempt) {
+                Backoff(attempt);
+            }
+
+            stats.blocked_time_ += Clock::now() - start;
+            Push(sources, Source{sequence++, std::move(line)}, stats);
+            ++stats.num_items_;
+        }
+
+        sources.Close();
+    }
+
+    void ParseAll(BoundedQueue<Source>& sources, BoundedQueue<Parsed>& parsed,
+                  StageStats& stats, tracing::Tracer::Buffer* trace) {
+        Source source;
+
+        while (Pop(sources, source, stats)) {
+            auto start = Clock::now();
+            Parsed item;
+            item.sequence_ = source.sequence_;
+
+            try {
+                tracing::Record(trace, "parse", source.sequence_, [&] {
+                    item.program_.emplace(parse_(source.text_));
+                });
+            } catch (std::exception& ex) {
+                item.error_ = ex.what();
+            }
+
+            stats.busy_time_ += Clock::now() - start;
+            ++stats.num_items_;
+            Push(parsed, std::move(item), stats);
+        }
+    }
+
+    void EvaluateAll(BoundedQueue<Parsed>& parsed,
+                     BoundedQueue<Evaluated>& results, StageStats& stats,
+                     tracing::Tracer::Buffer* trace) {
+        Parsed item;
+
+        while (Pop(parsed, item, stats)) {
+            auto start = Clock::now();
+            Evaluated evaluated;
+            evaluated.sequence_ = item.sequence_;
+
+            if (!item.program_) {
+                evaluated.result_ = {Status::ERROR, std::move(item.error_)};
+            } else {
+                auto evaluate = [&] {
+                    return evaluate_(std::move(*item.program_));
+                };
+
+                try {
+                    evaluated.result_ = tracing::Record(
+                        trace, "check/eval", item.sequence_, evaluate);
+                } catch (std::exception& ex) {
+                    evaluated.result_ = {Status::ERROR, ex.what()};
+                }
+            }
+
+            // Don't keep the program alive until the next one is popped.
+            item.program_.reset();
+            stats.busy_time_ += Clock::now() - start;
+            ++stats.num_items_;
+            Push(results, std::move(evaluated), stats);
+        }
+    }
+
+    void Write(BoundedQueue<Evaluated>& results, std::ostream& out,
+               std::atomic<std::uint64_t>& num_written, PipelineStats& totals,
+               StageStats& stats) {
+        std::map<std::uint64_t, Result> pending;
+        Evaluated evaluated;
+
+        // Flush whenever there is nothing to write, so that a program's
+        // result doesn't wait for the ones after it.
+        while (Pop(results, evaluated, stats, [&] { out.flush(); })) {
+            auto start = Clock::now();
+            pending.emplace(evaluated.sequence_, std::move(evaluated.result_));
+
+            for (auto next = pending.begin();
+                 next != pending.end() && next->first == num_written.load();
+                 next = pending.erase(next)) {
+                const Result& result = next->second;
+                ++totals.num_results_[static_cast<int>(result.status_)];
+                out << kStatusNames[static_cast<int>(result.status_)] << "\t"
+                    << Sanitize(result.text_) << "\n";
+                num_written.fetch_add(1, std::memory_order_release);
+                ++stats.num_items_;
+            }
+
+            stats.busy_time_ += Clock::now() - start;
+        }
+
+        out.flush();
+    }
+
+    static StageStats Merge(std::string name,
+                            const std::vector<StageStats>& threads) {
+        StageStats stats;
+        stats.name_ = std::move(name);
+        stats.num_threads_ = static_cast<int>(threads.size());
+
+        for (const StageStats& thread : threads) {
+            stats.Add(thread);
+        }
+
+        return stats;
+    }
+
+    int num_parse_threads_;
+    int num_eval_threads_;
+    std::size_t capacity_;
+    Parse parse_;
+    Evaluate evaluate_;
+    tracing::Tracer* tracer_ = nullptr;
+};
+}  // namespace corpus_runner
@@ -0,0 +1,761 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../instrumentation/instrumentation.hpp"
+
+/**
+ * Runs a corpus of programs, one per line, on all cores. Rather than threads
+ * the runner forks worker processes, which share no heap or global state:
+ * the corpus is split into one byte range per worker, each worker runs the
+ * chapter's pipeline on the programs of its range and sends back the results
+ * through a ring buffer in shared memory. The runner prints
+ *
+ *     <ok|error|budget> \t <result> \n
+ *
+ * for every program in the order of the corpus, followed by statistics.
+ * Blank lines are skipped. Every chapter defines its own namespaces, so each
+ * chapter builds its own runner from corpus.cpp; this header holds the parts
+ * that don't depend on the chapter.
+ *
+ * A worker that dies (e.g. of a stack overflow) loses only the program it was
+ * running: that program is reported as an error and a new worker takes over
+ * the rest of the range.
+ */
+namespace corpus_runner {
+enum class Status : std::uint8_t { OK, ERROR, BUDGET_EXCEEDED };
+
+struct Result {
+    Status status_ = Status::OK;
+    std::string text_;
+};
+
+/**
+ * A byte range [begin_, end_) of the corpus. Ranges start at the start of a
+ * line and a range owns the lines that start in it.
+ */
+struct Shard {
+    std::size_t begin_ = 0;
+    std::size_t end_ = 0;
+};
+
+namespace {
+const char* kStatusNames[] = {"ok", "error", "budget"};
+
+/**
+ * Returns the first program of corpus that starts in [pos, end), along with
+ * the offset just past its line.
+ */
+std::optional<std::pair<std::string_view, std::size_t>> NextProgram(
+    std::string_view corpus, std::size_t pos, std::size_t end) {
+    while (pos < end) {
+        std::size_t eol = std::min(corpus.find('\n', pos), corpus.size());
+        std::string_view line = corpus.substr(pos, eol - pos);
+        std::size_t next = std::min(eol + 1, corpus.size());
+
+        if (line.find_first_not_of(" \t\r") != std::string_view::npos) {
+            return std::make_pair(line, next);
+        }
+
+        pos = next;
+    }
+
+    return std::nullopt;
+}
+
+std::string Sanitize(std::string text) {
+    std::replace_if(
+        text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n'; },
+        ' ');
+    return text;
+}
+}  // namespace
+
+/**
+ * Splits corpus into num_shards ranges of about the same number of bytes.
+ * Some of them may be empty.
+ */
+std::vector<Shard> Split(std::string_view corpus, int num_shards) {
+    std::vector<Shard> shards;
+    std::size_t begin = 0;
+
+    for (int i = 1; i <= num_shards; ++i) {
+        std::size_t end = corpus.size() / num_shards * i;
+
+        if (i == num_shards) {
+            end = corpus.size();
+        } else if (end > begin) {
+            // Move the boundary to the start of the next line.
+            end = std::min(corpus.find('\n', end - 1), corpus.size() - 1) + 1;
+        } else {
+            end = begin;
+        }
+
+        shards.push_back({begin, end});
+        begin = end;
+    }
+
+    return shards;
+}
+
+/**
+ * Lets one process wait until another has something for it. The waiter
+ * calls Arm(), checks whether there is something to do and, if not, calls
+ * Wait(). Lives in shared memory.
+ */
+class Doorbell {
+   public:
+    Doorbell() {
+        if (sem_init(&semaphore_, 1, 0) < 0) {
+            throw std::runtime_error(std::string{"Can't create semaphore: "} +
+                                     std::strerror(errno));
+        }
+    }
+
+    Doorbell(const Doorbell&) = delete;
+    Doorbell& operator=(const Doorbell&) = delete;
+
+    ~Doorbell() { sem_destroy(&semaphore_); }
+
+    void Arm() { waiting_.store(true); }
+
+    void Disarm() { waiting_.store(false); }
+
+    /**
+     * Waits for Notify() after Arm(), but no longer than timeout.
+     */
+    void Wait(std::chrono::milliseconds timeout) {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        auto ns = deadline.tv_nsec +
+                  std::chrono::nanoseconds(timeout).count();
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+
+        while (sem_timedwait(&semaphore_, &deadline) < 0 && errno == EINTR) {
+        }
+
+        Disarm();
+    }
+
+    /**
+     * Wakes up the waiter, if there is one.
+     */
+    void Notify() {
+        if (waiting_.exchange(false)) {
+            sem_post(&semaphore_);
+        }
+    }
+
+   private:
+    std::atomic<bool> waiting_{false};
+    sem_t semaphore_;
+};
+
+/**
+ * A single-producer single-consumer byte queue between a worker and the
+ * runner. Lives in shared memory, so it only uses lock-free atomics. The
+ * producer blocks while the queue is full, the consumer never blocks.
+ */
+class Ring {
+   public:
+    static constexpr std::size_t kCapacity = 1 << 20;
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                      std::atomic<bool>::is_always_lock_free,
+                  "Atomics shared between processes must be lock-free.");
+
+    /**
+     * Appends size bytes from data and notifies consumer. Waits for the
+     * consumer to make room as needed, and gives up (returning false) if the
+     * process that started this one has exited.
+     */
+    bool Write(const void* data, std::size_t size, Doorbell& consumer,
+               pid_t parent) {
+        auto bytes = static_cast<const char*>(data);
+
+        while (size > 0) {
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+            std::uint64_t free =
+                kCapacity - (head - tail_.load(std::memory_order_acquire));
+
+            if (free == 0) {
+                consumer.Notify();
+                space_.Arm();
+
+                if (head - tail_.load() == kCapacity) {
+                    space_.Wait(std::chrono::milliseconds(100));
+
+                    if (getppid() != parent) {
+                        return false;
+                    }
+                } else {
+                    space_.Disarm();
+                }
+
+                continue;
+            }
+
+            std::size_t n = std::min<std::uint64_t>(
+                {size, free, kCapacity - head % kCapacity});
+            std::memcpy(data_ + head % kCapacity, bytes, n);
+            head_.store(head + n, std::memory_order_release);
+            bytes += n;
+            size -= n;
+        }
+
+        consumer.Notify();
+        return true;
+    }
+
+    /**
+     * Called by the producer after its last Write().
+     */
+    void Finish(Doorbell& consumer) {
+        done_.store(true, std::memory_order_release);
+        consumer.Notify();
+    }
+
+    /**
+     * Appends what was written since the last call to out and returns
+     * whether there was anything.
+     */
+    bool Read(std::string& out) {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        std::uint64_t head = head_.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            return false;
+        }
+
+        while (tail != head) {
+            std::size_t n = std::min<std::uint64_t>(
+                head - tail, kCapacity - tail % kCapacity);
+            out.append(data_ + tail % kCapacity, n);
+            tail += n;
+        }
+
+        tail_.store(tail, std::memory_order_release);
+        space_.Notify();
+        return true;
+    }
+
+    /**
+     * Whether the producer called Finish(). Everything it wrote before is
+     * visible to the next Read().
+     */
+    bool IsDone() const { return done_.load(std::memory_order_acquire); }
+
+    /**
+     * Empties the queue for a new producer. The old one must have exited.
+     */
+    void Reset() {
+        head_.store(0);
+        tail_.store(0);
+        done_.store(false);
+    }
+
+   private:
+    alignas(64) std::atomic<std::uint64_t> head_{0};
+    alignas(64) std::atomic<std::uint64_t> tail_{0};
+    std::atomic<bool> done_{false};
+    Doorbell space_;
+    char data_[kCapacity];
+};
+
+/**
+ * size objects of type T in anonymous memory that forked processes share.
+ */
+template <typename T>
+class SharedArray {
+   public:
+    explicit SharedArray(std::size_t size) : size_(size) {
+        void* memory = mmap(nullptr, std::max<std::size_t>(size, 1) * sizeof(T),
+                            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                            -1, 0);
+
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error(std::string{"Can't map shared memory: "} +
+                                     std::strerror(errno));
+        }
+
+        data_ = static_cast<T*>(memory);
+
+        for (std::size_t i = 0; i < size_; ++i) {
+            new (&data_[i]) T();
+        }
+    }
+
+    SharedArray(const SharedArray&) = delete;
+    SharedArray& operator=(const SharedArray&) = delete;
+
+    ~SharedArray() {
+        for (std::size_t i = 0; i < size_; ++i) {
+            data_[i].~T();
+        }
+
+        munmap(data_, std::max<std::size_t>(size_, 1) * sizeof(T));
+    }
+
+    T& operator[](std::size_t i) { return data_[i]; }
+
+   private:
+    std::size_t size_;
+    T* data_;
+};
+
+/**
+ * A read-only mapping of a whole file.
+ */
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            int error = errno;
+
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            throw std::runtime_error("Can't open " + path + ": " +
+                                     std::strerror(error));
+        }
+
+        size_ = st.st_size;
+
+        if (size_ > 0) {
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        int error = errno;
+        close(fd);
+
+        if (data_ == MAP_FAILED) {
+            throw std::runtime_error("Can't map " + path + ": " +
+                                     std::strerror(error));
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (size_ > 0) {
+            munmap(data_, size_);
+        }
+    }
+
+    std::string_view GetContents() const {
+        return {static_cast<const char*>(data_), size_};
+    }
+
+   private:
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+struct ShardStats {
+    Shard shard_;
+    long long num_programs_ = 0;
+    // The time spent running programs.
+    std::chrono::nanoseconds busy_time_{0};
+    // The number of workers that died.
+    int num_crashes_ = 0;
+};
+
+struct Stats {
+    long long num_results_[3] = {0, 0, 0};
+    std::chrono::nanoseconds wall_time_{0};
+    std::vector<ShardStats> shards_;
+
+    long long NumPrograms() const {
+        return num_results_[0] + num_results_[1] + num_results_[2];
+    }
+
+    void Print(std::ostream& out) const {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        auto wall_ms = duration_cast<milliseconds>(wall_time_).count();
+        double seconds = std::chrono::duration<double>(wall_time_).count();
+
+        out << "programs: " << NumPrograms() << " (ok " << num_results_[0]
+            << ", error " << num_results_[1] << ", budget " << num_results_[2]
+            << ")\n";
+        out << "wall time: " << wall_ms << " ms, "
+            << static_cast<long long>(seconds > 0 ? NumPrograms() / seconds : 0)
+            << " programs/s with " << shards_.size() << " workers\n";
+
+        for (std::size_t i = 0; i < shards_.size(); ++i) {
+            const ShardStats& shard = shards_[i];
+            out << "  worker " << i << ": "
+                << shard.shard_.end_ - shard.shard_.begin_ << " bytes, "
+                << shard.num_programs_ << " programs, busy "
+                << duration_cast<milliseconds>(shard.busy_time_).count()
+                << " ms";
+
+            if (shard.num_crashes_ > 0) {
+                out << ", crashes " << shard.num_crashes_;
+            }
+
+            out << "\n";
+        }
+    }
+};
+
+/**
+ * Runs a corpus on num_workers processes. evaluate takes the source of a
+ * program and returns its Result; it may throw std::exception for programs
+ * that don't parse or type check.
+ */
+template <typename Evaluate>
+class Runner {
+   public:
+    Runner(int num_workers, Evaluate evaluate)
+        : num_workers_(std::max(1, num_workers)),
+          evaluate_(std::move(evaluate)) {}
+
+    /**
+     * Records a span for every program on the track of the worker that ran
+     * it. Must be called before Run().
+     */
+    void SetTracer(tracing::Tracer& tracer) { tracer_ = &tracer; }
+
+    /**
+     * Writes the results of the programs of corpus to out in their order.
+     * Throws std::runtime_error if a worker can't be started.
+     */
+    Stats Run(std::string_view corpus, std::ostream& out) {
+        auto start = std::chrono::steady_clock::now();
+        corpus_ = corpus;
+        stats_ = Stats{};
+        workers_.clear();
+        workers_.resize(num_workers_);
+        SharedArray<Doorbell> doorbell{1};
+        SharedArray<Ring> rings{static_cast<std::size_t>(num_workers_)};
+        doorbell_ = &doorbell[0];
+
+        for (const Shard& shard : Split(corpus, num_workers_)) {
+            stats_.shards_.push_back({shard});
+        }
+
+        // The workers are processes, so their spans are recorded here from
+        // the times they report.
+        std::vector<tracing::Tracer::Buffer*> traces;
+
+        for (int i = 0; tracer_ && i < num_workers_; ++i) {
+            traces.push_back(&tracer_->GetBuffer());
+        }
+
+        for (int i = 0; i < num_workers_; ++i) {
+            workers_[i].ring_ = &rings[i];
+            workers_[i].next_ = stats_.shards_[i].shard_.begin_;
+            Spawn(i);
+        }
+
+        std::size_t num_written = 0;
+        long long num_programs = 0;
+
+        while (num_written < workers_.size()) {
+            bool progress = Collect();
+            progress |= Reap();
+
+            // Write what is ready in corpus order.
+            for (; num_written < workers_.size(); ++num_written) {
+                Worker& worker = workers_[num_written];
+
+                for (const auto& line : worker.lines_) {
+                    out << line.text_;
+
+                    if (tracer_ && line.start_) {
+                        traces[num_written]->Add("program", num_programs,
+                                                 *line.start_, line.elapsed_);
+                    }
+
+                    ++num_programs;
+                }
+
+                worker.lines_.clear();
+
+                if (!worker.finished_) {
+                    break;
+                }
+            }
+
+            if (!progress) {
+                doorbell_->Arm();
+
+                if (Collect()) {
+                    doorbell_->Disarm();
+                } else {
+                    doorbell_->Wait(std::chrono::milliseconds(10));
+                }
+            }
+        }
+
+        for (const Worker& worker : workers_) {
+            if (worker.pid_ >= 0) {
+                waitpid(worker.pid_, nullptr, 0);
+            }
+        }
+
+        out.flush();
+        stats_.wall_time_ = std::chrono::steady_clock::now() - start;
+        return std::move(stats_);
+    }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+
+    struct RecordHeader {
+        // The steady clock is the same in every process.
+        std::int64_t start_ns_;
+        std::uint64_t elapsed_ns_;
+        // The offset just past the line of the program.
+        std::uint64_t next_;
+        std::uint32_t size_;
+        Status status_;
+    };
+
+    struct Line {
+        std::string text_;
+        // When the worker started the program and how long it took, unless
+        // the worker died running it.
+        std::optional<Clock::time_point> start_;
+        std::chrono::nanoseconds elapsed_{0};
+    };
+
+    struct Worker {
+        // -1 once the process has exited.
+        pid_t pid_ = -1;
+        Ring* ring_ = nullptr;
+        // Whether every program of the range has been reported.
+        bool finished_ = false;
+        // Where the current process started or the last program it reported
+        // ended.
+        std::size_t next_ = 0;
+        // Bytes read from the ring that don't make a whole record yet.
+        std::string input_;
+        // Results that can't be written until the earlier ranges are.
+        std::vector<Line> lines_;
+    };
+
+    /**
+     * Starts a process that runs the programs of shard i from
+     * workers_[i].next_ on.
+     */
+    void Spawn(int i) {
+        Worker& worker = workers_[i];
+        Shard shard{worker.next_, stats_.shards_[i].shard_.end_};
+
+        if (!NextProgram(corpus_, shard.begin_, shard.end_)) {
+            worker.finished_ = true;
+            return;
+        }
+
+        pid_t parent = getpid();
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            throw std::runtime_error(std::string{"Can't start worker: "} +
+                                     std::strerror(errno));
+        }
+
+        if (pid == 0) {
+            // Don't unwind into the runner's stack or run its destructors.
+            try {
+                Work(shard, *worker.ring_, parent);
+            } catch (...) {
+                _exit(1);
+            }
+
+            _exit(0);
+        }
+
+        worker.pid_ = pid;
+    }
+
+    /**
+     * The body of a worker process.
+     */
+    void Work(Shard shard, Ring& ring, pid_t parent) {
+        while (auto program = NextProgram(corpus_, shard.begin_, shard.end_)) {
+            auto start = Clock::now();
+            Result result;
+
+            try {
+                result = evaluate_(program->first);
+            } catch (std::exception& ex) {
+                result = {Status::ERROR, ex.what()};
+            }
+
+            RecordHeader header{
+                std::chrono::nanoseconds(start.time_since_epoch()).count(),
+                static_cast<std::uint64_t>(
+                    std::chrono::nanoseconds(Clock::now() - start).count()),
+                program->second,
+                static_cast<std::uint32_t>(result.text_.size()),
+                result.status_};
+
+            if (!ring.Write(&header, sizeof(header), *doorbell_, parent) ||
+                !ring.Write(result.text_.data(), result.text_.size(),
+                            *doorbell_, parent)) {
+                return;
+            }
+
+            shard.begin_ = program->second;
+        }
+
+        ring.Finish(*doorbell_);
+    }
+
+    /**
+     * Reads the records of every worker. Returns whether there were any.
+     */
+    bool Collect() {
+        bool progress = false;
+
+        for (std::size_t i = 0; i < workers_.size(); ++i) {
+            if (!workers_[i].finished_ && Collect(i)) {
+                progress = true;
+            }
+        }
+
+        return progress;
+    }
+
+    bool Collect(std::size_t i) {
+        Worker& worker = workers_[i];
+        // Checked first, so that the read gets everything if it is.
+        bool done = worker.ring_->IsDone();
+
+        if (!worker.ring_->Read(worker.input_)) {
+            worker.finished_ = done;
+            return done;
+        }
+
+        std::size_t pos = 0;
+        RecordHeader header;
+
+        while (worker.input_.size() - pos >= sizeof(header)) {
+            std::memcpy(&header, worker.input_.data() + pos, sizeof(header));
+
+            if (worker.input_.size() - pos - sizeof(header) < header.size_) {
+                break;
+            }
+
+            pos += sizeof(header);
+            std::chrono::nanoseconds elapsed{header.elapsed_ns_};
+            AddResult(i, header.status_,
+                      worker.input_.substr(pos, header.size_),
+                      Clock::time_point{std::chrono::nanoseconds{
+                          header.start_ns_}},
+                      elapsed);
+            pos += header.size_;
+            worker.next_ = header.next_;
+            stats_.shards_[i].busy_time_ += elapsed;
+        }
+
+        worker.input_.erase(0, pos);
+        worker.finished_ = done;
+        return true;
+    }
+
+    void AddResult(std::size_t i, Status status, std::string text,
+                   std::optional<Clock::time_point> start = std::nullopt,
+                   std::chrono::nanoseconds elapsed = {}) {
+        ++stats_.num_results_[static_cast<int>(status)];
+        ++stats_.shards_[i].num_programs_;
+        workers_[i].lines_.push_back(
+            {std::string{kStatusNames[static_cast<int>(status)]} + "\t" +
+                 Sanitize(std::move(text)) + "\n",
+             start, elapsed});
+    }
+
+    /**
+     * Waits for the workers that exited. A worker that died before finishing
+     * its range is replaced by one that carries on after the program it was
+     * running. Returns whether any worker exited.
+     */
+    bool Reap() {
+        bool progress = false;
+        int status;
+        pid_t pid;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto worker = std::find_if(
+                workers_.begin(), workers_.end(),
+                [pid](const Worker& worker) { return worker.pid_ == pid; });
+
+            if (worker == workers_.end()) {
+                continue;
+            }
+
+            progress = true;
+            worker->pid_ = -1;
+            std::size_t i = worker - workers_.begin();
+
+            if (!worker->finished_) {
+                Collect(i);
+            }
+
+            if (worker->finished_) {
+                continue;
+            }
+
+            ++stats_.shards_[i].num_crashes_;
+            worker->input_.clear();
+            worker->ring_->Reset();
+            auto program = NextProgram(corpus_, worker->next_,
+                                       stats_.shards_[i].shard_.end_);
+
+            if (!program) {
+                worker->finished_ = true;
+                continue;
+            }
+
+            AddResult(i, Status::ERROR,
+                      WIFSIGNALED(status)
+                          ? "Worker killed by signal " +
+                                std::to_string(WTERMSIG(status)) + "."
+                          : "Worker exited with status " +
+                                std::to_string(WEXITSTATUS(status)) + ".");
+            worker->next_ = program->second;
+            Spawn(i);
+        }
+
+        return progress;
+    }
+
+    int num_workers_;
+    Evaluate evaluate_;
+    std::string_view corpus_;
+    Stats stats_;
+    std::vector<Worker> workers_;
+    Doorbell* doorbell_ = nullptr;
+    tracing::Tracer* tracer_ = nullptr;
+};
+}  // namespace corpus_runner
@@ -0,0 +1,96 @@
+#include <iostream>
+#include <map>
+
+#include "server.hpp"
+
+/**
+ * Sends the programs given on the command line to a running server (all of
+ * them before reading any response) and prints the results in order.
+ */
+int main(int argc, char* argv[]) {
+    std::string socket_path;
+    server::Request request;
+    std::vector<std::string> programs;
+
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+        std::string arg = argv[arg_idx];
+
+        if (arg.rfind("--", 0) != 0) {
+            programs.push_back(arg);
+            continue;
+        }
+
+        if (++arg_idx >= argc) {
+            std::cerr << "Error: expected a value after " << arg << ".\n";
+            return 1;
+        }
+
+        std::string value = argv[arg_idx];
+
+        try {
+            if (arg == "--socket") {
+                socket_path = value;
+            } else if (arg == "--chapter") {
+                request.chapter_ = value;
+            } else if (arg == "--max-steps") {
+                request.limits_.max_steps_ = std::stoll(value);
+            } else if (arg == "--max-nodes") {
+                request.limits_.max_term_nodes_ = std::stoll(value);
+            } else if (arg == "--timeout-ms") {
+                request.limits_.timeout_ms_ = std::stoll(value);
+            } else {
+                std::cerr << "Error: unknown option " << arg << ".\n";
+                return 1;
+            }
+        } catch (std::exception&) {
+            std::cerr << "Error: invalid value " << value << " for " << arg
+                      << ".\n";
+            return 1;
+        }
+    }
+
+    if (socket_path.empty() || request.chapter_.empty() || programs.empty()) {
+        std::cerr << "Usage: " << argv[0]
+                  << " --socket <path> --chapter <chapter> [--max-steps <n>]"
+                     " [--max-nodes <n>] [--timeout-ms <n>] <program>...\n";
+        return 1;
+    }
+
+    auto connection = server::Connection::Connect(socket_path);
+
+    for (std::size_t i = 0; i < programs.size(); ++i) {
+        request.id_ = i;
+        request.program_ = programs[i];
+        connection->Write(server::FormatRequest(request));
+    }
+
+    std::map<std::uint64_t, server::Response> responses;
+    std::string line;
+
+    while (responses.size() < programs.size() && connection->ReadLine(line)) {
+        auto response = server::ParseResponse(line);
+        responses[response.id_] = response;
+    }
+
+    int status = 0;
+
+    for (std::size_t i = 0; i < programs.size(); ++i) {
+        std::cout << "   " << programs[i] << "\n";
+        auto response = responses.find(i);
+
+        if (response == responses.end()) {
+            std::cout << "=> (no response)\n";
+            status = 1;
+            continue;
+        }
+
+        std::cout << "=> " << response->second.result_ << " ("
+                  << response->second.elapsed_.count() << " us)\n";
+
+        if (response->second.status_ != server::Status::OK) {
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "server.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string socket_path_;
+    std::string chapter_;
+    // Requests cycle through the programs.
+    std::vector<std::string> programs_;
+    server::Limits limits_;
+    int num_connections_ = 4;
+    int num_requests_ = 10000;
+    // The number of requests each connection keeps in flight.
+    int depth_ = 16;
+};
+
+struct ConnectionStats {
+    // The latencies of the requests for each program.
+    std::vector<std::vector<Clock::duration>> latencies_;
+    std::chrono::microseconds eval_time_{0};
+    int num_errors_ = 0;
+};
+
+/**
+ * Sends num_requests requests over one connection, keeping options.depth_ of
+ * them in flight, and records the latency of each.
+ */
+ConnectionStats Drive(const Options& options, int num_requests) {
+    ConnectionStats stats;
+    stats.latencies_.resize(options.programs_.size());
+    auto connection = server::Connection::Connect(options.socket_path_);
+    std::vector<Clock::time_point> send_times(num_requests);
+    server::Request request{0, options.chapter_, options.limits_, {}};
+    int num_sent = 0;
+
+    auto send_next = [&] {
+        request.id_ = num_sent;
+        request.program_ =
+            options.programs_[num_sent % options.programs_.size()];
+        send_times[num_sent] = Clock::now();
+        connection->Write(server::FormatRequest(request));
+        ++num_sent;
+    };
+
+    while (num_sent < std::min(options.depth_, num_requests)) {
+        send_next();
+    }
+
+    std::string line;
+
+    for (int num_received = 0;
+         num_received < num_requests && connection->ReadLine(line);
+         ++num_received) {
+        auto response = server::ParseResponse(line);
+        stats.latencies_[response.id_ % options.programs_.size()].push_back(
+            Clock::now() - send_times[response.id_]);
+        stats.eval_time_ += response.elapsed_;
+
+        if (response.status_ != server::Status::OK) {
+            ++stats.num_errors_;
+        }
+
+        if (num_sent < num_requests) {
+            send_next();
+        }
+    }
+
+    return stats;
+}
+
+double Percentile(const std::vector<Clock::duration>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    auto idx = static_cast<std::size_t>(p * (sorted.size() - 1));
+    return std::chrono::duration<double, std::micro>(sorted[idx]).count();
+}
+
+void PrintLatencies(std::vector<Clock::duration>& latencies) {
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Latency p50:     " << Percentile(latencies, 0.5) << " us\n"
+              << "Latency p99:     " << Percentile(latencies, 0.99) << " us\n"
+              << "Latency max:     " << Percentile(latencies, 1) << " us\n";
+}
+
+}  // namespace
+
+/**
+ * Measures the throughput and latency of a running server by sending it the
+ * given programs in turn over several connections at once. With several
+ * programs, e.g. a long and a short one, it also reports the latencies of
+ * each, which shows how well the server's scheduler keeps the long ones from
+ * holding up the short ones.
+ */
+int main(int argc, char* argv[]) {
+    Options options;
+
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+        std::string arg = argv[arg_idx];
+
+        if (arg.rfind("--", 0) != 0) {
+            options.programs_.push_back(arg);
+            continue;
+        }
+
+        if (++arg_idx >= argc) {
+            std::cerr << "Error: expected a value after " << arg << ".\n";
+            return 1;
+        }
+
+        std::string value = argv[arg_idx];
+
+        try {
+            if (arg == "--socket") {
+                options.socket_path_ = value;
+            } else if (arg == "--chapter") {
+                options.chapter_ = value;
+            } else if (arg == "--max-steps") {
+                options.limits_.max_steps_ = std::stoll(value);
+            } else if (arg == "--max-nodes") {
+                options.limits_.max_term_nodes_ = std::stoll(value);
+            } else if (arg == "--timeout-ms") {
+                options.limits_.timeout_ms_ = std::stoll(value);
+            } else if (arg == "--connections") {
+                options.num_connections_ = std::stoi(value);
+            } else if (arg == "--requests") {
+                options.num_requests_ = std::stoi(value);
+            } else if (arg == "--depth") {
+                options.depth_ = std::stoi(value);
+            } else {
+                std::cerr << "Error: unknown option " << arg << ".\n";
+                return 1;
+            }
+        } catch (std::exception&) {
+            std::cerr << "Error: invalid value " << value << " for " << arg
+                      << ".\n";
+            return 1;
+        }
+    }
+
+    if (options.socket_path_.empty() || options.chapter_.empty() ||
+        options.programs_.empty() || options.num_connections_ < 1 ||
+        options.depth_ < 1) {
+        std::cerr << "Usage: " << argv[0]
+                  << " --socket <path> --chapter <chapter> [--max-steps <n>]"
+                     " [--max-nodes <n>] [--timeout-ms <n>] [--connections <n>]"
+                     " [--requests <n>] [--depth <n>] <program>...\n";
+        return 1;
+    }
+
+    std::vector<ConnectionStats> stats(options.num_connections_);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+
+    for (int i = 0; i < options.num_connections_; ++i) {
+        // Spread the requests evenly over the connections.
+        int num_requests =
+            options.num_requests_ / options.num_connections_ +
+            (i < options.num_requests_ % options.num_connections_);
+        threads.emplace_back([&options, &stats, i, num_requests] {
+            stats[i] = Drive(options, num_requests);
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> duration = Clock::now() - start;
+    std::vector<std::vector<Clock::duration>> program_latencies(
+        options.programs_.size());
+    std::vector<Clock::duration> latencies;
+    std::chrono::microseconds eval_time{0};
+    int num_errors = 0;
+
+    for (const auto& connection_stats : stats) {
+        for (std::size_t i = 0; i < program_latencies.size(); ++i) {
+            const auto& connection_latencies = connection_stats.latencies_[i];
+            program_latencies[i].insert(program_latencies[i].end(),
+                                        connection_latencies.begin(),
+                                        connection_latencies.end());
+            latencies.insert(latencies.end(), connection_latencies.begin(),
+                             connection_latencies.end());
+        }
+
+        eval_time += connection_stats.eval_time_;
+        num_errors += connection_stats.num_errors_;
+    }
+
+    std::size_t num_responses = latencies.size();
+
+    std::cout << "Requests:        " << num_responses << " (" << num_errors
+              << " failed)\n"
+              << "Throughput:      " << num_responses / duration.count()
+              << " requests/s\n";
+    PrintLatencies(latencies);
+    std::cout << "Mean eval time:  "
+              << (num_responses ? eval_time.count() / num_responses : 0)
+              << " us\n";
+
+    if (program_latencies.size() > 1) {
+        for (std::size_t i = 0; i < program_latencies.size(); ++i) {
+            std::cout << "\nProgram " << i + 1 << ": "
+                      << options.programs_[i] << "\n";
+            PrintLatencies(program_latencies[i]);
+        }
+    }
+
+    return num_errors == 0 ? 0 : 1;
+}
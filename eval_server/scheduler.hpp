@@ -0,0 +1,133 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace server {
+/**
+ * Interleaves many long-running tasks on a few threads. A task runs in slices:
+ * it is called with the number of steps it may take and returns true once it
+ * is done, otherwise it goes back to the queue. So a few long evaluations
+ * can't starve short ones the way they would with a thread per evaluation or
+ * a FIFO thread pool.
+ */
+class Scheduler {
+   public:
+    enum class Policy {
+        // Round robin: every pending task gets a slice in turn.
+        FAIR,
+        // The task that has had the fewest slices so far runs next. That
+        // approximates shortest-remaining-first without knowing how long
+        // tasks take: new and short tasks overtake the long ones.
+        LEAST_ATTAINED
+    };
+
+    using Task = std::function<bool(long long fuel)>;
+
+    Scheduler(int num_threads, Policy policy, long long quantum)
+        : policy_(policy), quantum_(quantum) {
+        for (int i = 0; i < num_threads; ++i) {
+            threads_.emplace_back([this] { Work(); });
+        }
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * Runs the submitted tasks to completion and joins the threads.
+     */
+    ~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            stopping_ = true;
+        }
+
+        cv_.notify_all();
+
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Submit(Task task) {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            Push({std::move(task), 0, 0});
+        }
+
+        cv_.notify_one();
+    }
+
+   private:
+    struct Entry {
+        Task task_;
+        // The number of slices the task has run for so far.
+        long long num_slices_;
+        // Orders entries of equal priority first in, first out.
+        std::uint64_t sequence_;
+    };
+
+    struct LaterFirst {
+        bool operator()(const Entry& lhs, const Entry& rhs) const {
+            return std::pair{lhs.num_slices_, lhs.sequence_} >
+                   std::pair{rhs.num_slices_, rhs.sequence_};
+        }
+    };
+
+    /**
+     * Queues entry behind the others of its priority. Requires mutex_.
+     */
+    void Push(Entry entry) {
+        entry.sequence_ = next_sequence_++;
+
+        if (policy_ == Policy::FAIR) {
+            // Only the arrival order counts.
+            entry.num_slices_ = 0;
+        }
+
+        queue_.push(std::move(entry));
+    }
+
+    void Work() {
+        while (true) {
+            Entry entry;
+
+            {
+                std::unique_lock<std::mutex> lock{mutex_};
+                cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+
+                if (queue_.empty()) {
+                    return;
+                }
+
+                // priority_queue::top() is const, but the entry is popped
+                // right away.
+                entry = std::move(const_cast<Entry&>(queue_.top()));
+                queue_.pop();
+            }
+
+            if (!entry.task_(quantum_)) {
+                ++entry.num_slices_;
+                std::lock_guard<std::mutex> lock{mutex_};
+                Push(std::move(entry));
+            }
+        }
+    }
+
+    Policy policy_;
+    long long quantum_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Entry, std::vector<Entry>, LaterFirst> queue_;
+    std::uint64_t next_sequence_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+}  // namespace server
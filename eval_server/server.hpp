@@ -0,0 +1,530 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../instrumentation/instrumentation.hpp"
+#include "../result_cache/result_cache.hpp"
+#include "scheduler.hpp"
+
+/**
+ * A daemon that evaluates programs sent over a Unix domain socket, so that
+ * evaluating a small program doesn't cost a process start. Every chapter
+ * defines its own namespaces, so each chapter builds its own server from
+ * server.cpp; this header holds the parts that don't depend on the chapter.
+ *
+ * The protocol is line based. A request is
+ *
+ *     <id> \t <chapter> \t <max steps> \t <max term nodes> \t <timeout ms> \t
+ *     <program> \n
+ *
+ * where a limit of 0 means unlimited, and is answered by
+ *
+ *     <id> \t <ok|error|budget> \t <evaluation time in us> \t <result> \n
+ *
+ * A client may send any number of requests before reading the responses.
+ * Requests are evaluated concurrently in slices of a few thousand steps (see
+ * Scheduler), so that long programs don't hold up short ones. Responses come
+ * back in completion order and are matched to requests by id.
+ */
+namespace server {
+struct Limits {
+    long long max_steps_ = 0;
+    long long max_term_nodes_ = 0;
+    long long timeout_ms_ = 0;
+};
+
+struct Request {
+    std::uint64_t id_ = 0;
+    std::string chapter_;
+    Limits limits_;
+    std::string program_;
+};
+
+enum class Status { OK, ERROR, BUDGET_EXCEEDED };
+
+struct Response {
+    std::uint64_t id_ = 0;
+    Status status_ = Status::OK;
+    std::chrono::microseconds elapsed_{0};
+    std::string result_;
+};
+
+namespace {
+const char* kStatusNames[] = {"ok", "error", "budget"};
+
+/**
+ * Replaces the characters that delimit fields and messages.
+ */
+std::string Sanitize(std::string text) {
+    std::replace_if(
+        text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n'; },
+        ' ');
+    return text;
+}
+
+std::vector<std::string> SplitFields(const std::string& line, int num_fields) {
+    std::vector<std::string> fields;
+    std::size_t start = 0;
+
+    // The last field takes the rest of the line.
+    for (int i = 0; i < num_fields - 1; ++i) {
+        std::size_t end = line.find('\t', start);
+
+        if (end == std::string::npos) {
+            throw std::invalid_argument("Malformed message: " + line);
+        }
+
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+
+    fields.push_back(line.substr(start));
+    return fields;
+}
+}  // namespace
+
+std::string FormatRequest(const Request& request) {
+    std::ostringstream ss;
+    ss << request.id_ << "\t" << Sanitize(request.chapter_) << "\t"
+       << request.limits_.max_steps_ << "\t"
+       << request.limits_.max_term_nodes_ << "\t"
+       << request.limits_.timeout_ms_ << "\t" << Sanitize(request.program_)
+       << "\n";
+    return ss.str();
+}
+
+/**
+ * Parses a request line without its trailing newline. Throws
+ * std::invalid_argument if line isn't a request.
+ */
+Request ParseRequest(const std::string& line) {
+    auto fields = SplitFields(line, 6);
+    Request request;
+    request.id_ = std::stoull(fields[0]);
+    request.chapter_ = fields[1];
+    request.limits_ = {std::stoll(fields[2]), std::stoll(fields[3]),
+                       std::stoll(fields[4])};
+    request.program_ = fields[5];
+    return request;
+}
+
+std::string FormatResponse(const Response& response) {
+    std::ostringstream ss;
+    ss << response.id_ << "\t"
+       << kStatusNames[static_cast<int>(response.status_)] << "\t"
+       << response.elapsed_.count() << "\t" << Sanitize(response.result_)
+       << "\n";
+    return ss.str();
+}
+
+/**
+ * Parses a response line without its trailing newline. Throws
+ * std::invalid_argument if line isn't a response.
+ */
+Response ParseResponse(const std::string& line) {
+    auto fields = SplitFields(line, 4);
+    Response response;
+    response.id_ = std::stoull(fields[0]);
+    auto status = std::find(std::begin(kStatusNames), std::end(kStatusNames),
+                            fields[1]);
+
+    if (status == std::end(kStatusNames)) {
+        throw std::invalid_argument("Unknown status: " + fields[1]);
+    }
+
+    response.status_ =
+        static_cast<Status>(std::distance(std::begin(kStatusNames), status));
+    response.elapsed_ = std::chrono::microseconds(std::stoll(fields[2]));
+    response.result_ = fields[3];
+    return response;
+}
+
+/**
+ * A connected stream socket that reads newline-terminated messages and writes
+ * whole messages. Closes the socket when destroyed.
+ */
+class Connection {
+   public:
+    explicit Connection(int fd) : fd_(fd) {}
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    ~Connection() { close(fd_); }
+
+    /**
+     * Connects to the server listening at socket_path. Throws
+     * std::runtime_error on failure.
+     */
+    static std::unique_ptr<Connection> Connect(const std::string& socket_path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = MakeAddress(socket_path);
+
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address),
+                              sizeof(address)) < 0) {
+            std::string error = std::strerror(errno);
+
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            throw std::runtime_error("Can't connect to " + socket_path + ": " +
+                                     error);
+        }
+
+        return std::make_unique<Connection>(fd);
+    }
+
+    /**
+     * Reads the next line into line (without the newline) and returns false
+     * if the peer closed the connection first. Must only be called by one
+     * thread at a time.
+     */
+    bool ReadLine(std::string& line) {
+        while (true) {
+            std::size_t end = buffer_.find('\n', read_pos_);
+
+            if (end != std::string::npos) {
+                line.assign(buffer_, read_pos_, end - read_pos_);
+                read_pos_ = end + 1;
+                return true;
+            }
+
+            buffer_.erase(0, read_pos_);
+            read_pos_ = 0;
+            char chunk[64 * 1024];
+            ssize_t num_read = read(fd_, chunk, sizeof(chunk));
+
+            if (num_read <= 0) {
+                return false;
+            }
+
+            buffer_.append(chunk, num_read);
+        }
+    }
+
+    /**
+     * Writes message as a whole. Safe to call from several threads.
+     */
+    bool Write(const std::string& message) {
+        std::lock_guard<std::mutex> lock{write_mutex_};
+
+        for (std::size_t written = 0; written < message.size();) {
+            ssize_t num_written = send(fd_, message.data() + written,
+                                       message.size() - written, kSendFlags);
+
+            if (num_written <= 0) {
+                return false;
+            }
+
+            written += num_written;
+        }
+
+        return true;
+    }
+
+    static sockaddr_un MakeAddress(const std::string& socket_path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path too long: " +
+                                        socket_path);
+        }
+
+        std::strcpy(address.sun_path, socket_path.c_str());
+        return address;
+    }
+
+   private:
+#ifdef MSG_NOSIGNAL
+    // Don't raise SIGPIPE when the peer went away.
+    static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+    static constexpr int kSendFlags = 0;
+#endif
+
+    int fd_;
+    std::string buffer_;
+    std::size_t read_pos_ = 0;
+    std::mutex write_mutex_;
+};
+
+/**
+ * The outcome of a request: the printed result of the program or why it has
+ * none.
+ */
+using Outcome = std::pair<Status, std::string>;
+
+/**
+ * The evaluation of one request, which runs in slices so that the scheduler
+ * can interleave it with the others.
+ */
+class Job {
+   public:
+    virtual ~Job() = default;
+
+    /**
+     * Performs at most fuel reduction steps and returns the outcome once the
+     * evaluation is done.
+     */
+    virtual std::optional<Outcome> Resume(long long fuel) = 0;
+};
+
+/**
+ * Serves the requests for one chapter. JobFactory is called from the
+ * scheduler's threads as
+ *
+ *     std::unique_ptr<Job> start(const Request&)
+ *
+ * An exception that it or the job lets escape is reported as Status::ERROR.
+ */
+template <typename JobFactory>
+class Server {
+   public:
+    Server(std::string chapter, int num_threads, Scheduler::Policy policy,
+           long long quantum, JobFactory start)
+        : chapter_(std::move(chapter)),
+          start_(std::move(start)),
+          scheduler_(num_threads, policy, quantum) {}
+
+    /**
+     * Answers requests from cache if it has their result and stores the
+     * results of the others there. engine_version is the chapter's
+     * kEngineVersion. Must be called before Run().
+     */
+    void SetCache(result_cache::ResultCache& cache, int engine_version) {
+        cache_ = &cache;
+        engine_ = chapter_ + "/" + std::to_string(engine_version);
+    }
+
+    /**
+     * Records the start and the slices of every request on a track per
+     * scheduler thread and writes them to trace_path whenever the last client
+     * disconnects, so that the file covers all requests served so far. Must
+     * be called before Run().
+     */
+    void SetTracer(tracing::Tracer& tracer, std::string trace_path) {
+        tracer_ = &tracer;
+        trace_path_ = std::move(trace_path);
+    }
+
+    /**
+     * Listens at socket_path (replacing a stale socket file) and serves
+     * connections until accepting fails. Throws std::runtime_error if the
+     * socket can't be set up.
+     */
+    void Run(const std::string& socket_path) {
+        sockaddr_un address = Connection::MakeAddress(socket_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socket_path.c_str());
+
+        if (fd < 0 ||
+            bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) <
+                0 ||
+            listen(fd, SOMAXCONN) < 0) {
+            throw std::runtime_error("Can't listen on " + socket_path + ": " +
+                                     std::strerror(errno));
+        }
+
+        while (true) {
+            int client_fd = accept(fd, nullptr, nullptr);
+
+            if (client_fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                break;
+            }
+
+            // Closed once the client hung up and its last request is answered.
+            ++num_connections_;
+            std::shared_ptr<Connection> connection{
+                new Connection(client_fd), [this](Connection* connection) {
+                    delete connection;
+                    Disconnected();
+                }};
+            // Each connection gets a thread that reads its requests; the
+            // scheduler evaluates them.
+            std::thread{[this, connection] { Serve(connection); }}.detach();
+        }
+
+        close(fd);
+    }
+
+   private:
+    struct Pending {
+        Request request_;
+        // Holds on to the connection, which is closed once the client hung
+        // up and its last request is answered.
+        std::shared_ptr<Connection> connection_;
+        // Created by the first slice, so that parsing doesn't hold up the
+        // thread reading the connection.
+        std::unique_ptr<Job> job_;
+        // The time spent in slices so far, without the time spent waiting.
+        std::chrono::microseconds elapsed_{0};
+        // Set if there is a cache, which didn't have the result.
+        std::string cache_key_;
+    };
+
+    void Serve(std::shared_ptr<Connection> connection) {
+        std::string line;
+
+        while (connection->ReadLine(line)) {
+            Request request;
+
+            try {
+                request = ParseRequest(line);
+            } catch (std::exception& ex) {
+                connection->Write(
+                    FormatResponse({0, Status::ERROR, {}, ex.what()}));
+                continue;
+            }
+
+            // Scheduler::Task must be copyable.
+            auto pending = std::make_shared<Pending>(
+                Pending{std::move(request), connection, nullptr, {}});
+            scheduler_.Submit([this, pending](long long fuel) {
+                return RunSlice(*pending, fuel);
+            });
+        }
+    }
+
+    /**
+     * Runs the next slice of pending and answers its request once it is
+     * done. Returns whether it is.
+     */
+    bool RunSlice(Pending& pending, long long fuel) {
+        const Request& request = pending.request_;
+        std::optional<Outcome> outcome;
+        auto start = std::chrono::steady_clock::now();
+
+        if (request.chapter_ != chapter_) {
+            outcome = Outcome{Status::ERROR,
+                              "This server evaluates " + chapter_ +
+                                  " programs, not " + request.chapter_ + "."};
+        } else {
+            try {
+                if (!pending.job_) {
+                    outcome = FindCached(pending);
+                }
+
+                if (!outcome) {
+                    tracing::Tracer::Buffer* trace = GetTrace();
+
+                    if (!pending.job_) {
+                        pending.job_ = tracing::Record(
+                            trace, "parse", request.id_,
+                            [&] { return start_(request); });
+                    }
+
+                    outcome = tracing::Record(trace, "eval", request.id_, [&] {
+                        return pending.job_->Resume(fuel);
+                    });
+
+                    if (outcome && outcome->first == Status::OK &&
+                        !pending.cache_key_.empty()) {
+                        cache_->Insert(pending.cache_key_, outcome->second);
+                    }
+                }
+            } catch (std::exception& ex) {
+                outcome = Outcome{Status::ERROR, ex.what()};
+            }
+        }
+
+        pending.elapsed_ +=
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start);
+
+        if (!outcome) {
+            return false;
+        }
+
+        // The job may hold a lot of memory; don't wait for the task to be
+        // destroyed.
+        pending.job_.reset();
+        pending.connection_->Write(
+            FormatResponse({request.id_, outcome->first, pending.elapsed_,
+                            std::move(outcome->second)}));
+        return true;
+    }
+
+    /**
+     * Returns the trace buffer of the calling scheduler thread, or null if
+     * tracing is off.
+     */
+    tracing::Tracer::Buffer* GetTrace() {
+        if (!tracer_) {
+            return nullptr;
+        }
+
+        thread_local tracing::Tracer::Buffer* trace =
+            &tracer_->GetBuffer("scheduler");
+        return trace;
+    }
+
+    void Disconnected() {
+        if (--num_connections_ > 0 || !tracer_) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock{trace_mutex_};
+        std::ofstream trace_file{trace_path_};
+        tracer_->Write(trace_file);
+    }
+
+    /**
+     * Looks up the result of pending's program before it starts.
+     */
+    std::optional<Outcome> FindCached(Pending& pending) {
+        if (!cache_) {
+            return std::nullopt;
+        }
+
+        const Limits& limits = pending.request_.limits_;
+        std::string key = result_cache::MakeKey(
+            engine_,
+            "server max-steps=" + std::to_string(limits.max_steps_) +
+                " max-nodes=" + std::to_string(limits.max_term_nodes_),
+            pending.request_.program_);
+
+        if (auto result = cache_->Find(key)) {
+            return Outcome{Status::OK, std::move(*result)};
+        }
+
+        pending.cache_key_ = std::move(key);
+        return std::nullopt;
+    }
+
+    std::string chapter_;
+    JobFactory start_;
+    result_cache::ResultCache* cache_ = nullptr;
+    std::string engine_;
+    tracing::Tracer* tracer_ = nullptr;
+    std::string trace_path_;
+    // Serializes writing the trace file.
+    std::mutex trace_mutex_;
+    std::atomic<int> num_connections_{0};
+    Scheduler scheduler_;
+};
+}  // namespace server
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * What the chapters' pipelines use to observe and bound themselves while they
+ * run. Every chapter defines its own namespaces, but none of this depends on
+ * the language, so it lives here once and the batch tools (corpus_runner/,
+ * eval_server/) can use it too.
+ */
+namespace allocation {
+/**
+ * The phases of the pipeline that heap allocations are attributed to.
+ */
+enum class Phase {
+    OTHER,
+    LEXING,
+    PARSING,
+    TYPE_CHECKING,
+    EVALUATION,
+    NUM_PHASES
+};
+
+/**
+ * Whether the program was built with -DTRACK_ALLOCATIONS, which replaces the
+ * global operator new and operator delete with versions that report to
+ * Tracker.
+ */
+#ifdef TRACK_ALLOCATIONS
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+struct Stats {
+    long long count_ = 0;
+    long long bytes_ = 0;
+    // The largest number of bytes allocated and not yet freed (by any phase)
+    // while this phase was running.
+    long long peak_live_bytes_ = 0;
+};
+
+/**
+ * Attributes the heap allocations of the calling thread to the Phase that is
+ * current when they happen. Phases are entered with PhaseScope; everything
+ * outside of one counts as Phase::OTHER.
+ */
+class Tracker {
+   public:
+    static void RecordAllocation(std::size_t size) {
+        auto& state = GetState();
+        state.live_bytes_ += size;
+        auto& stats = state.stats_[static_cast<int>(state.phase_)];
+        ++stats.count_;
+        stats.bytes_ += size;
+        stats.peak_live_bytes_ =
+            std::max(stats.peak_live_bytes_, state.live_bytes_);
+    }
+
+    static void RecordDeallocation(std::size_t size) {
+        GetState().live_bytes_ -= size;
+    }
+
+    static const Stats& GetStats(Phase phase) {
+        return GetState().stats_[static_cast<int>(phase)];
+    }
+
+    /**
+     * Prints the statistics of every phase as a table.
+     */
+    static void Print(std::ostream& out) {
+        const char* names[] = {"other", "lexing", "parsing", "type checking",
+                               "evaluation"};
+        out << std::left << std::setw(16) << "Phase" << std::setw(16)
+            << "Allocations" << std::setw(16) << "Bytes"
+            << "Peak live bytes\n";
+
+        for (int phase = 0; phase < static_cast<int>(Phase::NUM_PHASES);
+             ++phase) {
+            const auto& stats = GetState().stats_[phase];
+            out << std::setw(16) << names[phase] << std::setw(16)
+                << stats.count_ << std::setw(16) << stats.bytes_
+                << stats.peak_live_bytes_ << "\n";
+        }
+    }
+
+   private:
+    friend class PhaseScope;
+
+    struct State {
+        Phase phase_ = Phase::OTHER;
+        long long live_bytes_ = 0;
+        Stats stats_[static_cast<int>(Phase::NUM_PHASES)];
+    };
+
+    static State& GetState() {
+        // Trivially destructible, so using it never allocates.
+        static thread_local State state;
+        return state;
+    }
+};
+
+/**
+ * Makes phase the current phase of the calling thread until destroyed. Costs
+ * nothing unless allocation tracking is enabled.
+ */
+class PhaseScope {
+   public:
+    explicit PhaseScope(Phase phase) {
+        if constexpr (kEnabled) {
+            auto& state = Tracker::GetState();
+            previous_ = state.phase_;
+            state.phase_ = phase;
+            auto& stats = state.stats_[static_cast<int>(phase)];
+            stats.peak_live_bytes_ =
+                std::max(stats.peak_live_bytes_, state.live_bytes_);
+        }
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+    ~PhaseScope() {
+        if constexpr (kEnabled) {
+            Tracker::GetState().phase_ = previous_;
+        }
+    }
+
+   private:
+    Phase previous_ = Phase::OTHER;
+};
+}  // namespace allocation
+
+#ifdef TRACK_ALLOCATIONS
+namespace allocation {
+// Every block is prefixed with its size so that operator delete can account
+// for it. The prefix is as large as the strictest fundamental alignment so the
+// memory handed out stays suitably aligned.
+constexpr std::size_t kSizePrefix = alignof(std::max_align_t);
+}  // namespace allocation
+
+// operator new[] and operator delete[] forward to these by default.
+void* operator new(std::size_t size) {
+    void* block = std::malloc(size + allocation::kSizePrefix);
+
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    *static_cast<std::size_t*>(block) = size;
+    allocation::Tracker::RecordAllocation(size);
+    return static_cast<char*>(block) + allocation::kSizePrefix;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    void* block = static_cast<char*>(ptr) - allocation::kSizePrefix;
+    allocation::Tracker::RecordDeallocation(*static_cast<std::size_t*>(block));
+    std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+#endif
+
+namespace tracing {
+/**
+ * Records how long the phases of the pipeline (parsing, type checking,
+ * evaluation) take for each program and writes them as Chrome trace-event
+ * JSON, which Perfetto and chrome://tracing display as a timeline with one
+ * track per thread.
+ *
+ * Every thread records into its own Buffer, so recording a phase takes two
+ * clock reads and an append to a vector under a lock no other thread takes
+ * except Write(); the events are only formatted once, by Write().
+ */
+class Tracer {
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        const char* phase_;
+        long long program_;
+        Clock::time_point start_;
+        Clock::duration duration_;
+    };
+
+   public:
+    /**
+     * The events recorded by a single thread. A Buffer must only be used by
+     * the thread that obtained it from GetBuffer().
+     */
+    class Buffer {
+       public:
+        Buffer(int thread, const char* role) : thread_(thread), role_(role) {}
+
+        /**
+         * Runs phase() and records it as a span called name for the program
+         * with the given index. The span is recorded even if phase() throws.
+         */
+        template <typename Phase>
+        decltype(auto) Record(const char* name, long long program,
+                              Phase phase) {
+            Span span{*this, name, program};
+            return phase();
+        }
+
+        /**
+         * Records a span called name for the program with the given index
+         * that was measured elsewhere, e.g. by another process.
+         */
+        void Add(const char* name, long long program, Clock::time_point start,
+                 Clock::duration duration) {
+            std::lock_guard<std::mutex> lock{mutex_};
+            events_.push_back({name, program, start, duration});
+        }
+
+       private:
+        friend class Tracer;
+
+        class Span {
+           public:
+            Span(Buffer& buffer, const char* name, long long program)
+                : buffer_(buffer),
+                  name_(name),
+                  program_(program),
+                  start_(Clock::now()) {}
+
+            ~Span() {
+                buffer_.Add(name_, program_, start_, Clock::now() - start_);
+            }
+
+           private:
+            Buffer& buffer_;
+            const char* name_;
+            long long program_;
+            Clock::time_point start_;
+        };
+
+        int thread_;
+        // Names the track of the thread, e.g. "worker".
+        const char* role_;
+        // Only contended while Write() runs.
+        std::mutex mutex_;
+        std::vector<Event> events_;
+    };
+
+    /**
+     * Returns a new Buffer for the calling thread, whose track is called role
+     * followed by a number. Only this function and Write() synchronize with
+     * other threads.
+     */
+    Buffer& GetBuffer(const char* role = "worker") {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return buffers_.emplace_back(static_cast<int>(buffers_.size()), role);
+    }
+
+    /**
+     * Writes all events recorded so far as a Chrome trace-event JSON object.
+     * Other threads may go on recording meanwhile.
+     */
+    void Write(std::ostream& out) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        long pid = getpid();
+        const char* separator = "\n";
+        out << "{\"traceEvents\":[";
+
+        for (auto& buffer : buffers_) {
+            out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+                << "\"pid\":" << pid << ",\"tid\":" << buffer.thread_
+                << ",\"args\":{\"name\":\"" << buffer.role_ << " "
+                << buffer.thread_ << "\"}}";
+            separator = ",\n";
+            std::lock_guard<std::mutex> buffer_lock{buffer.mutex_};
+
+            for (const auto& event : buffer.events_) {
+                out << separator << "{\"name\":\"" << event.phase_
+                    << "\",\"cat\":\"pipeline\",\"ph\":\"X\",\"ts\":";
+                WriteMicroseconds(out, event.start_ - start_);
+                out << ",\"dur\":";
+                WriteMicroseconds(out, event.duration_);
+                out << ",\"pid\":" << pid << ",\"tid\":" << buffer.thread_
+                    << ",\"args\":{\"program\":" << event.program_ << "}}";
+            }
+        }
+
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+   private:
+    static void WriteMicroseconds(std::ostream& out,
+                                  Clock::duration duration) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                      .count();
+        // The trace-event format expects microseconds; keep the nanoseconds
+        // as three fixed decimals rather than going through a double.
+        out << ns / 1000 << "." << static_cast<char>('0' + ns / 100 % 10)
+            << static_cast<char>('0' + ns / 10 % 10)
+            << static_cast<char>('0' + ns % 10);
+    }
+
+    std::mutex mutex_;
+    // A deque keeps the Buffers handed out by GetBuffer() in place as more
+    // threads register.
+    std::deque<Buffer> buffers_;
+    Clock::time_point start_ = Clock::now();
+};
+
+/**
+ * Runs phase() and records it in buffer like Buffer::Record(), unless buffer
+ * is null because tracing is off.
+ */
+template <typename Phase>
+decltype(auto) Record(Tracer::Buffer* buffer, const char* name,
+                      long long program, Phase phase) {
+    if (buffer == nullptr) {
+        return phase();
+    }
+
+    return buffer->Record(name, program, phase);
+}
+}  // namespace tracing
+
+namespace budget {
+/**
+ * Limits on a single evaluation. The defaults don't limit anything.
+ */
+struct Budget {
+    // The maximum number of reduction steps.
+    long long max_steps_ = std::numeric_limits<long long>::max();
+    // The maximum number of nodes the evaluated term may grow to.
+    std::size_t max_term_nodes_ = std::numeric_limits<std::size_t>::max();
+    // The maximum wall-clock time evaluation may take.
+    std::chrono::steady_clock::duration max_time_ =
+        std::chrono::steady_clock::duration::max();
+};
+
+/**
+ * Thrown by Interpret() when evaluation goes over its Budget. The program is
+ * left partially evaluated; the exception records how far evaluation got.
+ */
+class BudgetExceeded : public std::runtime_error {
+   public:
+    enum class Limit { STEPS, TERM_NODES, TIME };
+
+    BudgetExceeded(Limit limit, long long steps, std::size_t term_nodes,
+                   std::chrono::steady_clock::duration elapsed)
+        : std::runtime_error(Describe(limit, steps, term_nodes, elapsed)),
+          limit_(limit),
+          steps_(steps),
+          term_nodes_(term_nodes),
+          elapsed_(elapsed) {}
+
+    Limit GetLimit() const { return limit_; }
+
+    long long GetSteps() const { return steps_; }
+
+    std::size_t GetTermNodes() const { return term_nodes_; }
+
+    std::chrono::steady_clock::duration GetElapsed() const { return elapsed_; }
+
+   private:
+    static std::string Describe(Limit limit, long long steps,
+                                std::size_t term_nodes,
+                                std::chrono::steady_clock::duration elapsed) {
+        const char* names[] = {"step", "term size", "time"};
+        std::ostringstream ss;
+        ss << "Evaluation exceeded its " << names[static_cast<int>(limit)]
+           << " budget after " << steps << " steps (" << term_nodes
+           << " term nodes, "
+           << std::chrono::duration<double, std::milli>(elapsed).count()
+           << " ms).";
+        return ss.str();
+    }
+
+    Limit limit_;
+    long long steps_;
+    std::size_t term_nodes_;
+    std::chrono::steady_clock::duration elapsed_;
+};
+
+/**
+ * Counts the live objects of type T of each thread. T derives from Counted<T>,
+ * an empty base that doesn't make it any larger, so every constructor and
+ * destructor of T (including the implicit ones) updates the count.
+ */
+template <typename T>
+class Counted {
+   public:
+    /**
+     * The number of objects of type T constructed minus the number destroyed
+     * by the calling thread. An object may be destroyed by another thread
+     * than the one that constructed it, so only the difference between two
+     * calls on the same thread means anything.
+     */
+    static long long NumLive() { return num_live_; }
+
+   protected:
+    Counted() noexcept { ++num_live_; }
+    Counted(const Counted&) noexcept { ++num_live_; }
+    Counted(Counted&&) noexcept { ++num_live_; }
+    Counted& operator=(const Counted&) noexcept { return *this; }
+    Counted& operator=(Counted&&) noexcept { return *this; }
+    ~Counted() { --num_live_; }
+
+   private:
+    inline static thread_local long long num_live_ = 0;
+};
+
+/**
+ * Enforces a Budget during one evaluation of a term made of Nodes, which
+ * derive from Counted<Node>. The term is measured once when evaluation
+ * starts; from then on its size is a running count that every node
+ * constructed (e.g. by a substitution copying a term) or destroyed (by a
+ * reduction dropping one) updates. So Step(), which is called after every
+ * reduction, checks both the steps and the size of the term at the cost of a
+ * subtraction. Only the clock is read every kCheckInterval steps, and once
+ * more by Check() before a result is returned.
+ */
+template <typename Node>
+class BudgetMeter {
+    using Clock = std::chrono::steady_clock;
+
+   public:
+    static constexpr long long kCheckInterval = 1024;
+
+    /**
+     * steps is the number of steps the evaluation took before it was
+     * checkpointed (if it was resumed from a checkpoint).
+     */
+    explicit BudgetMeter(const Budget& budget, long long steps = 0)
+        : budget_(budget), steps_(steps) {}
+
+    long long GetSteps() const { return steps_; }
+
+    /**
+     * The number of nodes of the term (and of whatever else evaluation keeps,
+     * such as a store) after the last step.
+     */
+    std::size_t GetTermNodes() const { return term_nodes_; }
+
+    /**
+     * Measures term before the first step and checks all limits.
+     */
+    void Start(const Node& term) {
+        term_nodes_ = term.SizeAndDepth().first;
+        Resume();
+        Check();
+    }
+
+    /**
+     * Must be called before every run of steps: the nodes are counted per
+     * thread, and a suspended evaluation may be resumed by another thread.
+     */
+    void Resume() {
+        live_nodes_offset_ =
+            static_cast<long long>(term_nodes_) - Counted<Node>::NumLive();
+    }
+
+    void Step() {
+        term_nodes_ = Counted<Node>::NumLive() + live_nodes_offset_;
+
+        if (++steps_ > budget_.max_steps_) {
+            Exceed(BudgetExceeded::Limit::STEPS);
+        }
+
+        if (term_nodes_ > budget_.max_term_nodes_) {
+            Exceed(BudgetExceeded::Limit::TERM_NODES);
+        }
+
+        if (steps_ % kCheckInterval == 0 &&
+            Clock::now() - start_ > budget_.max_time_) {
+            Exceed(BudgetExceeded::Limit::TIME);
+        }
+    }
+
+    /**
+     * Checks all limits.
+     */
+    void Check() {
+        if (steps_ > budget_.max_steps_) {
+            Exceed(BudgetExceeded::Limit::STEPS);
+        }
+
+        if (term_nodes_ > budget_.max_term_nodes_) {
+            Exceed(BudgetExceeded::Limit::TERM_NODES);
+        }
+
+        if (Clock::now() - start_ > budget_.max_time_) {
+            Exceed(BudgetExceeded::Limit::TIME);
+        }
+    }
+
+   private:
+    [[noreturn]] void Exceed(BudgetExceeded::Limit limit) {
+        throw BudgetExceeded(limit, steps_, term_nodes_, Clock::now() - start_);
+    }
+
+    const Budget& budget_;
+    long long steps_;
+    std::size_t term_nodes_ = 0;
+    // The number of nodes of the term minus the number of live nodes of the
+    // thread running the evaluation.
+    long long live_nodes_offset_ = 0;
+    Clock::time_point start_ = Clock::now();
+};
+}  // namespace budget
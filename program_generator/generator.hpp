@@ -0,0 +1,476 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Generates random well-typed programs of a given type for the chapters with
+ * records (ch11_fullsimple, ch17_rcdjoinsub and ch18_fullref), so that
+ * benchmarks and tests aren't limited to programs written by hand.
+ *
+ * The generator works top-down from the type it is asked for: at every node it
+ * picks one of the constructs that can have the wanted type (a lambda for a
+ * function type, succ or pred for Nat, an if, an application, a projection, a
+ * let, ...) and splits the remaining size between the sub-terms, whose types
+ * either follow from the wanted one or are picked at random (e.g. the type of
+ * an argument). Once the size runs out, it falls back to a variable of the
+ * wanted type or the smallest value of it.
+ *
+ * Programs are returned as source text so that they go through the parser like
+ * any other input. Every sub-term is parenthesized. A generator started from
+ * the same seed with the same options returns the same programs everywhere,
+ * since all its choices come straight from a std::mt19937_64, whose output the
+ * standard fixes, rather than through distributions, whose output it doesn't.
+ */
+namespace program_generator {
+struct Options {
+    // Whether the language has let. Otherwise let x = s in t is generated as
+    // (l x:S. t) s.
+    bool let_ = false;
+    // Whether record arguments may have more fields than their parameter.
+    bool subtyping_ = false;
+    // The largest depth of the types that are picked at random.
+    int max_type_depth_ = 2;
+    // The largest number of fields of the records types that are picked at
+    // random, or of the records that are projected.
+    int max_record_width_ = 3;
+};
+
+namespace {
+
+/**
+ * Whether the chapter has references (Ref T, ref, !, := and Unit).
+ */
+template <typename Type, typename = void>
+struct HasReferences : std::false_type {};
+
+template <typename Type>
+struct HasReferences<Type,
+                     std::void_t<decltype(Type::Ref(std::declval<Type&>()))>>
+    : std::true_type {};
+
+/**
+ * The identifier prefix followed by a distinct suffix of letters for every i
+ * (prefix, prefix a, ..., prefix z, prefix aa, ...).
+ */
+std::string Identifier(const std::string& prefix, int i) {
+    std::string suffix;
+
+    for (; i > 0; i = (i - 1) / 26) {
+        suffix.insert(suffix.begin(), static_cast<char>('a' + (i - 1) % 26));
+    }
+
+    return prefix + suffix;
+}
+
+}  // namespace
+
+template <typename Type>
+class Generator {
+   public:
+    explicit Generator(std::uint64_t seed, Options options = {})
+        : random_(seed), options_(options) {}
+
+    /**
+     * Returns a closed program of the given type with about size nodes. The
+     * types it needs are interned in Type::Arena::Current().
+     */
+    std::string Generate(Type& type, int size) {
+        Context ctx;
+        num_vars_ = 0;
+        return Term(ctx, type, size);
+    }
+
+    /**
+     * Returns a random type of at most depth Options::max_type_depth_.
+     */
+    Type& RandomType() { return RandomType(options_.max_type_depth_); }
+
+    /**
+     * Returns type the way it is written in lambda annotations.
+     */
+    static std::string ToSource(const Type& type) {
+        if (type.IsBool()) {
+            return "Bool";
+        }
+
+        if (type.IsNat()) {
+            return "Nat";
+        }
+
+        if (type.IsFunction()) {
+            return "(" + ToSource(type.FunctionLHS()) + ")->(" +
+                   ToSource(type.FunctionRHS()) + ")";
+        }
+
+        if (type.IsRecord()) {
+            std::string res = "{";
+
+            for (const auto& [label, field_type] : SortedFields(type)) {
+                res += (res.size() > 1 ? ", " : "") + label + ":" +
+                       ToSource(*field_type);
+            }
+
+            return res + "}";
+        }
+
+        if constexpr (kReferences) {
+            if (type.IsUnit()) {
+                return "Unit";
+            }
+
+            if (type.IsRef()) {
+                return "Ref (" + ToSource(type.RefType()) + ")";
+            }
+        }
+
+        throw std::invalid_argument("Can't generate terms of this type.");
+    }
+
+   private:
+    static constexpr bool kReferences = HasReferences<Type>::value;
+
+    // The variables in scope along with their types.
+    using Context = std::vector<std::pair<std::string, Type*>>;
+    using Fields = std::vector<std::pair<std::string, Type*>>;
+
+    enum class Rule {
+        // The construct that builds values of the type: a lambda, a record,
+        // succ, pred, iszero, ref or :=.
+        INTRODUCTION,
+        IF,
+        APPLICATION,
+        PROJECTION,
+        LET,
+        DEREFERENCE,
+    };
+
+    /**
+     * The fields of a record type sorted by label, so that the programs don't
+     * depend on the order the chapter keeps them in.
+     */
+    static Fields SortedFields(const Type& type) {
+        Fields fields;
+
+        for (const auto& [label, field_type] : type.GetRecordFields()) {
+            fields.emplace_back(label, &field_type);
+        }
+
+        std::sort(fields.begin(), fields.end());
+        return fields;
+    }
+
+    /**
+     * Returns the record type with the given fields. They are sorted by label
+     * first, since in some chapters the order of fields is part of the type,
+     * and literals are generated with sorted fields.
+     */
+    static Type& MakeRecord(Fields fields) {
+        std::sort(fields.begin(), fields.end());
+        // The chapters keep record fields in different containers, but all of
+        // them can be built from a range.
+        std::vector<typename Type::RecordFields::value_type> values;
+
+        for (const auto& [label, field_type] : fields) {
+            values.emplace_back(label, *field_type);
+        }
+
+        return Type::Record({values.begin(), values.end()});
+    }
+
+    int Pick(int n) { return static_cast<int>(random_() % n); }
+
+    /**
+     * Returns num_parts random sizes that add up to size.
+     */
+    std::vector<int> Split(int size, int num_parts) {
+        std::vector<int> cuts{0, std::max(size, 0)};
+
+        for (int i = 1; i < num_parts; ++i) {
+            cuts.push_back(Pick(cuts[1] + 1));
+        }
+
+        std::sort(cuts.begin(), cuts.end());
+        std::vector<int> sizes;
+
+        for (int i = 0; i < num_parts; ++i) {
+            sizes.push_back(cuts[i + 1] - cuts[i]);
+        }
+
+        return sizes;
+    }
+
+    std::string NewVariable() { return Identifier("x", num_vars_++); }
+
+    /**
+     * Returns num_fields random labels, distinct from each other and from
+     * the labels in exclude.
+     */
+    std::vector<std::string> RandomLabels(int num_fields,
+                                          const Fields& exclude = {}) {
+        std::vector<std::string> labels;
+
+        while (static_cast<int>(labels.size()) < num_fields) {
+            // Labels come from a small pool, so that the records of a program
+            // share some of them.
+            int pool_size = 2 * options_.max_record_width_ + exclude.size();
+            std::string label = Identifier("y", Pick(pool_size) + 1);
+
+            if (std::find(labels.begin(), labels.end(), label) ==
+                    labels.end() &&
+                std::none_of(exclude.begin(), exclude.end(),
+                             [&](const auto& field) {
+                                 return field.first == label;
+                             })) {
+                labels.push_back(label);
+            }
+        }
+
+        return labels;
+    }
+
+    Type& RandomType(int depth) {
+        int num_base_types = kReferences ? 3 : 2;
+        int choice = Pick(depth > 0 ? num_base_types + (kReferences ? 3 : 2)
+                                    : num_base_types);
+
+        switch (choice) {
+            case 0:
+                return Type::Nat();
+            case 1:
+                return Type::Bool();
+            default:
+                break;
+        }
+
+        if constexpr (kReferences) {
+            if (choice == 2) {
+                return Type::Unit();
+            }
+
+            if (choice == 5) {
+                return Type::Ref(RandomType(depth - 1));
+            }
+        }
+
+        if (choice == num_base_types) {
+            Type& lhs = RandomType(depth - 1);
+            Type& rhs = RandomType(depth - 1);
+            return Type::Function(lhs, rhs);
+        }
+
+        Fields fields;
+
+        for (auto& label :
+             RandomLabels(Pick(options_.max_record_width_) + 1)) {
+            fields.emplace_back(std::move(label), &RandomType(depth - 1));
+        }
+
+        return MakeRecord(fields);
+    }
+
+    std::string Term(Context& ctx, Type& type, int size) {
+        if (size <= 1) {
+            return Leaf(ctx, type);
+        }
+
+        std::vector<Rule> rules = {Rule::INTRODUCTION, Rule::IF,
+                                   Rule::APPLICATION, Rule::PROJECTION,
+                                   Rule::LET};
+
+        if (kReferences) {
+            rules.push_back(Rule::DEREFERENCE);
+        }
+
+        switch (rules[Pick(rules.size())]) {
+            case Rule::INTRODUCTION:
+                return Introduction(ctx, type, size);
+            case Rule::IF: {
+                auto sizes = Split(size - 1, 3);
+                std::string condition = Term(ctx, Type::Bool(), sizes[0]);
+                std::string then_term = Term(ctx, type, sizes[1]);
+                std::string else_term = Term(ctx, type, sizes[2]);
+                return "if (" + condition + ") then (" + then_term +
+                       ") else (" + else_term + ")";
+            }
+            case Rule::APPLICATION: {
+                auto sizes = Split(size - 1, 2);
+                Type& arg_type = RandomType();
+                std::string function =
+                    Term(ctx, Type::Function(arg_type, type), sizes[0]);
+                std::string arg = Argument(ctx, arg_type, sizes[1]);
+                return "(" + function + ") (" + arg + ")";
+            }
+            case Rule::PROJECTION:
+                return Projection(ctx, type, size);
+            case Rule::LET: {
+                auto sizes = Split(size - 1, 2);
+                Type& var_type = RandomType();
+                std::string value = Term(ctx, var_type, sizes[0]);
+                std::string var = NewVariable();
+                ctx.emplace_back(var, &var_type);
+                std::string body = Term(ctx, type, sizes[1]);
+                ctx.pop_back();
+
+                if (options_.let_) {
+                    return "let " + var + " = (" + value + ") in (" + body +
+                           ")";
+                }
+
+                return "(l " + var + ":" + ToSource(var_type) + ". (" + body +
+                       ")) (" + value + ")";
+            }
+            case Rule::DEREFERENCE:
+                if constexpr (kReferences) {
+                    return "!(" + Term(ctx, Type::Ref(type), size - 1) + ")";
+                }
+                break;
+        }
+
+        return Leaf(ctx, type);
+    }
+
+    /**
+     * Returns a term whose outermost construct builds values of type.
+     */
+    std::string Introduction(Context& ctx, Type& type, int size) {
+        if (type.IsNat()) {
+            std::string op = Pick(2) == 0 ? "succ" : "pred";
+            return op + " (" + Term(ctx, type, size - 1) + ")";
+        }
+
+        if (type.IsBool()) {
+            return "iszero (" + Term(ctx, Type::Nat(), size - 1) + ")";
+        }
+
+        if (type.IsFunction()) {
+            Type& param_type = type.FunctionLHS();
+            std::string var = NewVariable();
+            ctx.emplace_back(var, &param_type);
+            std::string body = Term(ctx, type.FunctionRHS(), size - 1);
+            ctx.pop_back();
+            return "l " + var + ":" + ToSource(param_type) + ". (" + body + ")";
+        }
+
+        if (type.IsRecord()) {
+            return Record(ctx, SortedFields(type), size - 1);
+        }
+
+        if constexpr (kReferences) {
+            if (type.IsRef()) {
+                return "ref (" + Term(ctx, type.RefType(), size - 1) + ")";
+            }
+
+            if (type.IsUnit()) {
+                auto sizes = Split(size - 1, 2);
+                Type& value_type = RandomType();
+                std::string ref = Term(ctx, Type::Ref(value_type), sizes[0]);
+                std::string value = Term(ctx, value_type, sizes[1]);
+                return "(" + ref + ") := (" + value + ")";
+            }
+        }
+
+        return Leaf(ctx, type);
+    }
+
+    /**
+     * Returns a record literal with the given fields.
+     */
+    std::string Record(Context& ctx, const Fields& fields, int size) {
+        auto sizes = Split(size, fields.size());
+        std::string res = "{";
+
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            std::string value = Term(ctx, *fields[i].second, sizes[i]);
+            res += (i > 0 ? ", " : "") + fields[i].first + "=(" + value + ")";
+        }
+
+        return res + "}";
+    }
+
+    /**
+     * Returns the projection of a record literal with a field of type and
+     * some random other fields. The parser only supports projecting from
+     * literals and variables, and only the former everywhere.
+     */
+    std::string Projection(Context& ctx, Type& type, int size) {
+        std::string label = RandomLabels(1)[0];
+        Fields fields = {{label, &type}};
+
+        for (auto& other_label :
+             RandomLabels(Pick(options_.max_record_width_), fields)) {
+            fields.emplace_back(std::move(other_label), &RandomType());
+        }
+
+        std::sort(fields.begin(), fields.end());
+        return Record(ctx, fields, size - 1) + "." + label;
+    }
+
+    /**
+     * Returns a term that can be passed for a parameter of type. With
+     * subtyping, a record argument may have more fields than its parameter.
+     */
+    std::string Argument(Context& ctx, Type& type, int size) {
+        if (!options_.subtyping_ || !type.IsRecord() || Pick(2) == 0) {
+            return Term(ctx, type, size);
+        }
+
+        Fields fields = SortedFields(type);
+        Fields extra_fields;
+
+        for (auto& label : RandomLabels(1, fields)) {
+            extra_fields.emplace_back(std::move(label), &RandomType());
+        }
+
+        fields.insert(fields.end(), extra_fields.begin(), extra_fields.end());
+        std::sort(fields.begin(), fields.end());
+        return Record(ctx, fields, size - 1);
+    }
+
+    /**
+     * Returns a variable of type if one is in scope and picked, otherwise
+     * the smallest value of type.
+     */
+    std::string Leaf(Context& ctx, Type& type) {
+        std::vector<std::string> vars;
+
+        for (const auto& [var, var_type] : ctx) {
+            if (var_type == &type) {
+                vars.push_back(var);
+            }
+        }
+
+        if (!vars.empty() && Pick(2) == 0) {
+            return vars[Pick(vars.size())];
+        }
+
+        if (type.IsNat()) {
+            return "0";
+        }
+
+        if (type.IsBool()) {
+            return Pick(2) == 0 ? "true" : "false";
+        }
+
+        if constexpr (kReferences) {
+            if (type.IsUnit()) {
+                return "unit";
+            }
+        }
+
+        // Values of the other types have sub-terms, which get a size of 0 so
+        // that they are leaves too.
+        return Introduction(ctx, type, 1);
+    }
+
+    std::mt19937_64 random_;
+    Options options_;
+    int num_vars_ = 0;
+};
+}  // namespace program_generator
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * A persistent cache of the printed results of programs, so that a program
+ * seen before (by this or an earlier run) isn't lexed, parsed, type checked
+ * and evaluated again. Every chapter defines its own namespaces, so this
+ * header only deals in strings: a key names the engine (chapter and
+ * kEngineVersion), the options that change the result and the program, and
+ * maps to whatever the driver printed for it.
+ *
+ * A cache is a directory with two append-only files:
+ *  - results: records of a header (hash of the key, key size, value size),
+ *    the key and the value,
+ *  - index: pairs of the hash of a key and the offset of its record in
+ *    results, so that opening a cache doesn't read the results.
+ *
+ * Appends are serialized by an exclusive flock() on the results file, so
+ * several processes can share a cache. If a process dies between appending a
+ * record and its index entry, the next one to open the cache indexes the
+ * record. Integers are stored in native byte order, so a cache can't be
+ * moved to a machine of a different endianness.
+ */
+namespace result_cache {
+namespace {
+/**
+ * 64-bit FNV-1a.
+ */
+std::uint64_t Hash(const std::string& data) {
+    std::uint64_t hash = 14695981039346656037ull;
+
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+
+    return hash;
+}
+}  // namespace
+
+/**
+ * Collapses runs of whitespace to a single space and drops leading and
+ * trailing whitespace. Whitespace only separates tokens, so programs that
+ * differ only in layout share a cache entry without being lexed.
+ */
+std::string NormalizeSource(const std::string& source) {
+    std::string normalized;
+    bool pending_space = false;
+
+    for (char c : source) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            pending_space = !normalized.empty();
+            continue;
+        }
+
+        if (pending_space) {
+            normalized.push_back(' ');
+            pending_space = false;
+        }
+
+        normalized.push_back(c);
+    }
+
+    return normalized;
+}
+
+/**
+ * engine identifies the interpreter (e.g. "ch11_fullsimple/1") and options
+ * everything besides the program that changes what is printed.
+ */
+std::string MakeKey(const std::string& engine, const std::string& options,
+                    const std::string& source) {
+    return engine + "\n" + options + "\n" + NormalizeSource(source);
+}
+
+class ResultCache {
+   public:
+    /**
+     * Opens the cache in directory dir, creating it if needed. Throws
+     * std::runtime_error if that fails.
+     */
+    explicit ResultCache(const std::string& dir) {
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            Fail("create", dir);
+        }
+
+        results_path_ = dir + "/results";
+        index_path_ = dir + "/index";
+        results_fd_ = open(results_path_.c_str(),
+                           O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        index_fd_ = open(index_path_.c_str(),
+                         O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+        if (results_fd_ < 0 || index_fd_ < 0) {
+            Close();
+            Fail("open", dir);
+        }
+
+        Lock lock{results_fd_};
+        ReadIndex();
+        IndexUnindexedRecords();
+    }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    ~ResultCache() { Close(); }
+
+    /**
+     * Returns the value stored for key, if any. Safe to call from several
+     * threads.
+     */
+    std::optional<std::string> Find(const std::string& key) {
+        std::lock_guard<std::mutex> guard{mutex_};
+        std::uint64_t hash = Hash(key);
+
+        if (auto value = FindIndexed(key, hash)) {
+            return value;
+        }
+
+        // Another process may have added it since.
+        ReadIndex();
+
+        return FindIndexed(key, hash);
+    }
+
+    /**
+     * Stores value for key unless a value is stored for it already (e.g. by
+     * another process that missed it at the same time). Safe to call from
+     * several threads. Throws std::runtime_error if writing fails.
+     */
+    void Insert(const std::string& key, const std::string& value) {
+        std::lock_guard<std::mutex> guard{mutex_};
+        Lock lock{results_fd_};
+        ReadIndex();
+
+        if (FindIndexed(key, Hash(key))) {
+            return;
+        }
+
+        std::uint64_t offset = FileSize(results_fd_, results_path_);
+
+        Header header{Hash(key), static_cast<std::uint32_t>(key.size()),
+                      static_cast<std::uint32_t>(value.size())};
+        std::string record(reinterpret_cast<const char*>(&header),
+                           sizeof(header));
+        record += key;
+        record += value;
+        Append(results_fd_, record, results_path_);
+        AppendIndexEntry({header.hash_, offset});
+    }
+
+   private:
+    struct Header {
+        std::uint64_t hash_;
+        std::uint32_t key_size_;
+        std::uint32_t value_size_;
+    };
+
+    struct IndexEntry {
+        std::uint64_t hash_;
+        std::uint64_t offset_;
+    };
+
+    /**
+     * Holds an exclusive flock() on a file.
+     */
+    class Lock {
+       public:
+        explicit Lock(int fd) : fd_(fd) {
+            while (flock(fd_, LOCK_EX) < 0 && errno == EINTR) {
+            }
+        }
+
+        ~Lock() { flock(fd_, LOCK_UN); }
+
+       private:
+        int fd_;
+    };
+
+    std::optional<std::string> FindIndexed(const std::string& key,
+                                           std::uint64_t hash) {
+        auto [begin, end] = offsets_.equal_range(hash);
+
+        for (auto it = begin; it != end; ++it) {
+            Header header;
+
+            if (!ReadHeader(it->second, header) ||
+                header.key_size_ != key.size()) {
+                continue;
+            }
+
+            std::string record(header.key_size_ + header.value_size_, '\0');
+
+            if (ReadAt(it->second + sizeof(Header), record) &&
+                record.compare(0, key.size(), key) == 0) {
+                return record.substr(key.size());
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * Reads the index entries appended since the last call.
+     */
+    void ReadIndex() {
+        std::uint64_t size = FileSize(index_fd_, index_path_);
+        // A process may be in the middle of appending an entry.
+        size -= size % sizeof(IndexEntry);
+
+        if (size <= index_size_) {
+            return;
+        }
+
+        std::string entries(size - index_size_, '\0');
+
+        if (!ReadAt(index_fd_, index_size_, entries)) {
+            return;
+        }
+
+        for (std::size_t pos = 0; pos < entries.size();
+             pos += sizeof(IndexEntry)) {
+            IndexEntry entry;
+            std::memcpy(&entry, entries.data() + pos, sizeof(entry));
+            AddEntry(entry);
+        }
+
+        index_size_ = size;
+    }
+
+    /**
+     * Indexes the records after the last indexed one. Requires the lock.
+     */
+    void IndexUnindexedRecords() {
+        std::uint64_t size = FileSize(results_fd_, results_path_);
+        std::uint64_t offset = indexed_end_;
+        Header header;
+
+        while (offset + sizeof(Header) <= size && ReadHeader(offset, header)) {
+            std::uint64_t end = offset + sizeof(Header) + header.key_size_ +
+                                header.value_size_;
+
+            if (end > size) {
+                // A torn record (the process appending it died).
+                break;
+            }
+
+            AppendIndexEntry({header.hash_, offset});
+            offset = end;
+        }
+    }
+
+    /**
+     * Requires the lock, so that no other process appends to the index in
+     * between catching up with it and appending entry.
+     */
+    void AppendIndexEntry(const IndexEntry& entry) {
+        ReadIndex();
+        Append(index_fd_,
+               std::string(reinterpret_cast<const char*>(&entry),
+                           sizeof(entry)),
+               index_path_);
+        index_size_ += sizeof(entry);
+        AddEntry(entry);
+    }
+
+    void AddEntry(const IndexEntry& entry) {
+        offsets_.emplace(entry.hash_, entry.offset_);
+        Header header;
+
+        if (ReadHeader(entry.offset_, header)) {
+            indexed_end_ =
+                std::max<std::uint64_t>(indexed_end_, entry.offset_ +
+                                                          sizeof(Header) +
+                                                          header.key_size_ +
+                                                          header.value_size_);
+        }
+    }
+
+    bool ReadHeader(std::uint64_t offset, Header& header) const {
+        std::string bytes(sizeof(Header), '\0');
+
+        if (!ReadAt(offset, bytes)) {
+            return false;
+        }
+
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        return true;
+    }
+
+    bool ReadAt(std::uint64_t offset, std::string& out) const {
+        return ReadAt(results_fd_, offset, out);
+    }
+
+    static bool ReadAt(int fd, std::uint64_t offset, std::string& out) {
+        for (std::size_t done = 0; done < out.size();) {
+            ssize_t num_read =
+                pread(fd, &out[done], out.size() - done, offset + done);
+
+            if (num_read <= 0) {
+                return false;
+            }
+
+            done += num_read;
+        }
+
+        return true;
+    }
+
+    static void Append(int fd, const std::string& data,
+                       const std::string& path) {
+        for (std::size_t done = 0; done < data.size();) {
+            ssize_t num_written =
+                write(fd, data.data() + done, data.size() - done);
+
+            if (num_written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (num_written <= 0) {
+                Fail("write", path);
+            }
+
+            done += num_written;
+        }
+    }
+
+    static std::uint64_t FileSize(int fd, const std::string& path) {
+        struct stat st;
+
+        if (fstat(fd, &st) < 0) {
+            Fail("stat", path);
+        }
+
+        return st.st_size;
+    }
+
+    [[noreturn]] static void Fail(const std::string& action,
+                                  const std::string& path) {
+        throw std::runtime_error("Can't " + action + " result cache " + path +
+                                 ": " + std::strerror(errno));
+    }
+
+    void Close() {
+        if (results_fd_ >= 0) {
+            close(results_fd_);
+        }
+
+        if (index_fd_ >= 0) {
+            close(index_fd_);
+        }
+    }
+
+    std::string results_path_;
+    std::string index_path_;
+    int results_fd_ = -1;
+    int index_fd_ = -1;
+    std::mutex mutex_;
+    // From hashes of keys to offsets of their records.
+    std::unordered_multimap<std::uint64_t, std::uint64_t> offsets_;
+    // The number of bytes of the index read so far.
+    std::uint64_t index_size_ = 0;
+    // The end of the last indexed record.
+    std::uint64_t indexed_end_ = 0;
+};
+
+/**
+ * Copies everything written to a stream (e.g. std::cout) into a string while
+ * it exists, so that a driver can store what it printed in a ResultCache
+ * without changing how it prints.
+ */
+class OutputRecorder : public std::streambuf {
+   public:
+    explicit OutputRecorder(std::ostream& out)
+        : out_(out), original_(out.rdbuf(this)) {}
+
+    OutputRecorder(const OutputRecorder&) = delete;
+    OutputRecorder& operator=(const OutputRecorder&) = delete;
+
+    ~OutputRecorder() override { out_.rdbuf(original_); }
+
+    const std::string& GetOutput() const { return output_; }
+
+   protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) {
+            return traits_type::not_eof(c);
+        }
+
+        output_.push_back(traits_type::to_char_type(c));
+        return original_->sputc(traits_type::to_char_type(c));
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        output_.append(s, n);
+        return original_->sputn(s, n);
+    }
+
+    int sync() override { return original_->pubsync(); }
+
+   private:
+    std::ostream& out_;
+    std::streambuf* original_;
+    std::string output_;
+};
+}  // namespace result_cache